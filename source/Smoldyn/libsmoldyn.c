@@ -4,6 +4,7 @@
  Copyright 2003-2011 by Steven Andrews.  This work is distributed under the terms
  of the Gnu General Public License (GPL). */
 
+#include <time.h>
 #include "smoldyn.h"
 #include "libsmoldyn.h"
 
@@ -50,5 +51,125 @@ int smolLoadSimFromFile(char *filepath,char *filename,simptr *simpointer,char *f
 	return er; }
 
 
+/* smolAddSweepStatement */
+int smolAddSweepStatement(simptr sim,char *label,char *statement) {
+	if(!sim) return 3;
+	return sweepaddstatement(sim,label,statement); }
 
 
+/* smolRunSweep */
+int smolRunSweep(simptr sim) {
+	if(!sim) return 3;
+	return smolsimulateensemble(sim); }
+
+
+/* smolOpenOutputFiles */
+int smolOpenOutputFiles(simptr sim,int overwrite) {
+	if(!sim) return 3;
+	return scmdopenfiles(sim->cmds,overwrite); }
+
+
+/* smolRunTimeStep.  Runs one time step of the simulation, after running the
+commands for the starting time if this is the first step.  Returns 0 if the
+simulation should continue or else the code from simulatetimestep for why it
+should stop. */
+int smolRunTimeStep(simptr sim) {
+	int er;
+	time_t clockstt;
+
+	if(!sim) return 3;
+	clockstt=time(NULL);
+	er=0;
+	if(!sim->started) {
+		sim->started=1;
+		if(!sim->restorename[0]) er=simdocommands(sim); }
+	if(!er) er=simulatetimestep(sim);
+	sim->elapsedtime+=difftime(time(NULL),clockstt);
+	return er; }
+
+
+/* smolRunSimUntil.  Runs the simulation until its time reaches breaktime or
+until it stops for another reason.  Returns 0 if it reached breaktime or else
+the code from simulatetimestep for why it stopped.  The end of simulation tasks
+are not done here. */
+int smolRunSimUntil(simptr sim,double breaktime) {
+	int er;
+
+	if(!sim) return 3;
+	er=0;
+	while(!er && sim->time<breaktime) er=smolRunTimeStep(sim);
+	return er; }
+
+
+/* smolRunSim.  Runs the simulation to its end and then does the end of
+simulation tasks.  Returns the code from simulatetimestep for why it stopped. */
+int smolRunSim(simptr sim) {
+	int er;
+
+	if(!sim) return 3;
+	er=0;
+	while(!er) er=smolRunTimeStep(sim);
+	endsimulate(sim,er);
+	return er; }
+
+
+/* smolGetTime */
+double smolGetTime(simptr sim) {
+	if(!sim) return 0;
+	return sim->time; }
+
+
+/* smolGetSpeciesIndex.  Returns the species number of species, or -1 if it is
+unknown. */
+int smolGetSpeciesIndex(simptr sim,char *species) {
+	if(!sim || !sim->mols || !species) return -1;
+	return namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,species); }
+
+
+/* smolGetMoleculeCount.  Returns the number of molecules of species in state
+ms, which may be MSall, or -1 if the species is unknown. */
+int smolGetMoleculeCount(simptr sim,char *species,enum MolecState ms) {
+	int i;
+
+	i=smolGetSpeciesIndex(sim,species);
+	if(i<=0) return -1;
+	return molcount(sim,i,ms,NULL,-1); }
+
+
+/* smolFreeSim */
+void smolFreeSim(simptr sim) {
+	simfree(sim);
+	return; }
+
+
+/* smolGetLiveList.  Returns live list ll of the simulation, which is the
+simulation's own array of molecule pointers and not a copy, and its number of
+molecules in *nmolptr.  The array is valid until the simulation runs again or
+molecules are added or removed.  Returns NULL if there is no such list. */
+moleculeptr *smolGetLiveList(simptr sim,int ll,int *nmolptr) {
+	if(nmolptr) *nmolptr=0;
+	if(!sim || !sim->mols || ll<0 || ll>=sim->mols->nlist) return NULL;
+	if(nmolptr) *nmolptr=sim->mols->nl[ll];
+	return sim->mols->live[ll]; }
+
+
+/* smolGetMolecules.  Copies the data of molecules of species ident, or all
+species if ident is negative, in state ms, to the caller's arrays.  See
+molgetbulk. */
+int smolGetMolecules(simptr sim,int ident,enum MolecState ms,int max,int *identout,enum MolecState *msout,long int *sernoout,double *posout) {
+	if(!sim) return -1;
+	return molgetbulk(sim,ident,ms,max,0,identout,msout,sernoout,posout); }
+
+
+/* smolRemoveMolecules.  Like smolGetMolecules, but also removes the molecules
+that are copied from the simulation. */
+int smolRemoveMolecules(simptr sim,int ident,enum MolecState ms,int max,int *identout,enum MolecState *msout,long int *sernoout,double *posout) {
+	if(!sim) return -1;
+	return molgetbulk(sim,ident,ms,max,1,identout,msout,sernoout,posout); }
+
+
+/* smolAddMolecules.  Adds nmol solution-state molecules with species ident[m]
+and positions pos[m*dim+d].  See addmolbulk. */
+int smolAddMolecules(simptr sim,int nmol,int *ident,double *pos) {
+	if(!sim || !sim->mols) return 3;
+	return addmolbulk(sim,nmol,ident,pos,1); }
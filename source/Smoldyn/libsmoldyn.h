@@ -9,7 +9,27 @@
 
 #include "smoldyn.h"
 
+/* Simulation state is held in the simulation structure, except for the random
+number generator of the random2 library and the graphics state, which are
+global to a process.  A program can hold several simulations, but only one of
+them may run at a time; to run simulations in parallel, run them in separate
+processes, as smolsimulateensemble and smolsimulatedomains do. */
+
 int smolPrepareSimFromFile(char *filepath,char *filename,simptr *simpointer,char *flags);
 int smolLoadSimFromFile(char *filepath,char *filename,simptr *simpointer,char *flags,char *erstr);
+int smolAddSweepStatement(simptr sim,char *label,char *statement);
+int smolRunSweep(simptr sim);
+int smolOpenOutputFiles(simptr sim,int overwrite);
+int smolRunTimeStep(simptr sim);
+int smolRunSim(simptr sim);
+int smolRunSimUntil(simptr sim,double breaktime);
+double smolGetTime(simptr sim);
+int smolGetSpeciesIndex(simptr sim,char *species);
+int smolGetMoleculeCount(simptr sim,char *species,enum MolecState ms);
+void smolFreeSim(simptr sim);
+moleculeptr *smolGetLiveList(simptr sim,int ll,int *nmolptr);
+int smolGetMolecules(simptr sim,int ident,enum MolecState ms,int max,int *identout,enum MolecState *msout,long int *sernoout,double *posout);
+int smolRemoveMolecules(simptr sim,int ident,enum MolecState ms,int max,int *identout,enum MolecState *msout,long int *sernoout,double *posout);
+int smolAddMolecules(simptr sim,int nmol,int *ident,double *pos);
 
 #endif
@@ -5,7 +5,9 @@
  of the Gnu General Public License (GPL). */
 
 #include <float.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include "Geometry.h"
 #include "math2.h"
@@ -13,9 +15,41 @@
 #include "smoldyn.h"
 #include "Zn.h"
 
+#ifndef _WIN32
+#include <sched.h>
+#endif
+
 #define CHECK(A) if(!(A)) goto failure
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
+#define DOMALIGN(A) (((A)+63)/64*64)
+
+/* The shared exchange memory of a domain decomposition starts with the header,
+which holds the barrier state, and then has 4*ndomain counts: molecules in the
+inbox that domain k receives from its lower neighbor [2k] and from its upper
+neighbor [2k+1], ghost molecules that domain k copied from its edge layer
+[2*ndomain+k], and ghosts of its upper neighbor that domain k used up in
+reactions [3*ndomain+k].  These are followed by the inboxes, then the ghost
+buffers, and then the used ghost indices, each maxrec long.  Every buffer has a
+single writer, and domainbarrier separates writing from reading. */
+
+typedef struct domainheadstruct {	// header of shared exchange memory
+	volatile int count;					// processes that reached the barrier
+	volatile int sense;					// barrier sense
+	volatile int abort;					// 1 if any process failed
+	int reserved;								// 0, for alignment
+	} *domainheadptr;
+
+typedef struct domainrecstruct {	// molecule in shared exchange memory
+	long int serno;							// serial number
+	int ident;									// species
+	int mstate;									// state
+	panelptr pnl;								// panel, which is valid in every process
+	double pos[DIMMAX];					// position
+	double posx[DIMMAX];				// old position
+	double posoffset[DIMMAX];		// offset from periodic jumps
+	} *domainrecptr;
+
 
 
 /******************************************************************************/
@@ -168,6 +202,133 @@ void boxremovemol(moleculeptr mptr,int ll) {
 	return; }
 
 
+/* boxstring2os.  Converts a string to an obstacle shape.  Returns OSnone if the
+string is not recognized. */
+enum ObstacleShape boxstring2os(char *string) {
+	enum ObstacleShape ans;
+
+	if(!strcmp(string,"box")) ans=OSbox;
+	else if(!strcmp(string,"sphere")) ans=OSsphere;
+	else if(!strcmp(string,"capsule")) ans=OScapsule;
+	else if(!strcmp(string,"ecoli")) ans=OSecoli;
+	else ans=OSnone;
+	return ans; }
+
+
+/* boxos2string.  Converts an obstacle shape to a string, which is returned in
+string and as the function value. */
+char *boxos2string(enum ObstacleShape os,char *string) {
+	if(os==OSbox) strcpy(string,"box");
+	else if(os==OSsphere) strcpy(string,"sphere");
+	else if(os==OScapsule) strcpy(string,"capsule");
+	else if(os==OSecoli) strcpy(string,"ecoli");
+	else strcpy(string,"none");
+	return string; }
+
+
+/* obstacleinside.  Returns 1 if position pos is inside the shape of obstacle
+obst and 0 if not.  Capsules, including the ecoli shape, lie along the first
+axis with their low end at cent.  As in the excludebox, excludesphere, and
+includeecoli commands, box and sphere boundaries are inside and capsule
+boundaries are outside. */
+int obstacleinside(obstacleptr obst,double *pos,int dim) {
+	int d;
+	double dist,x;
+
+	if(obst->os==OSbox) {
+		for(d=0;d<dim;d++)
+			if(pos[d]<obst->poslo[d] || pos[d]>obst->poshi[d]) return 0;
+		return 1; }
+	if(obst->os==OSsphere) {
+		dist=0;
+		for(d=0;d<dim;d++) dist+=(pos[d]-obst->cent[d])*(pos[d]-obst->cent[d]);
+		return dist<=obst->rad*obst->rad; }
+	dist=0;
+	for(d=1;d<dim;d++) dist+=(pos[d]-obst->cent[d])*(pos[d]-obst->cent[d]);
+	x=pos[0]-obst->cent[0];
+	if(x<obst->rad) dist+=(x-obst->rad)*(x-obst->rad);
+	else if(x>obst->length-obst->rad) dist+=(x-obst->length+obst->rad)*(x-obst->length+obst->rad);
+	return dist<obst->rad*obst->rad; }
+
+
+/* obstacleputin.  Moves position pos, which should be outside of obstacle obst,
+to the nearest point on the obstacle surface.  For capsules, this is the same as
+the putinecoli function. */
+void obstacleputin(obstacleptr obst,double *pos,int dim) {
+	int d;
+	double dist,x,x0,scale;
+
+	if(obst->os==OSbox) {
+		for(d=0;d<dim;d++) {
+			if(pos[d]<obst->poslo[d]) pos[d]=obst->poslo[d];
+			else if(pos[d]>obst->poshi[d]) pos[d]=obst->poshi[d]; }
+		return; }
+	if(obst->os==OSsphere) {
+		dist=0;
+		for(d=0;d<dim;d++) dist+=(pos[d]-obst->cent[d])*(pos[d]-obst->cent[d]);
+		if(dist==0) return;
+		scale=obst->rad/sqrt(dist);
+		for(d=0;d<dim;d++) pos[d]=obst->cent[d]+scale*(pos[d]-obst->cent[d]);
+		return; }
+	x=pos[0]-obst->cent[0];
+	if(x<obst->rad) x0=obst->rad;
+	else if(x>obst->length-obst->rad) x0=obst->length-obst->rad;
+	else x0=x;
+	dist=(x-x0)*(x-x0);
+	for(d=1;d<dim;d++) dist+=(pos[d]-obst->cent[d])*(pos[d]-obst->cent[d]);
+	if(dist==0) return;
+	scale=obst->rad/sqrt(dist);
+	pos[0]=obst->cent[0]+x0+scale*(x-x0);
+	for(d=1;d<dim;d++) pos[d]=obst->cent[d]+scale*(pos[d]-obst->cent[d]);
+	return; }
+
+
+/* obstacleboxclass.  Classifies the axis-aligned region from lo to hi against
+obstacle obst.  Returns OBCclear if no position in the region can violate the
+obstacle, OBCblocked if every position violates it, and OBCpartial otherwise.
+For a sphere or capsule, this uses the smallest and largest squared distances
+between the region and the center point or axis segment; these are exact
+because each coordinate contributes separately. */
+enum ObstBoxClass obstacleboxclass(obstacleptr obst,double *lo,double *hi,int dim) {
+	int d,inside,outside;
+	double mind,maxd,a,b,c,xlo,xhi,r2;
+
+	if(obst->os==OSbox) {
+		inside=1;
+		outside=0;
+		for(d=0;d<dim;d++) {
+			if(hi[d]<obst->poslo[d] || lo[d]>obst->poshi[d]) outside=1;
+			if(lo[d]<obst->poslo[d] || hi[d]>obst->poshi[d]) inside=0; }}
+	else {
+		mind=maxd=0;
+		d=0;
+		if(obst->os!=OSsphere) {										// capsule axis along first dimension
+			xlo=obst->cent[0]+obst->rad;
+			xhi=obst->cent[0]+obst->length-obst->rad;
+			a=lo[0]>xhi?lo[0]-xhi:(hi[0]<xlo?xlo-hi[0]:0);
+			mind+=a*a;
+			a=lo[0]<xlo?xlo-lo[0]:(lo[0]>xhi?lo[0]-xhi:0);
+			b=hi[0]<xlo?xlo-hi[0]:(hi[0]>xhi?hi[0]-xhi:0);
+			maxd+=a>b?a*a:b*b;
+			d=1; }
+		for(;d<dim;d++) {
+			c=obst->cent[d];
+			a=lo[d]>c?lo[d]-c:(hi[d]<c?c-hi[d]:0);
+			mind+=a*a;
+			a=c-lo[d]>hi[d]-c?c-lo[d]:hi[d]-c;
+			maxd+=a*a; }
+		r2=obst->rad*obst->rad;
+		if(obst->os==OSsphere) {
+			outside=mind>r2;
+			inside=maxd<=r2; }
+		else {
+			outside=mind>=r2;
+			inside=maxd<r2; }}
+	if(outside) return obst->include?OBCblocked:OBCclear;
+	if(inside) return obst->include?OBCclear:OBCblocked;
+	return OBCpartial; }
+
+
 /******************************************************************************/
 /****************************** memory management *****************************/
 /******************************************************************************/
@@ -335,6 +496,10 @@ boxssptr boxssalloc(int dim) {
 	boxs->min=NULL;
 	boxs->size=NULL;
 	boxs->blist=NULL;
+	boxs->maxobst=0;
+	boxs->nobst=0;
+	boxs->obstlist=NULL;
+	boxs->dom=NULL;
 
 	CHECK(boxs->side=(int*)calloc(dim,sizeof(int)));
 	for(d=0;d<dim;d++) boxs->side[d]=0;
@@ -352,7 +517,12 @@ boxssptr boxssalloc(int dim) {
 /* boxssfree.  Frees a box superstructure, including the boxes.  nlist is the
 number of live lists. */
 void boxssfree(boxssptr boxs) {
+	int o;
+
 	if(!boxs) return;
+	domainfree(boxs->dom);
+	for(o=0;o<boxs->nobst;o++) obstaclefree(boxs->obstlist[o]);
+	free(boxs->obstlist);
 	boxesfree(boxs->blist,boxs->nbox,boxs->nlist);
 	free(boxs->size);
 	free(boxs->min);
@@ -361,6 +531,77 @@ void boxssfree(boxssptr boxs) {
 	return; }
 
 
+/* obstaclefree.  Frees a static obstacle, including its box classes. */
+void obstaclefree(obstacleptr obst) {
+	if(!obst) return;
+	free(obst->boxclass);
+	free(obst);
+	return; }
+
+
+/* domainalloc.  Allocates and initializes a domain decomposition structure for
+a simulation that has not been split yet.  Returns the structure, or NULL if
+memory could not be allocated. */
+domainptr domainalloc(void) {
+	domainptr dom;
+
+	dom=(domainptr) malloc(sizeof(struct domainstruct));
+	if(!dom) return NULL;
+	dom->ndomain=1;
+	dom->axis=0;
+	dom->maxrec=0;
+	dom->domain=-1;
+	dom->phase=-1;
+	dom->lower=-1;
+	dom->upper=-1;
+	dom->wrap=0;
+	dom->start=NULL;
+	dom->lclass=NULL;
+	dom->nedge=0;
+	dom->edge=NULL;
+	dom->maxsend=0;
+	dom->nsend=0;
+	dom->send=NULL;
+	dom->sendm=NULL;
+	dom->maxghost=0;
+	dom->nghost=0;
+	dom->ghost=NULL;
+	dom->maxsrc=0;
+	dom->nsrc=0;
+	dom->src=NULL;
+	dom->nlsave=NULL;
+	dom->shm=NULL;
+	dom->shmbytes=0;
+	dom->sense=0;
+	dom->merge=NULL;
+	dom->fpos=NULL;
+	dom->refused=0;
+	dom->sharedseed=0;
+	dom->nshared=0;
+	return dom; }
+
+
+/* domainfree.  Frees a domain decomposition structure, including its ghost
+molecules.  The shared exchange memory belongs to smolsimulatedomains and is not
+freed here. */
+void domainfree(domainptr dom) {
+	int g;
+
+	if(!dom) return;
+	for(g=0;g<dom->maxghost;g++) molfree(dom->ghost[g]);
+	free(dom->ghost);
+	free(dom->src);
+	free(dom->nlsave);
+	free(dom->sendm);
+	free(dom->send);
+	free(dom->edge);
+	free(dom->lclass);
+	free(dom->start);
+	free(dom->fpos);
+	free(dom);
+	return; }
+
+
 /******************************************************************************/
 /*************************** data structure output ****************************/
 /******************************************************************************/
@@ -419,11 +660,14 @@ void boxoutput(boxssptr boxs,int blo,int bhi,int dim) {
 /* boxssoutput.  Displays statistics about the box superstructure, including
 total number of boxes, number on each side, dimensions, and the minimium
 position.  It also prints out the requested and actual numbers of molecules
-per box. */
+per box, the static obstacles with their numbers of boxes in each class, and the
+domain decomposition. */
 void boxssoutput(simptr sim) {
-	int dim,d,ll;
+	int dim,d,ll,o,b,nclass[3];
 	boxssptr boxs;
 	double flt1;
+	obstacleptr obst;
+	char string[STRCHAR];
 
 	printf("VIRTUAL BOX PARAMETERS\n");
 	if(!sim || !sim->boxs) {
@@ -449,12 +693,27 @@ void boxssoutput(simptr sim) {
 		if(sim->mols->listtype[ll]==MLTsystem) flt1+=sim->mols->nl[ll];
 	flt1/=boxs->nbox;
 	printf(" Molecules per box= %g\n",flt1);
+	if(boxs->nobst) {
+		printf(" Static obstacles: %i\n",boxs->nobst);
+		for(o=0;o<boxs->nobst;o++) {
+			obst=boxs->obstlist[o];
+			printf("  %s %s",obst->include?"include":"exclude",boxos2string(obst->os,string));
+			nclass[OBCclear]=nclass[OBCblocked]=nclass[OBCpartial]=0;
+			for(b=0;b<obst->nbox;b++) nclass[obst->boxclass[b]]++;
+			if(obst->nbox) printf(", boxes clear: %i, blocked: %i, partial: %i",nclass[OBCclear],nclass[OBCblocked],nclass[OBCpartial]);
+			printf("\n"); }}
+	if(boxs->dom) {
+		printf(" Domain decomposition: %i slabs along axis %i",boxs->dom->ndomain,boxs->dom->axis);
+		if(boxs->dom->maxrec) printf(", exchange buffers for %i molecules",boxs->dom->maxrec);
+		printf("\n"); }
 	printf("\n");
 	return; }
 
 
 /* checkboxparams.  Checks and displays warning about various box parameters
-such as molecules per box, box sizes, and number of panels in each box. */
+such as molecules per box, box sizes, and number of panels in each box.  With
+domain decomposition, it is an error if the slabs would be thinner than 2 box
+layers. */
 int checkboxparams(simptr sim,int *warnptr) {
 	int error,warn,b,dim,nmolec,ll;
 	boxssptr boxs;
@@ -495,6 +754,10 @@ int checkboxparams(simptr sim,int *warnptr) {
 			warn++;
 			printf(" WARNING: box (%s) has %i panels in it, which is very high\n",Zn_vect2csvstring(bptr->indx,dim,string),bptr->npanel); }}
 
+	if(boxs->dom && boxs->condition==SCok && boxs->side[boxs->dom->axis]<2*boxs->dom->ndomain) {
+		error++;
+		printf(" ERROR: %i domains need at least %i boxes along axis %i, but there are only %i\n",boxs->dom->ndomain,2*boxs->dom->ndomain,boxs->dom->axis,boxs->side[boxs->dom->axis]); }
+
 	if(warnptr) *warnptr=warn;
 	return error; }
 
@@ -544,6 +807,113 @@ int boxsetsize(simptr sim,char *info,double val) {
 	return 0; }
 
 
+/* boxaddobstacle.  Adds a static obstacle to the box superstructure, allocating
+the superstructure if needed.  include is 1 if molecules are to be kept inside
+the obstacle and 0 if they are to be kept out of it.  params lists the shape
+parameters: for OSbox, the low and high corners as lo0 hi0 lo1 hi1 ...; for
+OSsphere, the center and then the radius; for OScapsule, the low end of the axis,
+which is along the first dimension, and then the radius and total length; and
+nothing for OSecoli, which takes its shape from the system walls when the boxes
+are set up.  Returns 0 for success, 1 for failure to allocate memory, 2 for an
+illegal shape or parameter, 3 if the system dimensionality has not been set up
+yet, or 4 for an ecoli shape in a system that is not 3 dimensional. */
+int boxaddobstacle(simptr sim,int include,enum ObstacleShape os,double *params) {
+	boxssptr boxs;
+	obstacleptr obst,*newlist;
+	int d,dim,o,maxobst;
+
+	if(!sim->dim) return 3;
+	dim=sim->dim;
+	if(os==OSnone) return 2;
+	if(os==OSecoli && dim!=3) return 4;
+	if(os==OSbox) {
+		for(d=0;d<dim;d++) if(params[2*d]>params[2*d+1]) return 2; }
+	else if(os==OSsphere) {
+		if(params[dim]<=0) return 2; }
+	else if(os==OScapsule) {
+		if(params[dim]<=0 || params[dim+1]<2*params[dim]) return 2; }
+
+	if(!sim->boxs) {
+		boxs=boxssalloc(dim);
+		if(!boxs) return 1;
+		boxs->sim=sim;
+		sim->boxs=boxs;
+		boxsetcondition(boxs,SCinit,0); }
+	else
+		boxs=sim->boxs;
+
+	if(boxs->nobst==boxs->maxobst) {
+		maxobst=2*boxs->maxobst+1;
+		newlist=(obstacleptr*) calloc(maxobst,sizeof(obstacleptr));
+		if(!newlist) return 1;
+		for(o=0;o<boxs->nobst;o++) newlist[o]=boxs->obstlist[o];
+		free(boxs->obstlist);
+		boxs->obstlist=newlist;
+		boxs->maxobst=maxobst; }
+
+	obst=(obstacleptr) malloc(sizeof(struct obstaclestruct));
+	if(!obst) return 1;
+	obst->os=os;
+	obst->include=include;
+	obst->rad=0;
+	obst->length=0;
+	obst->nbox=0;
+	obst->boxclass=NULL;
+	for(d=0;d<DIMMAX;d++) obst->poslo[d]=obst->poshi[d]=obst->cent[d]=0;
+	if(os==OSbox)
+		for(d=0;d<dim;d++) {
+			obst->poslo[d]=params[2*d];
+			obst->poshi[d]=params[2*d+1]; }
+	else if(os==OSsphere || os==OScapsule) {
+		for(d=0;d<dim;d++) obst->cent[d]=params[d];
+		obst->rad=params[dim];
+		if(os==OScapsule) obst->length=params[dim+1]; }
+	boxs->obstlist[boxs->nobst++]=obst;
+	boxsetcondition(boxs,SClists,0);
+	return 0; }
+
+
+/* boxsetobstacles.  Classifies every box of the box superstructure against each
+static obstacle, using obstacleboxclass.  Boxes on the edge of the system also
+cover the space beyond the walls because molecules that are outside of the
+system are assigned to the nearest box.  This also computes the shapes of ecoli
+obstacles from the system walls.  Returns 0 for success or 1 for failure to
+allocate memory. */
+int boxsetobstacles(simptr sim) {
+	int o,b,d,dim;
+	boxssptr boxs;
+	boxptr bptr;
+	obstacleptr obst;
+	double lo[DIMMAX],hi[DIMMAX];
+	wallptr *wlist;
+
+	boxs=sim->boxs;
+	dim=sim->dim;
+	wlist=sim->wlist;
+	for(o=0;o<boxs->nobst;o++) {
+		obst=boxs->obstlist[o];
+		if(obst->os==OSecoli) {
+			obst->rad=0.5*(wlist[3]->pos-wlist[2]->pos);
+			obst->length=wlist[1]->pos-wlist[0]->pos;
+			obst->cent[0]=wlist[0]->pos;
+			obst->cent[1]=0.5*(wlist[2]->pos+wlist[3]->pos);
+			obst->cent[2]=0.5*(wlist[4]->pos+wlist[5]->pos); }
+		if(obst->nbox!=boxs->nbox) {
+			free(obst->boxclass);
+			obst->nbox=0;
+			obst->boxclass=(enum ObstBoxClass*) calloc(boxs->nbox,sizeof(enum ObstBoxClass));
+			if(!obst->boxclass) return 1;
+			obst->nbox=boxs->nbox; }
+		for(b=0;b<boxs->nbox;b++) {
+			bptr=boxs->blist[b];
+			box2pos(sim,bptr,lo,hi);
+			for(d=0;d<dim;d++) {
+				if(bptr->indx[d]==0) lo[d]=-DBL_MAX;
+				if(bptr->indx[d]==boxs->side[d]-1) hi[d]=DBL_MAX; }
+			obst->boxclass[b]=obstacleboxclass(obst,lo,hi,dim); }}
+	return 0; }
+
+
 /* setupboxes.  Sets up a superstructure of boxes, and puts things in the boxes,
 including wall, panel, and molecule references.  It sets up the box
 superstructure, then adds indicies to each box, then adds the box neighbor list
@@ -666,6 +1036,8 @@ int setupboxes(simptr sim) {
 					if(indx[d]==0) bptr->wlist[w++]=sim->wlist[2*d];
 					if(indx[d]==side[d]-1) bptr->wlist[w++]=sim->wlist[2*d+1]; }}}
 
+		if(boxs->nobst && boxsetobstacles(sim)) return 1;		// obstacle box classes
+
 		boxsetcondition(boxs,SCparams,1); }						// end of condition SClists
 
 	if(boxs->condition==SCparams) {									// start of condition SCparams
@@ -693,7 +1065,8 @@ int setupboxes(simptr sim) {
 						for(ps=0;ps<PSMAX;ps++)
 							for(p=0;p<srf->npanel[ps];p++)
 								if(panelinbox(sim,srf->panels[ps][p],bptr))
-									bptr->panel[bptr->npanel++]=srf->panels[ps][p]; }}}}
+									bptr->panel[bptr->npanel++]=srf->panels[ps][p]; }}}
+			if(sim->cmptss) compartsetcondition(sim->cmptss,SCparams,0); }	// box classes depend on panels
 
 		if(sim->mols) {												// mptr->box, box->maxmol, nmol, mol
 			if(sim->mols->condition<SCparams) return 3;
@@ -738,6 +1111,211 @@ int setupboxes(simptr sim) {
 	return 0; }
 
 
+/* boxsetdomains.  Sets up domain decomposition, with which smolsimulatedomains
+splits the box grid into ndomain slabs along axis axis and runs each slab in its
+own process.  maxrec is the capacity of each shared exchange buffer in
+molecules, or 0 for a default that is based on the maximum number of molecules.
+Enter ndomain as 1 to turn domain decomposition off.  If the box superstructure
+has not been allocated yet, this allocates it.  Returns 0 for success, 1 for
+failure to allocate memory, 2 if ndomain is less than 1, 3 if the system
+dimensionality has not been set up yet, 4 if axis is out of range, or 5 if
+maxrec is negative. */
+int boxsetdomains(simptr sim,int ndomain,int axis,int maxrec) {
+	boxssptr boxs;
+
+	if(ndomain<1) return 2;
+	if(!sim->dim) return 3;
+	if(axis<0 || axis>=sim->dim) return 4;
+	if(maxrec<0) return 5;
+	if(!sim->boxs) {
+		boxs=boxssalloc(sim->dim);
+		if(!boxs) return 1;
+		boxs->sim=sim;
+		sim->boxs=boxs;
+		boxsetcondition(boxs,SCinit,0); }
+	else
+		boxs=sim->boxs;
+	if(ndomain==1) {
+		domainfree(boxs->dom);
+		boxs->dom=NULL;
+		return 0; }
+	if(!boxs->dom) {
+		boxs->dom=domainalloc();
+		if(!boxs->dom) return 1; }
+	boxs->dom->ndomain=ndomain;
+	boxs->dom->axis=axis;
+	boxs->dom->maxrec=maxrec;
+	return 0; }
+
+
+/* domaincompactmols.  Replaces the molecule pool of this domain, which it
+inherited whole from the parent process, with a new pool that only holds the
+molecules of its own slab and ndead dead molecules.  The molecules of owned
+boxes are copied into new molecule structures, in the same order within their
+boxes, and boxes outside of the slab are emptied.  Tracked molecules keep their
+slots if they are copied, and others are reported as killed.  The inherited
+molecules are neither written nor freed, so their memory pages stay shared
+with the parent process and don't count toward this domain's memory.  Returns
+0 for success or 1 for out of memory. */
+int domaincompactmols(simptr sim,int ndead) {
+	molssptr mols;
+	boxssptr boxs;
+	domainptr dom;
+	boxptr bptr;
+	moleculeptr mptr,mnew,**live,*dead;
+	int b,ll,m,t,d,dim,nd,*nl,*maxl;
+
+	mols=sim->mols;
+	boxs=sim->boxs;
+	dom=boxs->dom;
+	dim=sim->dim;
+	nd=0;
+	dead=NULL;
+	nl=NULL;
+	maxl=NULL;
+	CHECK(live=(moleculeptr**) calloc(mols->maxlist,sizeof(moleculeptr*)));
+	CHECK(nl=(int*) calloc(mols->maxlist,sizeof(int)));
+	CHECK(maxl=(int*) calloc(mols->maxlist,sizeof(int)));
+
+	for(b=0;b<boxs->nbox;b++) {												// count owned molecules
+		bptr=boxs->blist[b];
+		if(dom->lclass[bptr->indx[dom->axis]]<DCghost)
+			for(ll=0;ll<boxs->nlist && ll<mols->nlist;ll++) maxl[ll]+=bptr->nmol[ll]; }
+	for(ll=0;ll<mols->nlist;ll++) {
+		maxl[ll]+=ndead+1;
+		CHECK(live[ll]=(moleculeptr*) calloc(maxl[ll],sizeof(moleculeptr))); }
+	CHECK(dead=(moleculeptr*) calloc(ndead+1,sizeof(moleculeptr)));
+	for(nd=0;nd<ndead;nd++)
+		CHECK(dead[nd]=molalloc(dim));
+
+	for(t=0;t<mols->ntrack;t++) mols->track[t]=NULL;
+	for(b=0;b<boxs->nbox;b++) {												// copy owned molecules
+		bptr=boxs->blist[b];
+		for(ll=0;ll<boxs->nlist && ll<mols->nlist;ll++) {
+			if(dom->lclass[bptr->indx[dom->axis]]>=DCghost) {
+				bptr->nmol[ll]=0;
+				continue; }
+			for(m=0;m<bptr->nmol[ll];m++) {
+				mptr=bptr->mol[ll][m];
+				CHECK(mnew=molalloc(dim));
+				mnew->serno=mptr->serno;
+				mnew->list=mptr->list;
+				mnew->ident=mptr->ident;
+				mnew->mstate=mptr->mstate;
+				mnew->box=bptr;
+				mnew->pnl=mptr->pnl;
+				mnew->track=mptr->track;
+				for(d=0;d<dim;d++) {
+					mnew->pos[d]=mptr->pos[d];
+					mnew->posx[d]=mptr->posx[d];
+					mnew->via[d]=mptr->via[d];
+					mnew->posoffset[d]=mptr->posoffset[d]; }
+				if(mnew->track>=0) mols->track[mnew->track]=mnew;
+				bptr->mol[ll][m]=mnew;
+				live[ll][nl[ll]++]=mnew; }}}
+
+	for(ll=0;ll<mols->nlist;ll++) {										// use new pool
+		free(mols->live[ll]);
+		mols->live[ll]=live[ll];
+		mols->maxl[ll]=maxl[ll];
+		mols->nl[ll]=mols->topl[ll]=mols->sortl[ll]=nl[ll]; }
+	free(mols->dead);
+	mols->dead=dead;
+	mols->maxd=ndead+1;
+	mols->nd=mols->topd=ndead;
+	free(live);
+	free(nl);
+	free(maxl);
+	return 0;
+
+ failure:
+	if(live)
+		for(ll=0;ll<mols->nlist;ll++) {
+			if(live[ll] && nl)
+				for(m=0;m<nl[ll];m++) molfree(live[ll][m]);
+			free(live[ll]); }
+	if(dead)
+		for(m=0;m<nd;m++) molfree(dead[m]);
+	free(dead);
+	free(live);
+	free(nl);
+	free(maxl);
+	return 1; }
+
+
+/* domainsplit.  Makes this process domain k of the domain decomposition, which
+exchanges molecules through shared memory shm.  This is called by each worker
+process of smolsimulatedomains after the boxes are set up.  It divides the box
+layers along the decomposition axis into slabs of nearly equal thickness and
+classifies each layer as owned, owned edge, ghost, or foreign.  The edge layer
+is the first layer of the slab, if there is a lower neighbor slab, and its
+molecules are copied to that neighbor each time step; the ghost layer is the
+edge layer of the upper neighbor.  The molecule pool is then replaced with
+domaincompactmols, so that it only holds the molecules of this domain's slab,
+this domain's share of the dead molecules, and room for maxrec arriving
+molecules.  Serial numbers of new molecules start at an offset, so that they
+are unique over all domains.  Returns 0 for success, 1 for out of memory, or 2
+if the slabs would be thinner than 2 box layers. */
+int domainsplit(simptr sim,int k,void *shm) {
+	domainptr dom;
+	boxssptr boxs;
+	molssptr mols;
+	int n,axis,side,i,b;
+
+	boxs=sim->boxs;
+	dom=boxs->dom;
+	mols=sim->mols;
+	n=dom->ndomain;
+	axis=dom->axis;
+	side=boxs->side[axis];
+	if(side<2*n) return 2;
+
+	free(dom->start);
+	free(dom->lclass);
+	free(dom->edge);
+	free(dom->nlsave);
+	dom->lclass=NULL;
+	dom->edge=NULL;
+	dom->nlsave=NULL;
+	dom->start=(int*) calloc(n+1,sizeof(int));
+	if(!dom->start) return 1;
+	dom->lclass=(enum DomainClass*) calloc(side,sizeof(enum DomainClass));
+	if(!dom->lclass) return 1;
+	for(i=0;i<=n;i++) dom->start[i]=(int)((long int)i*side/n);
+
+	dom->wrap=sim->accur>=6 && sim->wlist[2*axis]->type=='p';
+	dom->domain=k;
+	dom->lower=k>0?k-1:(dom->wrap?n-1:-1);
+	dom->upper=k<n-1?k+1:(dom->wrap?0:-1);
+	for(i=0;i<side;i++) {
+		if(i>=dom->start[k] && i<dom->start[k+1])
+			dom->lclass[i]=(i==dom->start[k] && dom->lower>=0)?DCedge:DCown;
+		else if(dom->upper>=0 && i==dom->start[dom->upper]) dom->lclass[i]=DCghost;
+		else dom->lclass[i]=DCforeign; }
+
+	dom->nedge=0;
+	if(dom->lower>=0) {
+		dom->edge=(boxptr*) calloc(boxs->nbox/side,sizeof(boxptr));
+		if(!dom->edge) return 1;
+		for(b=0;b<boxs->nbox;b++)
+			if(boxs->blist[b]->indx[axis]==dom->start[k]) dom->edge[dom->nedge++]=boxs->blist[b]; }
+
+	if(mols) {
+		dom->nlsave=(int*) calloc(mols->maxlist,sizeof(int));
+		if(!dom->nlsave) return 1;
+		if(molsort(sim)) return 1;
+		if(domaincompactmols(sim,mols->nd/n+dom->maxrec)) return 1;
+		mols->serno+=k*((LONG_MAX-mols->serno)/n); }
+
+	dom->shm=shm;
+	dom->phase=-1;
+	dom->sense=0;
+	dom->nsend=0;
+	dom->nghost=0;
+	dom->nsrc=0;
+	return 0; }
+
+
 
 
 /******************************************************************************/
@@ -800,6 +1378,35 @@ boxptr line2nextbox(simptr sim,double *pt1,double *pt2,boxptr bptr) {
 	return sim->boxs->blist[adrs]; }
 
 
+/* obstaclecheck.  Enforces the static obstacles on molecule mptr, whose pos
+position is in box bptr.  Obstacles are skipped if the box is clear of them, and
+the full geometric test is only done if the box is partly in them.  A molecule
+that entered an exclusion obstacle is returned to its prior position, posx, if
+that was outside.  A molecule that left an inclusion obstacle is returned to
+posx if that was inside, and is otherwise put onto the obstacle surface.
+Returns the box for the final molecule position. */
+boxptr obstaclecheck(simptr sim,moleculeptr mptr,boxptr bptr) {
+	int o,b,dim;
+	boxssptr boxs;
+	obstacleptr obst;
+	enum ObstBoxClass bc;
+
+	boxs=sim->boxs;
+	dim=sim->dim;
+	b=indx2addZV(bptr->indx,boxs->side,dim);
+	for(o=0;o<boxs->nobst;o++) {
+		obst=boxs->obstlist[o];
+		bc=obst->boxclass[b];
+		if(bc==OBCclear) continue;
+		if(bc==OBCpartial && obstacleinside(obst,mptr->pos,dim)==obst->include) continue;
+		if(obstacleinside(obst,mptr->posx,dim)==obst->include) copyVD(mptr->posx,mptr->pos,dim);
+		else if(obst->include) obstacleputin(obst,mptr->pos,dim);
+		else continue;
+		bptr=pos2box(sim,mptr->pos);
+		b=indx2addZV(bptr->indx,boxs->side,dim); }
+	return bptr; }
+
+
 /* reassignmolecs.  Reassigns molecules to boxes.  If diffusing is 1, only
 molecules in lists that include diffusing molecules (sim->mols->diffuselist) are
 reassigned; otherwise all lists are reassigned.  If reborn is 1, only molecules
@@ -812,13 +1419,21 @@ pos element of the molecules.  Molecules outside the set of boxes are assigned
 to the nearest box.  If more molecules belong in a box than actually fit, the
 number of spaces is doubled using expandbox.  The function returns 0 unless
 memory could not be allocated by expandbox, in which case it fails and returns
-1. */
+1.  Static obstacles are enforced here too, using obstaclecheck, so that they
+apply to all reassigned molecules.  With domain decomposition, reassigned
+molecules that are outside of this domain's slab are added to the send list, for
+domainmigrate; this also returns 1 if the send list couldn't be expanded. */
 int reassignmolecs(simptr sim,int diffusing,int reborn) {
-	int m,nmol,m2,ll;
+	int m,nmol,m2,ll,nobst,axis;
 	boxptr bptr1;
 	moleculeptr mptr,*mlist,*mlist2;
+	domainptr dom;
 
-	if(sim->boxs->nbox==1) return 0;
+	nobst=sim->boxs->nobst;
+	if(sim->boxs->nbox==1 && !nobst) return 0;
+	dom=sim->boxs->dom;
+	if(dom && dom->domain<0) dom=NULL;
+	axis=dom?dom->axis:0;
 	for(ll=0;ll<sim->mols->nlist;ll++)
 		if(sim->mols->listtype[ll]==MLTsystem)
 			if(diffusing==0 || sim->mols->diffuselist[ll]==1) {
@@ -829,16 +1444,414 @@ int reassignmolecs(simptr sim,int diffusing,int reborn) {
 				for(;m<nmol;m++) {
 					mptr=mlist[m];
 					bptr1=pos2box(sim,mptr->pos);
+					if(nobst) bptr1=obstaclecheck(sim,mptr,bptr1);
 					if(mptr->box!=bptr1) {
 						mlist2=mptr->box->mol[ll];		// remove from current box
 						for(m2=0;mlist2[m2]!=mptr;m2++);
 						mlist2[m2]=mlist2[--mptr->box->nmol[ll]];
 						mptr->box=bptr1;								// add to new box
-						// for parallelization, need: if(bptr1 is not within node) add molecule to send list.
 						if(bptr1->nmol[ll]==bptr1->maxmol[ll])
 							if(expandbox(bptr1,1+bptr1->nmol[ll],ll)) return 1;
-						bptr1->mol[ll][bptr1->nmol[ll]++]=mptr; }}}
+						bptr1->mol[ll][bptr1->nmol[ll]++]=mptr; }
+					if(dom && dom->lclass[bptr1->indx[axis]]>=DCghost)	// not within domain
+						if(domainsend(dom,mptr,m)) return 1; }}
+	return 0; }
+
+
+
+
+/******************************************************************************/
+/**************************** domain decomposition ****************************/
+/******************************************************************************/
+
+
+/* domainshmsize.  Returns the number of bytes of shared exchange memory that
+the domain decomposition of sim needs, using its maxrec value. */
+size_t domainshmsize(simptr sim) {
+	domainptr dom;
+	size_t n,bytes;
+
+	dom=sim->boxs->dom;
+	n=dom->ndomain;
+	bytes=DOMALIGN(sizeof(struct domainheadstruct))+DOMALIGN(4*n*sizeof(int));
+	bytes+=3*n*(size_t)dom->maxrec*sizeof(struct domainrecstruct);
+	bytes+=n*(size_t)dom->maxrec*sizeof(int);
+	return bytes; }
+
+
+/* domainbuffers.  Returns pointers to the parts of the shared exchange memory
+of dom, which are described at the top of this file.  Enter NULL for any that
+aren't needed. */
+void domainbuffers(domainptr dom,int **countptr,void **mailptr,void **ghostptr,int **killptr) {
+	char *ptr;
+	size_t n;
+	domainrecptr mail,ghost;
+
+	n=dom->ndomain;
+	ptr=(char*)dom->shm+DOMALIGN(sizeof(struct domainheadstruct));
+	if(countptr) *countptr=(int*)ptr;
+	mail=(domainrecptr)(ptr+DOMALIGN(4*n*sizeof(int)));
+	ghost=mail+2*n*(size_t)dom->maxrec;
+	if(mailptr) *mailptr=(void*)mail;
+	if(ghostptr) *ghostptr=(void*)ghost;
+	if(killptr) *killptr=(int*)(ghost+n*(size_t)dom->maxrec);
+	return; }
+
+
+/* domainbarrier.  Waits until all domains have reached this point, using a
+sense reversing barrier in the shared exchange memory.  Returns 0 when they
+have, or 1 if any domain failed, in which case this domain needs to stop too. */
+int domainbarrier(domainptr dom) {
+#ifdef _WIN32
+	return 1;
+#else
+	domainheadptr head;
+
+	head=(domainheadptr)dom->shm;
+	dom->sense=!dom->sense;
+	if(__sync_add_and_fetch(&head->count,1)==dom->ndomain) {
+		head->count=0;
+		__sync_synchronize();
+		head->sense=dom->sense; }
+	else
+		while(head->sense!=dom->sense) {
+			if(head->abort) return 1;
+			sched_yield(); }
+	__sync_synchronize();														// see what other domains wrote
+	return head->abort?1:0;
+#endif
+	}
+
+
+/* domainabort.  Tells all domains to stop, so that none of them waits forever
+at a barrier for a domain that has failed or finished early. */
+void domainabort(domainptr dom) {
+	if(!dom || !dom->shm) return;
+	((domainheadptr)dom->shm)->abort=1;
+#ifndef _WIN32
+	__sync_synchronize();
+#endif
+	return; }
+
+
+/* domainpair.  Returns 1 if molecules in box bptr1 and molecules in box bptr2,
+which may be the same box, should be checked for bimolecular reactions in the
+current reaction phase of dom, and 0 if not.  Phase 0 includes pairs in owned
+boxes and pairs of owned and ghost boxes, and phase 1 includes pairs that have
+a molecule in the edge layer, which waits until the lower neighbor has reported
+which of these molecules its phase 0 used up.  Pairs of two ghost or foreign
+boxes are left to the domains that own them.  With phase -1, all pairs are
+included. */
+int domainpair(domainptr dom,boxptr bptr1,boxptr bptr2) {
+	enum DomainClass c1,c2;
+
+	if(dom->phase<0) return 1;
+	c1=dom->lclass[bptr1->indx[dom->axis]];
+	c2=dom->lclass[bptr2->indx[dom->axis]];
+	if(c1>=DCghost && c2>=DCghost) return 0;
+	if(c1==DCedge || c2==DCedge) return dom->phase==1;
+	return dom->phase==0; }
+
+
+/* domainsend.  Adds molecule mptr to the send list of dom, for domainmigrate to
+move it to the domain that owns its box.  m is the index of the molecule in its
+live list, or -1 if unknown.  Molecules may be listed more than once.  Returns 0
+for success or 1 if memory could not be allocated. */
+int domainsend(domainptr dom,moleculeptr mptr,int m) {
+	int maxsend,s,*newm;
+	moleculeptr *newsend;
+
+	if(dom->nsend==dom->maxsend) {
+		maxsend=2*dom->maxsend+64;
+		newsend=(moleculeptr*) calloc(maxsend,sizeof(moleculeptr));
+		newm=(int*) calloc(maxsend,sizeof(int));
+		if(!newsend || !newm) {
+			free(newsend);
+			free(newm);
+			return 1; }
+		for(s=0;s<dom->nsend;s++) {
+			newsend[s]=dom->send[s];
+			newm[s]=dom->sendm[s]; }
+		free(dom->send);
+		free(dom->sendm);
+		dom->send=newsend;
+		dom->sendm=newm;
+		dom->maxsend=maxsend; }
+	dom->send[dom->nsend]=mptr;
+	dom->sendm[dom->nsend++]=m;
+	return 0; }
+
+
+/* domainmol2rec.  Copies molecule mptr to exchange record rec. */
+void domainmol2rec(simptr sim,moleculeptr mptr,void *rec) {
+	domainrecptr drec;
+	int d;
+
+	drec=(domainrecptr)rec;
+	drec->serno=mptr->serno;
+	drec->ident=mptr->ident;
+	drec->mstate=(int)mptr->mstate;
+	drec->pnl=mptr->pnl;
+	for(d=0;d<sim->dim;d++) {
+		drec->pos[d]=mptr->pos[d];
+		drec->posx[d]=mptr->posx[d];
+		drec->posoffset[d]=mptr->posoffset[d]; }
+	return; }
+
+
+/* domainrec2mol.  Copies exchange record rec to molecule mptr, which is set up
+for its live list and box but not added to either of them. */
+void domainrec2mol(simptr sim,void *rec,moleculeptr mptr) {
+	domainrecptr drec;
+	int d;
+
+	drec=(domainrecptr)rec;
+	mptr->serno=drec->serno;
+	mptr->ident=drec->ident;
+	mptr->mstate=(enum MolecState)drec->mstate;
+	mptr->list=sim->mols->listlookup[mptr->ident][mptr->mstate];
+	mptr->pnl=drec->pnl;
+	for(d=0;d<sim->dim;d++) {
+		mptr->pos[d]=drec->pos[d];
+		mptr->posx[d]=drec->posx[d];
+		mptr->posoffset[d]=drec->posoffset[d]; }
+	mptr->box=pos2box(sim,mptr->pos);
+	return; }
+
+
+/* domainmigrate.  Moves the molecules on the send list, which reassignmolecs
+filled with molecules that left this domain's slab, to the domains that own
+their boxes, and adds the molecules that other domains sent here.  Molecules
+only go to neighboring slabs, so one that crossed more than one slab is passed
+along again in the next time step.  Molecules keep their serial numbers, but
+tracking slots are lost.  A second barrier after the inboxes are read keeps
+neighbors from writing the next step's molecules into them too soon, which
+matters when there is no barrier in domainbimolreact.  This sorts the molecule
+lists.  Returns 0 for success or 1 if an exchange buffer is full, the molecules
+ran out, memory could not be allocated, or another domain failed. */
+int domainmigrate(simptr sim) {
+	domainptr dom;
+	molssptr mols;
+	int s,ll,m,k,i,n,up,to,slot,*count;
+	domainrecptr mail;
+	moleculeptr mptr;
+
+	dom=sim->boxs->dom;
+	mols=sim->mols;
+	n=dom->ndomain;
+	domainbuffers(dom,&count,(void**)&mail,NULL,NULL);
+
+	for(s=0;s<dom->nsend;s++) {												// send molecules
+		mptr=dom->send[s];
+		ll=mptr->list;
+		if(ll<0 || !mptr->box) continue;								// killed, or listed twice
+		i=mptr->box->indx[dom->axis];
+		if(dom->lclass[i]<DCghost) continue;						// came back
+		for(k=0;dom->start[k+1]<=i;k++);
+		if(dom->lower<0) up=1;
+		else if(dom->upper<0) up=0;
+		else if(dom->wrap) up=(k-dom->domain+n)%n<=(dom->domain-k+n)%n;
+		else up=k>dom->domain;
+		to=up?dom->upper:dom->lower;
+		slot=2*to+(up?0:1);
+		if(count[slot]==dom->maxrec) {
+			domainabort(dom);
+			return 1; }
+		domainmol2rec(sim,mptr,mail+(size_t)slot*dom->maxrec+count[slot]);
+		count[slot]++;
+		m=dom->sendm[s];
+		if(m>=mols->nl[ll] || (m>=0 && mols->live[ll][m]!=mptr)) m=-1;
+		molkill(sim,mptr,ll,m); }
+	dom->nsend=0;
+
+	if(domainbarrier(dom)) return 1;
+
+	for(slot=2*dom->domain;slot<2*dom->domain+2;slot++) {		// receive molecules
+		for(i=0;i<count[slot];i++) {
+			mptr=getnextmol(mols);
+			if(!mptr) {
+				domainabort(dom);
+				return 1; }
+			domainrec2mol(sim,mail+(size_t)slot*dom->maxrec+i,mptr);
+			if(dom->lclass[mptr->box->indx[dom->axis]]>=DCghost)	// passing through
+				if(domainsend(dom,mptr,-1)) {
+					domainabort(dom);
+					return 1; }}
+		count[slot]=0; }
+	if(domainbarrier(dom)) return 1;										// inboxes are free again
+	if(molsort(sim)) {
+		domainabort(dom);
+		return 1; }
+	return 0; }
+
+
+/* domainclip.  Removes molecules that were created with serial numbers from
+serno up to the current serial number, and that are outside of this domain's
+slab.  Zeroth order reactions and commands that add molecules run in every
+domain, so this keeps only the part of their molecules that belongs here.  For
+zeroth order reactions, whose molecules are independent, this has the same
+distribution as running them once.  Commands that add a fixed number of
+molecules at random positions make the same molecules in every domain, because
+domaindocommand runs them with shared random numbers, so the domains keep them
+all exactly once.  Molecules that are not sorted yet
+are returned to the dead list directly, and others are killed and then sorted.
+Returns 0 for success or 1 if memory could not be allocated while sorting. */
+int domainclip(simptr sim,long int serno) {
+	domainptr dom;
+	molssptr mols;
+	int m,ll,axis,kill;
+	long int nnew,found;
+	moleculeptr mptr;
+
+	dom=sim->boxs->dom;
+	mols=sim->mols;
+	if(!dom || dom->domain<0 || !mols) return 0;
+	nnew=mols->serno-serno;
+	if(nnew<=0) return 0;
+	axis=dom->axis;
+
+	found=0;
+	for(m=mols->topd;m<mols->nd;m++) {								// resurrected molecules
+		mptr=mols->dead[m];
+		if(mptr->serno<serno || mptr->serno>=mols->serno) continue;
+		found++;
+		if(mptr->box && dom->lclass[mptr->box->indx[axis]]>=DCghost) {
+			mptr->ident=0;
+			mptr->mstate=MSsoln;
+			mptr->list=-1;
+			mptr->pnl=NULL;
+			mols->dead[m]=mols->dead[mols->topd];
+			mols->dead[mols->topd++]=mptr; }}
+	if(found==nnew) return 0;
+
+	kill=0;
+	for(ll=0;ll<mols->nlist;ll++)											// sorted molecules
+		if(mols->listtype[ll]==MLTsystem)
+			for(m=0;m<mols->nl[ll];m++) {
+				mptr=mols->live[ll][m];
+				if(mptr->serno<serno || mptr->serno>=mols->serno || mptr->ident==0) continue;
+				if(dom->lclass[mptr->box->indx[axis]]>=DCghost) {
+					molkill(sim,mptr,ll,m);
+					kill=1; }}
+	if(kill && molsort(sim)) return 1;
 	return 0; }
 
 
+/* domainbimolreact.  Does the bimolecular reactions of a time step for a
+domain, in two phases, so that the results are as if the whole system were
+simulated in one process.  First, each domain copies the molecules of its edge
+layer to shared memory, and adds the copies that its upper neighbor made to its
+own ghost layer, as ghost molecules.  These are listed at the ends of the live
+lists, above nl, so bireact uses them like any other molecules.  In phase 0,
+each domain does the reactions of all pairs that don't include its own edge
+layer, including pairs of its molecules with ghosts, and then removes the
+ghosts and reports which of them reacted.  In phase 1, each domain kills the
+edge layer molecules that its lower neighbor reported and does the reactions of
+pairs that include its edge layer.  Returns 0 for success, 5 if there weren't
+enough molecules for the reaction products, or 11 if an exchange buffer is full,
+memory could not be allocated, or another domain failed. */
+int domainbimolreact(simptr sim) {
+	domainptr dom;
+	molssptr mols;
+	int k,n,b,ll,m,g,i,ng,nk,nsrc,er,maxsrc,*count,*kill;
+	domainrecptr ghostrec;
+	moleculeptr mptr,*newsrc,*newghost;
+	boxptr bptr;
+
+	if(!sim->rxnss[2]) return 0;
+	dom=sim->boxs->dom;
+	mols=sim->mols;
+	k=dom->domain;
+	n=dom->ndomain;
+	domainbuffers(dom,&count,NULL,(void**)&ghostrec,&kill);
+
+	nsrc=0;																						// copy own edge layer
+	if(dom->lower>=0)
+		for(b=0;b<dom->nedge;b++) {
+			bptr=dom->edge[b];
+			for(ll=0;ll<mols->nlist;ll++)
+				for(m=0;m<bptr->nmol[ll];m++) {
+					mptr=bptr->mol[ll][m];
+					if(mptr->ident==0) continue;
+					if(nsrc==dom->maxrec) goto failure;
+					if(nsrc==dom->maxsrc) {
+						maxsrc=2*dom->maxsrc+64;
+						newsrc=(moleculeptr*) calloc(maxsrc,sizeof(moleculeptr));
+						if(!newsrc) goto failure;
+						for(i=0;i<nsrc;i++) newsrc[i]=dom->src[i];
+						free(dom->src);
+						dom->src=newsrc;
+						dom->maxsrc=maxsrc; }
+					domainmol2rec(sim,mptr,ghostrec+(size_t)k*dom->maxrec+nsrc);
+					dom->src[nsrc++]=mptr; }}
+	dom->nsrc=nsrc;
+	count[2*n+k]=nsrc;
+	if(domainbarrier(dom)) return 11;
+
+	for(ll=0;ll<mols->nlist;ll++) dom->nlsave[ll]=mols->nl[ll];	// add ghosts
+	ng=dom->upper>=0?count[2*n+dom->upper]:0;
+	if(ng>dom->maxghost) {
+		newghost=(moleculeptr*) calloc(ng,sizeof(moleculeptr));
+		if(!newghost) goto failure;
+		for(g=0;g<dom->maxghost;g++) newghost[g]=dom->ghost[g];
+		for(;g<ng;g++) newghost[g]=NULL;
+		free(dom->ghost);
+		dom->ghost=newghost;
+		for(g=dom->maxghost;g<ng;g++) {
+			dom->ghost[g]=molalloc(sim->dim);
+			if(!dom->ghost[g]) goto failure;
+			dom->maxghost=g+1; }}
+	er=0;
+	for(g=0;g<ng && !er;g++) {
+		mptr=dom->ghost[g];
+		domainrec2mol(sim,ghostrec+(size_t)dom->upper*dom->maxrec+g,mptr);
+		ll=mptr->list;
+		if(mols->nl[ll]==mols->maxl[ll] && molexpandlist(mols,sim->dim,ll,-1,0)) er=1;
+		else if(boxaddmol(mptr,ll)) er=1;
+		else mols->live[ll][mols->nl[ll]++]=mptr; }
+	dom->nghost=g;
+	if(er) ng=-1;
+
+	dom->phase=0;																			// phase 0
+	if(ng>=0) {
+		er=bireact(sim,0);
+		if(!er) er=bireact(sim,1); }
+
+	nk=0;																							// remove ghosts
+	for(ll=0;ll<mols->nlist;ll++) {
+		for(m=dom->nlsave[ll];m<mols->nl[ll];m++) {
+			boxremovemol(mols->live[ll][m],ll);
+			mols->live[ll][m]=NULL; }
+		mols->nl[ll]=dom->nlsave[ll]; }
+	for(g=0;g<dom->nghost;g++)
+		if(dom->ghost[g]->ident==0) kill[(size_t)k*dom->maxrec+nk++]=g;
+	dom->nghost=0;
+	count[3*n+k]=nk;
+	if(ng<0) goto failure;
+	if(er) {
+		domainabort(dom);
+		dom->phase=-1;
+		return 5; }
+	if(domainbarrier(dom)) {
+		dom->phase=-1;
+		return 11; }
+
+	if(dom->lower>=0) {																// kill used edge molecules
+		nk=count[3*n+dom->lower];
+		for(i=0;i<nk;i++) {
+			mptr=dom->src[kill[(size_t)dom->lower*dom->maxrec+i]];
+			if(mptr->ident) molkill(sim,mptr,mptr->list,-1); }}
+
+	dom->phase=1;																			// phase 1
+	er=bireact(sim,0);
+	if(!er) er=bireact(sim,1);
+	dom->phase=-1;
+	if(er) {
+		domainabort(dom);
+		return 5; }
+	return 0;
 
+ failure:
+	domainabort(dom);
+	dom->phase=-1;
+	return 11; }
@@ -5,6 +5,8 @@
  of the Gnu General Public License (GPL). */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
 #include <math.h>
 #include <string.h>
 #include "Geometry.h"
@@ -13,11 +15,26 @@
 #include "Rn.h"
 #include "RnSort.h"
 #include "smoldyn.h"
+#include "smoltraj.h"
 #include "string2.h"
 #include "Zn.h"
 
 #include "smoldyn_config.h"
 
+#ifdef THREADING
+#include <pthread.h>
+#endif
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
 
 /**********************************************************/
 /******************** command declarations ****************/
@@ -35,6 +52,7 @@ enum CMDcode cmdsetgraphic_iter(simptr sim,cmdptr cmd,char *line2);
 // file manipulation
 enum CMDcode cmdoverwrite(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdincrementfile(simptr sim,cmdptr cmd,char *line2);
+enum CMDcode cmdcheckpoint(simptr sim,cmdptr cmd,char *line2);
 
 // conditional
 enum CMDcode cmdifno(simptr sim,cmdptr cmd,char *line2);
@@ -53,17 +71,21 @@ enum CMDcode cmdmolcountincmpts(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmolcountincmpt2(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmolcountonsurf(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmolcountspace(simptr sim,cmdptr cmd,char *line2);
+enum CMDcode cmdmolcountgrid(simptr sim,cmdptr cmd,char *line2);
+enum CMDcode cmdradialdist(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdspeciesstreamcountheader(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdspeciesstreamcount(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdlistmols(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdlistmols2(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdlistmols3(simptr sim,cmdptr cmd,char *line2);
+enum CMDcode cmdlistmolsbin(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmolpos(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmolmoments(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdsavesim(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmeansqrdisp(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2);
 enum CMDcode cmddiagnostics(simptr sim,cmdptr cmd,char *line2);
+enum CMDcode cmdsnapshot(simptr sim,cmdptr cmd,char *line2);
 
 // system manipulation
 enum CMDcode cmdset(simptr sim,cmdptr cmd,char *line2);
@@ -95,12 +117,125 @@ enum CMDcode cmdincludeecoli(simptr sim,cmdptr cmd,char *line2);
 // internal functions
 void cmdv1free(cmdptr cmd);
 void cmdv1v2free(cmdptr cmd);
+void cmdv3free(cmdptr cmd);
+void cmdv1v3free(cmdptr cmd);
+void cmdv1v2v3free(cmdptr cmd);
+void cmdobsfree(cmdptr cmd);
+void* outwriter(void *data);
+void outdrain(outssptr outss);
+outblockptr outgetbuf(outssptr outss,FILE *fptr);
+void outsend(outssptr outss,outblockptr buf,int keep);
 enum CMDcode conditionalcmdtype(simptr sim,cmdptr cmd,int nparam);
+enum CMDcode domaindocommand(simptr sim,cmdptr cmd,char *word,char *line);
 int insideecoli(double *pos,double *ofst,double rad,double length);
 void putinecoli(double *pos,double *ofst,double rad,double length);
 int molinpanels(simptr sim,int ll,int m,int s,char pshape);
 
 
+/**********************************************************/
+/**************** compiled command arguments **************/
+/**********************************************************/
+
+/* Commands that are run often parse their arguments on the first call and
+store the results in one of these structures in cmd->v3, so that later calls
+skip parsing.  File names are kept as text because file pointers can change
+during the simulation. */
+
+typedef struct cmdargsmolcountspace {	// molcountspace arguments
+	int i;											// species, or <0 for all
+	enum MolecState ms;					// molecule state
+	int axis;										// axis for histogram
+	int nbin;										// number of bins
+	int average;								// number of invocations to average
+	double low[DIMMAX];					// low edge of counting region [d]
+	double high[DIMMAX];				// high edge of counting region [d]
+	char fline[STRCHAR];				// file name and following text
+	} *cmdargsmolcountspaceptr;
+
+typedef struct cmdargsmeansqrdisp {	// meansqrdisp arguments
+	int i;											// species
+	enum MolecState ms;					// molecule state
+	int msddim;									// dimension, or -1 for all
+	char fline[STRCHAR];				// file name and following text
+	molssptr mols;							// molecule superstructure, for tracking slots
+	} *cmdargsmeansqrdispptr;
+
+typedef struct cmdargsexclude {	// excludebox and excludesphere arguments
+	double poslo[DIMMAX];				// low corner of region [d]
+	double poshi[DIMMAX];				// high corner of region [d]
+	double poscent[DIMMAX];			// sphere center [d]
+	double rad2;								// sphere radius squared
+	} *cmdargsexcludeptr;
+
+typedef struct cmdargsfixmolcount {	// fixmolcount, fixmolcountonsurf, fixmolcountincmpt arguments
+	int i;											// species
+	enum MolecState ms;					// molecule state
+	int num;										// desired number of molecules
+	int s;											// surface number
+	compartptr cmpt;						// compartment
+	} *cmdargsfixmolcountptr;
+
+typedef struct cmdargslistmolsbin {	// listmolsbin arguments
+	int i;											// species, or <0 for all
+	enum MolecState ms;					// molecule state
+	int flags;									// trajectory format flags
+	size_t maxpayload;					// allocated size of payload in cmd->v1
+	size_t maxzip;							// allocated size of compressed payload in cmd->v2
+	char fline[STRCHAR];				// file name and following text
+	} *cmdargslistmolsbinptr;
+
+typedef struct cmdargsmolcountgrid {	// molcountgrid arguments
+	int i;											// species, or <0 for all
+	enum MolecState ms;					// molecule state
+	int nbin[DIMMAX];						// number of bins on each axis [d]
+	double low[DIMMAX];					// low edge of grid [d]
+	double high[DIMMAX];				// high edge of grid [d]
+	int average;								// number of invocations to average
+	char fline[STRCHAR];				// file name and following text
+	} *cmdargsmolcountgridptr;
+
+#ifdef THREADING
+typedef struct PARAMSET_molcountgrid_threaded {
+	simptr sim;
+	cmdargsmolcountgridptr args;
+	int thread;
+	int nthreads;
+	int *ct;
+} PARAMS_molcountgrid_threaded;
+#endif
+
+void molcountgrid(simptr sim,cmdargsmolcountgridptr args,int thread,int nthreads,int *ct);
+#ifdef THREADING
+void* molcountgrid_threaded(void *data);
+#endif
+
+typedef struct cmdargsradialdist {	// radialdist arguments
+	int i1;											// first species
+	enum MolecState ms1;				// first molecule state
+	int i2;											// second species
+	enum MolecState ms2;				// second molecule state
+	double rmax;								// largest distance
+	int nbin;										// number of bins
+	int average;								// number of invocations to average
+	char fline[STRCHAR];				// file name and following text
+	} *cmdargsradialdistptr;
+
+#ifdef THREADING
+typedef struct PARAMSET_radialdist_threaded {
+	simptr sim;
+	cmdargsradialdistptr args;
+	int b1;
+	int b2;
+	int *ct;
+} PARAMS_radialdist_threaded;
+#endif
+
+void radialdist(simptr sim,cmdargsradialdistptr args,int b1,int b2,int *ct);
+#ifdef THREADING
+void* radialdist_threaded(void *data);
+#endif
+
+
 /**********************************************************/
 /********************* command processor ******************/
 /**********************************************************/
@@ -113,9 +248,14 @@ enum CMDcode docommand(void *cmdfnarg,cmdptr cmd,char *line) {
 	if(!cmdfnarg) return CMDok;
 	sim=(simptr) cmdfnarg;
 	if(!line) return CMDok;
+	if(sim->cmdreplay) return CMDok;							// restoring command timing only
 	itct=sscanf(line,"%s",word);
 	if(itct<=0) return CMDok;
 	line2=strnword(line,2);
+	if(sim->boxs && sim->boxs->dom && sim->boxs->dom->fpos)
+		return domaindocommand(sim,cmd,word,line);
+	if(sim->obsplan && strcmp(word,"molcount") && strcmp(word,"molcountincmpt") && strcmp(word,"molcountspace") && strcmp(word,"molmoments"))
+		sim->obsplan->epoch++;									// other commands may change molecules
 
 	// simulation control
 	if(!strcmp(word,"stop")) return cmdstop(sim,cmd,line2);
@@ -129,6 +269,7 @@ enum CMDcode docommand(void *cmdfnarg,cmdptr cmd,char *line) {
 	// file manipulation
 	else if(!strcmp(word,"overwrite")) return cmdoverwrite(sim,cmd,line2);
 	else if(!strcmp(word,"incrementfile")) return cmdincrementfile(sim,cmd,line2);
+	else if(!strcmp(word,"checkpoint")) return cmdcheckpoint(sim,cmd,line2);
 
 	// conditional
 	else if(!strcmp(word,"ifno")) return cmdifno(sim,cmd,line2);
@@ -147,17 +288,21 @@ enum CMDcode docommand(void *cmdfnarg,cmdptr cmd,char *line) {
 	else if(!strcmp(word,"molcountincmpt2")) return cmdmolcountincmpt2(sim,cmd,line2);
 	else if(!strcmp(word,"molcountonsurf")) return cmdmolcountonsurf(sim,cmd,line2);
 	else if(!strcmp(word,"molcountspace")) return cmdmolcountspace(sim,cmd,line2);
+	else if(!strcmp(word,"molcountgrid")) return cmdmolcountgrid(sim,cmd,line2);
+	else if(!strcmp(word,"radialdist")) return cmdradialdist(sim,cmd,line2);
 	else if(!strcmp(word,"speciesstreamheader")) return cmdspeciesstreamcountheader(sim,cmd,line2);
 	else if(!strcmp(word,"speciesstreamcount")) return cmdspeciesstreamcount(sim,cmd,line2);
 	else if(!strcmp(word,"listmols")) return cmdlistmols(sim,cmd,line2);
 	else if(!strcmp(word,"listmols2")) return cmdlistmols2(sim,cmd,line2);
 	else if(!strcmp(word,"listmols3")) return cmdlistmols3(sim,cmd,line2);
+	else if(!strcmp(word,"listmolsbin")) return cmdlistmolsbin(sim,cmd,line2);
 	else if(!strcmp(word,"molpos")) return cmdmolpos(sim,cmd,line2);
 	else if(!strcmp(word,"molmoments")) return cmdmolmoments(sim,cmd,line2);
 	else if(!strcmp(word,"savesim")) return cmdsavesim(sim,cmd,line2);
 	else if(!strcmp(word,"meansqrdisp")) return cmdmeansqrdisp(sim,cmd,line2);
 	else if(!strcmp(word,"meansqrdisp2")) return cmdmeansqrdisp2(sim,cmd,line2);
 	else if(!strcmp(word,"diagnostics")) return cmddiagnostics(sim,cmd,line2);
+	else if(!strcmp(word,"snapshot")) return cmdsnapshot(sim,cmd,line2);
 
 	// system manipulation
 	else if(!strcmp(word,"set")) return cmdset(sim,cmd,line2);
@@ -278,6 +423,8 @@ enum CMDcode cmdsetgraphic_iter(simptr sim,cmdptr cmd,char *line2) {
 enum CMDcode cmdoverwrite(simptr sim,cmdptr cmd,char *line2) {
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDcontrol;
 	SCMDCHECK(line2,"missing argument");
+	snapwait(sim,0);
+	outflush(sim);
 	SCMDCHECK(scmdoverwrite(sim->cmds,line2),"failed to open file");
 	return CMDok; }
 
@@ -285,10 +432,30 @@ enum CMDcode cmdoverwrite(simptr sim,cmdptr cmd,char *line2) {
 enum CMDcode cmdincrementfile(simptr sim,cmdptr cmd,char *line2) {
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDcontrol;
 	SCMDCHECK(line2,"missing argument");
+	snapwait(sim,0);
+	outflush(sim);
 	SCMDCHECK(scmdincfile(sim->cmds,line2),"failed to increment file");
 	return CMDok; }
 
 
+/* cmdcheckpoint.  Requests a binary checkpoint of the simulation in file
+filename, relative to the configuration file path.  The checkpoint is written
+by simdocommands after all commands for this time step have run and molecules
+are sorted, so that a restored run continues from the start of the next step. */
+enum CMDcode cmdcheckpoint(simptr sim,cmdptr cmd,char *line2) {
+	int itct;
+	char nm[STRCHAR];
+
+	if(line2 && !strcmp(line2,"cmdtype")) return CMDcontrol;
+	SCMDCHECK(line2,"missing argument");
+	itct=sscanf(line2,"%s",nm);
+	SCMDCHECK(itct==1,"cannot read file name");
+	SCMDCHECK(strlen(sim->filepath)+strlen(nm)<STRCHAR,"file name is too long");
+	strcpy(sim->ckptname,sim->filepath);
+	strcat(sim->ckptname,nm);
+	return CMDok; }
+
+
 
 /**********************************************************/
 /********************** conditional ***********************/
@@ -418,9 +585,9 @@ enum CMDcode cmdwarnescapee(simptr sim,cmdptr cmd,char *line2) {
 					escape=!posinsystem(sim,posx);
 					if(!escape) {
 						via=mptr->via;
-						if(dim==1) fprintf(fptr,"New escapee: %g #%li %g to %g via %g\n",sim->time,mptr->serno,posx[0],pos[0],via[0]);
-						else if(dim==2) fprintf(fptr,"New escapee: %g #%li (%g,%g) to (%g,%g) via (%g,%g)\n",sim->time,mptr->serno,posx[0],posx[1],pos[0],pos[1],via[0],via[1]);
-						else fprintf(fptr,"New escapee: %g #%li (%g,%g,%g) to (%g,%g,%g) via (%g,%g,%g)\n",sim->time,mptr->serno,posx[0],posx[1],posx[2],pos[0],pos[1],pos[2],via[0],via[1],via[2]); }}}}}
+						if(dim==1) outprintf(sim,fptr,"New escapee: %g #%li %g to %g via %g\n",sim->time,mptr->serno,posx[0],pos[0],via[0]);
+						else if(dim==2) outprintf(sim,fptr,"New escapee: %g #%li (%g,%g) to (%g,%g) via (%g,%g)\n",sim->time,mptr->serno,posx[0],posx[1],pos[0],pos[1],via[0],via[1]);
+						else outprintf(sim,fptr,"New escapee: %g #%li (%g,%g,%g) to (%g,%g,%g) via (%g,%g,%g)\n",sim->time,mptr->serno,posx[0],posx[1],posx[2],pos[0],pos[1],pos[2],via[0],via[1],via[2]); }}}}}
 	return CMDok; }
 
 
@@ -438,7 +605,7 @@ enum CMDcode cmdecho(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(termqt=strchr(str,'"'),"no terminal quote on string");
 	*termqt='\0';
 	strbslash2escseq(str);
-	fprintf(fptr,"%s",str);
+	outprintf(sim,fptr,"%s",str);
 	return CMDok; }
 
 
@@ -450,15 +617,16 @@ enum CMDcode cmdmolcountheader(simptr sim,cmdptr cmd,char *line2) {
 	fptr=scmdgetfptr(sim->cmds,line2);
 	SCMDCHECK(fptr,"file name not recognized");
 	SCMDCHECK(sim->mols,"molecules are undefined");
-	fprintf(fptr,"time");
-	for(i=1;i<sim->mols->nspecies;i++) fprintf(fptr," %s",sim->mols->spname[i]);
-	fprintf(fptr,"\n");
+	outprintf(sim,fptr,"time");
+	for(i=1;i<sim->mols->nspecies;i++) outprintf(sim,fptr," %s",sim->mols->spname[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
 enum CMDcode cmdmolcount(simptr sim,cmdptr cmd,char *line2) {
 	FILE *fptr;
-	int ll,m,*ct,i,nspecies;
+	int *ct,i,nspecies;
+	obsptr obs;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
 	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
@@ -467,22 +635,18 @@ enum CMDcode cmdmolcount(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(sim->mols,"molecules are undefined");
 
 	nspecies=sim->mols->nspecies;
-	if(cmd->i1!=nspecies) {														// allocate counter if required
-		cmdv1free(cmd);
-		cmd->i1=nspecies;
-		cmd->freefn=&cmdv1free;
-		cmd->v1=calloc(nspecies,sizeof(int));
-		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;} }
-
-	ct=(int*)cmd->v1;
-	for(i=0;i<nspecies;i++) ct[i]=0;
-	for(ll=0;ll<sim->mols->nlist;ll++)
-		for(m=0;m<sim->mols->nl[ll];m++) {
-			i=sim->mols->live[ll][m]->ident;
-			if(i>0) ct[i]++; }
-	fprintf(fptr,"%g",sim->time);
-	for(i=1;i<nspecies;i++) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+	if(!cmd->v2) {																		// register observer
+		obs=obsregister(sim,cmd,OTmolcount,-1,MSall);
+		if(!obs) {cmd->i1=-1;return CMDwarn;}
+		cmd->v2=obs;
+		cmd->freefn=&cmdobsfree; }
+	obs=(obsptr)cmd->v2;
+	if(obssweep(sim,obs)) {cmd->i1=-1;return CMDwarn;}
+
+	ct=obs->ct;
+	outprintf(sim,fptr,"%g",sim->time);
+	for(i=1;i<nspecies;i++) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
@@ -520,19 +684,18 @@ enum CMDcode cmdmolcountinbox(simptr sim,cmdptr cmd,char *line2) {
 			for(d=0;d<dim;d++)
 				if(mptr->pos[d]<low[d] || mptr->pos[d]>high[d]) d=dim+1;
 			if(d==dim && mptr->ident>0) ct[mptr->ident]++; }
-	fprintf(fptr,"%g",sim->time);
-	for(i=1;i<nspecies;i++) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+	outprintf(sim,fptr,"%g",sim->time);
+	for(i=1;i<nspecies;i++) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
 enum CMDcode cmdmolcountincmpt(simptr sim,cmdptr cmd,char *line2) {
 	FILE *fptr;
 	char nm[STRCHAR];
-	compartptr cmpt;
 	compartssptr cmptss;
-	int ll,m,*ct,itct,c,i,nspecies;
-	moleculeptr mptr;
+	int *ct,itct,c,i,nspecies;
+	obsptr obs;
 	
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
 	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
@@ -542,30 +705,26 @@ enum CMDcode cmdmolcountincmpt(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(line2,"missing argument");
 	itct=sscanf(line2,"%s",nm);
 	SCMDCHECK(itct==1,"cannot read argument");
-	c=stringfind(cmptss->cnames,cmptss->ncmpt,nm);
-	SCMDCHECK(c>=0,"compartment name not recognized");
-	cmpt=cmptss->cmptlist[c];
 	line2=strnword(line2,2);
 	fptr=scmdgetfptr(sim->cmds,line2);
 	SCMDCHECK(fptr,"file name not recognized");
-	
+
 	nspecies=sim->mols->nspecies;
-	if(cmd->i1!=nspecies) {														// allocate counter if required
-		cmdv1free(cmd);
-		cmd->i1=nspecies;
-		cmd->freefn=&cmdv1free;
-		cmd->v1=calloc(nspecies,sizeof(int));
-		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;} }
-	
-	ct=(int*)cmd->v1;
-	for(i=0;i<nspecies;i++) ct[i]=0;
-	for(ll=0;ll<sim->mols->nlist;ll++)
-		for(m=0;m<sim->mols->nl[ll];m++) {
-			mptr=sim->mols->live[ll][m];
-			if(mptr->ident>0 && posincompart(sim,mptr->pos,cmpt) && mptr->mstate==MSsoln) ct[mptr->ident]++; }
-	fprintf(fptr,"%g",sim->time);
-	for(i=1;i<nspecies;i++) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+	if(!cmd->v2) {																		// register observer
+		c=stringfind(cmptss->cnames,cmptss->ncmpt,nm);
+		SCMDCHECK(c>=0,"compartment name not recognized");
+		obs=obsregister(sim,cmd,OTmolcountincmpt,-1,MSsoln);
+		if(!obs) {cmd->i1=-1;return CMDwarn;}
+		obs->cmpt=cmptss->cmptlist[c];
+		cmd->v2=obs;
+		cmd->freefn=&cmdobsfree; }
+	obs=(obsptr)cmd->v2;
+	if(obssweep(sim,obs)) {cmd->i1=-1;return CMDwarn;}
+
+	ct=obs->ct;
+	outprintf(sim,fptr,"%g",sim->time);
+	for(i=1;i<nspecies;i++) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
@@ -613,10 +772,10 @@ enum CMDcode cmdmolcountincmpts(simptr sim,cmdptr cmd,char *line2) {
 				for(ic=0;ic<ncmpt;ic++)
 					if(posincompart(sim,mptr->pos,cmptlist[ic])) ct[ic*nspecies+mptr->ident]++; }
 
-	fprintf(fptr,"%g",sim->time);
+	outprintf(sim,fptr,"%g",sim->time);
 	for(i=1;i<nspecies*ncmpt;i++) 
-		if(i%nspecies!=0) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+		if(i%nspecies!=0) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
@@ -662,9 +821,9 @@ enum CMDcode cmdmolcountincmpt2(simptr sim,cmdptr cmd,char *line2) {
 			mptr=sim->mols->live[ll][m];
 			if(mptr->ident>0 && posincompart(sim,mptr->pos,cmpt))
 				if(ms==MSall || mptr->mstate==ms) ct[mptr->ident]++; }
-	fprintf(fptr,"%g",sim->time);
-	for(i=1;i<nspecies;i++) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+	outprintf(sim,fptr,"%g",sim->time);
+	for(i=1;i<nspecies;i++) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
@@ -684,7 +843,7 @@ enum CMDcode cmdmolcountonsurf(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(line2,"missing argument");
 	itct=sscanf(line2,"%s",nm);
 	SCMDCHECK(itct==1,"cannot read argument");
-	s=stringfind(srfss->snames,srfss->nsrf,nm);
+	s=namehashfind(&srfss->snamehash,srfss->snames,srfss->nsrf,nm);
 	SCMDCHECK(s>=0,"surface name not recognized");
 	srf=srfss->srflist[s];
 	line2=strnword(line2,2);
@@ -705,23 +864,25 @@ enum CMDcode cmdmolcountonsurf(simptr sim,cmdptr cmd,char *line2) {
 		for(m=0;m<sim->mols->nl[ll];m++) {
 			mptr=sim->mols->live[ll][m];
 			if(mptr->ident>0 && mptr->mstate!=MSsoln && mptr->pnl->srf==srf) ct[mptr->ident]++; }
-	fprintf(fptr,"%g",sim->time);
-	for(i=1;i<nspecies;i++) fprintf(fptr," %i",ct[i]);
-	fprintf(fptr,"\n");
+	outprintf(sim,fptr,"%g",sim->time);
+	for(i=1;i<nspecies;i++) outprintf(sim,fptr," %i",ct[i]);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
 enum CMDcode cmdmolcountspace(simptr sim,cmdptr cmd,char *line2) {
 	FILE *fptr;
-	int dim,i,itct,axis,nbin,ax2,d,*ct,bin,ll,lllo,llhi,nmol,m,average;
+	int dim,i,itct,axis,nbin,ax2,d,*ct,bin,average;
 	enum MolecState ms;
-	double low[DIMMAX],high[DIMMAX],scale;
-	moleculeptr *mlist,mptr;
+	double low[DIMMAX],high[DIMMAX];
+	cmdargsmolcountspaceptr args;
+	obsptr obs;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
 	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
 
 	dim=sim->dim;
+	if(cmd->v3) goto compiled;
 	SCMDCHECK(line2,"missing arguments");
 	i=readmolname(sim,line2,&ms);
 	SCMDCHECK(!(i<0 && i>-5),"cannot read molecule and/or state name")
@@ -751,44 +912,321 @@ enum CMDcode cmdmolcountspace(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(itct==1,"cannot read average number");
 	SCMDCHECK(average>=0,"illegal average value");
 	line2=strnword(line2,2);
-	fptr=scmdgetfptr(sim->cmds,line2);
+	SCMDCHECK(scmdgetfptr(sim->cmds,line2),"file name not recognized");
+
+	args=(cmdargsmolcountspaceptr) malloc(sizeof(struct cmdargsmolcountspace));	// compile arguments
+	if(!args) {cmd->i1=-1;return CMDwarn;}
+	args->i=i;
+	args->ms=ms;
+	args->axis=axis;
+	args->nbin=nbin;
+	args->average=average;
+	for(d=0;d<dim;d++) {
+		args->low[d]=low[d];
+		args->high[d]=high[d]; }
+	strncpy(args->fline,line2,STRCHAR-1);
+	args->fline[STRCHAR-1]='\0';
+	cmd->v3=args;
+	cmd->freefn=&cmdobsfree;
+
+ compiled:
+	args=(cmdargsmolcountspaceptr) cmd->v3;
+	i=args->i;
+	ms=args->ms;
+	axis=args->axis;
+	nbin=args->nbin;
+	average=args->average;
+	for(d=0;d<dim;d++) {
+		low[d]=args->low[d];
+		high[d]=args->high[d]; }
+	fptr=scmdgetfptr(sim->cmds,args->fline);
 	SCMDCHECK(fptr,"file name not recognized");
 
 	if(cmd->i1!=nbin) {														// allocate counter if required
 		cmdv1free(cmd);
 		cmd->i1=nbin;
-		cmd->freefn=&cmdv1free;
+		cmd->freefn=&cmdobsfree;
 		cmd->v1=calloc(nbin,sizeof(int));
 		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;} }
 
+	if(!cmd->v2) {																		// register observer
+		obs=obsregister(sim,cmd,OTmolcountspace,i,ms);
+		if(!obs) {cmd->i1=-1;return CMDwarn;}
+		obs->axis=axis;
+		obs->nbin=nbin;
+		for(d=0;d<dim;d++) {
+			obs->low[d]=low[d];
+			obs->high[d]=high[d]; }
+		cmd->v2=obs; }
+	obs=(obsptr)cmd->v2;
+	if(obssweep(sim,obs)) {cmd->i1=-1;return CMDwarn;}
+
 	ct=(int*)cmd->v1;
 	if(average<=1 || cmd->invoke%average==1)
 		for(bin=0;bin<nbin;bin++) ct[bin]=0;
-	scale=(double)nbin/(high[axis]-low[axis]);
-
-	if(i<0 || ms==MSall) {lllo=0;llhi=sim->mols->nlist;}
-	else llhi=1+(lllo=sim->mols->listlookup[i][ms]);
-	for(ll=lllo;ll<llhi;ll++) {
-		mlist=sim->mols->live[ll];
-		nmol=sim->mols->nl[ll];
-		for(m=0;m<nmol;m++) {
-			mptr=mlist[m];
-			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) {
-				for(d=0;d<dim;d++)
-					if(mptr->pos[d]<=low[d] || mptr->pos[d]>=high[d]) d=dim+1;
-				if(d==dim) {
-					bin=(int)floor(scale*(mptr->pos[axis]-low[axis]));
-					if(bin==nbin) bin--;
-					ct[bin]++; }}}}
+	for(bin=0;bin<nbin;bin++) ct[bin]+=obs->ct[bin];
 
 	if(average<=1) {
-		fprintf(fptr,"%g",sim->time);
-		for(bin=0;bin<nbin;bin++) fprintf(fptr," %i",ct[bin]);
-		fprintf(fptr,"\n"); }
+		outprintf(sim,fptr,"%g",sim->time);
+		for(bin=0;bin<nbin;bin++) outprintf(sim,fptr," %i",ct[bin]);
+		outprintf(sim,fptr,"\n"); }
 	else if(cmd->invoke%average==0) {
-		fprintf(fptr,"%g",sim->time);
-		for(bin=0;bin<nbin;bin++) fprintf(fptr," %g",(double)(ct[bin])/(double)average);
-		fprintf(fptr,"\n"); }
+		outprintf(sim,fptr,"%g",sim->time);
+		for(bin=0;bin<nbin;bin++) outprintf(sim,fptr," %g",(double)(ct[bin])/(double)average);
+		outprintf(sim,fptr,"\n"); }
+	return CMDok; }
+
+
+enum CMDcode cmdmolcountgrid(simptr sim,cmdptr cmd,char *line2) {
+	FILE *fptr;
+	int dim,i,itct,d,g,ngrid,average,nthreads,thread,*ct;
+	enum MolecState ms;
+	double *acc,scale;
+	char word[STRCHAR];
+	cmdargsmolcountgridptr args;
+	struct cmdargsmolcountgrid local;
+	struct gridheadstruct head;
+#ifdef THREADING
+	PARAMS_molcountgrid_threaded theParams;
+	stack *current_thread_input_stack;
+#endif
+
+	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
+	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
+	SCMDCHECK(sim->mols,"molecules are undefined");
+	dim=sim->dim;
+
+	if(!cmd->v3) {
+		SCMDCHECK(line2,"missing arguments");
+		i=readmolname(sim,line2,&ms);
+		SCMDCHECK(!(i<0 && i>-5),"cannot read molecule and/or state name");
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"missing arguments");
+		args=&local;
+		args->i=i;
+		args->ms=ms;
+		itct=sscanf(line2,"%s",word);
+		if(itct==1 && !strcmp(word,"boxes")) {						// bins are virtual boxes
+			SCMDCHECK(sim->boxs && sim->boxs->nbox>0,"boxes are not set up");
+			for(d=0;d<dim;d++) {
+				args->nbin[d]=sim->boxs->side[d];
+				args->low[d]=sim->boxs->min[d];
+				args->high[d]=sim->boxs->min[d]+sim->boxs->side[d]*sim->boxs->size[d]; }
+			line2=strnword(line2,2); }
+		else {
+			for(d=0;d<dim;d++) {
+				SCMDCHECK(line2,"missing number of bins");
+				itct=sscanf(line2,"%i",&args->nbin[d]);
+				SCMDCHECK(itct==1,"cannot read number of bins");
+				SCMDCHECK(args->nbin[d]>0,"number of bins needs to be > 0");
+				args->low[d]=sim->wlist[2*d]->pos;
+				args->high[d]=sim->wlist[2*d+1]->pos;
+				line2=strnword(line2,2); }}
+		SCMDCHECK(line2,"missing arguments");
+		itct=sscanf(line2,"%i",&args->average);
+		SCMDCHECK(itct==1,"cannot read average number");
+		SCMDCHECK(args->average>=0,"illegal average value");
+		line2=strnword(line2,2);
+		SCMDCHECK(scmdgetfptr(sim->cmds,line2),"file name not recognized");
+		strncpy(args->fline,line2,STRCHAR-1);
+		args->fline[STRCHAR-1]='\0';
+		for(d=dim;d<DIMMAX;d++) {
+			args->nbin[d]=1;
+			args->low[d]=args->high[d]=0; }
+		args=(cmdargsmolcountgridptr) malloc(sizeof(struct cmdargsmolcountgrid));	// compile arguments
+		if(!args) {cmd->i1=-1;return CMDwarn;}
+		*args=local;
+		cmd->v3=args;
+		cmd->freefn=&cmdv1v2v3free; }
+
+	args=(cmdargsmolcountgridptr) cmd->v3;
+	average=args->average;
+	fptr=scmdgetfptr(sim->cmds,args->fline);
+	SCMDCHECK(fptr,"file name not recognized");
+
+	ngrid=1;
+	for(d=0;d<dim;d++) ngrid*=args->nbin[d];
+	nthreads=1;
+#ifdef THREADING
+	if(sim->threads && sim->threads->nthreads>1) nthreads=sim->threads->nthreads;
+#endif
+
+	if(!cmd->v1) {																		// allocate accumulator and histograms
+		cmd->v1=calloc(ngrid,sizeof(double));
+		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;}
+		cmd->i1=ngrid; }
+	if(cmd->i2<nthreads*ngrid) {
+		free(cmd->v2);
+		cmd->v2=calloc(nthreads*ngrid,sizeof(int));
+		cmd->i2=cmd->v2?nthreads*ngrid:0;
+		if(!cmd->v2) {cmd->i1=-1;return CMDwarn;} }
+	acc=(double*)cmd->v1;
+	ct=(int*)cmd->v2;
+
+#ifdef THREADING
+	if(nthreads>1) {																	// per-thread histograms
+		theParams.sim=sim;
+		theParams.args=args;
+		theParams.nthreads=nthreads;
+		for(thread=0;thread<nthreads;thread++) {
+			clearthreaddata(sim->threads->thread[thread]);
+			current_thread_input_stack=sim->threads->thread[thread]->input_stack;
+			theParams.thread=thread;
+			theParams.ct=ct+thread*ngrid;
+			push_data_onto_stack(current_thread_input_stack,&theParams,sizeof(theParams));
+			pthread_create((pthread_t*) sim->threads->thread[thread]->thread_id,NULL,molcountgrid_threaded,(void*) current_thread_input_stack->stack_data); }
+		for(thread=0;thread<nthreads;thread++)
+			pthread_join(*((pthread_t*) sim->threads->thread[thread]->thread_id),NULL); }
+	else
+#endif
+	molcountgrid(sim,args,0,1,ct);
+
+	if(average<=1 || cmd->invoke%average==1)					// start of averaging period
+		for(g=0;g<ngrid;g++) acc[g]=0;
+	for(thread=0;thread<nthreads;thread++)						// reduction
+		for(g=0;g<ngrid;g++) acc[g]+=ct[thread*ngrid+g];
+
+	if(average<=1 || cmd->invoke%average==0) {
+		scale=average>1?1.0/average:1.0;
+		head.magic=GRIDMAGIC;
+		head.version=TRAJVERSION;
+		head.dim=dim;
+		head.navg=average>1?average:1;
+		for(d=0;d<DIMMAX;d++) {
+			head.nbin[d]=args->nbin[d];
+			head.low[d]=args->low[d];
+			head.high[d]=args->high[d]; }
+		head.reserved=0;
+		head.time=sim->time;
+		if(scale!=1.0)
+			for(g=0;g<ngrid;g++) acc[g]*=scale;
+		outwrite(sim,fptr,&head,sizeof(struct gridheadstruct));
+		outwrite(sim,fptr,acc,ngrid*sizeof(double)); }
+	return CMDok; }
+
+
+enum CMDcode cmdradialdist(simptr sim,cmdptr cmd,char *line2) {
+	FILE *fptr;
+	int dim,itct,d,k,nbin,average,nthreads,thread,nbox,ll,m,n1,n2,*ct;
+	enum MolecState ms;
+	double *acc,vol,r1,r2,shell,pi,g;
+	cmdargsradialdistptr args;
+	struct cmdargsradialdist local;
+#ifdef THREADING
+	int stride;
+	PARAMS_radialdist_threaded theParams;
+	stack *current_thread_input_stack;
+#endif
+
+	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
+	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
+	SCMDCHECK(sim->mols,"molecules are undefined");
+	SCMDCHECK(sim->boxs && sim->boxs->nbox>0,"boxes are not set up");
+	SCMDCHECK(sim->accur>=3,"accuracy needs to be at least 3 for box neighbors");
+	dim=sim->dim;
+
+	if(!cmd->v3) {
+		args=&local;
+		SCMDCHECK(line2,"missing arguments");
+		args->i1=readmolname(sim,line2,&ms);
+		SCMDCHECK(args->i1>0,"cannot read first molecule and/or state name; 'all' is not permitted");
+		args->ms1=ms==MSall?MSsoln:ms;
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"missing arguments");
+		args->i2=readmolname(sim,line2,&ms);
+		SCMDCHECK(args->i2>0,"cannot read second molecule and/or state name; 'all' is not permitted");
+		args->ms2=ms==MSall?MSsoln:ms;
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"missing arguments");
+		itct=sscanf(line2,"%lf %i %i",&args->rmax,&args->nbin,&args->average);
+		SCMDCHECK(itct==3,"cannot read arguments: radius bins average");
+		SCMDCHECK(args->rmax>0,"radius needs to be > 0");
+		for(d=0;d<dim;d++)
+			SCMDCHECK(args->rmax<=sim->boxs->size[d],"radius needs to be no larger than the box size");
+		SCMDCHECK(args->nbin>0,"bins value needs to be > 0");
+		SCMDCHECK(args->average>=0,"illegal average value");
+		line2=strnword(line2,4);
+		SCMDCHECK(scmdgetfptr(sim->cmds,line2),"file name not recognized");
+		strncpy(args->fline,line2,STRCHAR-1);
+		args->fline[STRCHAR-1]='\0';
+		args=(cmdargsradialdistptr) malloc(sizeof(struct cmdargsradialdist));	// compile arguments
+		if(!args) {cmd->i1=-1;return CMDwarn;}
+		*args=local;
+		cmd->v3=args;
+		cmd->freefn=&cmdv1v2v3free; }
+
+	args=(cmdargsradialdistptr) cmd->v3;
+	nbin=args->nbin;
+	average=args->average;
+	fptr=scmdgetfptr(sim->cmds,args->fline);
+	SCMDCHECK(fptr,"file name not recognized");
+
+	nbox=sim->boxs->nbox;
+	nthreads=1;
+#ifdef THREADING
+	if(sim->threads && sim->threads->nthreads>1) nthreads=sim->threads->nthreads;
+#endif
+
+	if(!cmd->v1) {																		// allocate accumulator and histograms
+		cmd->v1=calloc(nbin+1,sizeof(double));
+		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;}
+		cmd->i1=nbin+1; }
+	if(cmd->i2<nthreads*nbin) {
+		free(cmd->v2);
+		cmd->v2=calloc(nthreads*nbin,sizeof(int));
+		cmd->i2=cmd->v2?nthreads*nbin:0;
+		if(!cmd->v2) {cmd->i1=-1;return CMDwarn;} }
+	acc=(double*)cmd->v1;
+	ct=(int*)cmd->v2;
+
+#ifdef THREADING
+	if(nthreads>1) {																	// boxes are divided among threads
+		stride=calculatestride(nbox,nthreads);
+		theParams.sim=sim;
+		theParams.args=args;
+		for(thread=0;thread<nthreads;thread++) {
+			clearthreaddata(sim->threads->thread[thread]);
+			current_thread_input_stack=sim->threads->thread[thread]->input_stack;
+			theParams.b1=thread*stride<nbox?thread*stride:nbox;
+			theParams.b2=thread==nthreads-1 || (thread+1)*stride>nbox?nbox:(thread+1)*stride;
+			theParams.ct=ct+thread*nbin;
+			push_data_onto_stack(current_thread_input_stack,&theParams,sizeof(theParams));
+			pthread_create((pthread_t*) sim->threads->thread[thread]->thread_id,NULL,radialdist_threaded,(void*) current_thread_input_stack->stack_data); }
+		for(thread=0;thread<nthreads;thread++)
+			pthread_join(*((pthread_t*) sim->threads->thread[thread]->thread_id),NULL); }
+	else
+#endif
+	radialdist(sim,args,0,nbox,ct);
+
+	n1=n2=0;																					// numbers of molecules
+	ll=sim->mols->listlookup[args->i1][args->ms1];
+	for(m=0;m<sim->mols->nl[ll];m++)
+		if(sim->mols->live[ll][m]->ident==args->i1 && sim->mols->live[ll][m]->mstate==args->ms1) n1++;
+	ll=sim->mols->listlookup[args->i2][args->ms2];
+	for(m=0;m<sim->mols->nl[ll];m++)
+		if(sim->mols->live[ll][m]->ident==args->i2 && sim->mols->live[ll][m]->mstate==args->ms2) n2++;
+	vol=1;
+	for(d=0;d<dim;d++) vol*=sim->wlist[2*d+1]->pos-sim->wlist[2*d]->pos;
+
+	if(average<=1 || cmd->invoke%average==1)					// start of averaging period
+		for(k=0;k<=nbin;k++) acc[k]=0;
+	for(thread=0;thread<nthreads;thread++)						// reduction
+		for(k=0;k<nbin;k++) acc[k]+=ct[thread*nbin+k];
+	if(args->i1==args->i2 && args->ms1==args->ms2) acc[nbin]+=0.5*n1*(n1-1)/vol;	// pair density
+	else acc[nbin]+=(double)n1*n2/vol;
+
+	if(average<=1 || cmd->invoke%average==0) {
+		pi=3.14159265358979323846;
+		outprintf(sim,fptr,"%g",sim->time);
+		for(k=0;k<nbin;k++) {
+			r1=args->rmax*k/nbin;
+			r2=args->rmax*(k+1)/nbin;
+			if(dim==1) shell=2*(r2-r1);
+			else if(dim==2) shell=pi*(r2*r2-r1*r1);
+			else shell=4.0/3.0*pi*(r2*r2*r2-r1*r1*r1);
+			g=acc[nbin]>0?acc[k]/(acc[nbin]*shell):0;
+			outprintf(sim,fptr," %g",g); }
+		outprintf(sim,fptr,"\n"); }
 	return CMDok; }
 
 
@@ -808,10 +1246,10 @@ enum CMDcode cmdspeciesstreamcountheader(simptr sim,cmdptr cmd,char *line2) {
 	er=mzrGetSpeciesStreams(sim->mzrss,&speciesStreamNames,&numNames);
 	SCMDCHECK(!er,"failed to allocate temporary memory");
 
-	fprintf(fptr,"time");
+	outprintf(sim,fptr,"time");
 	for(ndx=0;ndx<numNames;ndx++)
-		fprintf(fptr," %s",speciesStreamNames[ndx]);
-	fprintf(fptr,"\n");
+		outprintf(sim,fptr," %s",speciesStreamNames[ndx]);
+	outprintf(sim,fptr,"\n");
 	mzrFreeSpeciesStreams(speciesStreamNames,numNames);
 	return CMDok;	}
 
@@ -863,17 +1301,17 @@ enum CMDcode cmdspeciesstreamcount(simptr sim,cmdptr cmd,char *line2) {
 				if(mzrIsTagNameInStream(sim->mzrss,moleculizerName,speciesStreamNames[ss]))
 					speciesStreamArray[ss]+=populationArray[i]; }
 
-	fprintf(fptr,"%g ",sim->time);
+	outprintf(sim,fptr,"%g ",sim->time);
 	for(ss=0;ss<nspecstreams;ss++)
-		fprintf(fptr," %i",speciesStreamArray[ss]);
-	fprintf(fptr,"\n");
+		outprintf(sim,fptr," %i",speciesStreamArray[ss]);
+	outprintf(sim,fptr,"\n");
 	mzrFreeSpeciesStreams(speciesStreamNames,nspecstreams);
 	return CMDok; }
 
 
 enum CMDcode cmdlistmols(simptr sim,cmdptr cmd,char *line2) {
 	int m,ll;
-	static char string[STRCHAR];
+	char string[STRCHAR];
 	moleculeptr mptr;
 	FILE *fptr;
 
@@ -885,8 +1323,8 @@ enum CMDcode cmdlistmols(simptr sim,cmdptr cmd,char *line2) {
 		for(m=0;m<sim->mols->nl[ll];m++) {
 			mptr=sim->mols->live[ll][m];
 			if(mptr->ident>0) {
-				fprintf(fptr,"%s(%s) ",sim->mols->spname[mptr->ident],molms2string(mptr->mstate,string));
-				fprintVD(fptr,mptr->pos,sim->dim); }}
+				outprintf(sim,fptr,"%s(%s) ",sim->mols->spname[mptr->ident],molms2string(mptr->mstate,string));
+				outprintVD(sim,fptr,mptr->pos,sim->dim); }}
 	return CMDok; }
 
 
@@ -903,8 +1341,8 @@ enum CMDcode cmdlistmols2(simptr sim,cmdptr cmd,char *line2) {
 		for(m=0;m<sim->mols->nl[ll];m++) {
 			mptr=sim->mols->live[ll][m];
 			if(mptr->ident>0) {
-				fprintf(fptr,"%i %i %i ",invk,mptr->ident,mptr->mstate);
-				fprintVD(fptr,mptr->pos,sim->dim); }}
+				outprintf(sim,fptr,"%i %i %i ",invk,mptr->ident,mptr->mstate);
+				outprintVD(sim,fptr,mptr->pos,sim->dim); }}
 	return CMDok; }
 
 
@@ -931,8 +1369,141 @@ enum CMDcode cmdlistmols3(simptr sim,cmdptr cmd,char *line2) {
 		for(m=0;m<nmol;m++) {
 			mptr=mlist[m];
 			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) {
-				fprintf(fptr,"%i %i %i ",invk,mptr->ident,mptr->mstate);
-				fprintVD(fptr,mptr->pos,sim->dim); }}}
+				outprintf(sim,fptr,"%i %i %i ",invk,mptr->ident,mptr->mstate);
+				outprintVD(sim,fptr,mptr->pos,sim->dim); }}}
+	return CMDok; }
+
+
+enum CMDcode cmdlistmolsbin(simptr sim,cmdptr cmd,char *line2) {
+	int i,m,ll,d,dim,lllo,llhi,nmol,ct,itct,flags,psize;
+	size_t size;
+	char prec[STRCHAR],enc[STRCHAR],*payload;
+	long long *serno,sernoprev;
+	int *ident,identprev;
+	unsigned char *mstate;
+	float *posf;
+	double *posd;
+	moleculeptr *mlist,mptr;
+	FILE *fptr;
+	enum MolecState ms;
+	struct trajheadstruct head;
+	cmdargslistmolsbinptr args;
+#ifdef HAVE_LIBZ
+	uLongf zsize;
+#endif
+
+	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
+	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
+	SCMDCHECK(sim->mols,"molecules are undefined");
+	dim=sim->dim;
+
+	if(!cmd->v3) {
+		SCMDCHECK(line2,"missing arguments");
+		i=readmolname(sim,line2,&ms);
+		SCMDCHECK(!(i<0 && i>-5),"cannot read molecule and/or state name");
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"missing arguments");
+		itct=sscanf(line2,"%s %s",prec,enc);
+		SCMDCHECK(itct==2,"cannot read precision and encoding");
+		flags=0;
+		if(!strcmp(prec,"double")) flags|=TFdouble;
+		SCMDCHECK(flags || !strcmp(prec,"float"),"precision needs to be float or double");
+		if(!strcmp(enc,"delta")) flags|=TFdelta;
+		else if(!strcmp(enc,"zlib")) flags|=TFzlib;
+		else if(!strcmp(enc,"delta_zlib")) flags|=TFdelta|TFzlib;
+		SCMDCHECK((flags&(TFdelta|TFzlib)) || !strcmp(enc,"raw"),"encoding needs to be raw, delta, zlib, or delta_zlib");
+#ifndef HAVE_LIBZ
+		SCMDCHECK(!(flags&TFzlib),"zlib compression is not available");
+#endif
+		line2=strnword(line2,3);
+		SCMDCHECK(scmdgetfptr(sim->cmds,line2),"file name not recognized");
+
+		args=(cmdargslistmolsbinptr) malloc(sizeof(struct cmdargslistmolsbin));	// compile arguments
+		if(!args) {cmd->i1=-1;return CMDwarn;}
+		args->i=i;
+		args->ms=ms;
+		args->flags=flags;
+		args->maxpayload=0;
+		args->maxzip=0;
+		strncpy(args->fline,line2,STRCHAR-1);
+		args->fline[STRCHAR-1]='\0';
+		cmd->v3=args;
+		cmd->freefn=&cmdv1v2v3free; }
+
+	args=(cmdargslistmolsbinptr) cmd->v3;
+	i=args->i;
+	ms=args->ms;
+	flags=args->flags;
+	fptr=scmdgetfptr(sim->cmds,args->fline);
+	SCMDCHECK(fptr,"file name not recognized");
+
+	if(i<0 || ms==MSall) {lllo=0;llhi=sim->mols->nlist;}
+	else llhi=1+(lllo=sim->mols->listlookup[i][ms]);
+	nmol=0;																						// count molecules
+	for(ll=lllo;ll<llhi;ll++) {
+		mlist=sim->mols->live[ll];
+		for(m=0;m<sim->mols->nl[ll];m++) {
+			mptr=mlist[m];
+			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) nmol++; }}
+
+	psize=(flags&TFdouble)?sizeof(double):sizeof(float);
+	size=(size_t)nmol*(sizeof(long long)+dim*psize+sizeof(int)+sizeof(unsigned char));
+	if(size>args->maxpayload) {												// allocate payload if required
+		free(cmd->v1);
+		cmd->v1=malloc(size);
+		args->maxpayload=cmd->v1?size:0;
+		if(!cmd->v1) {cmd->i1=-1;return CMDwarn;} }
+	payload=(char*)cmd->v1;
+	serno=(long long*)payload;
+	posf=(float*)(payload+(size_t)nmol*sizeof(long long));
+	posd=(double*)posf;
+	ident=(int*)(payload+(size_t)nmol*(sizeof(long long)+dim*psize));
+	mstate=(unsigned char*)(ident+nmol);
+
+	ct=0;																							// fill columns
+	sernoprev=0;
+	identprev=0;
+	for(ll=lllo;ll<llhi;ll++) {
+		mlist=sim->mols->live[ll];
+		for(m=0;m<sim->mols->nl[ll];m++) {
+			mptr=mlist[m];
+			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) {
+				serno[ct]=(long long)mptr->serno-sernoprev;
+				ident[ct]=mptr->ident-identprev;
+				if(flags&TFdelta) {
+					sernoprev=mptr->serno;
+					identprev=mptr->ident; }
+				mstate[ct]=(unsigned char)mptr->mstate;
+				for(d=0;d<dim;d++) {
+					if(flags&TFdouble) posd[(size_t)d*nmol+ct]=mptr->pos[d];
+					else posf[(size_t)d*nmol+ct]=(float)mptr->pos[d]; }
+				ct++; }}}
+
+	head.magic=TRAJMAGIC;
+	head.version=TRAJVERSION;
+	head.flags=flags;
+	head.dim=dim;
+	head.nmol=nmol;
+	head.reserved=0;
+	head.stored=(long long)size;
+	head.raw=(long long)size;
+	head.time=sim->time;
+
+#ifdef HAVE_LIBZ
+	if(flags&TFzlib) {																// compress payload
+		zsize=compressBound(size);
+		if((size_t)zsize>args->maxzip) {
+			free(cmd->v2);
+			cmd->v2=malloc(zsize);
+			args->maxzip=cmd->v2?(size_t)zsize:0;
+			if(!cmd->v2) {cmd->i1=-1;return CMDwarn;} }
+		SCMDCHECK(compress2((Bytef*)cmd->v2,&zsize,(Bytef*)payload,size,Z_DEFAULT_COMPRESSION)==Z_OK,"zlib compression failed");
+		payload=(char*)cmd->v2;
+		head.stored=zsize; }
+#endif
+
+	outwrite(sim,fptr,&head,sizeof(struct trajheadstruct));
+	outwrite(sim,fptr,payload,(size_t)head.stored);
 	return CMDok; }
 
 
@@ -950,7 +1521,7 @@ enum CMDcode cmdmolpos(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(fptr,"file name not recognized");
 	dim=sim->dim;
 
-	fprintf(fptr,"%g ",sim->time);
+	outprintf(sim,fptr,"%g ",sim->time);
 	if(i<0 || ms==MSall) {lllo=0;llhi=sim->mols->nlist;}
 	else llhi=1+(lllo=sim->mols->listlookup[i][ms]);
 	for(ll=lllo;ll<llhi;ll++) {
@@ -960,19 +1531,20 @@ enum CMDcode cmdmolpos(simptr sim,cmdptr cmd,char *line2) {
 			mptr=mlist[m];
 			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) {
 				for(d=0;d<dim;d++)
-					fprintf(fptr,"%g ",mptr->pos[d]); }}}
-		fprintf(fptr,"\n");
+					outprintf(sim,fptr,"%g ",mptr->pos[d]); }}}
+		outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
 enum CMDcode cmdmolmoments(simptr sim,cmdptr cmd,char *line2) {
-	int i,ll,m,ctr,dim,d,d2,nmol;
+	int i,ctr,dim,d,d2;
 	double v1[DIMMAX],m1[DIMMAX*DIMMAX];
 	FILE *fptr;
-	moleculeptr *mlist,mptr;
 	enum MolecState ms;
+	obsptr obs;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
+	SCMDCHECK(cmd->i1!=-1,"error on setup");					// failed before, don't try again
 	i=readmolname(sim,line2,&ms);
 	SCMDCHECK(i>=0,"cannot read molecule and/or state name; 'all' is not permitted");
 	if(ms==MSall) ms=MSsoln;
@@ -981,30 +1553,25 @@ enum CMDcode cmdmolmoments(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(fptr,"file name not recognized");
 	dim=sim->dim;
 
-	ll=sim->mols->listlookup[i][ms];
-	mlist=sim->mols->live[ll];
-	nmol=sim->mols->nl[ll];
-	ctr=0;
-	for(d=0;d<dim;d++) v1[d]=0;
-	for(d=0;d<dim*dim;d++) m1[d]=0;
-	for(m=0;m<nmol;m++) {
-		mptr=mlist[m];
-		if(mptr->ident==i && mptr->mstate==ms) {
-			ctr++;
-			for(d=0;d<dim;d++) v1[d]+=mlist[m]->pos[d]; }}
-	for(d=0;d<dim;d++) v1[d]/=1.0*ctr;
-	for(m=0;m<nmol;m++) {
-		mptr=mlist[m];
-		if(mptr->ident==i && mptr->mstate==ms) {
-			for(d=0;d<dim;d++)
-				for(d2=0;d2<dim;d2++)
-					m1[d*dim+d2]+=(mlist[m]->pos[d]-v1[d])*(mlist[m]->pos[d2]-v1[d2]); }}
-	fprintf(fptr,"%g %i",sim->time,ctr);
-	for(d=0;d<dim;d++) fprintf(fptr," %g",v1[d]);
+	if(!cmd->v2) {																		// register observer
+		obs=obsregister(sim,cmd,OTmolmoments,i,ms);
+		if(!obs) {cmd->i1=-1;return CMDwarn;}
+		cmd->v2=obs;
+		cmd->freefn=&cmdobsfree; }
+	obs=(obsptr)cmd->v2;
+	if(obssweep(sim,obs)) {cmd->i1=-1;return CMDwarn;}
+
+	ctr=obs->nmom;																		// mean and covariance from sums
+	for(d=0;d<dim;d++) v1[d]=obs->ref[d]+obs->sum[d]/ctr;
 	for(d=0;d<dim;d++)
 		for(d2=0;d2<dim;d2++)
-			fprintf(fptr," %g",m1[d*dim+d2]/ctr);
-	fprintf(fptr,"\n");
+			m1[d*dim+d2]=obs->sum2[d*dim+d2]-obs->sum[d]*obs->sum[d2]/ctr;
+	outprintf(sim,fptr,"%g %i",sim->time,ctr);
+	for(d=0;d<dim;d++) outprintf(sim,fptr," %g",v1[d]);
+	for(d=0;d<dim;d++)
+		for(d2=0;d2<dim;d2++)
+			outprintf(sim,fptr," %g",m1[d*dim+d2]/ctr);
+	outprintf(sim,fptr,"\n");
 	return CMDok; }
 
 
@@ -1015,6 +1582,7 @@ enum CMDcode cmdsavesim(simptr sim,cmdptr cmd,char *line2) {
 	fptr=scmdgetfptr(sim->cmds,line2);
 	SCMDCHECK(fptr,"file name not recognized");
 	if(line2) strcutwhite(line2,2);
+	outflush(sim);
 
 	fprintf(fptr,"# Configuration file automatically created by Smoldyn\n\n");
 	writesim(sim,fptr);
@@ -1033,39 +1601,63 @@ enum CMDcode cmdsavesim(simptr sim,cmdptr cmd,char *line2) {
 
 void cmdmeansqrdispfree(cmdptr cmd) {
 	int j;
+	cmdargsmeansqrdispptr args;
 
+	args=(cmdargsmeansqrdispptr) cmd->v3;
+	if(args && cmd->v1)																// release tracking slots
+		for(j=0;j<cmd->i1;j++)
+			moluntrack(args->mols,(int)((long int*)cmd->v1)[j]);
 	if(cmd->v2 && cmd->i1)
 		for(j=0;j<cmd->i1;j++)
 			free(((double**)(cmd->v2))[j]);
 	if(cmd->v2) free(cmd->v2);
 	if(cmd->v1) free(cmd->v1);
+	if(cmd->v3) free(cmd->v3);
 	return; }
 
 
 enum CMDcode cmdmeansqrdisp(simptr sim,cmdptr cmd,char *line2) {
-	static char dimstr[STRCHAR];
-	int i,j,d,itct,ll,dim,ctr,m,msddim,nmol;
+	char dimstr[STRCHAR];
+	int i,j,d,itct,ll,dim,ctr,m,msddim,nmol,t;
 	FILE *fptr;
-	moleculeptr *mlist;
+	moleculeptr *mlist,mptr;
 	double r2,sum,sum4,diff,*pos,**v2;
 	long int *v1;
 	enum MolecState ms;
+	cmdargsmeansqrdispptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
-	i=readmolname(sim,line2,&ms);
-	SCMDCHECK(i>=0,"cannot read molecule and/or state name; 'all' is not permitted");
-	if(ms==MSall) ms=MSsoln;
-	line2=strnword(line2,2);
-	SCMDCHECK(line2,"missing dimension information");
-	itct=sscanf(line2,"%s",dimstr);
-	SCMDCHECK(itct==1,"cannot read dimension information");
-	if(!strcmp(dimstr,"all")) msddim=-1;
-	else {
-		itct=sscanf(dimstr,"%i",&msddim);
-		SCMDCHECK(itct==1,"cannot read dimension");
-		SCMDCHECK(msddim>=0 && msddim<sim->dim,"dimension out of range"); }
-	line2=strnword(line2,2);
-	fptr=scmdgetfptr(sim->cmds,line2);
+	if(!cmd->v3) {																// compile arguments on first call
+		i=readmolname(sim,line2,&ms);
+		SCMDCHECK(i>=0,"cannot read molecule and/or state name; 'all' is not permitted");
+		if(ms==MSall) ms=MSsoln;
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"missing dimension information");
+		itct=sscanf(line2,"%s",dimstr);
+		SCMDCHECK(itct==1,"cannot read dimension information");
+		if(!strcmp(dimstr,"all")) msddim=-1;
+		else {
+			itct=sscanf(dimstr,"%i",&msddim);
+			SCMDCHECK(itct==1,"cannot read dimension");
+			SCMDCHECK(msddim>=0 && msddim<sim->dim,"dimension out of range"); }
+		line2=strnword(line2,2);
+		SCMDCHECK(scmdgetfptr(sim->cmds,line2),"file name not recognized");
+		args=(cmdargsmeansqrdispptr) malloc(sizeof(struct cmdargsmeansqrdisp));
+		if(!args) {cmd->i2=2;return CMDwarn;}
+		args->i=i;
+		args->ms=ms;
+		args->msddim=msddim;
+		strncpy(args->fline,line2,STRCHAR-1);
+		args->fline[STRCHAR-1]='\0';
+		args->mols=sim->mols;
+		cmd->v3=args;
+		cmd->freefn=&cmdmeansqrdispfree; }
+
+	args=(cmdargsmeansqrdispptr) cmd->v3;
+	i=args->i;
+	ms=args->ms;
+	msddim=args->msddim;
+	fptr=scmdgetfptr(sim->cmds,args->fline);
 	SCMDCHECK(fptr,"file name not recognized");
 
 	SCMDCHECK(cmd->i2!=2,"error on setup");					// failed before, don't try again
@@ -1083,9 +1675,9 @@ enum CMDcode cmdmeansqrdisp(simptr sim,cmdptr cmd,char *line2) {
 		cmd->i1=ctr;										// size of arrays
 		SCMDCHECK(ctr>0,"no molecules to track");
 		cmd->freefn=&cmdmeansqrdispfree;
-		cmd->v1=calloc(ctr,sizeof(long int));	// v1 is serial numbers
+		cmd->v1=calloc(ctr,sizeof(long int));	// v1 is tracking slots
 		if(!cmd->v1) {cmd->i2=2;return CMDwarn;}
-		for(j=0;j<ctr;j++) ((long int*)cmd->v1)[j]=0;
+		for(j=0;j<ctr;j++) ((long int*)cmd->v1)[j]=-1;
 		cmd->v2=calloc(ctr,sizeof(double**));	// v2 is positions
 		if(!cmd->v2) {cmd->i2=2;return CMDwarn;}
 		for(j=0;j<ctr;j++) ((double**)cmd->v2)[j]=NULL;
@@ -1096,49 +1688,50 @@ enum CMDcode cmdmeansqrdisp(simptr sim,cmdptr cmd,char *line2) {
 		ctr=0;
 		for(m=0;m<nmol;m++) {
 			if(mlist[m]->ident==i && mlist[m]->mstate==ms) {
-				((long int*)cmd->v1)[ctr]=mlist[m]->serno;
+				t=moltrack(sim->mols,mlist[m]);
+				if(t<0) {cmd->i2=2;return CMDwarn;}
+				((long int*)cmd->v1)[ctr]=t;
 				for(d=0;d<dim;d++)
 					((double**)cmd->v2)[ctr][d]=mlist[m]->posoffset[d]+mlist[m]->pos[d];
-				ctr++; }}
-		sortVliv((long int*)cmd->v1,cmd->v2,cmd->i1); }
+				ctr++; }}}
 
 	ctr=0;														// start of code that is run every invokation
 	sum=0;
 	sum4=0;
 	v1=(long int*)cmd->v1;
 	v2=(double**)cmd->v2;
-	for(m=0;m<nmol;m++)
-		if(mlist[m]->ident==i && mlist[m]->mstate==ms) {
-			j=locateVli(v1,mlist[m]->serno,cmd->i1);
-			if(j>=0) {
-				pos=mlist[m]->pos;
-				ctr++;
-				if(msddim<0) {
-					r2=0;
-					for(d=0;d<dim;d++) {
-						diff=mlist[m]->posoffset[d]+pos[d]-v2[j][d];
-						r2+=diff*diff; }
-					sum+=r2;
-					sum4+=r2*r2; }
-				else {
-					diff=mlist[m]->posoffset[msddim]+pos[msddim]-v2[j][msddim];
-					sum+=diff*diff;
-					sum4+=diff*diff*diff*diff; }}}
-	fprintf(fptr,"%g %g %g\n",sim->time,sum/ctr,sum4/ctr);
+	for(j=0;j<cmd->i1;j++) {					// only visit tracked molecules
+		mptr=moltracked(sim->mols,(int)v1[j]);
+		if(mptr && mptr->ident==i && mptr->mstate==ms) {
+			pos=mptr->pos;
+			ctr++;
+			if(msddim<0) {
+				r2=0;
+				for(d=0;d<dim;d++) {
+					diff=mptr->posoffset[d]+pos[d]-v2[j][d];
+					r2+=diff*diff; }
+				sum+=r2;
+				sum4+=r2*r2; }
+			else {
+				diff=mptr->posoffset[msddim]+pos[msddim]-v2[j][msddim];
+				sum+=diff*diff;
+				sum4+=diff*diff*diff*diff; }}}
+	outprintf(sim,fptr,"%g %g %g\n",sim->time,sum/ctr,sum4/ctr);
 
 	return CMDok; }
 
 
 enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
-	static char dimstr[STRCHAR];
-	int i,j,d,itct,ll,dim,ctr,m,msddim,nmol,maxmoment,maxmol,mom;
+	char dimstr[STRCHAR];
+	int i,j,d,itct,ll,dim,ctr,m,msddim,nmol,maxmoment,maxmol,mom,t,nsorted;
 	FILE *fptr;
-	moleculeptr *mlist;
-	static double sum[17];
+	moleculeptr *mlist,mptr;
+	double sum[17];
 	double r2,diff,**v2,*dblptr;
 	long int *v1;
 	enum MolecState ms;
 	char startchar,reportchar;
+	cmdargsmeansqrdispptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
 	i=readmolname(sim,line2,&ms);
@@ -1176,10 +1769,18 @@ enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
 		cmd->i1=maxmol;
 		cmd->i3=0;
 		cmd->freefn=&cmdmeansqrdispfree;
-		cmd->v1=calloc(maxmol,sizeof(long int));	// v1 is serial numbers
+		args=(cmdargsmeansqrdispptr) malloc(sizeof(struct cmdargsmeansqrdisp));	// v3 is for tracking slots
+		if(!args) {cmd->i2=2;return CMDwarn;}
+		args->i=i;
+		args->ms=ms;
+		args->msddim=msddim;
+		args->fline[0]='\0';
+		args->mols=sim->mols;
+		cmd->v3=args;
+		cmd->v1=calloc(maxmol,sizeof(long int));	// v1 is tracking slots
 		if(!cmd->v1) {cmd->i2=2;return CMDwarn;}
 		v1=(long int*)cmd->v1;
-		for(j=0;j<maxmol;j++) v1[j]=0;
+		for(j=0;j<maxmol;j++) v1[j]=-1;
 		cmd->v2=calloc(maxmol,sizeof(double**));	// v2 is positions
 		if(!cmd->v2) {cmd->i2=2;return CMDwarn;}
 		v2=(double**)cmd->v2;
@@ -1192,7 +1793,9 @@ enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
 		for(m=0;m<nmol;m++) {
 			if(mlist[m]->ident==i && mlist[m]->mstate==ms) {
 				SCMDCHECK(ctr<maxmol,"insufficient allocated space");
-				v1[ctr]=mlist[m]->serno;
+				t=moltrack(sim->mols,mlist[m]);
+				if(t<0) {cmd->i2=2;return CMDwarn;}
+				v1[ctr]=t;
 				if(startchar=='c') v2[ctr][0]=0;
 				else v2[ctr][0]=2.0;
 				for(d=0;d<dim;d++)
@@ -1204,23 +1807,28 @@ enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
 	v1=(long int*)cmd->v1;						// start of code that is run every invokation
 	v2=(double**)cmd->v2;
 
-	for(m=0;m<nmol;m++) {							// update tracking information for all tracked molecules
-		if(mlist[m]->ident==i && mlist[m]->mstate==ms) {
-			j=locateVli(v1,mlist[m]->serno,cmd->i3);
-			if(j>=0) {										// molecule was found
-				v2[j][0]+=1.0;
-				if(v2[j][0]==3.0) {					// molecule is being tracked and exists, so record current positions
-					for(d=0;d<dim;d++)
-						v2[j][dim+1+d]=mlist[m]->posoffset[d]+mlist[m]->pos[d]; }}
-			else if(startchar!='i') {			// molecule was not found but should be tracked
+	for(j=0;j<cmd->i3;j++) {					// update tracking information for all tracked molecules
+		mptr=moltracked(sim->mols,(int)v1[j]);
+		if(mptr && mptr->ident==i && mptr->mstate==ms) {	// molecule was found
+			v2[j][0]+=1.0;
+			if(v2[j][0]==3.0) {						// molecule is being tracked and exists, so record current positions
+				for(d=0;d<dim;d++)
+					v2[j][dim+1+d]=mptr->posoffset[d]+mptr->pos[d]; }}}
+
+	if(startchar!='i') {							// look for molecules that should be tracked
+		nsorted=cmd->i3;
+		for(m=0;m<nmol;m++) {
+			mptr=mlist[m];
+			if(mptr->ident==i && mptr->mstate==ms && (mptr->track<0 || locateVli(v1,mptr->track,nsorted)<0)) {
 				if(cmd->i3==cmd->i1) SCMDCHECK(0,"not enough allocated space");
-				j=cmd->i3++;					// find empty spot
-				v1[j]=mlist[m]->serno;
+				t=moltrack(sim->mols,mptr);
+				if(t<0) {cmd->i2=2;return CMDwarn;}
+				j=cmd->i3++;				// find empty spot
+				v1[j]=t;
 				v2[j][0]=3.0;
 				for(d=0;d<dim;d++)
-					v2[j][1+d]=v2[j][dim+1+d]=mlist[m]->posoffset[d]+mlist[m]->pos[d]; }}}
-	if(startchar!='i')								// resort lists if appropriate
-		if(cmd->i3>0) sortVliv(v1,cmd->v2,cmd->i3);
+					v2[j][1+d]=v2[j][dim+1+d]=mptr->posoffset[d]+mptr->pos[d]; }}
+		if(cmd->i3>0) sortVliv(v1,cmd->v2,cmd->i3); }	// resort lists
 
 	for(mom=0;mom<=maxmoment;mom++)
 		sum[mom]=0;
@@ -1240,15 +1848,16 @@ enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
 					sum[mom]+=pow(diff,mom); }}}
 
 	if(sum[0]>0) {
-		fprintf(fptr,"%g %g",sim->time,sum[0]);					// display results
+		outprintf(sim,fptr,"%g %g",sim->time,sum[0]);					// display results
 		for(mom=1;mom<=maxmoment;mom++) {
-			fprintf(fptr," %g",sum[mom]/sum[0]); }
-		fprintf(fptr,"\n"); }
+			outprintf(sim,fptr," %g",sum[mom]/sum[0]); }
+		outprintf(sim,fptr,"\n"); }
 
 	for(j=0;j<cmd->i3;j++) {							// stop tracking expired molecules
 		if(v2[j][0]==0 || v2[j][0]==2.0) {
+			moluntrack(sim->mols,(int)v1[j]);
 			v1[j]=v1[cmd->i3-1];
-			v1[cmd->i3-1]=0;
+			v1[cmd->i3-1]=-1;
 			dblptr=v2[j];
 			v2[j]=v2[cmd->i3-1];
 			v2[cmd->i3-1]=dblptr;
@@ -1264,7 +1873,7 @@ enum CMDcode cmdmeansqrdisp2(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmddiagnostics(simptr sim,cmdptr cmd,char *line2) {
 	int itct,order;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	enum SmolStruct ss;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDobserve;
@@ -1289,6 +1898,58 @@ enum CMDcode cmddiagnostics(simptr sim,cmdptr cmd,char *line2) {
 	return CMDok; }
 
 
+/* cmdsnapshot.  Runs the observation command in line2 in a child process that
+is created with fork, so the child sees a copy-on-write snapshot of the
+simulation while the parent continues with the simulation.  If the maximum
+number of snapshot processes are already running, this waits for the oldest one
+to finish.  Changes that the command makes to its own state, such as averages or
+tracked molecules, are lost with the child, so snapshot is only useful for
+commands that just write output, such as savesim or listmols.  Without fork, or
+if the maximum is 0, the command runs in place. */
+enum CMDcode cmdsnapshot(simptr sim,cmdptr cmd,char *line2) {
+	char string[STRCHAR],*strptr;
+	enum CMDcode ans;
+	snapssptr snapss;
+#ifndef _WIN32
+	pid_t pid;
+#endif
+
+	if(line2 && !strcmp(line2,"cmdtype")) return conditionalcmdtype(sim,cmd,0);
+	SCMDCHECK(line2,"missing command");
+	strcpy(string,line2);
+	strptr=cmd->str;
+	cmd->str=string;
+	ans=scmdcmdtype(sim->cmds,cmd);
+	cmd->str=strptr;
+	SCMDCHECK(ans==CMDobserve,"snapshot can only run observation commands");
+	if(!sim->snapss) {
+		sim->snapss=snapssalloc(SNAPMAX);
+		SCMDCHECK(sim->snapss,"out of memory"); }
+	snapss=sim->snapss;
+	if(!snapss->maxsnap) return docommand(sim,cmd,line2);
+
+#ifdef _WIN32
+	return docommand(sim,cmd,line2);
+#else
+	snapwait(sim,snapss->maxsnap-1);
+	outflush(sim);																// child can't use the writer thread
+	fflush(NULL);																	// or duplicate stdio buffers
+	pid=fork();
+	if(pid<0) return docommand(sim,cmd,line2);
+	if(pid==0) {
+		if(sim->outss) sim->outss->maxqueue=0;
+		snapss->nsnap=0;
+		snapss->maxsnap=0;
+		ans=docommand(sim,cmd,line2);
+		if(ans==CMDwarn) fprintf(stderr,"snapshot error: %s\n",cmd->erstr);
+		fflush(NULL);
+		_exit(ans==CMDwarn?1:0); }
+	snapss->pid[snapss->nsnap++]=(int)pid;
+	return CMDok;
+#endif
+	}
+
+
 /**********************************************************/
 /****************** system manipulation ********************/
 /**********************************************************/
@@ -1311,7 +1972,7 @@ enum CMDcode cmdset(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdpointsource(simptr sim,cmdptr cmd,char *line2) {
 	int itct,num,i;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	double pos[DIMMAX];
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
@@ -1320,7 +1981,7 @@ enum CMDcode cmdpointsource(simptr sim,cmdptr cmd,char *line2) {
 	itct=sscanf(line2,"%s %i",nm,&num);
 	SCMDCHECK(itct==2,"read failure");
 	SCMDCHECK(num>=0,"number cannot be negative");
-	i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+	i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 	SCMDCHECK(i>=1,"name not recognized");
 	line2=strnword(line2,3);
 	SCMDCHECK(line2,"missing location");
@@ -1332,7 +1993,7 @@ enum CMDcode cmdpointsource(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdvolumesource(simptr sim,cmdptr cmd,char *line2) {
 	int itct,num,i,d;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	double poslo[DIMMAX],poshi[DIMMAX];
 	
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
@@ -1341,7 +2002,7 @@ enum CMDcode cmdvolumesource(simptr sim,cmdptr cmd,char *line2) {
 	itct=sscanf(line2,"%s %i",nm,&num);
 	SCMDCHECK(itct==2,"read failure");
 	SCMDCHECK(num>=0,"number cannot be negative");
-	i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+	i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 	SCMDCHECK(i>=1,"name not recognized");
 	line2=strnword(line2,3);
 	SCMDCHECK(line2,"missing location");
@@ -1356,7 +2017,7 @@ enum CMDcode cmdvolumesource(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdmovesurfacemol(simptr sim,cmdptr cmd,char *line2) {
 	int itct,i1,s1,s2,p1,p2,ll,lllo,llhi,m,d,nmol;
-	static char nm[STRCHAR],nm2[STRCHAR];
+	char nm[STRCHAR],nm2[STRCHAR];
 	double prob;
 	enum MolecState ms1,ms2;
 	enum PanelShape ps1,ps2;
@@ -1466,7 +2127,7 @@ enum CMDcode cmdkillmolprob(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdkillmolinsphere(simptr sim,cmdptr cmd,char *line2) {
 	int itct,i,s,ll,m,lllo,llhi,nmol;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	moleculeptr *mlist,mptr;
 	enum MolecState ms;
 
@@ -1480,7 +2141,7 @@ enum CMDcode cmdkillmolinsphere(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(itct==1,"cannot read surface name");
 	if(!strcmp(nm,"all")) s=-1;
 	else {
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		SCMDCHECK(s>=0,"surface not recognized"); }
 
 	if(i<0 || ms==MSall) {lllo=0;llhi=sim->mols->nlist;}
@@ -1497,7 +2158,7 @@ enum CMDcode cmdkillmolinsphere(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdkillmolincmpt(simptr sim,cmdptr cmd,char *line2) {
 	int itct,i,ll,m,c;
-	static char cname[STRCHAR];
+	char cname[STRCHAR];
 	moleculeptr mptr;
 	enum MolecState ms;
 	compartssptr cmptss;
@@ -1560,17 +2221,32 @@ enum CMDcode cmdkillmoloutsidesystem(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdfixmolcount(simptr sim,cmdptr cmd,char *line2) {
 	int itct,num,i,ll,m,ct,numl;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	double pos1[DIMMAX],pos2[DIMMAX];
+	cmdargsfixmolcountptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
-	SCMDCHECK(line2,"missing argument");
-	SCMDCHECK(sim->mols,"molecules are undefined");
-	itct=sscanf(line2,"%s %i",nm,&num);
-	SCMDCHECK(itct==2,"read failure");
-	SCMDCHECK(num>=0,"number cannot be negative");
-	i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
-	SCMDCHECK(i>=1,"name not recognized");
+	if(!cmd->v3) {																// compile arguments on first call
+		SCMDCHECK(line2,"missing argument");
+		SCMDCHECK(sim->mols,"molecules are undefined");
+		itct=sscanf(line2,"%s %i",nm,&num);
+		SCMDCHECK(itct==2,"read failure");
+		SCMDCHECK(num>=0,"number cannot be negative");
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
+		SCMDCHECK(i>=1,"name not recognized");
+		args=(cmdargsfixmolcountptr) malloc(sizeof(struct cmdargsfixmolcount));
+		SCMDCHECK(args,"out of memory");
+		args->i=i;
+		args->ms=MSsoln;
+		args->num=num;
+		args->s=-1;
+		args->cmpt=NULL;
+		cmd->v3=args;
+		cmd->freefn=&cmdv3free; }
+
+	args=(cmdargsfixmolcountptr) cmd->v3;
+	i=args->i;
+	num=args->num;
 
 	ll=sim->mols->listlookup[i][MSsoln];
 	numl=sim->mols->nl[ll];
@@ -1594,24 +2270,41 @@ enum CMDcode cmdfixmolcount(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdfixmolcountonsurf(simptr sim,cmdptr cmd,char *line2) {
 	int itct,num,i,ll,m,ct,numl,s;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	enum MolecState ms;
 	surfaceptr sptr;
 	moleculeptr mptr;
+	cmdargsfixmolcountptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
-	SCMDCHECK(line2,"missing argument");
-	i=readmolname(sim,line2,&ms);
-	SCMDCHECK(i>0,"failed to read molecule name or state");
-	SCMDCHECK(ms!=MSsoln && ms!=MSbsoln,"molecule state needs to be surface-bound");
-	line2=strnword(line2,2);
-	SCMDCHECK(line2,"fixmolcountonsurf format: species(state) number surface");
-	itct=sscanf(line2,"%i %s",&num,nm);
-	SCMDCHECK(itct==2,"read failure");
-	SCMDCHECK(num>=0,"number cannot be negative");
-	SCMDCHECK(sim->srfss,"no surfaces defined");
-	s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
-	SCMDCHECK(s>=0,"surface not recognized");
+	if(!cmd->v3) {																// compile arguments on first call
+		SCMDCHECK(line2,"missing argument");
+		i=readmolname(sim,line2,&ms);
+		SCMDCHECK(i>0,"failed to read molecule name or state");
+		SCMDCHECK(ms!=MSsoln && ms!=MSbsoln,"molecule state needs to be surface-bound");
+		line2=strnword(line2,2);
+		SCMDCHECK(line2,"fixmolcountonsurf format: species(state) number surface");
+		itct=sscanf(line2,"%i %s",&num,nm);
+		SCMDCHECK(itct==2,"read failure");
+		SCMDCHECK(num>=0,"number cannot be negative");
+		SCMDCHECK(sim->srfss,"no surfaces defined");
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
+		SCMDCHECK(s>=0,"surface not recognized");
+		args=(cmdargsfixmolcountptr) malloc(sizeof(struct cmdargsfixmolcount));
+		SCMDCHECK(args,"out of memory");
+		args->i=i;
+		args->ms=ms;
+		args->num=num;
+		args->s=s;
+		args->cmpt=NULL;
+		cmd->v3=args;
+		cmd->freefn=&cmdv3free; }
+
+	args=(cmdargsfixmolcountptr) cmd->v3;
+	i=args->i;
+	ms=args->ms;
+	num=args->num;
+	s=args->s;
 	sptr=sim->srfss->srflist[s];
 
 	ll=sim->mols->listlookup[i][ms];
@@ -1639,25 +2332,40 @@ enum CMDcode cmdfixmolcountonsurf(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdfixmolcountincmpt(simptr sim,cmdptr cmd,char *line2) {
 	int itct,num,i,ll,m,ct,numl,c;
-	static char nm[STRCHAR];
+	char nm[STRCHAR];
 	moleculeptr mptr;
 	compartptr cmpt;
+	cmdargsfixmolcountptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
-	SCMDCHECK(line2,"missing argument");
-	SCMDCHECK(sim->mols,"molecules are undefined");
-	SCMDCHECK(sim->cmptss,"compartments are undefined");
-	itct=sscanf(line2,"%s %i",nm,&num);
-	SCMDCHECK(itct==2,"read failure");
-	SCMDCHECK(num>=0,"number cannot be negative");
-	i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
-	SCMDCHECK(i>=1,"molecule name not recognized");
-	line2=strnword(line2,3);
-	SCMDCHECK(line2,"compartment name missing");
-	itct=sscanf(line2,"%s",nm);
-	c=stringfind(sim->cmptss->cnames,sim->cmptss->ncmpt,nm);
-	SCMDCHECK(c>=0,"compartment not recognized");
-	cmpt=sim->cmptss->cmptlist[c];
+	if(!cmd->v3) {																// compile arguments on first call
+		SCMDCHECK(line2,"missing argument");
+		SCMDCHECK(sim->mols,"molecules are undefined");
+		SCMDCHECK(sim->cmptss,"compartments are undefined");
+		itct=sscanf(line2,"%s %i",nm,&num);
+		SCMDCHECK(itct==2,"read failure");
+		SCMDCHECK(num>=0,"number cannot be negative");
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
+		SCMDCHECK(i>=1,"molecule name not recognized");
+		line2=strnword(line2,3);
+		SCMDCHECK(line2,"compartment name missing");
+		itct=sscanf(line2,"%s",nm);
+		c=stringfind(sim->cmptss->cnames,sim->cmptss->ncmpt,nm);
+		SCMDCHECK(c>=0,"compartment not recognized");
+		args=(cmdargsfixmolcountptr) malloc(sizeof(struct cmdargsfixmolcount));
+		SCMDCHECK(args,"out of memory");
+		args->i=i;
+		args->ms=MSsoln;
+		args->num=num;
+		args->s=-1;
+		args->cmpt=sim->cmptss->cmptlist[c];
+		cmd->v3=args;
+		cmd->freefn=&cmdv3free; }
+
+	args=(cmdargsfixmolcountptr) cmd->v3;
+	i=args->i;
+	num=args->num;
+	cmpt=args->cmpt;
 
 	ll=sim->mols->listlookup[i][MSsoln];
 	numl=sim->mols->nl[ll];
@@ -1870,7 +2578,7 @@ enum CMDcode cmdmodulatemol(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdreact1(simptr sim,cmdptr cmd,char *line2) {
 	int itct,i,ll,m,r,nmol,lllo,llhi;
-	static char rnm[STRCHAR];
+	char rnm[STRCHAR];
 	moleculeptr *mlist,mptr;
 	enum MolecState ms;
 
@@ -1882,7 +2590,7 @@ enum CMDcode cmdreact1(simptr sim,cmdptr cmd,char *line2) {
 	itct=sscanf(line2,"%s",rnm);
 	SCMDCHECK(itct==1,"cannot read reaction name");
 	SCMDCHECK(sim->rxnss[1],"no first order reactions defined");
-	r=stringfind(sim->rxnss[1]->rname,sim->rxnss[1]->totrxn,rnm);
+	r=namehashfind(&sim->rxnss[1]->rnamehash,sim->rxnss[1]->rname,sim->rxnss[1]->totrxn,rnm);
 	SCMDCHECK(r>=0,"reaction not recognized");
 
 	if(i<0) {lllo=0;llhi=sim->mols->nlist;}
@@ -1899,7 +2607,7 @@ enum CMDcode cmdreact1(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdsetrateint(simptr sim,cmdptr cmd,char *line2) {
 	int itct,r,order, i, j;
-	static char rnm[STRCHAR];
+	char rnm[STRCHAR];
 	double rateint;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
@@ -1907,13 +2615,13 @@ enum CMDcode cmdsetrateint(simptr sim,cmdptr cmd,char *line2) {
 	itct=sscanf(line2,"%s %lg",rnm,&rateint);
 	SCMDCHECK(itct==2,"read failure");
 	r=-1;
-	if(sim->rxnss[0]) r=stringfind(sim->rxnss[0]->rname,sim->rxnss[0]->totrxn,rnm);
+	if(sim->rxnss[0]) r=namehashfind(&sim->rxnss[0]->rnamehash,sim->rxnss[0]->rname,sim->rxnss[0]->totrxn,rnm);
 	if(r>=0) order=0;
 	else {
-		if(sim->rxnss[1]) r=stringfind(sim->rxnss[1]->rname,sim->rxnss[1]->totrxn,rnm);
+		if(sim->rxnss[1]) r=namehashfind(&sim->rxnss[1]->rnamehash,sim->rxnss[1]->rname,sim->rxnss[1]->totrxn,rnm);
 		if(r>=0) order=1;
 		else {
-			if(sim->rxnss[2]) r=stringfind(sim->rxnss[2]->rname,sim->rxnss[2]->totrxn,rnm);
+			if(sim->rxnss[2]) r=namehashfind(&sim->rxnss[2]->rnamehash,sim->rxnss[2]->rname,sim->rxnss[2]->totrxn,rnm);
 			if(r>=0) order=2;
 			else SCMDCHECK(0,"reaction name not recognized"); }}
 	SCMDCHECK(rateint>=0,"internal rate cannot be negative");
@@ -1923,6 +2631,7 @@ enum CMDcode cmdsetrateint(simptr sim,cmdptr cmd,char *line2) {
 	      //@Christine: changed to  lookup table for bindrad , setting default bindrad 
 	    else sim->rxnss[order]->rxn[r]->bindrad2[i][j]=rateint*rateint;
 	  }}
+	rxnupdatemollist(sim,order,r);
 	 return CMDok; }
 
 
@@ -1943,10 +2652,10 @@ enum CMDcode cmdsetsurfcoeff(simptr sim,cmdptr cmd,char *line2) {
 	SCMDCHECK(line2,"missing argument");
 	itct=sscanf(line2,"%s %s %s %s %lg",nm,molname,ms1string,ms2string,&rate);	
 	SCMDCHECK(itct==5,"read failure");
-	s=stringfind(srfss->snames,srfss->nsrf,nm);	
+	s=namehashfind(&srfss->snamehash,srfss->snames,srfss->nsrf,nm);	
 	SCMDCHECK(s>=0,"surface name not recognized");
 	srf=srfss->srflist[s];	
-	i=stringfind(sim->mols->spname,sim->mols->nspecies,molname);
+	i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,molname);
 	SCMDCHECK(i>=0,"molecule name not recognized");
 	ms1=molstring2ms(ms1string);
 	ms2=molstring2ms(ms2string);
@@ -1998,19 +2707,34 @@ enum CMDcode cmdporttransport(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdexcludebox(simptr sim,cmdptr cmd,char *line2) {
 	int m,itct,dim,d,b,b1,b2;
-	double *pos,poslo[DIMMAX],poshi[DIMMAX];
+	double *pos,*poslo,*poshi,lo[DIMMAX],hi[DIMMAX];
 	boxptr bptr1,bptr2,bptr;
 	boxssptr boxs;
 	moleculeptr *mlist;
+	cmdargsexcludeptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
 	dim=sim->dim;
 	boxs=sim->boxs;
-	for(d=0;d<dim;d++) {
-		SCMDCHECK(line2,"missing argument");
-		itct=sscanf(line2,"%lg %lg",&poslo[d],&poshi[d]);
-		SCMDCHECK(itct==2,"read failure");
-		line2=strnword(line2,3); }
+	if(!cmd->v3) {																// compile arguments on first call
+		for(d=0;d<dim;d++) {
+			SCMDCHECK(line2,"missing argument");
+			itct=sscanf(line2,"%lg %lg",&lo[d],&hi[d]);
+			SCMDCHECK(itct==2,"read failure");
+			line2=strnword(line2,3); }
+		args=(cmdargsexcludeptr) malloc(sizeof(struct cmdargsexclude));
+		SCMDCHECK(args,"out of memory");
+		for(d=0;d<dim;d++) {
+			args->poslo[d]=lo[d];
+			args->poshi[d]=hi[d];
+			args->poscent[d]=0.5*(lo[d]+hi[d]); }
+		args->rad2=0;
+		cmd->v3=args;
+		cmd->freefn=&cmdv3free; }
+
+	args=(cmdargsexcludeptr) cmd->v3;
+	poslo=args->poslo;
+	poshi=args->poshi;
 
 	bptr1=pos2box(sim,poslo);
 	bptr2=pos2box(sim,poshi);
@@ -2031,28 +2755,40 @@ enum CMDcode cmdexcludebox(simptr sim,cmdptr cmd,char *line2) {
 
 enum CMDcode cmdexcludesphere(simptr sim,cmdptr cmd,char *line2) {
 	int m,itct,dim,d,b,b1,b2;
-	double *pos,poslo[DIMMAX],poshi[DIMMAX],poscent[DIMMAX],rad,dist;
+	double *pos,*poslo,*poshi,poscent[DIMMAX],rad,dist;
 	boxptr bptr1,bptr2,bptr;
 	boxssptr boxs;
 	moleculeptr *mlist;
+	cmdargsexcludeptr args;
 
 	if(line2 && !strcmp(line2,"cmdtype")) return CMDmanipulate;
 	dim=sim->dim;
 	boxs=sim->boxs;
-	for(d=0;d<dim;d++) {
-		SCMDCHECK(line2,"missing center argument");
-		itct=sscanf(line2,"%lg",&poscent[d]);
-		SCMDCHECK(itct==1,"failure reading center");
-		line2=strnword(line2,2); }
-	SCMDCHECK(line2,"missing radius");
-	itct=sscanf(line2,"%lg",&rad);
-	SCMDCHECK(itct==1,"failure reading radius");
-
-	dist=rad*sqrt(dim);
-	for(d=0;d<dim;d++) {
-		poslo[d]=poscent[d]-dist;
-		poshi[d]=poscent[d]+dist; }
-	rad*=rad;
+	if(!cmd->v3) {																// compile arguments on first call
+		for(d=0;d<dim;d++) {
+			SCMDCHECK(line2,"missing center argument");
+			itct=sscanf(line2,"%lg",&poscent[d]);
+			SCMDCHECK(itct==1,"failure reading center");
+			line2=strnword(line2,2); }
+		SCMDCHECK(line2,"missing radius");
+		itct=sscanf(line2,"%lg",&rad);
+		SCMDCHECK(itct==1,"failure reading radius");
+		args=(cmdargsexcludeptr) malloc(sizeof(struct cmdargsexclude));
+		SCMDCHECK(args,"out of memory");
+		dist=rad*sqrt(dim);
+		for(d=0;d<dim;d++) {
+			args->poscent[d]=poscent[d];
+			args->poslo[d]=poscent[d]-dist;
+			args->poshi[d]=poscent[d]+dist; }
+		args->rad2=rad*rad;
+		cmd->v3=args;
+		cmd->freefn=&cmdv3free; }
+
+	args=(cmdargsexcludeptr) cmd->v3;
+	poslo=args->poslo;
+	poshi=args->poshi;
+	for(d=0;d<dim;d++) poscent[d]=args->poscent[d];
+	rad=args->rad2;
 	bptr1=pos2box(sim,poslo);
 	bptr2=pos2box(sim,poshi);
 	b1=indx2addZV(bptr1->indx,boxs->side,dim);
@@ -2111,6 +2847,209 @@ void cmdv1v2free(cmdptr cmd) {
 	return; }
 
 
+void cmdv3free(cmdptr cmd) {
+	free(cmd->v3);
+	return; }
+
+
+void cmdv1v3free(cmdptr cmd) {
+	free(cmd->v1);
+	free(cmd->v3);
+	return; }
+
+
+void cmdv1v2v3free(cmdptr cmd) {
+	free(cmd->v1);
+	free(cmd->v2);
+	free(cmd->v3);
+	return; }
+
+
+/* cmdobsfree.  Frees v1 and v3 of a command that uses an observer, and
+disconnects its observer in v2.  The observer itself is owned by the planner. */
+void cmdobsfree(cmdptr cmd) {
+	free(cmd->v1);
+	free(cmd->v3);
+	if(cmd->v2) ((obsptr)cmd->v2)->cmd=NULL;
+	return; }
+
+
+/* obsplanfree.  Frees an observation planner and all of its observers. */
+void obsplanfree(obsplanptr plan) {
+	int o;
+
+	if(!plan) return;
+	for(o=0;o<plan->nobs;o++) {
+		free(plan->obs[o]->ct);
+		free(plan->obs[o]); }
+	free(plan->obs);
+	free(plan);
+	return; }
+
+
+/* obsregister.  Creates an observer of type type for command cmd, which
+observes species i, or all species if i<0, in state ms, adds it to the
+observation planner of sim, and returns it.  The planner is allocated if
+needed.  Observers are grouped by the command timing parameters, so that all
+observers in a group are due at the same times.  If the observer only needs one
+live list, because it is for a single species and state, that list is recorded
+so that sweeps for its group only scan the lists that its observers need.  The
+calling command sets the other observer parameters that are specific to its
+type.  Returns NULL if memory could not be allocated. */
+obsptr obsregister(simptr sim,cmdptr cmd,enum ObsType type,int i,enum MolecState ms) {
+	obsplanptr plan;
+	obsptr obs,*newobs;
+	int o,maxobs;
+
+	plan=sim->obsplan;
+	if(!plan) {
+		plan=(obsplanptr) malloc(sizeof(struct obsplanstruct));
+		if(!plan) return NULL;
+		plan->maxobs=0;
+		plan->nobs=0;
+		plan->obs=NULL;
+		plan->epoch=0;
+		sim->obsplan=plan; }
+
+	if(plan->nobs==plan->maxobs) {
+		maxobs=2*plan->maxobs+1;
+		newobs=(obsptr*) calloc(maxobs,sizeof(obsptr));
+		if(!newobs) return NULL;
+		for(o=0;o<plan->nobs;o++) newobs[o]=plan->obs[o];
+		free(plan->obs);
+		plan->obs=newobs;
+		plan->maxobs=maxobs; }
+
+	obs=(obsptr) malloc(sizeof(struct obsstruct));
+	if(!obs) return NULL;
+	obs->cmd=cmd;
+	obs->type=type;
+	obs->key[0]=cmd->on;
+	obs->key[1]=cmd->off;
+	obs->key[2]=cmd->dt;
+	obs->key[3]=cmd->xt;
+	obs->key[4]=(double)cmd->oni;
+	obs->key[5]=(double)cmd->offi;
+	obs->key[6]=(double)cmd->dti;
+	obs->i=i;
+	obs->ms=ms;
+	obs->ll=-1;
+	if(i>0 && ms>=0 && ms<MSMAX) obs->ll=sim->mols->listlookup[i][ms];
+	obs->cmpt=NULL;
+	obs->axis=0;
+	obs->nbin=0;
+	obs->maxct=0;
+	obs->ct=NULL;
+	obs->nmom=0;
+	obs->sweeptime=sim->tmin-1;
+	obs->epoch=plan->epoch;
+	obs->fresh=0;
+	plan->obs[plan->nobs++]=obs;
+	return obs; }
+
+
+/* obssweep.  Makes the sweep results of observer obs current.  If they were
+already computed for the current simulation time by a sweep for another
+observer in the same group, and no unfused command has run since then, they are
+used directly.  Otherwise, this sweeps once over the live lists that the
+observers in the group of obs need, which is all of them unless every observer
+is for a single species and state, and dispatches each molecule to every
+observer in the group, so that the other observers in the group that are due at
+this time can use these results.  Returns 0 for success or 1 for out of
+memory. */
+int obssweep(simptr sim,obsptr obs) {
+	obsplanptr plan;
+	obsptr *group,gobs;
+	int o,g,ngroup,k,nct,ll,m,nmol,dim,d,d2,bin,*newct,nll,*lls;
+	moleculeptr mptr,*mlist;
+	double scale,dx[DIMMAX];
+
+	plan=sim->obsplan;
+	if(obs->fresh && obs->sweeptime==sim->time && obs->epoch==plan->epoch) {
+		obs->fresh=0;
+		return 0; }
+
+	dim=sim->dim;
+	group=(obsptr*) calloc(plan->nobs,sizeof(obsptr));		// find group
+	if(!group) return 1;
+	lls=(int*) calloc(plan->nobs+sim->mols->nlist,sizeof(int));
+	if(!lls) {free(group);return 1;}
+	ngroup=0;
+	for(o=0;o<plan->nobs;o++) {
+		gobs=plan->obs[o];
+		if(!gobs->cmd) continue;
+		for(k=0;k<7 && gobs->key[k]==obs->key[k];k++);
+		if(k==7) group[ngroup++]=gobs; }
+
+	nll=0;																									// lists to sweep
+	for(g=0;g<ngroup && nll>=0;g++) {
+		ll=group[g]->ll;
+		if(ll<0 || ll>=sim->mols->nlist) nll=-1;
+		else {
+			for(k=0;k<nll && lls[k]!=ll;k++);
+			if(k==nll) lls[nll++]=ll; }}
+	if(nll<0)
+		for(nll=0;nll<sim->mols->nlist;nll++) lls[nll]=nll;
+
+	for(g=0;g<ngroup;g++) {																	// reset accumulators
+		gobs=group[g];
+		nct=gobs->type==OTmolcountspace?gobs->nbin:sim->mols->nspecies;
+		if(gobs->type!=OTmolmoments && nct>gobs->maxct) {
+			newct=(int*) calloc(nct,sizeof(int));
+			if(!newct) {free(group);free(lls);return 1;}
+			free(gobs->ct);
+			gobs->ct=newct;
+			gobs->maxct=nct; }
+		for(k=0;k<gobs->maxct;k++) gobs->ct[k]=0;
+		gobs->nmom=0;
+		for(d=0;d<dim;d++) gobs->sum[d]=0;
+		for(d=0;d<dim*dim;d++) gobs->sum2[d]=0; }
+
+	for(k=0;k<nll;k++) {																		// sweep over molecules
+		ll=lls[k];
+		mlist=sim->mols->live[ll];
+		nmol=sim->mols->nl[ll];
+		for(m=0;m<nmol;m++) {
+			mptr=mlist[m];
+			if(mptr->ident<=0) continue;
+			for(g=0;g<ngroup;g++) {
+				gobs=group[g];
+				if(gobs->type==OTmolcount)
+					gobs->ct[mptr->ident]++;
+				else if(gobs->type==OTmolcountincmpt) {
+					if(mptr->mstate==MSsoln && posincompart(sim,mptr->pos,gobs->cmpt)) gobs->ct[mptr->ident]++; }
+				else if(gobs->type==OTmolcountspace) {
+					if((gobs->i<0 || mptr->ident==gobs->i) && (gobs->ms==MSall || mptr->mstate==gobs->ms)) {
+						for(d=0;d<dim;d++)
+							if(mptr->pos[d]<=gobs->low[d] || mptr->pos[d]>=gobs->high[d]) d=dim+1;
+						if(d==dim) {
+							scale=(double)gobs->nbin/(gobs->high[gobs->axis]-gobs->low[gobs->axis]);
+							bin=(int)floor(scale*(mptr->pos[gobs->axis]-gobs->low[gobs->axis]));
+							if(bin==gobs->nbin) bin--;
+							gobs->ct[bin]++; }}}
+				else if(gobs->type==OTmolmoments) {
+					if(mptr->ident==gobs->i && mptr->mstate==gobs->ms) {
+						if(gobs->nmom==0)
+							for(d=0;d<dim;d++) gobs->ref[d]=mptr->pos[d];
+						gobs->nmom++;
+						for(d=0;d<dim;d++) {
+							dx[d]=mptr->pos[d]-gobs->ref[d];
+							gobs->sum[d]+=dx[d]; }
+						for(d=0;d<dim;d++)
+							for(d2=0;d2<dim;d2++)
+								gobs->sum2[d*dim+d2]+=dx[d]*dx[d2]; }}}}}
+
+	for(g=0;g<ngroup;g++) {
+		gobs=group[g];
+		gobs->sweeptime=sim->time;
+		gobs->epoch=plan->epoch;
+		gobs->fresh=1; }
+	obs->fresh=0;
+	free(group);
+	free(lls);
+	return 0; }
+
+
 enum CMDcode conditionalcmdtype(simptr sim,cmdptr cmd,int nparam) {
 	char string[STRCHAR],*strptr;
 	enum CMDcode ans;
@@ -2126,6 +3065,69 @@ enum CMDcode conditionalcmdtype(simptr sim,cmdptr cmd,int nparam) {
 	return ans; }
 
 
+/* domaindocommand.  Runs command line, whose first word is word, in one domain
+of smolsimulatedomains.  Commands that depend on the molecules in the whole
+system, which a domain doesn't know, are refused and stop the simulation.
+These are the conditional commands, the fixmolcount commands, and porttransport;
+equilmol is allowed because it acts on each molecule separately.  Commands that
+can add a fixed number of molecules at random positions, which are volumesource
+and set, are run with random numbers that are the same in all domains, so that
+every domain makes the same molecules and keeps the ones in its own slab (see
+domainclip); afterward, the domain's own random numbers continue from a seed
+that was drawn before the command.  Each domain still needs enough dead
+molecules for all of the molecules that such a command adds.  Other commands
+are run with docommand, and each output file that they write to is marked in
+dom->merge with how it can be merged afterward: molecule counts add up over
+domains, so their columns are summed; binary files are not merged; and
+everything else is concatenated.  This includes moments, mean square
+displacements, radial distributions, and molecule lists, and also echo text,
+whose numbers would otherwise be summed. */
+enum CMDcode domaindocommand(simptr sim,cmdptr cmd,char *word,char *line) {
+	static char *refuse[]={"ifno","ifless","ifmore","ifincmpt","fixmolcount","fixmolcountonsurf","fixmolcountincmpt","porttransport",NULL};
+	static char *shared[]={"volumesource","set",NULL};
+	static char *additive[]={"molcount","molcountinbox","molcountincmpt","molcountincmpts","molcountincmpt2","molcountonsurf","molcountspace","speciesstreamcount","molcountheader","speciesstreamheader",NULL};
+	static char *binary[]={"listmolsbin","molcountgrid","savesim",NULL};
+	domainptr dom;
+	cmdssptr cmds;
+	enum DomainMerge kind;
+	enum CMDcode ans;
+	long int *fpos,seed;
+	int i,fid,share;
+
+	dom=sim->boxs->dom;
+	cmds=sim->cmds;
+	for(i=0;refuse[i];i++)
+		if(!strcmp(word,refuse[i])) {
+			fprintf(stderr,"ERROR: command %s can't be used with domain decomposition because it depends on the molecules in the whole system\n",word);
+			dom->refused=1;
+			return CMDabort; }
+	kind=DFcat;
+	for(i=0;additive[i];i++)
+		if(!strcmp(word,additive[i])) kind=DFsum;
+	for(i=0;binary[i];i++)
+		if(!strcmp(word,binary[i])) kind=DFnone;
+
+	fpos=dom->fpos;
+	for(fid=0;fid<cmds->nfile;fid++)
+		fpos[fid]=cmds->fptr[fid]?ftell(cmds->fptr[fid]):-1;
+	share=0;
+	for(i=0;shared[i];i++)
+		if(!strcmp(word,shared[i])) share=1;
+	seed=0;
+	if(share) {																		// same random numbers in all domains
+		seed=(long int)(randULI()&0x7fffffff);
+		dom->nshared++;
+		randomize((dom->sharedseed+1000003L*dom->nshared)&0x7fffffff); }
+	dom->fpos=NULL;															// so docommand runs the command
+	ans=docommand((void*)sim,cmd,line);
+	dom->fpos=fpos;
+	if(share) randomize(seed);
+	for(fid=0;fid<cmds->nfile;fid++)
+		if(cmds->fptr[fid] && ftell(cmds->fptr[fid])!=fpos[fid] && kind>dom->merge[fid])
+			dom->merge[fid]=kind;
+	return ans; }
+
+
 int insideecoli(double *pos,double *ofst,double rad,double length) {
 	double dist;
 
@@ -2177,5 +3179,522 @@ int molinpanels(simptr sim,int ll,int m,int s,char pshape) {
 	return 0; }
 
 
+/* molcountgrid.  Counts molecules in a grid of bins for the molcountgrid
+command, using the arguments in args.  Counts are written to ct, which has one
+element for each bin, ordered with the first dimension varying slowest.  For
+threading, the molecules of each live list are divided into nthreads equal
+blocks, of which this counts block thread; use 0 and 1 to count all molecules.
+Molecules outside of the grid are ignored. */
+void molcountgrid(simptr sim,cmdargsmolcountgridptr args,int thread,int nthreads,int *ct) {
+	int i,ll,lllo,llhi,m,m1,m2,nmol,stride,d,dim,g,ngrid,indx;
+	enum MolecState ms;
+	double scale[DIMMAX];
+	moleculeptr *mlist,mptr;
+
+	dim=sim->dim;
+	i=args->i;
+	ms=args->ms;
+	ngrid=1;
+	for(d=0;d<dim;d++) {
+		ngrid*=args->nbin[d];
+		scale[d]=(double)args->nbin[d]/(args->high[d]-args->low[d]); }
+	for(g=0;g<ngrid;g++) ct[g]=0;
+
+	if(i<0 || ms==MSall) {lllo=0;llhi=sim->mols->nlist;}
+	else llhi=1+(lllo=sim->mols->listlookup[i][ms]);
+	for(ll=lllo;ll<llhi;ll++) {
+		mlist=sim->mols->live[ll];
+		nmol=sim->mols->nl[ll];
+		stride=nthreads>1?calculatestride(nmol,nthreads):nmol;
+		m1=thread*stride<nmol?thread*stride:nmol;
+		m2=thread==nthreads-1 || (thread+1)*stride>nmol?nmol:(thread+1)*stride;
+		for(m=m1;m<m2;m++) {
+			mptr=mlist[m];
+			if((mptr->ident>0 && i<0 && (ms==MSall || mptr->mstate==ms)) || (mptr->ident==i && (ms==MSall || mptr->mstate==ms))) {
+				g=0;
+				for(d=0;d<dim;d++) {
+					if(mptr->pos[d]<args->low[d] || mptr->pos[d]>args->high[d]) break;
+					indx=(int)(scale[d]*(mptr->pos[d]-args->low[d]));
+					if(indx==args->nbin[d]) indx--;
+					g=args->nbin[d]*g+indx; }
+				if(d==dim) ct[g]++; }}}
+	return; }
+
+
+#ifdef THREADING
+/* molcountgrid_threaded.  Thread function for the molcountgrid command, which
+calls molcountgrid. */
+void* molcountgrid_threaded(void *data) {
+	PARAMS_molcountgrid_threaded *pParams;
+
+	pParams=(PARAMS_molcountgrid_threaded*) data;
+	molcountgrid(pParams->sim,pParams->args,pParams->thread,pParams->nthreads,pParams->ct);
+	return NULL; }
+#endif
+
 
+/* radialdist.  Computes the pair distance histogram for the radialdist command,
+using the arguments in args, for molecules of the first species that are in
+boxes b1 up to, but not including, b2.  Counts are written to ct, which has
+args->nbin elements.  Pairs are found with the box neighbor lists in the same
+way as for bimolecular reactions, including wrap-around for periodic
+boundaries.  If the two species and states are the same, each pair is counted
+once. */
+void radialdist(simptr sim,cmdargsradialdistptr args,int b1,int b2,int *ct) {
+	int dim,d,b,bn,bmax,ll1,ll2,m1,m2,nmol2,nbin,k,same,wpcode;
+	double rmax2,scale,dist2,diff,len[DIMMAX];
+	boxptr bptr,bptr2;
+	moleculeptr *mlist2,mptr1,mptr2;
 
+	dim=sim->dim;
+	nbin=args->nbin;
+	rmax2=args->rmax*args->rmax;
+	scale=nbin/args->rmax;
+	ll1=sim->mols->listlookup[args->i1][args->ms1];
+	ll2=sim->mols->listlookup[args->i2][args->ms2];
+	same=(args->i1==args->i2 && args->ms1==args->ms2);
+	for(d=0;d<dim;d++) len[d]=sim->wlist[2*d+1]->pos-sim->wlist[2*d]->pos;
+	for(k=0;k<nbin;k++) ct[k]=0;
+
+	for(b=b1;b<b2;b++) {
+		bptr=sim->boxs->blist[b];
+		for(m1=0;m1<bptr->nmol[ll1];m1++) {
+			mptr1=bptr->mol[ll1][m1];
+			if(mptr1->ident!=args->i1 || mptr1->mstate!=args->ms1) continue;
+
+			mlist2=bptr->mol[ll2];													// same box
+			nmol2=bptr->nmol[ll2];
+			for(m2=0;m2<nmol2;m2++) {
+				mptr2=mlist2[m2];
+				if(same && mptr2==mptr1) break;
+				if(mptr2==mptr1 || mptr2->ident!=args->i2 || mptr2->mstate!=args->ms2) continue;
+				dist2=0;
+				for(d=0;d<dim;d++) {
+					diff=mptr1->pos[d]-mptr2->pos[d];
+					dist2+=diff*diff; }
+				if(dist2<rmax2) {
+					k=(int)(scale*sqrt(dist2));
+					if(k<nbin) ct[k]++; }}
+
+			bmax=same?bptr->midneigh:bptr->nneigh;				// neighbor boxes
+			for(bn=0;bn<bmax;bn++) {
+				bptr2=bptr->neigh[bn];
+				wpcode=bptr->wpneigh?bptr->wpneigh[bn]:0;
+				mlist2=bptr2->mol[ll2];
+				nmol2=bptr2->nmol[ll2];
+				for(m2=0;m2<nmol2;m2++) {
+					mptr2=mlist2[m2];
+					if(mptr2->ident!=args->i2 || mptr2->mstate!=args->ms2) continue;
+					dist2=0;
+					for(d=0;d<dim;d++) {
+						diff=mptr1->pos[d]-mptr2->pos[d];
+						if((wpcode>>2*d&3)==1) diff+=len[d];
+						else if((wpcode>>2*d&3)==2) diff-=len[d];
+						dist2+=diff*diff; }
+					if(dist2<rmax2) {
+						k=(int)(scale*sqrt(dist2));
+						if(k<nbin) ct[k]++; }}}}}
+	return; }
+
+
+#ifdef THREADING
+/* radialdist_threaded.  Thread function for the radialdist command, which calls
+radialdist. */
+void* radialdist_threaded(void *data) {
+	PARAMS_radialdist_threaded *pParams;
+
+	pParams=(PARAMS_radialdist_threaded*) data;
+	radialdist(pParams->sim,pParams->args,pParams->b1,pParams->b2,pParams->ct);
+	return NULL; }
+#endif
+
+
+/**********************************************************/
+/********************* buffered output ********************/
+/**********************************************************/
+
+
+/* outssalloc.  Allocates and returns a buffered output superstructure, with no
+file buffers and with the writer thread not started yet.  Returns NULL if memory
+could not be allocated. */
+outssptr outssalloc(void) {
+	outssptr outss;
+
+	outss=(outssptr) malloc(sizeof(struct outssstruct));
+	if(!outss) return NULL;
+	outss->maxqueue=OUTMAXQUEUE;
+	outss->maxbuf=0;
+	outss->nbuf=0;
+	outss->buf=NULL;
+	outss->head=NULL;
+	outss->tail=NULL;
+	outss->queued=0;
+	outss->running=0;
+	outss->quit=0;
+	outss->thread_id=NULL;
+	outss->mutex=NULL;
+	outss->cond=NULL;
+#ifdef THREADING
+	outss->thread_id=malloc(sizeof(pthread_t));
+	outss->mutex=malloc(sizeof(pthread_mutex_t));
+	outss->cond=malloc(sizeof(pthread_cond_t));
+	if(!outss->thread_id || !outss->mutex || !outss->cond) {
+		free(outss->thread_id);
+		free(outss->mutex);
+		free(outss->cond);
+		free(outss);
+		return NULL; }
+	pthread_mutex_init((pthread_mutex_t*)outss->mutex,NULL);
+	pthread_cond_init((pthread_cond_t*)outss->cond,NULL);
+#endif
+	return outss; }
+
+
+/* outssfree.  Sends any buffered output to the writer thread, waits for the
+writer thread to write it all, stops the writer thread, and frees the
+superstructure.  This needs to be called before the output files are closed. */
+void outssfree(outssptr outss) {
+	int b;
+
+	if(!outss) return;
+#ifdef THREADING
+	for(b=0;b<outss->nbuf;b++) {
+		outsend(outss,outss->buf[b],0);
+		free(outss->buf[b]->data);
+		free(outss->buf[b]); }
+	if(outss->running) {
+		pthread_mutex_lock((pthread_mutex_t*)outss->mutex);
+		outss->quit=1;
+		pthread_cond_broadcast((pthread_cond_t*)outss->cond);
+		pthread_mutex_unlock((pthread_mutex_t*)outss->mutex);
+		pthread_join(*((pthread_t*)outss->thread_id),NULL); }
+	pthread_mutex_destroy((pthread_mutex_t*)outss->mutex);
+	pthread_cond_destroy((pthread_cond_t*)outss->cond);
+#else
+	for(b=0;b<outss->nbuf;b++) {
+		free(outss->buf[b]->data);
+		free(outss->buf[b]); }
+#endif
+	free(outss->buf);
+	free(outss->thread_id);
+	free(outss->mutex);
+	free(outss->cond);
+	free(outss);
+	return; }
+
+
+/* outsetmaxqueue.  Sets the number of bytes of output that can be queued for
+the writer thread before commands have to wait for it, allocating the buffered
+output superstructure if needed.  A value of 0 turns buffering off so that
+commands write directly to their files.  Returns 0 for success, 1 for out of
+memory, or 2 for a negative value. */
+int outsetmaxqueue(simptr sim,int maxqueue) {
+	if(maxqueue<0) return 2;
+	if(!sim->outss) {
+		sim->outss=outssalloc();
+		if(!sim->outss) return 1; }
+	sim->outss->maxqueue=maxqueue;
+	return 0; }
+
+
+/* outwriter.  Writer thread function.  This waits for blocks in the writer
+queue, writes them to their files in the order in which they were queued, and
+frees them.  It returns when it is told to quit and the queue is empty. */
+void* outwriter(void *data) {
+#ifdef THREADING
+	outssptr outss;
+	outblockptr block;
+
+	outss=(outssptr) data;
+	pthread_mutex_lock((pthread_mutex_t*)outss->mutex);
+	while(1) {
+		while(!outss->head && !outss->quit)
+			pthread_cond_wait((pthread_cond_t*)outss->cond,(pthread_mutex_t*)outss->mutex);
+		if(!outss->head) break;
+		block=outss->head;
+		outss->head=block->next;
+		if(!outss->head) outss->tail=NULL;
+		pthread_mutex_unlock((pthread_mutex_t*)outss->mutex);
+		fwrite(block->data,1,block->n,block->fptr);
+		pthread_mutex_lock((pthread_mutex_t*)outss->mutex);
+		outss->queued-=block->n;
+		pthread_cond_broadcast((pthread_cond_t*)outss->cond);
+		free(block->data);
+		free(block); }
+	pthread_mutex_unlock((pthread_mutex_t*)outss->mutex);
+#endif
+	return NULL; }
+
+
+/* outdrain.  Waits until the writer thread has written everything that has been
+queued for it. */
+void outdrain(outssptr outss) {
+#ifdef THREADING
+	if(!outss->running) return;
+	pthread_mutex_lock((pthread_mutex_t*)outss->mutex);
+	while(outss->queued>0)
+		pthread_cond_wait((pthread_cond_t*)outss->cond,(pthread_mutex_t*)outss->mutex);
+	pthread_mutex_unlock((pthread_mutex_t*)outss->mutex);
+#endif
+	return; }
+
+
+/* outgetbuf.  Returns the buffer for file fptr, creating it if there isn't one
+yet.  Returns NULL if memory could not be allocated. */
+outblockptr outgetbuf(outssptr outss,FILE *fptr) {
+	int b,maxbuf;
+	outblockptr buf,*newbuf;
+
+	for(b=0;b<outss->nbuf;b++)
+		if(outss->buf[b]->fptr==fptr) return outss->buf[b];
+
+	if(outss->nbuf==outss->maxbuf) {
+		maxbuf=2*outss->maxbuf+1;
+		newbuf=(outblockptr*) calloc(maxbuf,sizeof(outblockptr));
+		if(!newbuf) return NULL;
+		for(b=0;b<outss->nbuf;b++) newbuf[b]=outss->buf[b];
+		free(outss->buf);
+		outss->buf=newbuf;
+		outss->maxbuf=maxbuf; }
+
+	buf=(outblockptr) malloc(sizeof(struct outblockstruct));
+	if(!buf) return NULL;
+	buf->data=(char*) malloc(OUTBLOCK);
+	if(!buf->data) {free(buf);return NULL;}
+	buf->fptr=fptr;
+	buf->n=0;
+	buf->max=OUTBLOCK;
+	buf->next=NULL;
+	outss->buf[outss->nbuf++]=buf;
+	return buf; }
+
+
+/* outsend.  Moves the contents of buffer buf to the end of the writer queue,
+starting the writer thread if it isn't running yet.  If keep is 1, buf is given
+a new empty block of memory; if it is 0, buf is left without memory because it
+is about to be freed.  If the queue already holds more than maxqueue bytes, this
+waits for the writer thread to catch up, which keeps memory use bounded.  If
+the block cannot be queued, because memory could not be allocated or the thread
+could not be started, the contents are written directly instead. */
+void outsend(outssptr outss,outblockptr buf,int keep) {
+#ifdef THREADING
+	outblockptr block;
+	char *data;
+
+	if(buf->n==0) return;
+	block=(outblockptr) malloc(sizeof(struct outblockstruct));
+	data=keep?(char*) malloc(OUTBLOCK):NULL;
+	if(block && !outss->running && !pthread_create((pthread_t*)outss->thread_id,NULL,outwriter,(void*)outss))
+		outss->running=1;
+	if(!block || !outss->running || (keep && !data)) {		// write directly
+		outdrain(outss);
+		fwrite(buf->data,1,buf->n,buf->fptr);
+		buf->n=0;
+		free(block);
+		free(data);
+		return; }
+
+	block->fptr=buf->fptr;
+	block->data=buf->data;
+	block->n=buf->n;
+	block->max=buf->max;
+	block->next=NULL;
+	buf->data=data;
+	buf->n=0;
+	buf->max=keep?OUTBLOCK:0;
+
+	pthread_mutex_lock((pthread_mutex_t*)outss->mutex);
+	while(outss->queued>0 && outss->queued+block->n>outss->maxqueue)	// back-pressure
+		pthread_cond_wait((pthread_cond_t*)outss->cond,(pthread_mutex_t*)outss->mutex);
+	if(outss->tail) outss->tail->next=block;
+	else outss->head=block;
+	outss->tail=block;
+	outss->queued+=block->n;
+	pthread_cond_broadcast((pthread_cond_t*)outss->cond);
+	pthread_mutex_unlock((pthread_mutex_t*)outss->mutex);
+#endif
+	return; }
+
+
+/* outprintf.  Equivalent to fprintf, but for output from runtime commands.  If
+the code was compiled with threading and buffering hasn't been turned off, the
+text is formatted into a memory buffer for file fptr and full buffers are
+written by a separate writer thread, so the simulation doesn't wait for disk
+output.  Output to stdout and stderr is not buffered.  Returns the number of
+characters printed, or a negative value for an error. */
+int outprintf(simptr sim,FILE *fptr,const char *format,...) {
+	va_list arguments;
+	int n;
+#ifdef THREADING
+	va_list copy;
+	outssptr outss;
+	outblockptr buf;
+#endif
+
+	va_start(arguments,format);
+#ifdef THREADING
+	if(!sim->outss) sim->outss=outssalloc();
+	outss=sim->outss;
+	if(outss && outss->maxqueue>0 && fptr!=stdout && fptr!=stderr && (buf=outgetbuf(outss,fptr))) {
+		va_copy(copy,arguments);
+		n=vsnprintf(buf->data+buf->n,buf->max-buf->n,format,copy);
+		va_end(copy);
+		if(n>=buf->max-buf->n) {												// text didn't fit
+			outsend(outss,buf,1);
+			if(n<buf->max-buf->n)
+				n=vsnprintf(buf->data+buf->n,buf->max-buf->n,format,arguments);
+			else {																				// larger than a block
+				outdrain(outss);
+				n=vfprintf(fptr,format,arguments);
+				va_end(arguments);
+				return n; }}
+		if(n>0) buf->n+=n;
+		va_end(arguments);
+		return n; }
+#endif
+	n=vfprintf(fptr,format,arguments);
+	va_end(arguments);
+	return n; }
+
+
+/* outwrite.  Equivalent to fwrite, but for binary output from runtime commands.
+This writes n bytes from data to file fptr, using the same buffers and writer
+thread as outprintf, so text and binary output to a file stay in order.
+Returns the number of bytes written. */
+size_t outwrite(simptr sim,FILE *fptr,const void *data,size_t n) {
+#ifdef THREADING
+	outssptr outss;
+	outblockptr buf;
+
+	if(!sim->outss) sim->outss=outssalloc();
+	outss=sim->outss;
+	if(outss && outss->maxqueue>0 && fptr!=stdout && fptr!=stderr && (buf=outgetbuf(outss,fptr))) {
+		if(n>(size_t)(buf->max-buf->n)) outsend(outss,buf,1);
+		if(n<=(size_t)(buf->max-buf->n)) {
+			memcpy(buf->data+buf->n,data,n);
+			buf->n+=n;
+			return n; }
+		outdrain(outss); }																// larger than a block
+#endif
+	return fwrite(data,1,n,fptr); }
+
+
+/* outprintVD.  Equivalent to fprintVD, but uses outprintf for the output.
+Returns the number of characters printed. */
+int outprintVD(simptr sim,FILE *fptr,double *c,int n) {
+	int i,ct;
+
+	if(!c) return outprintf(sim,fptr,"NULL\n");
+	if(n<=0) return outprintf(sim,fptr,"Empty\n");
+	ct=0;
+	for(i=0;i<n-1;i++) ct+=outprintf(sim,fptr,"%g ",c[i]);
+	ct+=outprintf(sim,fptr,"%g\n",c[n-1]);
+	return ct; }
+
+
+/* outflush.  Sends all buffered output to the writer thread, waits for it to be
+written, and flushes the files.  This is called before files are closed or
+written to directly, and at the end of the simulation.  Afterwards, there are no
+file buffers, so none of them refer to files that may be closed later. */
+void outflush(simptr sim) {
+	outssptr outss;
+	int b;
+
+	outss=sim->outss;
+	if(!outss || !outss->nbuf) return;
+	for(b=0;b<outss->nbuf;b++) {
+		outsend(outss,outss->buf[b],0);
+		free(outss->buf[b]->data); }
+	outdrain(outss);
+	for(b=0;b<outss->nbuf;b++) {
+		fflush(outss->buf[b]->fptr);
+		free(outss->buf[b]); }
+	outss->nbuf=0;
+	return; }
+
+
+/**********************************************************/
+/******************** snapshot processes ******************/
+/**********************************************************/
+
+
+/* snapssalloc.  Allocates and returns a snapshot process superstructure with
+space for maxsnap running processes.  Returns NULL if memory could not be
+allocated. */
+snapssptr snapssalloc(int maxsnap) {
+	snapssptr snapss;
+
+	snapss=(snapssptr) malloc(sizeof(struct snapssstruct));
+	if(!snapss) return NULL;
+	snapss->maxsnap=maxsnap;
+	snapss->nsnap=0;
+	snapss->pid=NULL;
+	if(maxsnap>0) {
+		snapss->pid=(int*) calloc(maxsnap,sizeof(int));
+		if(!snapss->pid) {
+			free(snapss);
+			return NULL; }}
+	return snapss; }
+
+
+/* snapssfree.  Waits for any snapshot processes that are still running and
+then frees the snapshot process superstructure. */
+void snapssfree(snapssptr snapss) {
+#ifndef _WIN32
+	int n,status;
+#endif
+
+	if(!snapss) return;
+#ifndef _WIN32
+	for(n=0;n<snapss->nsnap;n++) waitpid((pid_t)snapss->pid[n],&status,0);
+#endif
+	free(snapss->pid);
+	free(snapss);
+	return; }
+
+
+/* snapsetmax.  Sets the maximum number of snapshot processes that can run at
+once, allocating the superstructure if needed.  A value of 0 makes snapshot
+commands run in place.  This waits for running snapshots before changing the
+value.  Returns 0 for success, 1 for out of memory, or 2 for a negative value. */
+int snapsetmax(simptr sim,int maxsnap) {
+	int *newpid;
+
+	if(maxsnap<0) return 2;
+	if(!sim->snapss) {
+		sim->snapss=snapssalloc(maxsnap);
+		return sim->snapss?0:1; }
+	snapwait(sim,0);
+	newpid=NULL;
+	if(maxsnap>0) {
+		newpid=(int*) calloc(maxsnap,sizeof(int));
+		if(!newpid) return 1; }
+	free(sim->snapss->pid);
+	sim->snapss->pid=newpid;
+	sim->snapss->maxsnap=maxsnap;
+	return 0; }
+
+
+/* snapwait.  Removes finished snapshot processes from the list and then waits
+for the oldest ones to finish until no more than max are still running.  A
+warning is displayed for a snapshot that did not succeed. */
+void snapwait(simptr sim,int max) {
+#ifndef _WIN32
+	snapssptr snapss;
+	int n,n2,status;
+	pid_t ans;
+
+	snapss=sim->snapss;
+	if(!snapss) return;
+	if(max<0) max=0;
+	for(n=0;n<snapss->nsnap;) {
+		if(snapss->nsnap>max) ans=waitpid((pid_t)snapss->pid[n],&status,0);
+		else ans=waitpid((pid_t)snapss->pid[n],&status,WNOHANG);
+		if(ans==0) n++;
+		else {
+			if(ans>0 && !(WIFEXITED(status) && WEXITSTATUS(status)==0))
+				fprintf(stderr,"WARNING: snapshot process %i did not succeed\n",snapss->pid[n]);
+			for(n2=n+1;n2<snapss->nsnap;n2++) snapss->pid[n2-1]=snapss->pid[n2];
+			snapss->nsnap--; }}
+#endif
+	return; }
@@ -12,9 +12,24 @@
 #include "smoldyn.h"
 #include "Zn.h"
 
+#ifdef THREADING
+#include <pthread.h>
+
+typedef struct PARAMSET_compartvolfracs_threaded {
+	simptr sim;
+	compartptr cmpt;
+	int *need;
+	double *frac;
+	int b1;
+	int b2;
+} PARAMS_compartvolfracs_threaded;
+#endif
+
 #define CHECK(A) if(!(A)) goto failure; else (void)0
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
+#define CMPTMAXCROSS 16		// max panel crossings in a box for posincompartsurf
+
 
 /******************************************************************************/
 /********************************* Compartments *******************************/
@@ -64,27 +79,103 @@ char *cmptcl2string(enum CmptLogic cls,char *string) {
 /****************************** low level utilities ***************************/
 /******************************************************************************/
 
-/* posincompart.  Tests if position pos is in compartment cmpt, returning 1 if
-so and 0 if not.  This includes composed compartment logic tests.  It does not
-use the compartment box list.  This function is quite efficient for surfaces
-with few panels, but inefficient if surfaces have lots of panels. */
-int posincompart(simptr sim,double *pos,compartptr cmpt) {
-	int s,p,k,incmpt,pcross,cl,incmptl;
+/* compartboxrefpt.  Returns in pos the reference point for box bptr, which is
+used for compartment box classification.  It is a fixed point near the box
+center that is offset from the center so that it is unlikely to lie exactly on
+a surface panel. */
+void compartboxrefpt(simptr sim,boxptr bptr,double *pos) {
+	const double frac[3]={0.5137,0.4791,0.5283};
+	int d;
+
+	for(d=0;d<sim->dim;d++)
+		pos[d]=sim->boxs->min[d]+sim->boxs->size[d]*(bptr->indx[d]+frac[d]);
+	return; }
+
+
+/* posincompartsurf.  Tests if position pos is in the portion of compartment
+cmpt that is defined by its bounding surfaces and inside-defining points,
+ignoring any logic compartments, and returns 1 if so and 0 if not.  If the
+compartment box classification has been computed (by compartsetboxclass) and pos
+is within the box region, the classification of the box that contains pos is
+used.  Boxes that are entirely inside or outside give the answer directly.  For
+boxes that a bounding surface passes through, this starts with the known answer
+for the box reference point and toggles it for each crossing of a bounding
+surface panel that is listed in the box, along the segment from pos to the
+reference point; this segment is within the box, so other panels are not
+checked.  The parity is ambiguous if the segment passes within epsilon of a
+panel edge or vertex, where it can hit two panels at one point, or if it enters
+and leaves a curved panel, so these cases fall back to the method that is used
+without box information.  In that method, a line segment from pos to each
+inside-defining point is tested against every panel of every bounding surface,
+and pos is inside if any of these segments crosses no panels.  This last method
+is efficient for surfaces with few panels, but inefficient if surfaces have lots
+of panels. */
+int posincompartsurf(simptr sim,double *pos,compartptr cmpt) {
+	int s,p,k,d,b,indx,dim,incmpt,pcross,ncross,amb;
 	enum PanelShape ps;
+	enum PanelFace face1,face2;
 	surfaceptr srf;
-	double crsspt[DIMMAX];
-	enum CmptLogic sym;
+	double crsspt[DIMMAX],refpt[DIMMAX],cross,xcross[CMPTMAXCROSS],len,epsilon;
+	boxssptr boxs;
+	boxptr bptr;
+	panelptr pnl;
 
-	incmpt=0;
+	dim=sim->dim;
+	boxs=sim->boxs;
+	b=-1;
+	if(cmpt->boxclass && boxs && boxs->nbox) {					// find box index
+		b=0;
+		for(d=0;d<dim && b>=0;d++) {
+			indx=(int)floor((pos[d]-boxs->min[d])/boxs->size[d]);
+			if(indx<0 || indx>=boxs->side[d]) b=-1;
+			else b=boxs->side[d]*b+indx; }}
+
+	if(b>=0 && cmpt->boxclass[b]==CBCin) return 1;		// box is inside or outside
+	if(b>=0 && cmpt->boxclass[b]==CBCout) return 0;
+
+	if(b>=0) {																			// box contains a bounding surface
+		bptr=boxs->blist[b];
+		compartboxrefpt(sim,bptr,refpt);
+		incmpt=(cmpt->boxclass[b]==CBCbordin);
+		len=0;
+		for(d=0;d<dim;d++) len+=(refpt[d]-pos[d])*(refpt[d]-pos[d]);
+		len=sqrt(len);
+		epsilon=sim->srfss?sim->srfss->epsilon:VERYCLOSE;
+		ncross=0;
+		amb=0;
+		for(p=0;p<bptr->npanel && !amb;p++) {
+			pnl=bptr->panel[p];
+			for(s=0;s<cmpt->nsrf && cmpt->surflist[s]!=pnl->srf;s++);
+			if(s<cmpt->nsrf && lineXpanel(pos,refpt,pnl,dim,crsspt,&face1,&face2,&cross,NULL,NULL)) {
+				if(face1==face2 || ncross==CMPTMAXCROSS) amb=1;
+				for(k=0;k<ncross && !amb;k++)
+					if(fabs(cross-xcross[k])*len<epsilon) amb=1;
+				if(!amb) xcross[ncross++]=cross;
+				incmpt=!incmpt; }}
+		if(!amb) return incmpt; }
+
+	incmpt=0;																				// no box information
 	for(k=0;k<cmpt->npts&&incmpt==0;k++) {
 		pcross=0;
 		for(s=0;s<cmpt->nsrf&&!pcross;s++) {
 			srf=cmpt->surflist[s];
 			for(ps=0;ps<PSMAX&&!pcross;ps++)
 				for(p=0;p<srf->npanel[ps]&&!pcross;p++)
-					if(lineXpanel(pos,cmpt->points[k],srf->panels[ps][p],sim->dim,crsspt,NULL,NULL,NULL,NULL,NULL)) 
+					if(lineXpanel(pos,cmpt->points[k],srf->panels[ps][p],dim,crsspt,NULL,NULL,NULL,NULL,NULL)) 
 						pcross=1; }
 		if(pcross==0) incmpt=1; }
+	return incmpt; }
+
+
+/* posincompart.  Tests if position pos is in compartment cmpt, returning 1 if
+so and 0 if not.  This includes composed compartment logic tests.  It does not
+use the compartment box list, but does use the compartment box classification,
+if it has been computed, as described for posincompartsurf. */
+int posincompart(simptr sim,double *pos,compartptr cmpt) {
+	int cl,incmpt,incmptl;
+	enum CmptLogic sym;
+
+	incmpt=posincompartsurf(sim,pos,cmpt);
 
 	for(cl=0;cl<cmpt->ncmptl;cl++) {
 		incmptl=posincompart(sim,pos,cmpt->cmptl[cl]);
@@ -156,6 +247,8 @@ compartptr compartalloc(void) {
 	cmpt->boxlist=NULL;
 	cmpt->boxfrac=NULL;
 	cmpt->cumboxvol=NULL;
+	cmpt->boxclass=NULL;
+	cmpt->volpts=100;
 	return cmpt; }
 
 
@@ -164,6 +257,7 @@ void compartfree(compartptr cmpt) {
 	int k;
 
 	if(!cmpt) return;
+	free(cmpt->boxclass);
 	free(cmpt->cumboxvol);
 	free(cmpt->boxfrac);
 	free(cmpt->boxlist);
@@ -234,7 +328,7 @@ stdout. */
 void compartoutput(simptr sim) {
 	compartssptr cmptss;
 	compartptr cmpt;
-	int c,dim,s,k,d,cl;
+	int c,dim,s,k,d,cl,b,nin,nbord;
 	char string[STRCHAR];
 
 	cmptss=sim->cmptss;
@@ -257,8 +351,14 @@ void compartoutput(simptr sim) {
 		printf("  %i logically combined compartments\n",cmpt->ncmptl);
 		for(cl=0;cl<cmpt->ncmptl;cl++)
 			printf("   %s %s\n",cmptcl2string(cmpt->clsym[cl],string),cmpt->cmptl[cl]->cname);
-		printf("  volume: %g\n",cmpt->volume);
-		printf("  %i virtual boxes listed\n",cmpt->nbox); }
+		printf("  volume: %g, from %i sample points per boundary box\n",cmpt->volume,cmpt->volpts);
+		printf("  %i virtual boxes listed\n",cmpt->nbox);
+		if(cmpt->boxclass && sim->boxs) {
+			nin=nbord=0;
+			for(b=0;b<sim->boxs->nbox;b++) {
+				if(cmpt->boxclass[b]==CBCin) nin++;
+				else if(cmpt->boxclass[b]>=CBCbordout) nbord++; }
+			printf("  box classification: %i inside, %i on boundary, %i outside\n",nin,nbord,sim->boxs->nbox-nin-nbord); }}
 	printf("\n");
 	return; }
 
@@ -287,6 +387,7 @@ void writecomparts(simptr sim,FILE *fptr) {
 			fprintf(fptr,"\n"); }
 		for(cl=0;cl<cmpt->ncmptl;cl++)
 			fprintf(fptr,"compartment %s %s\n",cmptcl2string(cmpt->clsym[cl],string),cmpt->cmptl[cl]->cname);
+		fprintf(fptr,"volume_samples %i\n",cmpt->volpts);
 		fprintf(fptr,"end_compartment\n\n"); }
 	return; }
 
@@ -412,6 +513,97 @@ int compartaddcmptl(compartptr cmpt,compartptr cmptl,enum CmptLogic sym) {
 	return 0; }
 
 
+/* compartsetvolpts.  Sets the number of sample points that are used for
+estimating the volume fraction of each compartment boundary box to volpts.
+Returns 0 for success or 2 if volpts is less than 1. */
+int compartsetvolpts(compartptr cmpt,int volpts) {
+	if(volpts<1) return 2;
+	cmpt->volpts=volpts;
+	compartsetcondition(cmpt->cmptss,SCparams,0);
+	return 0; }
+
+
+/* compartboxvolfrac.  Returns the fraction of the volume of box bptr that is
+inside compartment cmpt.  This tests cmpt->volpts points that are placed in the
+box with the R_d (Kronecker) low-discrepancy sequence.  These points stratify
+the box evenly, so the result has much less noise than the same number of random
+points, and it is deterministic, so it does not depend on the random number
+generator or on the order in which boxes are processed. */
+double compartboxvolfrac(simptr sim,compartptr cmpt,boxptr bptr) {
+	const double alpha[3][3]={{0.6180339887498949,0,0},{0.7548776662466927,0.5698402909980532,0},{0.8191725133961645,0.6710436067037893,0.5497004779019703}};
+	int i,d,dim,ptsin;
+	double pos[DIMMAX],x;
+
+	dim=sim->dim;
+	ptsin=0;
+	for(i=0;i<cmpt->volpts;i++) {
+		for(d=0;d<dim;d++) {
+			x=0.5+(i+1)*alpha[dim-1][d];
+			x-=floor(x);
+			pos[d]=sim->boxs->min[d]+sim->boxs->size[d]*(bptr->indx[d]+x); }
+		if(posincompart(sim,pos,cmpt)) ptsin++; }
+	return (double)ptsin/(double)cmpt->volpts; }
+
+
+#ifdef THREADING
+/* compartvolfracs_threaded.  Thread function for compartvolfracs, which
+computes volume fractions for boxes b1 to b2-1. */
+void* compartvolfracs_threaded(void *data) {
+	PARAMS_compartvolfracs_threaded *pParams;
+	int b;
+
+	pParams=(PARAMS_compartvolfracs_threaded*) data;
+	for(b=pParams->b1;b<pParams->b2;b++) {
+		if(pParams->need[b]==1) pParams->frac[b]=1;
+		else if(pParams->need[b]==-1) pParams->frac[b]=compartboxvolfrac(pParams->sim,pParams->cmpt,pParams->sim->boxs->blist[b]);
+		else pParams->frac[b]=0; }
+	return NULL; }
+#endif
+
+
+/* compartvolfracs.  Computes the volume fraction of every box that is inside
+compartment cmpt, and returns them in frac, which needs to be allocated with one
+element for each box of the simulation.  need lists what is known about each box
+before this is called: 1 means the box is entirely inside, -1 means its volume
+fraction needs to be estimated with compartboxvolfrac, and 0 means it is not in
+the compartment.  If the simulation is threaded, the boxes are divided among the
+threads.  The result is the same either way. */
+void compartvolfracs(simptr sim,compartptr cmpt,int *need,double *frac) {
+	int b,nbox;
+#ifdef THREADING
+	int thread_ndx,nthreads,stride;
+	PARAMS_compartvolfracs_threaded theParams;
+	stack *current_thread_input_stack;
+#endif
+
+	nbox=sim->boxs->nbox;
+#ifdef THREADING
+	if(sim->threads && sim->threads->nthreads>1) {
+		nthreads=sim->threads->nthreads;
+		stride=calculatestride(nbox,nthreads);
+		theParams.sim=sim;
+		theParams.cmpt=cmpt;
+		theParams.need=need;
+		theParams.frac=frac;
+		for(thread_ndx=0;thread_ndx<nthreads;thread_ndx++) {
+			clearthreaddata(sim->threads->thread[thread_ndx]);
+			current_thread_input_stack=sim->threads->thread[thread_ndx]->input_stack;
+			theParams.b1=thread_ndx*stride<nbox?thread_ndx*stride:nbox;
+			theParams.b2=thread_ndx==nthreads-1 || (thread_ndx+1)*stride>nbox?nbox:(thread_ndx+1)*stride;
+			push_data_onto_stack(current_thread_input_stack,&theParams,sizeof(theParams));
+			pthread_create((pthread_t*) sim->threads->thread[thread_ndx]->thread_id,NULL,compartvolfracs_threaded,(void*) current_thread_input_stack->stack_data); }
+		for(thread_ndx=0;thread_ndx<nthreads;thread_ndx++)
+			pthread_join(*((pthread_t*) sim->threads->thread[thread_ndx]->thread_id),NULL);
+		return; }
+#endif
+
+	for(b=0;b<nbox;b++) {
+		if(need[b]==1) frac[b]=1;
+		else if(need[b]==-1) frac[b]=compartboxvolfrac(sim,cmpt,sim->boxs->blist[b]);
+		else frac[b]=0; }
+	return; }
+
+
 /* compartupdatebox.  Updates the listing of box bptr in compartment cmpt,
 according to the rule that boxes should be listed if any portion of them is
 within the compartment and should not be listed if no portion is within the
@@ -427,9 +619,8 @@ box within the compartment needs to be calcuated, this calculates it with a
 hard-coded value of 100 random trial points.  Memory is allocated as needed.
 */
 int compartupdatebox(simptr sim,compartptr cmpt,boxptr bptr,double volfrac) {
-	int ptsmax=100;	// number of random points for volume determination
-	int bc,max,ptsin,i,bc2;
-	double pos[DIMMAX],volfrac2,*newboxfrac,*newcumboxvol,boxvol,vol;
+	int bc,max,bc2;
+	double volfrac2,*newboxfrac,*newcumboxvol,boxvol,vol;
 	boxptr *newboxlist;
 
 	newboxlist=NULL;
@@ -439,12 +630,8 @@ int compartupdatebox(simptr sim,compartptr cmpt,boxptr bptr,double volfrac) {
 	for(bc=0;bc<cmpt->nbox && cmpt->boxlist[bc]!=bptr;bc++);	// check for box already in cmpt
 	if(bc<cmpt->nbox && volfrac==-2) return 0;				// box is listed and volume ok, so return
 
-	if(volfrac<=0) {																// find actual volume fraction
-		ptsin=0;
-		for(i=0;i<ptsmax;i++) {
-			boxrandpos(sim,pos,bptr);
-			if(posincompart(sim,pos,cmpt)) ptsin++; }
-		volfrac2=(double)ptsin/(double)ptsmax; }
+	if(volfrac<=0)																	// find actual volume fraction
+		volfrac2=compartboxvolfrac(sim,cmpt,bptr);
 	else if(volfrac>1) volfrac2=1;
 	else volfrac2=volfrac;
 
@@ -510,6 +697,44 @@ int compartupdatebox(simptr sim,compartptr cmpt,boxptr bptr,double volfrac) {
  	return -1; }
 
 
+/* compartsetboxclass.  Classifies every box of the simulation for compartment
+cmpt, for use by posincompartsurf.  Boxes that list a panel of one of the
+compartment's bounding surfaces are boundary boxes, which are classified by
+whether their reference point (from compartboxrefpt) is inside the surface
+portion of the compartment.  All points of other boxes are on the same side of
+the bounding surfaces, so these boxes are classified as entirely inside or
+entirely outside using their reference points.  Logic compartments are not
+considered here because they are classified separately.  Returns 0 for
+success, 1 for out of memory, or 2 if boxes have not been set up. */
+int compartsetboxclass(simptr sim,compartptr cmpt) {
+	boxssptr boxs;
+	boxptr bptr;
+	int b,p,s,border,in;
+	double pos[DIMMAX];
+	enum CmptBoxClass *boxclass;
+
+	boxs=sim->boxs;
+	if(!boxs || !boxs->nbox) return 2;
+	free(cmpt->boxclass);
+	cmpt->boxclass=NULL;
+	boxclass=(enum CmptBoxClass*) calloc(boxs->nbox,sizeof(enum CmptBoxClass));
+	if(!boxclass) return 1;
+
+	for(b=0;b<boxs->nbox;b++) {
+		bptr=boxs->blist[b];
+		border=0;
+		for(p=0;p<bptr->npanel && !border;p++)
+			for(s=0;s<cmpt->nsrf && !border;s++)
+				if(cmpt->surflist[s]==bptr->panel[p]->srf) border=1;
+		compartboxrefpt(sim,bptr,pos);
+		in=posincompartsurf(sim,pos,cmpt);
+		if(border) boxclass[b]=in?CBCbordin:CBCbordout;
+		else boxclass[b]=in?CBCin:CBCout; }
+
+	cmpt->boxclass=boxclass;
+	return 0; }
+
+
 /* cmptreadstring */
 int cmptreadstring(simptr sim,int cmptindex,char *word,char *line2,char *erstr) {
 	char nm[STRCHAR],nm1[STRCHAR];
@@ -541,7 +766,7 @@ int cmptreadstring(simptr sim,int cmptindex,char *word,char *line2,char *erstr)
 		CHECKS(cmpt,"name has to be entered before surface");
 		itct=sscanf(line2,"%s",nm);
 		CHECKS(itct==1,"error reading surface name");
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		CHECKS(s>=0,"surface name not recognized");
 		er=compartaddsurf(cmpt,sim->srfss->srflist[s]);
 		CHECKS(er!=1,"out of memory adding surface to compartment");
@@ -569,6 +794,14 @@ int cmptreadstring(simptr sim,int cmptindex,char *word,char *line2,char *erstr)
 		CHECKS(er!=2,"cannot a compartment to itself");
 		CHECKS(!strnword(line2,3),"unexpected text following compartment"); }
 
+	else if(!strcmp(word,"volume_samples")) {		// volume_samples
+		CHECKS(cmpt,"name has to be entered before volume_samples");
+		itct=sscanf(line2,"%i",&s);
+		CHECKS(itct==1,"volume_samples format: number");
+		er=compartsetvolpts(cmpt,s);
+		CHECKS(er!=2,"volume_samples number needs to be at least 1");
+		CHECKS(!strnword(line2,2),"unexpected text following volume_samples"); }
+
 	else {																				// unknown word
 		CHECKS(0,"syntax error within compartment block: statement not recognized"); }
 
@@ -623,15 +856,20 @@ int loadcompart(simptr sim,ParseFilePtr *pfpptr,char *line2,char *erstr) {
 
 
 /* setupcomparts.  Sets up the boxes and volumes portions of all compartments.
-Returns 0 for success and 1 for inability to allocate sufficient memory. */
+Boxes are first classified with compartsetboxclass.  Then, for each compartment,
+boxes that are entirely inside are listed with their full volumes, and the volume
+fractions of boxes that the compartment only partly occupies are estimated with
+compartvolfracs, which uses threads if they are enabled.  Volumes are not
+sampled while a checkpoint is being restored, because simreadcheckpoint
+restores them.  Returns 0 for success and 1 for inability to allocate
+sufficient memory. */
 int setupcomparts(simptr sim) {
 	boxssptr boxs;
 	boxptr bptr;
 	compartssptr cmptss;
 	compartptr cmpt;
-	int b,c,s,p,inbox,er,cl;
-	double pos[3];
-	surfaceptr srf;
+	int b,c,d,er,cl,bc,*need;
+	double *frac;
 	enum CmptLogic clsym;
 
 	cmptss=sim->cmptss;
@@ -640,36 +878,51 @@ int setupcomparts(simptr sim) {
 		boxs=sim->boxs;
 		if(!boxs || !boxs->nbox) return 2;
 
+		for(c=0;c<cmptss->ncmpt;c++) {								// box classification
+			er=compartsetboxclass(sim,cmptss->cmptlist[c]);
+			if(er) return 1; }
+
+		need=(int*) calloc(boxs->nbox,sizeof(int));
+		frac=(double*) calloc(boxs->nbox,sizeof(double));
+		if(!need || !frac) {
+			free(need);
+			free(frac);
+			return 1; }
+
 		for(c=0;c<cmptss->ncmpt;c++) {
 			cmpt=cmptss->cmptlist[c];
-			if(cmpt->volume==0) {
+			if(cmpt->volume==0 && !sim->restoring) {
 				cmpt->nbox=0;
 
 				for(b=0;b<boxs->nbox;b++) {
-					bptr=boxs->blist[b];
-					inbox=0;
-					for(p=0;p<bptr->npanel && !inbox;p++) {
-						srf=bptr->panel[p]->srf;
-						for(s=0;s<cmpt->nsrf && !inbox;s++)
-							if(cmpt->surflist[s]==srf) inbox=1; }			// a compartment surface is in the box
-					if(!inbox && cmpt->ncmptl==0) {
-						boxrandpos(sim,pos,bptr);
-						if(posincompart(sim,pos,cmpt)) inbox=2; }		// compartment contains whole box
-					if(inbox) {
-						er=compartupdatebox(sim,cmpt,bptr,inbox==2?1:-1);
-						if(er==-1) return 1; }}
+					need[b]=0;
+					if(cmpt->boxclass[b]>=CBCbordout) need[b]=-1;		// a compartment surface is in the box
+					else if(cmpt->boxclass[b]==CBCin && cmpt->ncmptl==0) need[b]=1; }	// compartment contains whole box
 
 				for(cl=0;cl<cmpt->ncmptl;cl++) {
 					clsym=cmpt->clsym[cl];
 					if(clsym==CLequal || clsym==CLor || clsym==CLxor)
-						for(b=0;b<cmpt->cmptl[cl]->nbox;b++) {
-							bptr=cmpt->cmptl[cl]->boxlist[b];
-							er=compartupdatebox(sim,cmpt,bptr,-2);
-							if(er==-1) return 1; }
-					else if(clsym==CLequalnot || CLornot)
-						for(b=0;b<boxs->nbox;b++) {
-							bptr=boxs->blist[b];
-							er=compartupdatebox(sim,cmpt,bptr,-2); }}}}
+						for(bc=0;bc<cmpt->cmptl[cl]->nbox;bc++) {
+							bptr=cmpt->cmptl[cl]->boxlist[bc];
+							b=0;
+							for(d=0;d<sim->dim;d++) b=boxs->side[d]*b+bptr->indx[d];
+							if(need[b]==0) need[b]=-1; }
+					else
+						for(b=0;b<boxs->nbox;b++)
+							if(need[b]==0) need[b]=-1; }
+
+				compartvolfracs(sim,cmpt,need,frac);
+
+				for(b=0;b<boxs->nbox;b++)
+					if(frac[b]>0) {
+						er=compartupdatebox(sim,cmpt,boxs->blist[b],frac[b]);
+						if(er==-1) {
+							free(need);
+							free(frac);
+							return 1; }}}}
+
+		free(need);
+		free(frac);
 		compartsetcondition(cmptss,SCok,1); }
 
 	return 0; }
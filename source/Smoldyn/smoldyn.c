@@ -139,7 +139,8 @@ void smolsimulategl(simptr sim) {
 	glutTimerFunc(0,TimerFunction,0);
 	sim->clockstt=time(NULL);
 	Sim=sim;
-	er=simdocommands(sim);
+	if(sim->restorename[0]) er=0;				// commands at restored time ran before checkpoint
+	else er=simdocommands(sim);
 	if(er) endsimulate(sim,er);
 	glutMainLoop();
 	return; }
@@ -219,14 +220,18 @@ int main(int argc,char **argv) {
 	sim=NULL;
 
 	er=setupsim(root,fname,&sim,flags);
-	if(!oflag && !pflag && !er) er=scmdopenfiles(sim->cmds,wflag);
+	if(!oflag && !pflag && !er && !sim->nrep && !sim->sweep && !(sim->boxs && sim->boxs->dom)) er=scmdopenfiles(sim->cmds,wflag);
 	
 	if(pflag || er) {
 	      if(!qflag) printf("Simulation skipped\n"); }
 	else { 
 	      fflush(stdout);
 	      fflush(stderr);
-	      if(tflag || !sim->graphss || sim->graphss->graphics==0) {
+	      if(sim->nrep || sim->sweep)
+		      smolsimulateensemble(sim);
+	      else if(sim->boxs && sim->boxs->dom)
+		      smolsimulatedomains(sim);
+	      else if(tflag || !sim->graphss || sim->graphss->graphics==0) {
     	
 		      er=smolsimulate(sim);
 		      endsimulate(sim,er); }
@@ -21,6 +21,14 @@
 
 enum StructCond {SCinit,SClists,SCparams,SCok};
 
+typedef struct namehashstruct {	// hashed index of a list of names
+	int nbucket;								// number of buckets, a power of 2
+	int n;											// number of names indexed
+	int maxn;										// allocated size of next
+	int *bucket;								// first name index in each bucket, or -1 [b]
+	int *next;									// next index in bucket, -1 at end, -2 if unlinked [i]
+	} *namehashptr;
+
 /********************************* Molecules ********************************/
 
 #define MSMAX 5
@@ -39,6 +47,7 @@ typedef struct moleculestruct {
 	enum MolecState mstate;			// physical state of molecule (ms)
 	struct boxstruct *box;			// pointer to box which molecule is in
 	struct panelstruct *pnl;		// panel that molecule is bound to if any
+	int track;									// tracking slot, or -1 if not tracked
 	} *moleculeptr;
 
 typedef struct molsuperstruct {
@@ -47,6 +56,7 @@ typedef struct molsuperstruct {
 	int maxspecies;							// maximum number of species
 	int nspecies;								// number of species, including empty mols.
 	char **spname;							// names of molecular species
+	namehashptr sphash;					// hashed index of spname
 	double **difc;							// diffusion constants [i][ms]
 	double **difstep;						// rms diffusion step [i][ms]
 	double ***difm;							// diffusion matrix [i][ms][d]
@@ -73,6 +83,12 @@ typedef struct molsuperstruct {
 	int ngausstbl;							// number of elements in gausstbl
 	double *gausstbl;						// random numbers for diffusion
 	int *expand;								// whether species expand with libmzr [i]
+	int maxtrack;								// allocated number of tracking slots
+	int ntrack;									// number of tracking slots used
+	moleculeptr *track;					// tracked molecules, NULL if killed [t]
+	int *trackref;							// number of users of tracking slots [t]
+	int nfreetrack;							// number of free tracking slots
+	int *freetrack;							// list of free tracking slots
 	} *molssptr;
 
 /*********************************** Walls **********************************/
@@ -112,6 +128,7 @@ typedef struct rxnstruct {
 	double **prdpos;						// product position vectors [prd][d]
 	struct compartstruct *cmpt;	// compartment reaction occurs in, or NULL
 	struct surfacestruct *srf;	// surface reaction on, or NULL
+	int dirty;									// 1 if parameters need recalculating
 	} *rxnptr;
 
 typedef struct rxnsuperstruct {
@@ -125,8 +142,11 @@ typedef struct rxnsuperstruct {
 	int maxrxn;									// allocated number of reactions
 	int totrxn;									// total number of reactions listed
 	char **rname;								// names of reactions [r]
+	namehashptr rnamehash;			// hashed index of rname
 	rxnptr *rxn;								// list of reactions [r]
 	int *rxnmollist;						// live lists that have reactions [ll]
+	int ndirty;									// number of dirty reactions
+	int alldirty;								// 1 if all reactions are dirty
 	} *rxnssptr;
 
 /********************************* Surfaces *********************************/
@@ -159,6 +179,7 @@ typedef struct panelstruct {
 	int maxneigh;								// maximum number of neighbor panels
 	int nneigh;									// number of neighbor panels
 	struct panelstruct **neigh;	// list of neighbor panels [p]
+	double *neighedge;					// shared edge normal, offset [p*(DIMMAX+1)+d]
 	double *emitterabsorb[2];		// absorption for emitters [face][i]
 	} *panelptr;
 
@@ -191,6 +212,7 @@ typedef struct surfacestruct {
 	double ***emitterpos[2];		// emitter positions [face][i][emit][d]
 	double **sdifc;			//Christine: Surface specific difusion coefficients [i][ms]
 	double **sdifstep;		//Christine: Surface specific difusion coefficients [i][ms]
+	int autoneigh;							// 1 if panel neighbors are found automatically
 	 } *surfaceptr;
 
 typedef struct surfacesuperstruct {
@@ -201,13 +223,26 @@ typedef struct surfacesuperstruct {
 	int nsrf;										// number of surfaces
 	double epsilon;							// max deviation of surface-point from surface
 	double neighdist;						// neighbor distance value
+	double emittertheta;				// opening angle for emitter tree, or 0
 	char **snames;							// surface names [s]
+	namehashptr snamehash;			// hashed index of snames
 	surfaceptr *srflist;				// list of surfaces [s]
 	int maxmollist;							// number of molecule lists allocated
 	int nmollist;								// number of molecule lists used
 	enum SMLflag *srfmollist;		// flags for molecule lists to check [ll]
+	int molflags;								// 1 if srfmollist flags need updating
 	} *surfacessptr;
 
+typedef struct emitnodestruct {	// node of emitter tree
+	int e1;											// first emitter in node
+	int e2;											// last emitter in node, plus 1
+	int child;									// first of two child nodes, or -1
+	double amount;							// total emitter amount
+	double center[DIMMAX];			// center of emitter amount magnitudes [d]
+	double dipole[DIMMAX];			// dipole moment about center [d]
+	double radius;							// largest emitter distance from center
+	} *emitnodeptr;
+
 /*********************************** Boxes **********************************/
 
 typedef struct boxstruct {
@@ -226,6 +261,58 @@ typedef struct boxstruct {
 	moleculeptr **mol;					// lists of live molecules in the box [ll][m]
 	} *boxptr;
 
+enum ObstacleShape {OSbox,OSsphere,OScapsule,OSecoli,OSnone};
+enum ObstBoxClass {OBCclear,OBCblocked,OBCpartial};
+
+typedef struct obstaclestruct {
+	enum ObstacleShape os;			// obstacle shape
+	int include;								// 1 to keep molecules in, 0 to keep them out
+	double poslo[DIMMAX];				// low corner of box shape [d]
+	double poshi[DIMMAX];				// high corner of box shape [d]
+	double cent[DIMMAX];				// sphere center or capsule low end [d]
+	double rad;									// sphere or capsule radius
+	double length;							// capsule length along first axis
+	int nbox;										// number of boxes classified
+	enum ObstBoxClass *boxclass;	// class of each box in boxs->blist [b]
+	} *obstacleptr;
+
+enum DomainClass {DCown,DCedge,DCghost,DCforeign};
+enum DomainMerge {DFsum,DFcat,DFnone};
+
+typedef struct domainstruct {
+	int ndomain;								// number of domains
+	int axis;										// axis that is split into slabs
+	int maxrec;									// capacity of exchange buffers in molecules
+	int domain;									// domain of this process, or -1 if not split
+	int phase;									// bimolecular reaction phase, or -1 for all
+	int lower;									// domain of lower neighbor slab, or -1
+	int upper;									// domain of upper neighbor slab, or -1
+	int wrap;										// 1 if slabs wrap around periodic walls
+	int *start;									// first box layer of each domain [k]
+	enum DomainClass *lclass;		// class of each box layer on axis [i]
+	int nedge;									// number of boxes in own edge layer
+	boxptr *edge;								// boxes in own edge layer [b]
+	int maxsend;								// allocated size of send list
+	int nsend;									// number of molecules to send
+	moleculeptr *send;					// molecules to send to other domains [s]
+	int *sendm;									// live list index of molecules to send [s]
+	int maxghost;								// allocated number of ghost molecules
+	int nghost;									// number of ghost molecules in use
+	moleculeptr *ghost;					// ghosts of upper domain's edge layer [g]
+	int maxsrc;									// allocated size of ghost source list
+	int nsrc;										// number of own molecules sent as ghosts
+	moleculeptr *src;						// own molecules sent as ghosts [g]
+	int *nlsave;								// live list sizes without ghosts [ll]
+	void *shm;									// shared exchange memory
+	size_t shmbytes;						// size of shared exchange memory
+	int sense;									// barrier sense of this process
+	enum DomainMerge *merge;		// how to merge each output file, shared [fid]
+	long int *fpos;							// output file positions before a command [fid]
+	int refused;								// 1 if a command was refused
+	long int sharedseed;				// random number seed common to all domains
+	long int nshared;						// commands run with shared random numbers
+	} *domainptr;
+
 typedef struct boxsuperstruct {
 	enum StructCond condition;	// structure condition
 	struct simstruct *sim;			// simulation structure
@@ -238,11 +325,16 @@ typedef struct boxsuperstruct {
 	double *min;								// position vector for low corner of space
 	double *size;								// length of each side of a box
 	boxptr *blist; 							// actual array of boxes
+	int maxobst;								// allocated size of obstacle list
+	int nobst;									// number of static obstacles
+	obstacleptr *obstlist;			// list of static obstacles [o]
+	domainptr dom;							// domain decomposition, or NULL
 	} *boxssptr;
 
 /******************************* Compartments *******************************/
 
 enum CmptLogic {CLequal,CLequalnot,CLand,CLor,CLxor,CLandnot,CLornot,CLnone};
+enum CmptBoxClass {CBCout,CBCin,CBCbordout,CBCbordin};
 
 typedef struct compartstruct {
 	struct compartsuperstruct *cmptss;	// compartment superstructure
@@ -260,6 +352,8 @@ typedef struct compartstruct {
 	boxptr *boxlist;						// list of boxes inside compartment [b]
 	double *boxfrac;						// fraction of box volume that's inside [b]
 	double *cumboxvol;					// cumulative cmpt. volume of boxes [b]
+	enum CmptBoxClass *boxclass;	// class of each box in boxs->blist [b]
+	int volpts;									// sample points for box volume fractions
 	} *compartptr;
 
 typedef struct compartsuperstruct {
@@ -273,11 +367,20 @@ typedef struct compartsuperstruct {
 
 /*********************************** Ports **********************************/
 
+#define PORTRINGMAX 65536
+
+enum PortRing {PRnone,PRexport,PRimport};
+
 typedef struct portstruct {
 	char *portname;							// port name (reference, not owned)
 	surfaceptr srf;							// porting surface (ref.)
 	enum PanelFace face;				// active face of porting surface
 	int llport;									// live list number for buffer
+	enum PortRing ringdir;			// direction of shared memory ring, if any
+	char *ringname;							// shared memory name of ring
+	int ringcap;								// number of records in ring
+	void *ring;									// mapped ring, or NULL if not open
+	long int ringbytes;					// size of mapped ring
 	} *portptr;
 
 typedef struct portsuperstruct {
@@ -307,17 +410,35 @@ typedef struct mzrsuperstruct {
 	int maxnamehash;									// allocated size of name hash
 	int nnamehash;										// actual size of name hash
 	char **tagname;										// hash list of mzr tagged names
+	namehashptr taghash;							// hashed index of tagname
 	char **smolname;									// hash list of Smoldyn names
 	int maxrxnhash;										// allocated size of reaction hash
 	int nrxnhash;											// actual size of reaction hash
 	char **mzrrxn;										// hash list of mzr reaction names
 	char **smolrxn;										// hash list of Smoldyn reaction names
+	int nextrxnnum;										// number for next Smoldyn reaction name
 	int maxspecies;										// allocated size of species list
 	enum MolecState *defaultstate;		// default state for each species [i]
 	int refspecies;										// species for diffusion coeff. reference
 	double refmass;										// mass of reference species
 	double refdifc[MSMAX];						// diffusion coefficients of ref. species
 	int expandall;										// flag for full expansion at initialize
+	int expandasync;									// flag for expansion in background thread
+	int running;											// 1 if expansion thread is running
+	int quit;													// 1 tells expansion thread to stop
+	int maxqueue;											// allocated size of expansion queue
+	int nqueue;												// number of species in expansion queue
+	char **queue;											// Smoldyn names waiting to expand [q]
+	int pending;											// 1 if expansion results aren't staged
+	int staged;												// 1 if expansion results are staged
+	void *stagedspecies;							// staged new species array
+	int nstagedspecies;								// number of staged new species
+	void *stagedrxns;									// staged new reaction array
+	int nstagedrxns;									// number of staged new reactions
+	void *thread_id;									// expansion thread
+	void *mutex;											// lock for queue and staged results
+	void *cond;												// signal for queue and staged results
+	void *mzrlock;										// recursive lock for moleculizer object
 	} *mzrssptr;
 
 /******************************** Threading ********************************/
@@ -367,11 +488,92 @@ typedef struct graphicssuperstruct {
 	GLfloat lightpos[MAXLIGHTS][3];	// light positions [lt][d]
 	} *graphicsssptr;
 
+/********************************* Commands ********************************/
+
+enum ObsType {OTmolcount,OTmolcountincmpt,OTmolcountspace,OTmolmoments};
+
+typedef struct obsstruct {		// observer for fused observation commands
+	cmdptr cmd;									// owning command, or NULL if freed
+	enum ObsType type;					// type of observer
+	double key[7];							// command timing, which defines group
+	int i;											// species, or <0 for all
+	enum MolecState ms;					// molecule state
+	int ll;											// only live list needed, or -1 for all
+	compartptr cmpt;						// compartment for OTmolcountincmpt
+	int axis;										// histogram axis for OTmolcountspace
+	int nbin;										// number of histogram bins
+	double low[DIMMAX];					// low edge of counting region [d]
+	double high[DIMMAX];				// high edge of counting region [d]
+	int maxct;									// allocated size of ct
+	int *ct;										// counts from the last sweep [i or bin]
+	int nmom;										// molecules counted for OTmolmoments
+	double ref[DIMMAX];					// reference position for moments [d]
+	double sum[DIMMAX];					// position sums relative to ref [d]
+	double sum2[DIMMAX*DIMMAX];	// position product sums relative to ref [d*dim+d2]
+	double sweeptime;						// simulation time of last sweep
+	int epoch;									// planner epoch of last sweep
+	int fresh;									// 1 if sweep results have not been used
+	} *obsptr;
+
+typedef struct obsplanstruct {	// planner for fused observation commands
+	int maxobs;									// allocated number of observers
+	int nobs;										// number of observers
+	obsptr *obs;								// list of observers [o]
+	int epoch;									// incremented by commands that aren't fused
+	} *obsplanptr;
+
+#define OUTBLOCK 65536
+#define OUTMAXQUEUE 16777216
+
+typedef struct outblockstruct {	// block of formatted output for one file
+	FILE *fptr;									// destination file
+	char *data;									// formatted text
+	int n;											// number of characters in data
+	int max;										// allocated size of data
+	struct outblockstruct *next;	// next block in writer queue
+	} *outblockptr;
+
+typedef struct outssstruct {	// buffered output superstructure
+	int maxqueue;								// queued bytes before back-pressure, 0 to disable
+	int maxbuf;									// allocated number of file buffers
+	int nbuf;										// number of file buffers
+	outblockptr *buf;						// buffers being filled, one per file [b]
+	outblockptr head;						// first block in writer queue
+	outblockptr tail;						// last block in writer queue
+	int queued;									// bytes queued or being written
+	int running;								// 1 if writer thread is running
+	int quit;										// 1 tells writer thread to exit
+	void *thread_id;						// writer thread
+	void *mutex;								// lock for queue
+	void *cond;									// signal for writer and for space
+	} *outssptr;
+
+#define SNAPMAX 2
+
+typedef struct snapssstruct {	// snapshot process superstructure
+	int maxsnap;								// maximum running snapshots, 0 to run in place
+	int nsnap;									// number of running snapshot processes
+	int *pid;										// process IDs of running snapshots [n]
+	} *snapssptr;
+
 /******************************** Simulation *******************************/
 
-#define ETMAX 10
+typedef struct sweepstruct {	// parameter sweep
+	int maxpoint;								// allocated number of listed points
+	int npoint;									// number of listed points
+	char **label;								// labels of listed points [p]
+	int maxstmt;								// allocated number of statements
+	int nstmt;									// number of statements
+	int *point;									// listed point of statement, -1 for grid axis [s]
+	char **stmt;								// configuration statement text [s]
+	char **value;								// values for grid axis [s]
+	int *nvalue;								// number of values for grid axis [s]
+	char *outname;							// file for results, empty for stdout
+	} *sweepptr;
+
+#define ETMAX 11							// event types; names are etname and etcol in smolsim.c
 enum SmolStruct {SSmolec,SSwall,SSrxn,SSsurf,SSbox,SScmpt,SSport,SScmd,SSmzr,SSsim,SScheck,SSall,SSnone};
-enum EventType {ETwall,ETsurf,ETdesorb,ETrxn0,ETrxn1,ETrxn2intra,ETrxn2inter,ETrxn2wrap,ETimport,ETexport};
+enum EventType {ETwall,ETsurf,ETdesorb,ETrxn0,ETrxn1,ETrxn2intra,ETrxn2inter,ETrxn2wrap,ETimport,ETexport,ETimportdrop};
 
 typedef int (*diffusefnptr)(struct simstruct *);
 typedef int (*surfaceboundfnptr)(struct simstruct *,int);
@@ -407,6 +609,18 @@ typedef struct simstruct {
 	portssptr portss;						// port superstructure
 	mzrssptr mzrss;							// network generation rule superstructure
 	cmdssptr cmds;							// command superstructure
+	obsplanptr obsplan;					// planner for observation commands
+	outssptr outss;							// buffered output for commands
+	snapssptr snapss;						// snapshot processes for commands
+	char *ckptname;							// checkpoint to write after commands
+	char *restorename;					// checkpoint to restore after set up
+	int cmdreplay;							// 1 while command timing is replayed
+	int restoring;							// 1 while set up for a checkpoint restore
+	int updatedepth;						// recursion depth of simupdate
+	int started;								// 1 once the initial commands have run
+	int nrep;										// number of ensemble replicates, 0 for one run
+	int maxrep;									// most replicates at once, 0 for one per CPU
+	sweepptr sweep;							// parameter sweep
 	graphicsssptr graphss;			// graphics superstructure
 	threadssptr threads;				// pthreads superstructure
 	diffusefnptr diffusefn;											// function for molecule diffusion
@@ -471,9 +685,14 @@ int setupmols(simptr sim);
 void molkill(simptr sim,moleculeptr mptr,int ll,int m);
 moleculeptr getnextmol(molssptr mols);
 moleculeptr newestmol(molssptr mols);
+int moltrack(molssptr mols,moleculeptr mptr);
+void moluntrack(molssptr mols,int t);
+moleculeptr moltracked(molssptr mols,int t);
 int addmol(simptr sim,int nmol,int ident,double *poslo,double *poshi,int sort);
 int addsurfmol(simptr sim,int nmol,int ident,enum MolecState ms,double *pos,panelptr pnl,int surface,enum PanelShape ps,char *pname);
 int addcompartmol(simptr sim,int nmol,int ident,compartptr cmpt);
+int addmolbulk(simptr sim,int nmol,int *ident,double *pos,int sort);
+int molgetbulk(simptr sim,int ident,enum MolecState ms,int max,int kill,int *identout,enum MolecState *msout,long int *sernoout,double *posout);
 int molgetexport(simptr sim,int ident,enum MolecState ms);
 int molputimport(simptr sim,int nmol,int ident,enum MolecState ms,panelptr pnl,enum PanelFace face);
 int moldummyporter(simptr sim);
@@ -527,6 +746,7 @@ int rxnreactantstate(rxnptr rxn,enum MolecState *mstate,int convertb2f);
 int rxnallstates(rxnptr rxn);
 int findreverserxn(simptr sim,int order,int r,int *optr,int *rptr);
 int rxnisprod(simptr sim,int i,enum MolecState ms,int code);
+int rxnisprodmoving(simptr sim,rxnptr rxn,int prd);
 
 // memory management
 rxnptr rxnalloc(int order,int max_surface);
@@ -546,10 +766,15 @@ int rxnsetproduct(simptr sim,int order,int r,char *erstr);
 int rxnsetproducts(simptr sim,int order,char *erstr);
 double rxncalcrate(simptr sim,int order,int r,double *pgemptr);
 void rxncalctau(simptr sim,int order);
+void rxnsettau(simptr sim,int order,int r);
+void rxnspreaddirty(simptr sim);
 int rxnsettimestep(simptr sim);
 
 // structure set up
 void rxnsetcondition(simptr sim,int order,enum StructCond cond,int upgrade);
+void rxnsetdirty(simptr sim,rxnptr rxn);
+void rxnsetspeciesdirty(simptr sim,int ident);
+int rxnupdatemollist(simptr sim,int order,int r);
 int rxnsetmollist(simptr sim,int order);
 int RxnSetValue(simptr sim,char *option,rxnptr rxn,double value);
 int RxnSetRevparam(simptr sim,rxnptr rxn,enum RevParam rparamt,double rparam,int prd,double *pos,int dim);
@@ -594,6 +819,7 @@ double surfacearea(surfaceptr srf,int dim,int *totpanelptr);
 double surfacearea2(simptr sim,int surface,enum PanelShape ps,char *pname,int *totpanelptr);
 void panelrandpos(panelptr pnl,double *pos,int dim);
 panelptr surfrandpos(surfaceptr srf,double *pos,int dim);
+int surfrandposbulk(surfaceptr srf,int n,double *pos,panelptr *pnls,int dim);
 int issurfprod(simptr sim,int i,enum MolecState ms);
 int srfsamestate(enum MolecState ms1,enum PanelFace face1,enum MolecState ms2,enum MolecState *ms3ptr);
 void srfreverseaction(enum MolecState ms1,enum PanelFace face1,enum MolecState ms2,enum MolecState *ms3ptr,enum PanelFace *face2ptr,enum MolecState *ms4ptr);
@@ -622,6 +848,7 @@ surfaceptr surfaddsurface(simptr sim,char *surfname);
 void surfsetcondition(surfacessptr surfss,enum StructCond cond,int upgrade);
 int surfsetepsilon(simptr sim,double epsilon);
 int surfsetneighdist(simptr sim,double neighdist);
+int surfsetemittertheta(simptr sim,double theta);
 int surfsetcolor(surfaceptr srf,enum PanelFace face,double *rgba);
 int surfsetedgepts(surfaceptr srf,double value);
 int surfsetstipple(surfaceptr srf,unsigned int factor,unsigned int pattern);
@@ -631,15 +858,23 @@ int surfsetaction(surfaceptr srf,int i,enum MolecState ms,enum PanelFace face,en
 int surfsetrate(surfaceptr srf,int ident,enum MolecState ms,enum MolecState ms1,enum MolecState ms2,int newident,double value,int which);
 int surfsetmaxpanel(surfaceptr srf,int dim,enum PanelShape ps,int maxpanel);
 int surfaddpanel(surfaceptr srf,int dim,enum PanelShape ps,char *string,double *params,char *name);
+int surfaddmesh(surfaceptr srf,int dim,char *fname,int orient);
+int emittertreebuild(int nemit,double *amount,double **pos,int dim,int *order,emitnodeptr tree);
+int emittertreesum(emitnodeptr tree,int n,int *order,double *amount,double **pos,int dim,double theta,double *x,double *normal,double *numer,double *denom);
+int emitterkappas(simptr sim,surfaceptr srf,enum PanelFace face,int i,emitnodeptr tree,int *order,panelptr *pnllist,int p1,int p2,double *kappa);
 int surfsetemitterabsorption(simptr sim);
 int surfsetjumppanel(surfaceptr srf,panelptr pnl1,enum PanelFace face1,int bidirect,panelptr pnl2,enum PanelFace face2);
 double srfcalcrate(simptr sim,surfaceptr srf,int i,enum MolecState ms1,enum PanelFace face,enum MolecState ms2);
 double srfcalcprob(simptr sim,surfaceptr srf,int i,enum MolecState ms1,enum PanelFace face,enum MolecState ms2);
 int surfsetneighbors(panelptr pnl,panelptr *neighlist,int nneigh,int add);
+void paneledgenormal(panelptr pnl,int pt1,int pt2,int dim,double *edge);
+int surfvertexneighbors(panelptr *pnltbl,int npnl,int *vfirst,int *vid,int nid,int dim);
+int surfautoneighbors(simptr sim);
 int surfaddemitter(surfaceptr srf,enum PanelFace face,int i,double amount,double *pos,int dim);
 surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char *erstr);
 int loadsurface(simptr sim,ParseFilePtr *pfpptr,char *line2,char *erstr);
 int surfupdateparams(simptr sim);
+int surfupdatemolflags(simptr sim);
 int surfupdatelists(simptr sim);
 
 // core simulation functions
@@ -670,6 +905,11 @@ void boxrandpos(simptr sim,double *pos,boxptr bptr);
 int panelinbox(simptr sim,panelptr pnl,boxptr bptr);
 int boxaddmol(moleculeptr mptr,int ll);
 void boxremovemol(moleculeptr mptr,int ll);
+enum ObstacleShape boxstring2os(char *string);
+char *boxos2string(enum ObstacleShape os,char *string);
+int obstacleinside(obstacleptr obst,double *pos,int dim);
+void obstacleputin(obstacleptr obst,double *pos,int dim);
+enum ObstBoxClass obstacleboxclass(obstacleptr obst,double *lo,double *hi,int dim);
 
 // memory management
 boxptr boxalloc(int dim,int nlist);
@@ -680,6 +920,9 @@ boxptr *boxesalloc(int nbox,int dim,int nlist);
 void boxesfree(boxptr *blist,int nbox,int nlist);
 boxssptr boxssalloc(int dim);
 void boxssfree(boxssptr boxs);
+void obstaclefree(obstacleptr obst);
+domainptr domainalloc(void);
+void domainfree(domainptr dom);
 
 // data structure output
 void boxoutput(boxssptr boxs,int blo,int bhi,int dim);
@@ -689,12 +932,31 @@ int checkboxparams(simptr sim,int *warnptr);
 // structure set up
 void boxsetcondition(boxssptr boxs,enum StructCond cond,int upgrade);
 int boxsetsize(simptr sim,char *info,double val);
+int boxaddobstacle(simptr sim,int include,enum ObstacleShape os,double *params);
+int boxsetobstacles(simptr sim);
 int setupboxes(simptr sim);
+int boxsetdomains(simptr sim,int ndomain,int axis,int maxrec);
+int domaincompactmols(simptr sim,int ndead);
+int domainsplit(simptr sim,int k,void *shm);
 
 // core simulation functions
 boxptr line2nextbox(simptr sim,double *pt1,double *pt2,boxptr bptr);
+boxptr obstaclecheck(simptr sim,moleculeptr mptr,boxptr bptr);
 int reassignmolecs(simptr sim,int diffusing,int reborn);
 
+// domain decomposition
+size_t domainshmsize(simptr sim);
+void domainbuffers(domainptr dom,int **countptr,void **mailptr,void **ghostptr,int **killptr);
+int domainbarrier(domainptr dom);
+void domainabort(domainptr dom);
+int domainpair(domainptr dom,boxptr bptr1,boxptr bptr2);
+int domainsend(domainptr dom,moleculeptr mptr,int m);
+void domainmol2rec(simptr sim,moleculeptr mptr,void *rec);
+void domainrec2mol(simptr sim,void *rec,moleculeptr mptr);
+int domainmigrate(simptr sim);
+int domainclip(simptr sim,long int serno);
+int domainbimolreact(simptr sim);
+
 /******************************* Compartments *******************************/
 
 // enumerated types
@@ -702,6 +964,8 @@ enum CmptLogic cmptstring2cl(char *string);
 char *cmptcl2string(enum CmptLogic cls,char *string);
 
 // low level utilities
+void compartboxrefpt(simptr sim,boxptr bptr,double *pos);
+int posincompartsurf(simptr sim,double *pos,compartptr cmpt);
 int posincompart(simptr sim,double *pos,compartptr cmpt);
 int compartrandpos(simptr sim,double *pos,compartptr cmpt);
 
@@ -721,7 +985,11 @@ void compartsetcondition(compartssptr cmptss,enum StructCond cond,int upgrade);
 int compartaddsurf(compartptr cmpt,surfaceptr srf);
 int compartaddpoint(compartptr cmpt,int dim,double *point);
 int compartaddcmptl(compartptr cmpt,compartptr cmptl,enum CmptLogic sym);
+int compartsetvolpts(compartptr cmpt,int volpts);
+double compartboxvolfrac(simptr sim,compartptr cmpt,boxptr bptr);
+void compartvolfracs(simptr sim,compartptr cmpt,int *need,double *frac);
 int compartupdatebox(simptr sim,compartptr cmpt,boxptr bptr,double volfrac);
+int compartsetboxclass(simptr sim,compartptr cmpt);
 int cmptreadstring(simptr sim,int cmptindex,char *word,char *line2,char *erstr);
 int loadcompart(simptr sim,ParseFilePtr *pfpptr,char *line2,char *erstr);
 int setupcomparts(simptr sim);
@@ -744,12 +1012,17 @@ void portsetcondition(portssptr portss,enum StructCond cond,int upgrade);
 portptr addport(portssptr portss,char *portname,surfaceptr srf,enum PanelFace face);
 int portreadstring(simptr sim,int portindex,char *word,char *line2,char *erstr);
 int loadport(simptr sim,ParseFilePtr *pfpptr,char* line2,char *erstr);
+int portsetring(portptr port,enum PortRing dir,char *name,int capacity);
+int portopenring(simptr sim,portptr port);
 int setupports(simptr sim);
 
 // core simulation functions
 int portgetmols(simptr sim,portptr port,int ident,enum MolecState ms);
+int portgetmolsbulk(simptr sim,portptr port,int *count);
 int portputmols(simptr sim,portptr port,int nmol,int ident);
+int portputmolsbulk(simptr sim,portptr port,int nspecies,int *count);
 int porttransport(simptr sim1,portptr port1,simptr sim2,portptr port2);
+int portexchange(simptr sim);
 
 /******************************** Moleculizer *******************************/
 
@@ -802,6 +1075,11 @@ int mzrsetupmoleculizer(simptr sim,char *erstr);
 int mzrExpandSpecies(simptr sim,int ident);
 int mzrExpandNetwork(simptr sim);
 int mzrExpandUnexpandedSpecies(simptr sim);
+int mzrlock(mzrssptr mzrss,int code);
+int mzrExpandQueue(mzrssptr mzrss,char *smolname);
+void* mzrExpandThread(void *data);
+int mzrMergeExpansion(simptr sim);
+void mzrExpandStop(mzrssptr mzrss);
 int mzrAddRxn(simptr sim,char *name,int order,int *reactants,int *products,int nprod,double rate);
 
 /******************************** Threading *********************************/
@@ -846,6 +1124,20 @@ void RenderSim(simptr sim);
 
 enum CMDcode docommand(void *cmdfnarg,cmdptr cmd,char *line);
 void cmdmeansqrdispfree(cmdptr cmd);
+void obsplanfree(obsplanptr plan);
+obsptr obsregister(simptr sim,cmdptr cmd,enum ObsType type,int i,enum MolecState ms);
+int obssweep(simptr sim,obsptr obs);
+outssptr outssalloc(void);
+void outssfree(outssptr outss);
+int outsetmaxqueue(simptr sim,int maxqueue);
+int outprintf(simptr sim,FILE *fptr,const char *format,...);
+int outprintVD(simptr sim,FILE *fptr,double *c,int n);
+size_t outwrite(simptr sim,FILE *fptr,const void *data,size_t n);
+void outflush(simptr sim);
+snapssptr snapssalloc(int maxsnap);
+void snapssfree(snapssptr snapss);
+int snapsetmax(simptr sim,int maxsnap);
+void snapwait(simptr sim,int max);
 
 /******************************** Simulation ********************************/
 
@@ -856,6 +1148,10 @@ char *simsc2string(enum StructCond sc,char *string);
 
 // low level utilities
 void Simsetrandseed(simptr sim,long int randseed);
+unsigned int namehashkey(char *name);
+void namehashfree(namehashptr nh);
+int namehashupdate(namehashptr *nhptr,char **names,int n);
+int namehashfind(namehashptr *nhptr,char **names,int n,char *name);
 
 // memory management
 simptr simalloc(char *root);
@@ -871,16 +1167,34 @@ int simsetpthreads(simptr sim,int number);
 void simsetcondition(simptr sim,enum StructCond cond,int upgrade);
 int simsetdim(simptr sim,int dim);
 int simsettime(simptr sim,double time,int code);
+int simsetreplicates(simptr sim,int nrep,int maxrep);
 int simreadstring(simptr sim,char *word,char *line2,char *erstr);
 int loadsim(simptr sim,char *fileroot,char *filename,char *erstr,char *flags);
 int simupdate(simptr sim,char *erstr);
 int setupsim(char *root,char *filename,simptr *smptr,char *flags);
 
+// checkpoints
+int simpanelindex(simptr sim,panelptr pnl,int *sptr,int *psptr);
+int simwritecheckpoint(simptr sim,char *filename);
+int simreadcheckpoint(simptr sim,char *filename,char *erstr);
+
+// parameter sweeps
+sweepptr sweepalloc(void);
+void sweepfree(sweepptr sweep);
+int sweepaddstatement(simptr sim,char *label,char *line);
+int sweepsetoutput(simptr sim,char *filename);
+int sweepnumber(sweepptr sweep);
+int sweeppoint(sweepptr sweep,int pt,int *vindex,char *label);
+int sweepapply(simptr sim,int pt,char *erstr);
+
 // core simulation functions
 int simdocommands(simptr sim);
 int simulatetimestep(simptr sim);
 void endsimulate(simptr sim,int er);
 int smolsimulate(simptr sim);
+int smolsimulateensemble(simptr sim);
+int domainmergefiles(simptr sim,char *froot,int ndomain,enum DomainMerge *merge);
+int smolsimulatedomains(simptr sim);
 
 /********************************* Threads **********************************/
 //???????????? all of this section is new, and undocumented
@@ -127,7 +127,7 @@ int readmolname(simptr sim,char *str,enum MolecState *msptr) {
 	else ms=MSsoln;
 	if(!strcmp(nm,"all")) i=-5;		// all
 	else {
-		i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 		if(i<0) return -4; }		// unknown molecule name
 	if(msptr) *msptr=ms;
 	return i; }
@@ -271,6 +271,8 @@ void molsetdifc(simptr sim,int ident,enum MolecState ms,double difc) {
 		for(ms=mslo;ms<mshi;ms++)
 			sim->mols->difc[i][ms]=difc;
 	molsetcondition(sim->mols,SCparams,0);
+	rxnsetspeciesdirty(sim,ident);
+	if(sim->srfss) sim->srfss->molflags=1;
 	return; }
 
 
@@ -540,6 +542,7 @@ moleculeptr molalloc(int dim) {
 	mptr->mstate=MSsoln;
 	mptr->box=NULL;
 	mptr->pnl=NULL;
+	mptr->track=-1;
 
 	CHECK(mptr->pos=(double*)calloc(dim,sizeof(double)));
 	CHECK(mptr->posx=(double*)calloc(dim,sizeof(double)));
@@ -581,6 +584,7 @@ molssptr molssalloc(int maxspecies) {
 	mols->maxspecies=maxspecies;
 	mols->nspecies=1;
 	mols->spname=NULL;
+	mols->sphash=NULL;
 	mols->difc=NULL;
 	mols->difstep=NULL;
 	mols->difm=NULL;
@@ -607,6 +611,12 @@ molssptr molssalloc(int maxspecies) {
 	mols->ngausstbl=0;
 	mols->gausstbl=NULL;
 	mols->expand=NULL;
+	mols->maxtrack=0;
+	mols->ntrack=0;
+	mols->track=NULL;
+	mols->trackref=NULL;
+	mols->nfreetrack=0;
+	mols->freetrack=NULL;
 
 	CHECK(mols->spname=(char**) calloc(maxspecies,sizeof(char*)));
 	for(i=0;i<maxspecies;i++) mols->spname[i]=NULL;
@@ -845,6 +855,10 @@ void molssfree(molssptr mols) {
 
 	free(mols->expand);
 
+	free(mols->freetrack);
+	free(mols->trackref);
+	free(mols->track);
+
 	free(mols->gausstbl);
 
 	for(ll=0;ll<mols->maxlist;ll++) {
@@ -909,6 +923,7 @@ void molssfree(molssptr mols) {
 	if(mols->spname) {
 		for(i=0;i<maxspecies;i++) free(mols->spname[i]);
 		free(mols->spname); }
+	namehashfree(mols->sphash);
 
 	free(mols);
 	return; }
@@ -1288,13 +1303,13 @@ int moladdspecies(simptr sim,char *nm) {
 	if(mols->nspecies==mols->maxspecies) return -3;
 	if(!strcmp(nm,"empty")) return -4;
 
-	found=stringfind(mols->spname,mols->nspecies,nm);
+	found=namehashfind(&mols->sphash,mols->spname,mols->nspecies,nm);
 	if(found>=0) return -5;
 
 	strncpy(mols->spname[mols->nspecies++],nm,STRCHAR);
+	namehashupdate(&mols->sphash,mols->spname,mols->nspecies);
 	molsetcondition(mols,SClists,0);
-	rxnsetcondition(sim,-1,SClists,0);
-	surfsetcondition(sim->srfss,SClists,0);
+	if(sim->srfss) sim->srfss->molflags=1;		// new species has no reactions yet
 	return mols->nspecies-1; }
 
 
@@ -1436,6 +1451,9 @@ void molkill(simptr sim,moleculeptr mptr,int ll,int m) {
 	mptr->list=-1;
 	for(d=0;d<sim->dim;d++) mptr->posoffset[d]=0;
 	mptr->pnl=NULL;
+	if(mptr->track>=0) {
+		sim->mols->track[mptr->track]=NULL;
+		mptr->track=-1; }
 	if(m<0) sim->mols->sortl[ll]=0;
 	else if(m<sim->mols->sortl[ll]) sim->mols->sortl[ll]=m;
 	return; }
@@ -1459,6 +1477,68 @@ moleculeptr newestmol(molssptr mols) {
 	return mols->dead[mols->topd-1]; }
 
 
+/* moltrack.  Starts tracking molecule mptr and returns its tracking slot, which
+is a handle that stays valid when the molecule moves between lists or changes
+species.  If the molecule is already tracked, this returns its existing slot.
+Each call needs to be matched with a call to moluntrack when the slot is no
+longer needed.  Use moltracked to get the molecule for a slot.  Returns -1 if
+memory could not be allocated. */
+int moltrack(molssptr mols,moleculeptr mptr) {
+	int t,maxtrack,*newref,*newfree;
+	moleculeptr *newtrack;
+
+	if(mptr->track>=0) {
+		mols->trackref[mptr->track]++;
+		return mptr->track; }
+
+	if(mols->nfreetrack) t=mols->freetrack[--mols->nfreetrack];
+	else {
+		if(mols->ntrack==mols->maxtrack) {				// expand tracking table
+			maxtrack=2*mols->maxtrack+1;
+			newtrack=(moleculeptr*) calloc(maxtrack,sizeof(moleculeptr));
+			newref=(int*) calloc(maxtrack,sizeof(int));
+			newfree=(int*) calloc(maxtrack,sizeof(int));
+			if(!newtrack || !newref || !newfree) {
+				free(newtrack);
+				free(newref);
+				free(newfree);
+				return -1; }
+			for(t=0;t<mols->ntrack;t++) {
+				newtrack[t]=mols->track[t];
+				newref[t]=mols->trackref[t]; }
+			for(t=0;t<mols->nfreetrack;t++) newfree[t]=mols->freetrack[t];
+			free(mols->track);
+			free(mols->trackref);
+			free(mols->freetrack);
+			mols->track=newtrack;
+			mols->trackref=newref;
+			mols->freetrack=newfree;
+			mols->maxtrack=maxtrack; }
+		t=mols->ntrack++; }
+
+	mols->track[t]=mptr;
+	mols->trackref[t]=1;
+	mptr->track=t;
+	return t; }
+
+
+/* moluntrack.  Releases tracking slot t, which was returned by moltrack.  When
+no users remain, the molecule is no longer tracked and the slot can be reused. */
+void moluntrack(molssptr mols,int t) {
+	if(t<0 || t>=mols->ntrack || mols->trackref[t]<=0) return;
+	if(--mols->trackref[t]>0) return;
+	if(mols->track[t]) mols->track[t]->track=-1;
+	mols->track[t]=NULL;
+	mols->freetrack[mols->nfreetrack++]=t;
+	return; }
+
+
+/* moltracked.  Returns the molecule in tracking slot t, or NULL if that molecule
+has been killed since tracking started. */
+moleculeptr moltracked(molssptr mols,int t) {
+	return mols->track[t]; }
+
+
 /* addmol.  Adds nmol molecules of type ident and state MSsoln to the system.
 These molecules are not added to surfaces.  Their positions are chosen
 randomly within the rectanguloid that is defined by its corners poslo and
@@ -1609,6 +1689,92 @@ int addcompartmol(simptr sim,int nmol,int ident,compartptr cmpt) {
 		else mptr->box=NULL; }
 	return 0; }
 
+/* addmolbulk.  Adds nmol solution-state molecules to the system in one pass,
+with species ident[m] and position pos[m*dim+d] for molecule m.  Enough live
+list space is reserved for all of them at once, and then, if sort is 1, they are
+moved into the live lists and boxes with a single molsort.  Returns 0 for
+success, 1 for out of memory, 2 for an illegal species number, in which case
+nothing is added, or 3 for insufficient molecules in the dead list. */
+int addmolbulk(simptr sim,int nmol,int *ident,double *pos,int sort) {
+	molssptr mols;
+	int m,d,dim,ll,*nadd;
+	moleculeptr mptr;
+
+	mols=sim->mols;
+	dim=sim->dim;
+	for(m=0;m<nmol;m++)
+		if(ident[m]<=0 || ident[m]>=mols->nspecies) return 2;
+	if(mols->topd<nmol) return 3;
+
+	if(sort) {
+		nadd=(int*) calloc(mols->nlist,sizeof(int));
+		if(!nadd) return 1;
+		for(m=0;m<nmol;m++) nadd[mols->listlookup[ident[m]][MSsoln]]++;
+		for(ll=0;ll<mols->nlist;ll++)
+			if(mols->nl[ll]+nadd[ll]>mols->maxl[ll])
+				if(molexpandlist(mols,dim,ll,mols->nl[ll]+nadd[ll]-mols->maxl[ll],0)) {
+					free(nadd);
+					return 1; }
+		free(nadd); }
+
+	for(m=0;m<nmol;m++) {
+		mptr=getnextmol(mols);
+		mptr->ident=ident[m];
+		mptr->mstate=MSsoln;
+		mptr->list=mols->listlookup[ident[m]][MSsoln];
+		for(d=0;d<dim;d++)
+			mptr->posx[d]=mptr->pos[d]=pos[m*dim+d];
+		if(sim->boxs && sim->boxs->nbox) mptr->box=pos2box(sim,mptr->pos);
+		else mptr->box=NULL; }
+	if(sort)
+		if(molsort(sim)) return 1;
+	return 0; }
+
+
+/* molgetbulk.  Copies the data of live molecules that have species ident, or
+any species if ident is negative, and state ms, which may be MSall, to the
+caller's arrays in one pass over the live lists.  Up to max molecules are
+copied, with species in identout[m], states in msout[m], serial numbers in
+sernoout[m], and positions in posout[m*dim+d]; any of these arrays may be NULL.
+If kill is 1, the copied molecules are also removed from the system, with a
+single molsort at the end.  Returns the number of matching molecules, which can
+be more than max (so call with max equal to 0 to find the array sizes needed),
+-1 if molsort runs out of memory, or -2 if ident is not a species of this
+simulation or ms is not a molecule state or MSall. */
+int molgetbulk(simptr sim,int ident,enum MolecState ms,int max,int kill,int *identout,enum MolecState *msout,long int *sernoout,double *posout) {
+	molssptr mols;
+	int ll,lllo,llhi,m,d,dim,n;
+	moleculeptr mptr;
+
+	mols=sim->mols;
+	if(!mols) return 0;
+	if(ident>=mols->nspecies) return -2;
+	if(ms!=MSall && (ms<0 || ms>=MSMAX)) return -2;
+	dim=sim->dim;
+	lllo=0;
+	llhi=mols->nlist;
+	if(ident>0 && ms!=MSall) {										// only one list can have these
+		lllo=mols->listlookup[ident][ms];
+		if(lllo<0) return 0;
+		llhi=lllo+1; }
+
+	n=0;
+	for(ll=lllo;ll<llhi;ll++)
+		for(m=0;m<mols->nl[ll];m++) {
+			mptr=mols->live[ll][m];
+			if(mptr->ident<=0 || (ident>=0 && mptr->ident!=ident) || (ms!=MSall && mptr->mstate!=ms)) continue;
+			if(n<max) {
+				if(identout) identout[n]=mptr->ident;
+				if(msout) msout[n]=mptr->mstate;
+				if(sernoout) sernoout[n]=mptr->serno;
+				if(posout)
+					for(d=0;d<dim;d++) posout[n*dim+d]=mptr->pos[d];
+				if(kill) molkill(sim,mptr,ll,m); }
+			n++; }
+	if(kill && n>0)
+		if(molsort(sim)) return -1;
+	return n; }
+
 
 /******************************************************************************/
 /*************************** core simulation functions ************************/
@@ -13,6 +13,10 @@
 #include "string2.h"
 #include "uthash.h"
 
+#ifdef THREADING
+#include <pthread.h>
+#endif
+
 #define CHECK(A) if(!(A)) goto failure; else (void)0
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
@@ -47,13 +51,13 @@ int mzrTagName2SmolName(simptr sim,char *tagname) {
 	int ans,itag;
 
 	mzrss=sim->mzrss;
-	itag=stringfind(mzrss->tagname,mzrss->nnamehash,tagname);
+	itag=namehashfind(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash,tagname);
 	if(itag>=0) {
-		ans=stringfind(sim->mols->spname,sim->mols->nspecies,mzrss->smolname[itag]);
+		ans=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,mzrss->smolname[itag]);
 		if(ans>=0) return ans;
 		else return -2; }
 	else {
-		ans=stringfind(sim->mols->spname,sim->mols->nspecies,tagname);
+		ans=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,tagname);
 		if(ans>=0) return ans;
 		else return -1; }
 	return -1; }
@@ -62,7 +66,12 @@ int mzrTagName2SmolName(simptr sim,char *tagname) {
 /* mzrSmolName2TagName */
 int mzrSmolName2TagName(mzrssptr mzrss,char *smolname,char *tagname) {
 #ifdef LIBMOLECULIZER
-	return convertSomeNameToTaggedName(mzrss->mzr,smolname,tagname,STRCHAR);
+	int er;
+
+	mzrlock(mzrss,1);
+	er=convertSomeNameToTaggedName(mzrss->mzr,smolname,tagname,STRCHAR);
+	mzrlock(mzrss,0);
+	return er;
 #else
 	return 4;
 #endif
@@ -102,7 +111,9 @@ int mzrGetSpeciesStreams(mzrssptr mzrss,char ***streamnames,int *numnames) {
 	int ans;
 
 	ans=0;
+	mzrlock(mzrss,1);
 	getAllSpeciesStreams(mzrss->mzr,streamnames,numnames);
+	mzrlock(mzrss,0);
 	if(*streamnames==NULL) {
 		ans=1;
 		*numnames=0; }
@@ -127,7 +138,12 @@ void mzrFreeSpeciesStreams(char **streamnames,int numnames) {
 /* mzrIsTagNameInStream */
 int mzrIsTagNameInStream(mzrssptr mzrss,char *tagname,char *stream) {
 #ifdef LIBMOLECULIZER
-	return checkSpeciesTagIsInSpeciesStream(mzrss->mzr,tagname,stream);
+	int ans;
+
+	mzrlock(mzrss,1);
+	ans=checkSpeciesTagIsInSpeciesStream(mzrss->mzr,tagname,stream);
+	mzrlock(mzrss,0);
+	return ans;
 #else
 	return -1;
 #endif
@@ -137,8 +153,13 @@ int mzrIsTagNameInStream(mzrssptr mzrss,char *tagname,char *stream) {
 /* mzrNumberOfSpecies. */
 int mzrNumberOfSpecies(mzrssptr mzrss) {
 #ifdef LIBMOLECULIZER
+	int ans;
+
 	if(!mzrss || !mzrss->mzr) return 0;
-	return getNumberOfSpecies(mzrss->mzr);
+	mzrlock(mzrss,1);
+	ans=getNumberOfSpecies(mzrss->mzr);
+	mzrlock(mzrss,0);
+	return ans;
 #else
 	return 0;
 #endif
@@ -149,8 +170,13 @@ int mzrNumberOfSpecies(mzrssptr mzrss) {
  moleculizer has recorded thus far. */
 int mzrNumberOfReactions(mzrssptr mzrss) {
 #ifdef LIBMOLECULIZER
+	int ans;
+
 	if(!mzrss || !mzrss->mzr) return 0;
-	return getNumberOfReactions(mzrss->mzr); 
+	mzrlock(mzrss,1);
+	ans=getNumberOfReactions(mzrss->mzr);
+	mzrlock(mzrss,0);
+	return ans;
 #else
 	return 0;
 #endif
@@ -432,9 +458,11 @@ mzrssptr mzrssalloc(void) {
 	mzrss->maxnamehash=0;
 	mzrss->nnamehash=0;
 	mzrss->tagname=NULL;
+	mzrss->taghash=NULL;
 	mzrss->smolname=NULL;
 	mzrss->maxrxnhash=0;
 	mzrss->nrxnhash=0;
+	mzrss->nextrxnnum=0;
 	mzrss->mzrrxn=NULL;
 	mzrss->smolrxn=NULL;
 	mzrss->maxspecies=0;
@@ -443,13 +471,67 @@ mzrssptr mzrssalloc(void) {
 	mzrss->refmass=0;
 	for(ms=0;ms<MSMAX;ms++) mzrss->refdifc[ms]=0;
 	mzrss->expandall=0;
+	mzrss->expandasync=0;
+	mzrss->running=0;
+	mzrss->quit=0;
+	mzrss->maxqueue=0;
+	mzrss->nqueue=0;
+	mzrss->queue=NULL;
+	mzrss->pending=0;
+	mzrss->staged=0;
+	mzrss->stagedspecies=NULL;
+	mzrss->nstagedspecies=0;
+	mzrss->stagedrxns=NULL;
+	mzrss->nstagedrxns=0;
+	mzrss->thread_id=NULL;
+	mzrss->mutex=NULL;
+	mzrss->cond=NULL;
+	mzrss->mzrlock=NULL;
+#ifdef THREADING
+	{
+	pthread_mutexattr_t attr;
+
+	mzrss->thread_id=malloc(sizeof(pthread_t));
+	mzrss->mutex=malloc(sizeof(pthread_mutex_t));
+	mzrss->cond=malloc(sizeof(pthread_cond_t));
+	mzrss->mzrlock=malloc(sizeof(pthread_mutex_t));
+	if(!mzrss->thread_id || !mzrss->mutex || !mzrss->cond || !mzrss->mzrlock) {
+		free(mzrss->thread_id);
+		free(mzrss->mutex);
+		free(mzrss->cond);
+		free(mzrss->mzrlock);
+		free(mzrss);
+		return NULL; }
+	pthread_mutex_init((pthread_mutex_t*)mzrss->mutex,NULL);
+	pthread_cond_init((pthread_cond_t*)mzrss->cond,NULL);
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr,PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init((pthread_mutex_t*)mzrss->mzrlock,&attr);
+	pthread_mutexattr_destroy(&attr);
+	}
+#endif
 	return mzrss; }
 
 
 /* mzrssfree. */
 void mzrssfree(mzrssptr mzrss) {
+	int q;
+
 	if(!mzrss) return;
-	
+
+	mzrExpandStop(mzrss);
+#ifdef THREADING
+	pthread_mutex_destroy((pthread_mutex_t*)mzrss->mutex);
+	pthread_cond_destroy((pthread_cond_t*)mzrss->cond);
+	pthread_mutex_destroy((pthread_mutex_t*)mzrss->mzrlock);
+#endif
+	free(mzrss->thread_id);
+	free(mzrss->mutex);
+	free(mzrss->cond);
+	free(mzrss->mzrlock);
+	for(q=0;q<mzrss->maxqueue;q++) free(mzrss->queue[q]);
+	free(mzrss->queue);
+
 #ifdef LIBMOLECULIZER
 	if(mzrss->mzr) freeMoleculizerObject(mzrss->mzr);
 #endif
@@ -457,6 +539,7 @@ void mzrssfree(mzrssptr mzrss) {
 	free(mzrss->defaultstate);
 	mzrfreerxnhash(mzrss->mzrrxn,mzrss->smolrxn,mzrss->maxrxnhash);
 	mzrfreenamehash(mzrss->tagname,mzrss->smolname,mzrss->maxnamehash);
+	namehashfree(mzrss->taghash);
 	mzrfreestreams(mzrss->streamname,mzrss->displaysize,mzrss->color,mzrss->strmdifc,mzrss->maxstreams);
 	free(mzrss->rules);
 	free(mzrss);
@@ -514,6 +597,7 @@ void mzroutput(mzrssptr mzrss) {
 	species **speciesarray;
 
 	if(!mzrss || !mzrss->mzr) return;
+	mzrlock(mzrss,1);
 	printf("  Modifications: %i\n",getNumModificationDefs(mzrss->mzr));
 	printf("  Mols: %i\n",getNumMolDefs(mzrss->mzr));
 	printf("  Reaction rules: %i\n",getNumReactionRules(mzrss->mzr));
@@ -527,7 +611,7 @@ void mzroutput(mzrssptr mzrss) {
 
 	printf("  Number of species: %i\n",nspec);
 	for(i=0;i<nspec;i++) {
-		i2=stringfind(mzrss->tagname,mzrss->nnamehash,speciesarray[i]->name);
+		i2=namehashfind(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash,speciesarray[i]->name);
 		CHECK(i2>=0);
 		printf("   %s, mass=%g\n",mzrss->smolname[i2],*speciesarray[i]->mass); }
 
@@ -538,7 +622,7 @@ void mzroutput(mzrssptr mzrss) {
 			i2=checkSpeciesTagIsInSpeciesStream(mzrss->mzr,speciesarray[i]->name,streamarray[strm]);
 			CHECK(i2>=0);
 			if(i2) {
-				i2=stringfind(mzrss->tagname,mzrss->nnamehash,speciesarray[i]->name);
+				i2=namehashfind(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash,speciesarray[i]->name);
 				CHECK(i2>=0);
 				printf("    %s\n",mzrss->smolname[i2]); }}}
 
@@ -546,8 +630,10 @@ void mzroutput(mzrssptr mzrss) {
 
 	if(streamarray) freeCharPtrArray(streamarray,nstrm);
 	if(speciesarray) freeSpeciesArray(speciesarray,nspec);
+	mzrlock(mzrss,0);
 	return;
 failure:
+	mzrlock(mzrss,0);
 	printf("BUG: in mzroutput\n");
 	return;
 #else
@@ -641,6 +727,8 @@ void mzrssoutput(simptr sim) {
 		printf(" expansion on-the-fly and limited to %i species",mzrss->maxNetworkSpecies);
 	else
 		printf(" expansion on-the-fly and unlimited");
+	if(!mzrss->expandall && mzrss->expandasync)
+		printf(", in a background thread");
 
 	printf("\n");
 	return; }
@@ -839,6 +927,7 @@ int mzraddtonamehash(mzrssptr mzrss,char *tagname,char *smolname) {
 	i=mzrss->nnamehash++;
 	strncpy(mzrss->tagname[i],tagname,STRCHAR);
 	strncpy(mzrss->smolname[i],smolname,STRCHAR);
+	namehashupdate(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash);
 	return i; }
 
 
@@ -857,9 +946,7 @@ int mzraddtorxnhash(mzrssptr mzrss,char *mzrrxn,char *smolrxn) {
 
 /* mzrNextSmolrxnName */
 void mzrNextSmolrxnName(mzrssptr mzrss,char *smolrxn) {
-	static int num=0;
-
-	sprintf(smolrxn,"mzr%i",++num);
+	sprintf(smolrxn,"mzr%i",++mzrss->nextrxnnum);
 	return; }
 
 
@@ -886,11 +973,11 @@ int mzrMakeNameHash(simptr sim) {
 	for(i=0;i<numNames;i++) {
 		er=convertUserNameToTaggedName(mzrss->mzr,names[i],taggedName,STRCHAR);
 		if(er) return 2;
-		i2=stringfind(mzrss->tagname,mzrss->nnamehash,taggedName);
+		i2=namehashfind(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash,taggedName);
 		if(i2>=0) return -1-i2;
 		mzraddtonamehash(mzrss,taggedName,names[i]);
 
-		i2=stringfind(sim->mols->spname,sim->mols->nspecies,names[i]);
+		i2=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,names[i]);
 		if(i2>=0) molsetexpansionflag(sim,i2,1); }
 	freeCharPtrArray(names,numNames);
 	return 0;
@@ -1008,6 +1095,8 @@ void mzrSetValue(mzrssptr mzrss,char *item,int i1) {
 		mzrss->refspecies=i1;
 	else if(!strcmp(item,"expandall"))
 		mzrss->expandall=i1;
+	else if(!strcmp(item,"expandasync"))
+		mzrss->expandasync=i1;
 	return; }
 
 
@@ -1023,6 +1112,7 @@ int mzrsetupmoleculizer(simptr sim,char *erstr) {
 
 	if(!sim->mzrss) return 0;
 	mzrss=sim->mzrss;
+	mzrlock(mzrss,1);
 
 	if(mzrss->condition==SCinit) {
 		CHECKS(!mzrssload(sim,errstring),errstring);
@@ -1041,7 +1131,7 @@ int mzrsetupmoleculizer(simptr sim,char *erstr) {
 		CHECKS(!mzrExpandUnexpandedSpecies(sim),"BUG: in mzrExpandUnexpandedSpecies");
 
 		for(inm=0;inm<mzrss->nnamehash;inm++) {				// set molecule exist element
-			i=stringfind(sim->mols->spname,sim->mols->nspecies,mzrss->smolname[inm]);
+			i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,mzrss->smolname[inm]);
 			if(i>0) molsetexist(sim,i,MSall,1); }
 
 		mzrsetcondition(mzrss,SCparams,1); }
@@ -1064,8 +1154,10 @@ int mzrsetupmoleculizer(simptr sim,char *erstr) {
 		freeReactionArray(new_reactions_array,(unsigned int)number_reactions);
 		mzrsetcondition(sim->mzrss,SCok,1); }
 	
+	mzrlock(mzrss,0);
 	return 0;
  failure:
+	mzrlock(mzrss,0);
 	return 1;
 #else
 	if(sim->mzrss) mzrsetcondition(sim->mzrss,SCok,1);
@@ -1087,7 +1179,7 @@ int addMzrSpeciesArrayToSim(simptr sim,species **species_array,int number_specie
 
 	mzrss=sim->mzrss;
 	for(speciesNdx=0;speciesNdx<number_species;speciesNdx++) {
-		i=stringfind(mzrss->tagname,mzrss->nnamehash,species_array[speciesNdx]->name);
+		i=namehashfind(&mzrss->taghash,mzrss->tagname,mzrss->nnamehash,species_array[speciesNdx]->name);
 		if(i<0) {
 			code=convertTaggedNameToUniqueID(mzrss->mzr,species_array[speciesNdx]->name,uniqueID,STRCHAR);
 			if(code==1 || code==2) return 1;
@@ -1146,14 +1238,22 @@ int mzrExpandSpecies(simptr sim,int ident) {
 	char tagged_name[STRCHAR];
 	
 	mzrss=sim->mzrss;
+	if(mzrss->expandasync && mzrss->condition==SCok && !mzrExpandQueue(mzrss,sim->mols->spname[ident])) {
+		molsetexpansionflag(sim,ident,0);																				// call to Smoldyn
+		return 0; }
+
+	mzrlock(mzrss,1);
 	er=convertSomeNameToTaggedName(mzrss->mzr,sim->mols->spname[ident],tagged_name,STRCHAR);
-	if(er) return 1;
+	if(er) {
+		mzrlock(mzrss,0);
+		return 1; }
 	
 	size1=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
 	if(mzrss->maxNetworkSpecies<0 || mzrss->maxNetworkSpecies>getNumberOfSpecies(mzrss->mzr))
 		expandSpeciesByTag(mzrss->mzr,tagged_name);
 	molsetexpansionflag(sim,ident,0);																					// call to Smoldyn
 	size2=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
+	mzrlock(mzrss,0);
 	
 	if(size1!=size2) {						// If the network grew because of expansion. 
 		mzrsetcondition(sim->mzrss,SCparams,0); }
@@ -1173,11 +1273,13 @@ int mzrExpandNetwork(simptr sim) {
 	
 	mzrss=sim->mzrss;
 	
+	mzrlock(mzrss,1);
 	size1=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
 	er=expandNetwork(mzrss->mzr);
+	size2=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
+	mzrlock(mzrss,0);
 	if(er) return 1;
 	molsetexpansionflag(sim,-1,0);																					// call to Smoldyn
-	size2=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
 	
 	if(size1!=size2) {						// If the network grew because of expansion. 
 		mzrsetcondition(sim->mzrss,SCparams,0); }
@@ -1202,6 +1304,192 @@ int mzrExpandUnexpandedSpecies(simptr sim) {
 	return 0; }
 
 
+/* mzrlock.  Locks the moleculizer object for exclusive use if code is 1,
+unlocks it if code is 0, or tries to lock it without waiting if code is 2.  The
+lock is needed because the background expansion thread uses the same object.
+It is recursive, so functions that use the moleculizer object can call each
+other while holding it.  Returns 0 for success or 1 if code is 2 and the lock is
+held by another thread.  Without threading, this does nothing. */
+int mzrlock(mzrssptr mzrss,int code) {
+#ifdef THREADING
+	if(code==1) pthread_mutex_lock((pthread_mutex_t*)mzrss->mzrlock);
+	else if(code==0) pthread_mutex_unlock((pthread_mutex_t*)mzrss->mzrlock);
+	else if(code==2) return pthread_mutex_trylock((pthread_mutex_t*)mzrss->mzrlock)?1:0;
+#endif
+	return 0; }
+
+
+/* mzrExpandQueue.  Adds the Smoldyn species name smolname to the queue of
+species for the background thread to expand, starting the thread if it isn't
+running yet.  Returns 0 for success or 1 if the species could not be queued,
+because of insufficient memory, because the thread could not be started, or
+because the code was compiled without threading; in that case the caller should
+expand the species itself. */
+int mzrExpandQueue(mzrssptr mzrss,char *smolname) {
+#if defined(THREADING) && defined(LIBMOLECULIZER)
+	char **newqueue;
+	int q,maxqueue;
+
+	if(!mzrss->running) {
+		mzrss->quit=0;
+		if(pthread_create((pthread_t*)mzrss->thread_id,NULL,mzrExpandThread,(void*)mzrss)) return 1;
+		mzrss->running=1; }
+
+	pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+	if(mzrss->nqueue==mzrss->maxqueue) {
+		maxqueue=2*mzrss->maxqueue+1;
+		newqueue=(char**) calloc(maxqueue,sizeof(char*));
+		if(!newqueue) {
+			pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+			return 1; }
+		for(q=0;q<mzrss->maxqueue;q++) newqueue[q]=mzrss->queue[q];
+		for(;q<maxqueue;q++) newqueue[q]=NULL;
+		for(q=mzrss->maxqueue;q<maxqueue;q++)
+			if(!(newqueue[q]=EmptyString())) {
+				for(q=mzrss->maxqueue;q<maxqueue;q++) free(newqueue[q]);
+				free(newqueue);
+				pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+				return 1; }
+		free(mzrss->queue);
+		mzrss->queue=newqueue;
+		mzrss->maxqueue=maxqueue; }
+	strncpy(mzrss->queue[mzrss->nqueue],smolname,STRCHAR-1);
+	mzrss->queue[mzrss->nqueue++][STRCHAR-1]='\0';
+	pthread_cond_broadcast((pthread_cond_t*)mzrss->cond);
+	pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+	return 0;
+#else
+	return 1;
+#endif
+}
+
+
+/* mzrExpandThread.  Background expansion thread function.  This takes species
+from the expansion queue and expands them with the moleculizer object.  When the
+network grows and no earlier results are waiting to be merged, it collects the
+new species and reactions from moleculizer and stages them for mzrMergeExpansion.
+If earlier results are still staged, the new ones are left in moleculizer and
+collected after the merge.  It returns when told to quit.  The moleculizer lock
+is always taken before the queue lock, here and in mzrMergeExpansion. */
+void* mzrExpandThread(void *data) {
+#if defined(THREADING) && defined(LIBMOLECULIZER)
+	mzrssptr mzrss;
+	char smolname[STRCHAR],tagged_name[STRCHAR];
+	species **new_species_array;
+	reaction **new_reactions_array;
+	int number_species,number_reactions,size1,size2;
+
+	mzrss=(mzrssptr) data;
+	while(1) {
+		pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+		while(!mzrss->nqueue && !(mzrss->pending && !mzrss->staged) && !mzrss->quit)
+			pthread_cond_wait((pthread_cond_t*)mzrss->cond,(pthread_mutex_t*)mzrss->mutex);
+		if(mzrss->quit) {
+			pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+			break; }
+		smolname[0]='\0';
+		if(mzrss->nqueue) strcpy(smolname,mzrss->queue[--mzrss->nqueue]);
+		pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+
+		mzrlock(mzrss,1);
+		size1=size2=0;
+		if(smolname[0] && !convertSomeNameToTaggedName(mzrss->mzr,smolname,tagged_name,STRCHAR)) {
+			size1=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr);
+			if(mzrss->maxNetworkSpecies<0 || mzrss->maxNetworkSpecies>getNumberOfSpecies(mzrss->mzr))
+				expandSpeciesByTag(mzrss->mzr,tagged_name);
+			size2=getNumberOfSpecies(mzrss->mzr)*getNumberOfReactions(mzrss->mzr); }
+
+		pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+		if(size1!=size2) mzrss->pending=1;
+		if(mzrss->pending && !mzrss->staged) {
+			new_species_array=NULL;
+			new_reactions_array=NULL;
+			number_species=0;
+			number_reactions=0;
+			if(!getDeltaSpecies(mzrss->mzr,&new_species_array,&number_species) && !getDeltaReactions(mzrss->mzr,&new_reactions_array,&number_reactions)) {
+				clearDeltaState(mzrss->mzr);
+				mzrss->stagedspecies=(void*)new_species_array;
+				mzrss->nstagedspecies=number_species;
+				mzrss->stagedrxns=(void*)new_reactions_array;
+				mzrss->nstagedrxns=number_reactions;
+				mzrss->staged=1; }
+			mzrss->pending=0; }
+		pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+		mzrlock(mzrss,0); }
+#endif
+	return NULL; }
+
+
+/* mzrMergeExpansion.  Merges any species and reactions that were staged by the
+background expansion thread into the simulation.  This is called at the end of
+each time step.  It doesn't wait for the thread: if the thread is in the middle
+of an expansion, the merge is left for a later time step.  New species and
+reactions are added directly, so the moleculizer superstructure condition is not
+downgraded.  Returns 0 for success or 1 if the results could not be added. */
+int mzrMergeExpansion(simptr sim) {
+#if defined(THREADING) && defined(LIBMOLECULIZER)
+	mzrssptr mzrss;
+	species **new_species_array;
+	reaction **new_reactions_array;
+	int number_species,number_reactions,staged,er;
+
+	mzrss=sim->mzrss;
+	if(!mzrss || !mzrss->running) return 0;
+	if(mzrlock(mzrss,2)) return 0;
+
+	pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+	staged=mzrss->staged;
+	new_species_array=(species**)mzrss->stagedspecies;
+	number_species=mzrss->nstagedspecies;
+	new_reactions_array=(reaction**)mzrss->stagedrxns;
+	number_reactions=mzrss->nstagedrxns;
+	mzrss->stagedspecies=NULL;
+	mzrss->nstagedspecies=0;
+	mzrss->stagedrxns=NULL;
+	mzrss->nstagedrxns=0;
+	mzrss->staged=0;
+	pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+
+	er=0;
+	if(staged) {
+		er=addMzrSpeciesArrayToSim(sim,new_species_array,number_species);
+		if(!er) er=addMzrReactionArrayToSim(sim,new_reactions_array,number_reactions);
+		freeSpeciesArray(new_species_array,(unsigned int)number_species);
+		freeReactionArray(new_reactions_array,(unsigned int)number_reactions);
+		pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+		pthread_cond_broadcast((pthread_cond_t*)mzrss->cond);
+		pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex); }
+	mzrlock(mzrss,0);
+	return er;
+#else
+	return 0;
+#endif
+}
+
+
+/* mzrExpandStop.  Stops the background expansion thread, if it is running, and
+frees any results that it staged but that weren't merged.  Species that were
+still in the queue are not expanded. */
+void mzrExpandStop(mzrssptr mzrss) {
+#if defined(THREADING) && defined(LIBMOLECULIZER)
+	if(mzrss->running) {
+		pthread_mutex_lock((pthread_mutex_t*)mzrss->mutex);
+		mzrss->quit=1;
+		pthread_cond_broadcast((pthread_cond_t*)mzrss->cond);
+		pthread_mutex_unlock((pthread_mutex_t*)mzrss->mutex);
+		pthread_join(*((pthread_t*)mzrss->thread_id),NULL);
+		mzrss->running=0; }
+	if(mzrss->staged) {
+		freeSpeciesArray((species**)mzrss->stagedspecies,(unsigned int)mzrss->nstagedspecies);
+		freeReactionArray((reaction**)mzrss->stagedrxns,(unsigned int)mzrss->nstagedrxns);
+		mzrss->stagedspecies=NULL;
+		mzrss->stagedrxns=NULL;
+		mzrss->staged=0; }
+	mzrss->nqueue=0;
+#endif
+	return; }
+
+
 /* mzrAddRxn */
 int mzrAddRxn(simptr sim,char *name,int order,int *reactants,int *products,int nprod,double rate) {
 	mzrssptr mzrss;
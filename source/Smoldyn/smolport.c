@@ -5,15 +5,52 @@
  of the Gnu General Public License (GPL). */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
+#include "random2.h"
 #include "smoldyn.h"
 #include "string2.h"
 #include "Zn.h"
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #define CHECK(A) if(!(A)) goto failure; else (void)0
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
+#define PORTRINGMAGIC 0x52504d53
+
+/* A port ring is a single-producer, single-consumer queue in POSIX shared
+memory, which carries molecules from the export buffer of a port in one
+simulation to the system of another simulation, which may be in another
+process.  The header is followed by capacity records.  head and tail count the
+records that have been written and read; only the exporting side changes head
+and only the importing side changes tail, so neither side needs a lock and
+neither ever waits.  Whichever side opens the ring first sets capacity and dim,
+and the other side checks that they agree; magic then marks the memory as a
+ring, so that shared memory of the same name that isn't one is refused.  Ports
+only carry solution-phase molecules, so records don't include a state. */
+
+typedef struct portringstruct {	// shared memory ring header
+	int magic;									// PORTRINGMAGIC once set up
+	int capacity;								// number of records
+	int dim;										// system dimensionality
+	int reserved;								// 0, for alignment
+	volatile long long head;		// records written by exporter
+	volatile long long tail;		// records read by importer
+	} *portringptr;
+
+typedef struct portrecstruct {	// molecule record in ring
+	int ident;									// species
+	int reserved;								// 0, for alignment
+	double pos[DIMMAX];					// position
+	} *portrecptr;
+
 
 /******************************************************************************/
 /************************************* Ports **********************************/
@@ -41,12 +78,24 @@ portptr portalloc(void) {
 	port->srf=NULL;
 	port->face=PFnone;
 	port->llport=-1;
+	port->ringdir=PRnone;
+	port->ringname=NULL;
+	port->ringcap=0;
+	port->ring=NULL;
+	port->ringbytes=0;
 	return port; }
 
 
-/* portfree.  Frees a port. */
+/* portfree.  Frees a port.  If it has a shared memory ring, the ring is
+unmapped, and the importing side also removes its name. */
 void portfree(portptr port) {
 	if(!port) return;
+#ifndef _WIN32
+	if(port->ring) {
+		munmap(port->ring,(size_t)port->ringbytes);
+		if(port->ringdir==PRimport) shm_unlink(port->ringname); }
+#endif
+	free(port->ringname);
 	free(port);
 	return; }
 
@@ -119,7 +168,8 @@ void portoutput(simptr sim) {
 		if(port->srf) printf("  surface: %s, %s\n",port->srf->sname,surfface2string(port->face,string));
 		else printf("  no surface assigned\n");
 		if(port->llport>=0) printf("  molecule list: %s\n",sim->mols->listname[port->llport]);
-		else printf("  no molecule list assigned"); }
+		else printf("  no molecule list assigned");
+		if(port->ringdir!=PRnone) printf("  %s shared memory ring %s, %i records%s\n",port->ringdir==PRexport?"exports to":"imports from",port->ringname,port->ringcap,port->ring?"":", not open"); }
 	printf("\n");
 	return; }
 
@@ -139,8 +189,9 @@ void writeports(simptr sim,FILE *fptr) {
 	for(prt=0;prt<portss->nport;prt++) {
 		port=portss->portlist[prt];
 		fprintf(fptr,"start_port %s\n",port->portname);
-		fprintf(fptr,"surface %s\n",port->srf->sname);
-		fprintf(fptr,"face %s\n",surfface2string(port->face,string));
+		if(port->srf) fprintf(fptr,"surface %s\n",port->srf->sname);
+		if(port->face!=PFnone) fprintf(fptr,"face %s\n",surfface2string(port->face,string));
+		if(port->ringdir!=PRnone) fprintf(fptr,"%s %s %i\n",port->ringdir==PRexport?"ring_export":"ring_import",port->ringname,port->ringcap);
 		fprintf(fptr,"end_port\n\n"); }
 	return; }
 
@@ -163,10 +214,13 @@ int checkportparams(simptr sim,int *warnptr) {
 		printf(" WARNING: port structure %s\n",simsc2string(portss->condition,string)); }
 
 	for(prt=0;prt<portss->nport;prt++) {
-		port=portss->portlist[prt];					// check for porting surface
-		if(!port->srf) {warn++;printf(" WARNING: there is no porting surface assigned to port %s\n",port->portname);}
+		port=portss->portlist[prt];
+		if(port->ringdir!=PRnone && !port->ring) {error++;printf(" ERROR: shared memory ring %s of port %s is not open\n",port->ringname,port->portname);}
+		if(port->ringdir==PRimport && !port->srf) continue;	// ring imports don't need a surface
+																				// check for porting surface
+		if(!port->srf) {warn++;printf(" WARNING: there is no porting surface assigned to port %s\n",port->portname);continue;}
 		if(!(port->face==PFfront||port->face==PFback))
-			{error++;printf(" ERROR: no surface face has been assigned to port %s\n",port->portname);}
+			{error++;printf(" ERROR: no surface face has been assigned to port %s\n",port->portname);continue;}
 
 		if(port->srf->port[port->face]!=port) {error++;printf(" ERROR: port %s is not registered by surface %s\n",port->portname,port->srf->sname);}
 
@@ -224,7 +278,7 @@ portptr addport(portssptr portss,char *portname,surfaceptr srf,enum PanelFace fa
 int portreadstring(simptr sim,int portindex,char *word,char *line2,char *erstr) {
 	char nm[STRCHAR];
 	portptr port;
-	int itct,s;
+	int itct,s,cap,er;
 	enum PanelFace face;
 
 	if(portindex>=0) port=sim->portss->portlist[portindex];
@@ -242,7 +296,7 @@ int portreadstring(simptr sim,int portindex,char *word,char *line2,char *erstr)
 		CHECKS(port,"port name has to be entered before surface");
 		itct=sscanf(line2,"%s",nm);
 		CHECKS(itct==1,"error reading surface name");
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		CHECKS(s>=0,"surface name not recognized");
 		CHECKS(port==addport(sim->portss,port->portname,sim->srfss->srflist[s],PFnone),"SMOLDYN BUG: new port was created when adding surface");
 		CHECKS(!strnword(line2,2),"unexpected text following surface"); }
@@ -256,6 +310,17 @@ int portreadstring(simptr sim,int portindex,char *word,char *line2,char *erstr)
 		CHECKS(port==addport(sim->portss,port->portname,NULL,face),"SMOLDYN BUG: new port was created when adding face");
 		CHECKS(!strnword(line2,2),"unexpected text following face"); }
 
+	else if(!strcmp(word,"ring_export") || !strcmp(word,"ring_import")) {	// ring_export, ring_import
+		CHECKS(port,"name has to be entered before ring_export or ring_import");
+		itct=sscanf(line2,"%s %i",nm,&cap);
+		CHECKS(itct>=1,"format: ring_export or ring_import name [capacity]");
+		if(itct==1) cap=PORTRINGMAX;
+		er=portsetring(port,word[5]=='e'?PRexport:PRimport,nm,cap);
+		CHECKS(er!=1,"out of memory");
+		CHECKS(er!=2,"ring capacity needs to be at least 1");
+		CHECKS(er!=3,"ring name is too long");
+		CHECKS(!strnword(line2,itct+1),"unexpected text following ring_export or ring_import"); }
+
 	else {																				// unknown word
 		CHECKS(0,"syntax error within port block: statement not recognized"); }
 
@@ -309,9 +374,73 @@ int loadport(simptr sim,ParseFilePtr *pfpptr,char* line2,char *erstr) {
 	return 1; }
 
 
-/* setupports.  Sets up the molecule buffers for all ports.  Returns 0 for
-success, 1 for inability to allocate sufficient memory, or 2 for molecules not
-set up sufficiently. */
+/* portsetring.  Sets port to export molecules to, or import molecules from,
+the shared memory ring called name, which holds capacity records.  The ring is
+opened when the ports are set up.  Returns 0 for success, 1 for out of memory,
+2 for a capacity less than 1, or 3 for a name that is too long. */
+int portsetring(portptr port,enum PortRing dir,char *name,int capacity) {
+	if(capacity<1) return 2;
+	if(strlen(name)>=STRCHAR-1) return 3;
+	if(!port->ringname) {
+		port->ringname=EmptyString();
+		if(!port->ringname) return 1; }
+	port->ringname[0]='\0';
+	if(name[0]!='/') strcpy(port->ringname,"/");
+	strcat(port->ringname,name);
+	port->ringdir=dir;
+	port->ringcap=capacity;
+	return 0; }
+
+
+/* portopenring.  Opens and maps the shared memory ring of port, creating it
+if the other side hasn't yet.  Returns 0 for success or if the port doesn't use
+a ring, 1 if the shared memory could not be opened or mapped, 2 if the ring
+already exists with a different capacity or dimensionality, or if the shared
+memory isn't a port ring, or 3 if shared memory isn't available on this
+system. */
+int portopenring(simptr sim,portptr port) {
+#ifdef _WIN32
+	return port->ringdir==PRnone?0:3;
+#else
+	int fd,old,er;
+	long int bytes;
+	struct stat st;
+	portringptr ring;
+
+	if(port->ringdir==PRnone || port->ring) return 0;
+	bytes=sizeof(struct portringstruct)+port->ringcap*sizeof(struct portrecstruct);
+	fd=shm_open(port->ringname,O_RDWR|O_CREAT,0600);
+	if(fd<0) return 1;
+	if(fstat(fd,&st)) {close(fd);return 1;}
+	if(st.st_size==0 && ftruncate(fd,(off_t)bytes)) {close(fd);return 1;}
+	else if(st.st_size!=0 && st.st_size!=bytes) {close(fd);return 2;}
+	ring=(portringptr) mmap(NULL,(size_t)bytes,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+	close(fd);
+	if(ring==MAP_FAILED) return 1;
+
+	er=0;
+	if(ring->magic!=0 && ring->magic!=PORTRINGMAGIC) er=2;
+	old=__sync_val_compare_and_swap(&ring->capacity,0,port->ringcap);
+	if(old!=0 && old!=port->ringcap) er=2;
+	old=__sync_val_compare_and_swap(&ring->dim,0,sim->dim);
+	if(old!=0 && old!=sim->dim) er=2;
+	if(!er) {
+		old=__sync_val_compare_and_swap(&ring->magic,0,PORTRINGMAGIC);
+		if(old!=0 && old!=PORTRINGMAGIC) er=2; }
+	if(er) {
+		munmap(ring,(size_t)bytes);
+		return er; }
+	port->ring=(void*)ring;
+	port->ringbytes=bytes;
+	return 0;
+#endif
+	}
+
+
+/* setupports.  Sets up the molecule buffers for all ports and opens their
+shared memory rings.  Returns 0 for success, 1 for inability to allocate
+sufficient memory, 2 for molecules not set up sufficiently, or 3 if a shared
+memory ring could not be opened. */
 int setupports(simptr sim) {
 	portssptr portss;
 	portptr port;
@@ -329,7 +458,8 @@ int setupports(simptr sim) {
 			if(port->llport<0) {
 				ll=addmollist(sim,port->portname,MLTport);
 				if(ll<0) return 1;
-				port->llport=ll; }}
+				port->llport=ll; }
+			if(portopenring(sim,port)) return 3; }
 	portsetcondition(portss,SCok,1); }
 	return 0; }
 
@@ -362,47 +492,204 @@ int portgetmols(simptr sim,portptr port,int ident,enum MolecState ms) {
 	return count; }
 
 
+/* portgetmolsbulk.  Kills all molecules that are in the export buffer of port
+port, in a single pass through the buffer, and counts them by species in
+count[i], which needs to have an element for each species of sim and is set to
+zeros here.  This is equivalent to calling portgetmols for each species with
+MSall, but without rescanning the buffer each time.  Returns the total number
+of molecules. */
+int portgetmolsbulk(simptr sim,portptr port,int *count) {
+	int ll,nmol,total,m,i;
+	moleculeptr *mlist;
+
+	for(i=0;i<sim->mols->nspecies;i++) count[i]=0;
+	ll=port->llport;
+	mlist=sim->mols->live[ll];
+	nmol=sim->mols->nl[ll];
+	total=0;
+	for(m=0;m<nmol;m++)
+		if(mlist[m]->ident>0) {
+			count[mlist[m]->ident]++;
+			total++;
+			molkill(sim,mlist[m],ll,m); }
+	sim->eventcount[ETexport]+=total;
+	return total; }
+
+
 /* portputmols.  Adds nmol molecules of type ident and state MSsoln to the
 simulation system at the porting surface of port port.  Molecules are placed
-randomly on the surface.  This returns 0 for success, 1 for insufficient
-available molecules, 2 for no porting surface defined, 3 for no porting surface
-face defined, and 4 for inability to allocated temporary memory. */
+randomly on the surface.  This calls portputmolsbulk with a single species, so
+see it for the return values. */
 int portputmols(simptr sim,portptr port,int nmol,int ident) {
-	moleculeptr mptr;
-	int dim,m,d;
-	panelptr pnl;
+	int *count,er;
+
+	if(!nmol) return 0;
+	if(ident<=0 || ident>=sim->mols->nspecies) return 5;
+	count=(int*) calloc(ident+1,sizeof(int));
+	if(!count) return 4;
+	count[ident]=nmol;
+	er=portputmolsbulk(sim,port,ident+1,count);
+	free(count);
+	return er; }
+
 
+/* portputmolsbulk.  Adds count[i] molecules of species i, for i from 1 to
+nspecies-1, in state MSsoln, to the simulation system at the porting surface of
+port port.  Molecules are placed randomly on the surface.  All of them are
+handled together: the dead list is checked for the total at once, and the
+positions are chosen with one call to surfrandposbulk.  Because those positions
+come out grouped by panel, species are assigned to them in a random order.
+Molecules are sorted into the live lists at the next molsort.  Nothing is added
+if there is an error.  This returns 0 for success, 1 for insufficient available
+molecules, 2 for no porting surface defined, 3 for no porting surface face
+defined, 4 for inability to allocate temporary memory, or 5 for a species that
+is not in this simulation. */
+int portputmolsbulk(simptr sim,portptr port,int nspecies,int *count) {
+	molssptr mols;
+	moleculeptr mptr;
+	int dim,m,d,i,n,nmol,*ident,er;
+	double *pos;
+	panelptr *pnls;
+
+	mols=sim->mols;
+	nmol=0;
+	for(i=1;i<nspecies;i++)
+		if(count[i]) {
+			if(i>=mols->nspecies) return 5;
+			nmol+=count[i]; }
 	if(!nmol) return 0;
 	if(!port->srf) return 2;
 	if(port->face==PFnone) return 3;
+	if(mols->topd<nmol) return 1;
 	dim=sim->dim;
 
+	pos=(double*) calloc(nmol*dim,sizeof(double));
+	pnls=(panelptr*) calloc(nmol,sizeof(panelptr));
+	ident=(int*) calloc(nmol,sizeof(int));
+	er=(!pos || !pnls || !ident)?4:0;
+	if(!er && surfrandposbulk(port->srf,nmol,pos,pnls,dim)) er=2;
+	if(er) {
+		free(pos);
+		free(pnls);
+		free(ident);
+		return er; }
+
+	m=0;																						// shuffled species
+	for(i=1;i<nspecies;i++)
+		for(n=0;n<count[i];n++) ident[m++]=i;
+	for(m=nmol-1;m>0;m--) {
+		n=intrand(m+1);
+		i=ident[m];
+		ident[m]=ident[n];
+		ident[n]=i; }
+
 	for(m=0;m<nmol;m++) {
-		mptr=getnextmol(sim->mols);
-		if(!mptr) return 1;
-		mptr->ident=ident;
+		mptr=getnextmol(mols);
+		mptr->ident=ident[m];
 		mptr->mstate=MSsoln;
-		mptr->list=sim->mols->listlookup[ident][MSsoln];
-		pnl=surfrandpos(port->srf,mptr->posx,dim);
-		if(!pnl) return 4;
-		fixpt2panel(mptr->posx,pnl,dim,port->face,sim->srfss->epsilon);
+		mptr->list=mols->listlookup[ident[m]][MSsoln];
+		for(d=0;d<dim;d++) mptr->posx[d]=pos[m*dim+d];
+		fixpt2panel(mptr->posx,pnls[m],dim,port->face,sim->srfss->epsilon);
 		for(d=0;d<dim;d++) mptr->pos[d]=mptr->posx[d];
 		mptr->box=pos2box(sim,mptr->pos); }
+	free(pos);
+	free(pnls);
+	free(ident);
 	sim->eventcount[ETimport]+=nmol;
 	return 0; }
 
 
 /* porttransport.  Transports molecules from port1 of simulation structure sim1
 to port2 of simulation structure sim2.  sim1 and sim2 may be the same and port1
-and port2 may be the same.  This is designed for testing ports or for coupled
-Smoldyn simulations that communicate with ports. */
+and port2 may be the same.  The export buffer is read once, with
+portgetmolsbulk, and all molecules are put into sim2 together, with
+portputmolsbulk.  This is designed for testing ports or for coupled Smoldyn
+simulations that communicate with ports.  Returns 0 for success or a
+portputmolsbulk error code. */
 int porttransport(simptr sim1,portptr port1,simptr sim2,portptr port2) {
-	int i,nmol,er;
+	int *count,er;
 
 	if(!portgetmols(sim1,port1,-1,MSnone)) return 0;
-	er=0;
-	for(i=1;i<sim1->mols->nspecies&&!er;i++) {
-		nmol=portgetmols(sim1,port1,i,MSall);
-		er=portputmols(sim2,port2,nmol,i); }
+	count=(int*) calloc(sim1->mols->nspecies,sizeof(int));
+	if(!count) return 4;
+	portgetmolsbulk(sim1,port1,count);
+	er=portputmolsbulk(sim2,port2,sim1->mols->nspecies,count);
+	free(count);
 	return er; }
 
+
+/* portexchange.  Moves molecules through the shared memory rings of all ports.
+For an exporting port, molecules in the export buffer are written to the ring
+and killed, as long as the ring has space; the others stay in the buffer until
+the next time.  For an importing port, all molecules that are waiting in the
+ring are added to the system, in solution, with the positions that they had in
+the exporting simulation and new serial numbers from this simulation, so that
+serial numbers stay unique.  Records of species that aren't in this simulation
+are discarded and counted as ETimportdrop events, which are reported at the end
+of the simulation.  Imported molecules are sorted into the live lists at the
+next molsort.  Neither side waits for the
+other.  Returns 0 for success or 1 if there were too few dead molecules for all
+imports, in which case the rest stay in the ring. */
+int portexchange(simptr sim) {
+	portssptr portss;
+	portptr port;
+	portringptr ring;
+	portrecptr rec,recs;
+	moleculeptr mptr,*mlist;
+	int prt,ll,m,d,dim,nmol,count,er;
+	long long head,tail;
+
+	portss=sim->portss;
+	if(!portss) return 0;
+	dim=sim->dim;
+	er=0;
+	for(prt=0;prt<portss->nport;prt++) {
+		port=portss->portlist[prt];
+		if(!port->ring) continue;
+		ring=(portringptr)port->ring;
+		recs=(portrecptr)(ring+1);
+		count=0;
+		if(port->ringdir==PRexport) {
+			ll=port->llport;
+			mlist=sim->mols->live[ll];
+			nmol=sim->mols->nl[ll];
+			head=ring->head;
+			tail=ring->tail;
+			__sync_synchronize();											// read records before reusing slots
+			for(m=0;m<nmol && head-tail<port->ringcap;m++) {
+				mptr=mlist[m];
+				if(mptr->ident<=0) continue;
+				rec=recs+head%port->ringcap;
+				rec->ident=mptr->ident;
+				rec->reserved=0;
+				for(d=0;d<dim;d++) rec->pos[d]=mptr->pos[d];
+				head++;
+				count++;
+				molkill(sim,mptr,ll,m); }
+			__sync_synchronize();											// write records before publishing
+			ring->head=head;
+			sim->eventcount[ETexport]+=count; }
+		else {
+			tail=ring->tail;
+			head=ring->head;
+			__sync_synchronize();											// see records that were published
+			for(;tail<head;tail++) {
+				rec=recs+tail%port->ringcap;
+				if(rec->ident<=0 || rec->ident>=sim->mols->nspecies) {
+					sim->eventcount[ETimportdrop]++;
+					continue; }
+				mptr=getnextmol(sim->mols);
+				if(!mptr) {
+					er=1;
+					break; }
+				mptr->ident=rec->ident;
+				mptr->mstate=MSsoln;
+				mptr->list=sim->mols->listlookup[rec->ident][MSsoln];
+				for(d=0;d<dim;d++) mptr->posx[d]=mptr->pos[d]=rec->pos[d];
+				if(sim->boxs && sim->boxs->nbox) mptr->box=pos2box(sim,mptr->pos);
+				else mptr->box=NULL;
+				count++; }
+			__sync_synchronize();											// read records before freeing slots
+			ring->tail=tail;
+			sim->eventcount[ETimport]+=count; }}
+	return er; }
@@ -190,7 +190,8 @@ int readrxnname(simptr sim, char *rname, int *orderptr, rxnptr *rxnpt) {
 	r = -1;
 	for (order = 0; order < MAXORDER && r == -1; order++)
 		if (sim->rxnss[order])
-			r = stringfind(sim->rxnss[order]->rname, sim->rxnss[order]->totrxn,
+			r = namehashfind(&sim->rxnss[order]->rnamehash,
+					sim->rxnss[order]->rname, sim->rxnss[order]->totrxn,
 					rname);
 	order--;
 	if (r >= 0) {
@@ -446,7 +447,7 @@ is 0, there are no additional conditions.  If code is 1, the molecule also has
 to be displaced from the reaction position (i.e. either confspread or the
 unbinding radius is non-zero) in order to qualify. */
 int rxnisprod(simptr sim, int i, enum MolecState ms, int code) {
-	int order, k, l,r, prd;
+	int order, r, prd;
 	rxnssptr rxnss;
 	rxnptr rxn;
 
@@ -459,19 +460,8 @@ int rxnisprod(simptr sim, int i, enum MolecState ms, int code) {
 					if (rxn->prdident[prd] == i && rxn->prdstate[prd] == ms) {
 						if (code == 0)
 							return 1;
-						//@Christine
-						if (rxn->rparamt == RPconfspread)
+						if (rxnisprodmoving(sim, rxn, prd))
 							return 1;
-						for (k = 0; k <= rxnss->sim->nrfs; k++) {
-						  for(l = 0; l <=rxnss->sim->nrfs; l++) {
-							if (rxn->unbindrad[k][l] && rxn->unbindrad[k][l] > 0)
-								return 1;
-							if (dotVVD(rxn->prdpos[k][l][prd], rxn->prdpos[k][l][prd], sim->dim)
-								> 0)
-							    return 1;
-						  }
-						}
-						
 					}
 			}
 		}
@@ -479,6 +469,27 @@ int rxnisprod(simptr sim, int i, enum MolecState ms, int code) {
 	return 0;
 }
 
+/* rxnisprodmoving.  Returns 1 if product prd of reaction rxn is displaced from
+the reaction position (i.e. either confspread or the unbinding radius or the
+product offset is non-zero), and 0 if not. */
+int rxnisprodmoving(simptr sim, rxnptr rxn, int prd) {
+	int k, l;
+
+	//@Christine
+	if (rxn->rparamt == RPconfspread)
+		return 1;
+	for (k = 0; k <= sim->nrfs; k++) {
+	  for(l = 0; l <= sim->nrfs; l++) {
+		if (rxn->unbindrad[k][l] && rxn->unbindrad[k][l] > 0)
+			return 1;
+		if (dotVVD(rxn->prdpos[k][l][prd], rxn->prdpos[k][l][prd], sim->dim)
+			> 0)
+		    return 1;
+	  }
+	}
+	return 0;
+}
+
 /******************************************************************************/
 /****************************** memory management *****************************/
 /******************************************************************************/
@@ -511,6 +522,7 @@ rxnptr rxnalloc(int order, int max_surface) {
 	rxn->prdpos=NULL;
 	rxn->cmpt=NULL;
 	rxn->srf=NULL;
+	rxn->dirty=0;
 
 
 	if(order>0) {
@@ -643,8 +655,11 @@ rxnssptr rxnssalloc(int order, int maxspecies) {
 	rxnss->maxrxn=0;
 	rxnss->totrxn=0;
 	rxnss->rname=NULL;
+	rxnss->rnamehash=NULL;
 	rxnss->rxn=NULL;
 	rxnss->rxnmollist=NULL;
+	rxnss->ndirty=0;
+	rxnss->alldirty=1;
 
 	if(order>0) {
 		ni2o=intpower(maxspecies,order);
@@ -675,6 +690,7 @@ void rxnssfree(rxnssptr rxnss) {
 		for (r = 0; r < rxnss->maxrxn; r++)
 			free(rxnss->rname[r]);
 	free(rxnss->rname);
+	namehashfree(rxnss->rnamehash);
 	if (rxnss->table) {
 		ni2o = intpower(rxnss->maxspecies, rxnss->order);
 		for (i = 0; i < ni2o; i++)
@@ -2048,56 +2064,110 @@ reaction, only the latter ones found are recorded.  Also, all molecule states
 are counted, which ignores the permit reaction structure element. */
 void rxncalctau(simptr sim, int order) {
 	rxnssptr rxnss;
-	rxnptr rxn;
-	int r,i,j;
-	double rate, vol, conc1, conc2;
+	int r;
 
 	rxnss = sim->rxnss[order];
 	if (!rxnss)
 		return;
 
+	for (r = 0; r < rxnss->totrxn; r++)
+		rxnsettau(sim, order, r);
+
+	return;
+}
+
+/* rxnsettau.  Calculates the characteristic time for reaction r of order
+order, as described for rxncalctau. */
+void rxnsettau(simptr sim, int order, int r) {
+	rxnptr rxn;
+	int i,j;
+	double rate, vol, conc1, conc2;
+
+	rxn = sim->rxnss[order]->rxn[r];
+
 	if (order == 1) {
-		for (r = 0; r < rxnss->totrxn; r++) {
-			rxn = rxnss->rxn[r];
-			for(i=0;i<=sim->srfss->nsrf;i++){
-			    for(j=0;j<=sim->srfss->nsrf;j++){
-				rate = rxncalcrate(sim, 1, r, NULL, i-1,j-1);
-				rxn->tau[i][j] = 1.0 / rate;
-			    }
-			}
+		for(i=0;i<=sim->srfss->nsrf;i++){
+		    for(j=0;j<=sim->srfss->nsrf;j++){
+			rate = rxncalcrate(sim, 1, r, NULL, i-1,j-1);
+			rxn->tau[i][j] = 1.0 / rate;
+		    }
 		}
 	}
 
 	else if (order == 2) {
 		vol = systemvolume(sim);
-		for (r = 0; r < rxnss->totrxn; r++) {
-			rxn = rxnss->rxn[r];
-			conc1 = (double) molcount(sim, rxn->rctident[0], MSall, NULL, -1)
-					/ vol;
-			conc2 = (double) molcount(sim, rxn->rctident[1], MSall, NULL, -1)
-					/ vol;
-			
-			for(i=0;i<=sim->srfss->nsrf;i++){
-			    for(j=0;j<=sim->srfss->nsrf;j++){
-				rate = rxncalcrate(sim, 2, r, NULL,i-1,j-1);
-				if (rxn->rparamt == RPconfspread)
-				    rxn->tau[i][j] = 1.0 / rate;
+		conc1 = (double) molcount(sim, rxn->rctident[0], MSall, NULL, -1)
+				/ vol;
+		conc2 = (double) molcount(sim, rxn->rctident[1], MSall, NULL, -1)
+				/ vol;
+		
+		for(i=0;i<=sim->srfss->nsrf;i++){
+		    for(j=0;j<=sim->srfss->nsrf;j++){
+			rate = rxncalcrate(sim, 2, r, NULL,i-1,j-1);
+			if (rxn->rparamt == RPconfspread)
+			    rxn->tau[i][j] = 1.0 / rate;
 			else
-				rxn->tau[i][j] = (conc1 + conc2) / (rate * conc1 * conc2);
-			    }
-			}
+			    rxn->tau[i][j] = (conc1 + conc2) / (rate * conc1 * conc2);
+		    }
 		}
 	}
 
 	return;
 }
 
+/* rxnspreaddirty.  Marks as dirty every reaction whose parameters depend on
+those of a dirty reaction.  These are the other first order reactions of the
+same reactant, since their probabilities are computed together, and reverse
+reactions, which are marked in both directions. */
+void rxnspreaddirty(simptr sim) {
+	rxnssptr rxnss;
+	rxnptr rxn;
+	int order, r, i, j, o2, r2, rev, ndirty;
+
+	ndirty = 0;
+	for (order = 0; order < MAXORDER; order++)
+		if (sim->rxnss[order])
+			ndirty += sim->rxnss[order]->ndirty;
+	if (!ndirty)
+		return;
+
+	rxnss = sim->rxnss[1];
+	if (rxnss && rxnss->ndirty)
+		for (r = 0; r < rxnss->totrxn; r++)
+			if (rxnss->rxn[r]->dirty) {
+				i = rxnss->rxn[r]->rctident[0];
+				for (j = 0; j < rxnss->nrxn[i]; j++)
+					rxnsetdirty(sim, rxnss->rxn[rxnss->table[i][j]]);
+			}
+
+	for (order = 1; order < MAXORDER; order++) {
+		rxnss = sim->rxnss[order];
+		if (rxnss)
+			for (r = 0; r < rxnss->totrxn; r++) {
+				rxn = rxnss->rxn[r];
+				rev = findreverserxn(sim, order, r, &o2, &r2);
+				if (rev > 0) {
+					if (rxn->dirty)
+						rxnsetdirty(sim, sim->rxnss[o2]->rxn[r2]);
+					else if (sim->rxnss[o2]->rxn[r2]->dirty)
+						rxnsetdirty(sim, rxn);
+				}
+			}
+	}
+	return;
+}
+
 /* rxnsettimestep.  Sets reaction structure parameters for the simulation time
-step.  Return values are 0 for success, 1 for an error with setting either rates
-or products (and output to stderr with an error message), or 2 if the reaction
+step.  Only dirty reactions, and the reactions that depend on them (see
+rxnspreaddirty), are recalculated, so a change to a few reactions doesn't cost a
+pass over all of them.  All reactions of a superstructure are dirty if its
+condition was lowered with rxnsetcondition, such as after a time step change.
+Return values are 0 for success, 1 for an error with setting either rates or
+products (and output to stderr with an error message), or 2 if the reaction
 structure was not sufficiently set up beforehand. */
 int rxnsettimestep(simptr sim) {
-	int er, order, wflag;
+	int er, order, wflag, r, ndirty;
+	rxnssptr rxnss;
 	char errorstr[STRCHAR];
 
 	er = 0;
@@ -2114,39 +2184,71 @@ int rxnsettimestep(simptr sim) {
 	er = 0;
 
 	wflag = strchr(sim->flags, 'w') ? 1 : 0;
-	for (order = 0; order < MAXORDER; order++)
-		if (sim->rxnss[order] && sim->rxnss[order]->condition <= SCparams) {
-			er = rxnsetrates(sim, order, errorstr); // set rates
-			if (er >= 0) {
-				fprintf(
-						stderr,
-						"Error setting rate for reaction order %i, reaction %s\n",
-						order, sim->rxnss[order]->rname[er]);
-				fprintf(stderr, "%s\n", errorstr);
-				return 1;
-			}
-		}
+	ndirty = 0;
+	for (order = 0; order < MAXORDER; order++) { // find dirty reactions
+		rxnss = sim->rxnss[order];
+		if (rxnss && rxnss->alldirty)
+			for (r = 0; r < rxnss->totrxn; r++)
+				rxnsetdirty(sim, rxnss->rxn[r]);
+	}
+	rxnspreaddirty(sim);
 
-	for (order = 0; order < MAXORDER; order++)
-		if (sim->rxnss[order] && sim->rxnss[order]->condition <= SCparams) {
+	for (order = 0; order < MAXORDER; order++) { // set rates
+		rxnss = sim->rxnss[order];
+		if (rxnss && rxnss->ndirty)
+			for (r = 0; r < rxnss->totrxn; r++)
+				if (rxnss->rxn[r]->dirty) {
+					er = rxnsetrate(sim, order, r, errorstr);
+					if (er > 1) {
+						fprintf(
+								stderr,
+								"Error setting rate for reaction order %i, reaction %s\n",
+								order, rxnss->rname[r]);
+						fprintf(stderr, "%s\n", errorstr);
+						return 1;
+					}
+				}
+	}
+
+	for (order = 0; order < MAXORDER; order++) { // set products
+		rxnss = sim->rxnss[order];
+		if (rxnss && rxnss->ndirty) {
 			errorstr[0] = '\0';
-			er = rxnsetproducts(sim, order, errorstr); // set products
-			if (er >= 0) {
-				fprintf(
-						stderr,
-						"Error setting products for reaction order %i, reaction %s\n",
-						order, sim->rxnss[order]->rname[er]);
-				fprintf(stderr, "%s\n", errorstr);
-				return 1;
-			}
+			for (r = 0; r < rxnss->totrxn; r++)
+				if (rxnss->rxn[r]->dirty) {
+					er = rxnsetproduct(sim, order, r, errorstr);
+					if (er) {
+						fprintf(
+								stderr,
+								"Error setting products for reaction order %i, reaction %s\n",
+								order, rxnss->rname[r]);
+						fprintf(stderr, "%s\n", errorstr);
+						return 1;
+					}
+				}
 			if (!wflag && strlen(errorstr))
 				fprintf(stderr, "%s\n", errorstr);
 		}
+	}
 
-	for (order = 0; order < MAXORDER; order++) // calculate tau values
-		if (sim->rxnss[order] && sim->rxnss[order]->condition <= SCparams)
-			rxncalctau(sim, order);
+	for (order = 0; order < MAXORDER; order++) { // calculate tau values and molecule list flags
+		rxnss = sim->rxnss[order];
+		if (rxnss && rxnss->ndirty) {
+			for (r = 0; r < rxnss->totrxn; r++)
+				if (rxnss->rxn[r]->dirty) {
+					rxnsettau(sim, order, r);
+					rxnupdatemollist(sim, order, r);
+					rxnss->rxn[r]->dirty = 0;
+				}
+			ndirty += rxnss->ndirty;
+			rxnss->ndirty = 0;
+		}
+		if (rxnss)
+			rxnss->alldirty = 0;
+	}
 
+	if (ndirty && sim->srfss) // products may need surface actions
+		sim->srfss->molflags = 1;
 	rxnsetcondition(sim, -1, SCok, 1);
 	return 0;
 }
@@ -2172,6 +2274,8 @@ void rxnsetcondition(simptr sim, int order, enum StructCond cond, int upgrade) {
 
 	for (order = o1; order <= o2; order++) {
 		if (sim->rxnss[order]) {
+			if (upgrade != 1 && cond <= SCparams)
+				sim->rxnss[order]->alldirty = 1;
 			if (upgrade == 0 && sim->rxnss[order]->condition > cond)
 				sim->rxnss[order]->condition = cond;
 			else if (upgrade == 1 && sim->rxnss[order]->condition < cond)
@@ -2188,13 +2292,111 @@ void rxnsetcondition(simptr sim, int order, enum StructCond cond, int upgrade) {
 	return;
 }
 
-/* rxnsetmollist */
-int rxnsetmollist(simptr sim, int order) {
+/* rxnsetdirty.  Marks reaction rxn as needing its parameters recalculated at
+the next simulation update.  Unlike rxnsetcondition, this leaves the other
+reactions alone, apart from those that depend on this one. */
+void rxnsetdirty(simptr sim, rxnptr rxn) {
+	rxnssptr rxnss;
+
+	rxnss = rxn->rxnss;
+	if (!rxn->dirty) {
+		rxn->dirty = 1;
+		rxnss->ndirty++;
+	}
+	if (rxnss->condition > SCparams) {
+		rxnss->condition = SCparams;
+		if (sim->condition > SCparams)
+			simsetcondition(sim, SCparams, 0);
+	}
+	return;
+}
+
+/* rxnsetspeciesdirty.  Marks as dirty the reactions that depend on the
+diffusion coefficients of species ident, which are the bimolecular reactions
+that it is a reactant of and the reactions that it is a product of.  Enter
+ident as -1 for all species. */
+void rxnsetspeciesdirty(simptr sim, int ident) {
 	rxnssptr rxnss;
-	int maxlist, ll, nl2o, r, i1, i2, ll1, ll2;
+	rxnptr rxn;
+	int order, r, prd, dirty;
+
+	if (ident < 0) {
+		rxnsetcondition(sim, -1, SCparams, 0);
+		return;
+	}
+	for (order = 0; order < MAXORDER; order++) {
+		rxnss = sim->rxnss[order];
+		if (rxnss)
+			for (r = 0; r < rxnss->totrxn; r++) {
+				rxn = rxnss->rxn[r];
+				dirty = 0;
+				if (order == 2 && (rxn->rctident[0] == ident || rxn->rctident[1] == ident))
+					dirty = 1;
+				for (prd = 0; prd < rxn->nprod && !dirty; prd++)
+					if (rxn->prdident[prd] == ident)
+						dirty = 1;
+				if (dirty)
+					rxnsetdirty(sim, rxn);
+			}
+	}
+	return;
+}
+
+/* rxnupdatemollist.  Sets the rxnmollist flags for the molecule lists of the
+reactants of reaction r of order order, without clearing other flags.  This
+is the incremental form of rxnsetmollist, for reactions that were added or
+changed after the flags were set up.  Returns 0 for success or 2 if the flags
+haven't been set up for the current molecule lists, in which case rxnsetmollist
+is needed. */
+int rxnupdatemollist(simptr sim, int order, int r) {
+	rxnssptr rxnss;
+	int maxlist, i1, i2, ll1, ll2;
 	rxnptr rxn;
 	enum MolecState ms1, ms2;
 
+	rxnss = sim->rxnss[order];
+	if (order == 0)
+		return 0;
+	maxlist = rxnss->maxlist;
+	if (!sim->mols || maxlist != sim->mols->maxlist)
+		return 2;
+	if (maxlist == 0)
+		return 0;
+
+	rxn = rxnss->rxn[r];
+	i1 = rxn->rctident[0];
+	if (order == 1) {
+		for (ms1 = 0; ms1 < MSMAX1; ms1++)
+			if (rxn->permit[ms1] && (rxn->prob[0][0] > 0 || rxn->rate > 0)) {
+				ll1 = sim->mols->listlookup[i1][ms1];
+				rxnss->rxnmollist[ll1] = 1;
+			}
+	}
+	else if (order == 2) {
+		i2 = rxn->rctident[1];
+		for (ms1 = 0; ms1 < MSMAX1; ms1++)
+			for (ms2 = 0; ms2 < MSMAX1; ms2++)
+				//default binding radius should be above zero in any case
+				if (rxn->permit[ms1 * MSMAX1 + ms2] && rxn->prob[0][0] != 0
+						&& (rxn->rate > 0 || rxn->bindrad2[0][0] > 0)) {
+					ll1
+							= sim->mols->listlookup[i1][ms1 == MSbsoln ? MSsoln
+									: ms1];
+					ll2
+							= sim->mols->listlookup[i2][ms2 == MSbsoln ? MSsoln
+									: ms2];
+					rxnss->rxnmollist[ll1 * maxlist + ll2] = 1;
+					rxnss->rxnmollist[ll2 * maxlist + ll1] = 1;
+				}
+	}
+	return 0;
+}
+
+/* rxnsetmollist */
+int rxnsetmollist(simptr sim, int order) {
+	rxnssptr rxnss;
+	int maxlist, ll, nl2o, r;
+
 	rxnss = sim->rxnss[order];
 	if (!rxnss)
 		return 0;
@@ -2228,34 +2430,8 @@ int rxnsetmollist(simptr sim, int order) {
 		for (ll = 0; ll < nl2o; ll++)
 			rxnss->rxnmollist[ll] = 0;
 
-		for (r = 0; r < rxnss->totrxn; r++) {
-			rxn = rxnss->rxn[r];
-			i1 = rxn->rctident[0];
-			if (order == 1) {
-				for (ms1 = 0; ms1 < MSMAX1; ms1++)
-					if (rxn->permit[ms1] && (rxn->prob[0][0] > 0 || rxn->rate > 0)) {
-						ll1 = sim->mols->listlookup[i1][ms1];
-						rxnss->rxnmollist[ll1] = 1;
-					}
-			}
-			else if (order == 2) {
-				i2 = rxn->rctident[1];
-				for (ms1 = 0; ms1 < MSMAX1; ms1++)
-					for (ms2 = 0; ms2 < MSMAX1; ms2++)
-						//default binding radius should be above zero in any case
-						if (rxn->permit[ms1 * MSMAX1 + ms2] && rxn->prob[0][0] != 0
-								&& (rxn->rate > 0 || rxn->bindrad2[0][0] > 0)) {
-							ll1
-									= sim->mols->listlookup[i1][ms1 == MSbsoln ? MSsoln
-											: ms1];
-							ll2
-									= sim->mols->listlookup[i2][ms2 == MSbsoln ? MSsoln
-											: ms2];
-							rxnss->rxnmollist[ll1 * maxlist + ll2] = 1;
-							rxnss->rxnmollist[ll2 * maxlist + ll1] = 1;
-						}
-			}
-		}
+		for (r = 0; r < rxnss->totrxn; r++)
+			rxnupdatemollist(sim, order, r);
 	}
 
 	rxnsetcondition(sim, order, SCparams, 1);
@@ -2311,7 +2487,8 @@ int RxnSetValue(simptr sim, char *option, rxnptr rxn, double value) {
 			er = 2; 
 		}
 	}
-	rxnsetcondition(sim, -1, SCparams, 0);
+	if (rxn)
+		rxnsetdirty(sim, rxn);
 	return er;
 }
 
@@ -2353,7 +2530,7 @@ int RxnSetRevparam(simptr sim, rxnptr rxn, enum RevParam rparamt,
 			  }
 			}
 	}
-	rxnsetcondition(sim, -1, SCparams, 0);
+	rxnsetdirty(sim, rxn);
 	return er;
 }
 
@@ -2365,33 +2542,28 @@ Other values are not allowed (and are not caught here).  This does not affect
 other permit elements. */
 void RxnSetPermit(simptr sim, rxnptr rxn, int order, enum MolecState *rctstate,
 		int value) {
-	enum MolecState ms, nms2o, mslist[MSMAX1];
-	int set, ord;
-	static int recurse;
+	enum MolecState ms, nms2o, mslist[MSMAX1], rctlist[MAXORDER];
+	int set, ord, pass, npass;
 
 	if (order == 0)
 		return;
+	npass = (order == 2 && rxn->rctident[0] == rxn->rctident[1]) ? 2 : 1;
 	nms2o = intpower(MSMAX1, order);
-	for (ms = 0; ms < nms2o; ms++) {
-		rxnunpackstate(order, ms, mslist);
-		set = 1;
-		for (ord = 0; ord < order && set; ord++)
-			if (!(rctstate[ord] == MSall || rctstate[ord] == mslist[ord]))
-				set = 0;
-		if (set)
-			rxn->permit[ms] = value;
-	}
-
-	if (order == 2 && rxn->rctident[0] == rxn->rctident[1] && recurse == 0) {
-		recurse = 1;
-		mslist[0] = rctstate[1];
-		mslist[1] = rctstate[0];
-		RxnSetPermit(sim, rxn, order, mslist, value);
-		recurse = 0;
+	for (pass = 0; pass < npass; pass++) {	// second pass for swapped states
+		for (ord = 0; ord < order; ord++)
+			rctlist[ord] = pass ? rctstate[order - 1 - ord] : rctstate[ord];
+		for (ms = 0; ms < nms2o; ms++) {
+			rxnunpackstate(order, ms, mslist);
+			set = 1;
+			for (ord = 0; ord < order && set; ord++)
+				if (!(rctlist[ord] == MSall || rctlist[ord] == mslist[ord]))
+					set = 0;
+			if (set)
+				rxn->permit[ms] = value;
+		}
 	}
 
-// 	rxnsetcondition(sim, -1, SCparams, 0);
-	surfsetcondition(sim->srfss, SClists, 0);
+	rxnsetdirty(sim, rxn);
 	return;
 }
 
@@ -2429,7 +2601,7 @@ rxnptr RxnAddReaction(simptr sim, char *rname, int order, int *rctident,
 		rxnsetcondition(sim,-1,SClists,0);}
 	rxnss=sim->rxnss[order];
 	maxspecies=rxnss->maxspecies;
-	r=stringfind(rxnss->rname,rxnss->totrxn,rname);
+	r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,rname);
 
 	if(r>=0) {
 		CHECK(rxnss->rxn[r]->nprod==0);
@@ -2479,6 +2651,7 @@ rxnptr RxnAddReaction(simptr sim, char *rname, int order, int *rctident,
 		strncpy(rxnss->rname[rxnss->totrxn],rname,STRCHAR-1); // plug in reaction
 		rxnss->rname[rxnss->totrxn][STRCHAR-1]='\0';
 		rxnss->totrxn++;
+		namehashupdate(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn);
 		rxnss->rxn[rxnss->totrxn-1]=rxn;}
 	freerxn=0;
 
@@ -2509,7 +2682,7 @@ rxnptr RxnAddReaction(simptr sim, char *rname, int order, int *rctident,
 	}
 	rxn->cmpt=cmpt; // add reaction compartment
 	rxn->srf=srf; // add reaction surface
-	surfsetcondition(sim->srfss,SClists,0);
+	rxnsetdirty(sim,rxn);
 	return rxn;
 
 	failure:
@@ -2629,7 +2802,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			for(j--;j>=0;j--) {
 				itct=sscanf(line2,"%s",nm);
 				CHECKS(itct==1,"missing reaction name in reactant");
-				CHECKS(stringfind(rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
+				CHECKS(namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
 				CHECKS(RxnAddReaction(sim,nm,0,NULL,NULL,0,NULL,NULL,NULL,NULL),"faied to add 0th order reaction");
 				line2=strnword(line2,2);}}
 
@@ -2650,7 +2823,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			for(j--;j>=0;j--) {
 				itct=sscanf(line2,"%s",nm);
 				CHECKS(itct==1,"missing reaction name in reactant");
-				CHECKS(stringfind(rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
+				CHECKS(namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
 				CHECKS(RxnAddReaction(sim,nm,1,identlist,mslist,0,NULL,NULL,NULL,NULL),"faied to add 1st order reaction");
 				line2=strnword(line2,2);}}
 
@@ -2680,7 +2853,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			for(j--;j>=0;j--) {
 				itct=sscanf(line2,"%s",nm);
 				CHECKS(itct==1,"missing reaction name in reactant");
-				CHECKS(stringfind(rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
+				CHECKS(namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm)<0,"reaction name has already been used");
 				CHECKS(RxnAddReaction(sim,nm,2,identlist,mslist,0,NULL,NULL,NULL,NULL),"faied to add 1st order reaction");
 				line2=strnword(line2,2);}}
 
@@ -2700,7 +2873,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(line2=strnword(line2,2),"permit format: name(state) rxn_name value");
 			itct=sscanf(line2,"%s %i",rxnnm,&i3);
 			CHECKS(itct==2,"permit format: name(state) rxn_name value");
-			r=stringfind(rxnss->rname,rxnss->totrxn,rxnnm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,rxnnm);
 			CHECKS(r>=0,"in permit, reaction name not recognized");
 			for(j=0;j<rxnss->nrxn[i] && rxnss->table[i][j]!=r;j++);
 			CHECKS(rxnss->table[i][j]==r,"in permit, reaction was not already listed for this reactant");
@@ -2731,7 +2904,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			i=i1*maxspecies+i2;
 			itct=sscanf(line2,"%s %i",rxnnm,&i3);
 			CHECKS(itct==2,"permit format: name(state) + name(state) rxn_name value");
-			r=stringfind(rxnss->rname,rxnss->totrxn,rxnnm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,rxnnm);
 			CHECKS(r>=0,"in permit, reaction name not recognized");
 			for(j=0;j<rxnss->nrxn[i] && rxnss->table[i][j]!=r;j++);
 			CHECKS(rxnss->table[i][j]==r,"in permit, reaction was not already listed for this reactant");
@@ -2743,7 +2916,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before rate");
 			itct=sscanf(line2,"%s %lg",nm,&rtemp);
 			CHECKS(itct==2,"format for rate: rxn_name rate");
-			r=stringfind(rxnss->rname,rxnss->totrxn,nm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm);
 			CHECKS(r>=0,"unknown reaction name in rate");
 			CHECKS(rtemp>=0,"reaction rate needs to be >=0 (maybe try rate_internal)");
 			rxnss->rxn[r]->rate=rtemp;
@@ -2753,7 +2926,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before confspread_radius");
 			itct=sscanf(line2,"%s %lg",nm,&rtemp);
 			CHECKS(itct==2,"format for confspread_radius: rxn_name radius");
-			r=stringfind(rxnss->rname,rxnss->totrxn,nm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm);
 			CHECKS(r>=0,"unknown reaction name in confspread_radius");
 			CHECKS(rxnss->rxn[r]->rparamt!=RPconfspread,"confspread_radius can only be entered once for a reaction");
 			CHECKS(rtemp>=0,"confspread_radius needs to be >=0");
@@ -2769,7 +2942,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before rate_internal");
 			itct=sscanf(line2,"%s %lg",nm,&rtemp);
 			CHECKS(itct==2,"format for rate_internal: rxn_name rate");
-			r=stringfind(rxnss->rname,rxnss->totrxn,nm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm);
 			CHECKS(r>=0,"unknown reaction name in rate_internal");
 			CHECKS(rtemp>=0,"rate_internal needs to be >=0");
 			for(k=0;k<=sim->nrfs;k++){
@@ -2788,7 +2961,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before probability");
 			itct=sscanf(line2,"%s %lg",nm,&rtemp);
 			CHECKS(itct==2,"format for probability: rxn_name probability");
-			r=stringfind(rxnss->rname,rxnss->totrxn,nm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm);
 			CHECKS(r>=0,"unknown reaction name in probability");
 			CHECKS(rtemp>=0,"probability needs to be >=0");
 			CHECKS(rtemp<=1,"probability needs to be <=1");
@@ -2803,7 +2976,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before product");
 			itct=sscanf(line2,"%s",rxnnm);
 			CHECKS(itct==1,"format for product: rxn_name product_list");
-			r=stringfind(rxnss->rname,rxnss->totrxn,rxnnm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,rxnnm);
 			CHECKS(r>=0,"unknown reaction name in product");
 			nptemp=symbolcount(line2,'+')+1;
 			CHECKS(nptemp>=0,"number of products needs to be >=0");
@@ -2829,7 +3002,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 			CHECKS(got[0],"order needs to be entered before product_param");
 			itct=sscanf(line2,"%s",nm);
 			CHECKS(itct==1,"format for product_param: rxn type [parameters]");
-			r=stringfind(rxnss->rname,rxnss->totrxn,nm);
+			r=namehashfind(&rxnss->rnamehash,rxnss->rname,rxnss->totrxn,nm);
 			CHECKS(r>=0,"unknown reaction name in product_param");
 			rxn=rxnss->rxn[r];
 			rparamt=rxn->rparamt;
@@ -2850,7 +3023,7 @@ int loadrxn(simptr sim, ParseFilePtr *pfpptr, char *line2, char *erstr) {
 				CHECKS(line2=strnword(line2,2),"missing parameters in product_param");
 				itct=sscanf(line2,"%s",nm2);
 				CHECKS(itct==1,"format for product_param: rxn type [parameters]");
-				CHECKS((i=stringfind(sim->mols->spname,sim->mols->nspecies,nm2))>=0,"unknown molecule in product_param");
+				CHECKS((i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm2))>=0,"unknown molecule in product_param");
 				for(prd=0;prd<rxn->nprod && rxn->prdident[prd]!=i;prd++);
 				CHECKS(prd<rxn->nprod,"molecule in product_param is not a product of this reaction");
 				CHECKS(line2=strnword(line2,2),"position vector missing for product_param");
@@ -3286,8 +3459,10 @@ routine whether to consider only reactions between neighboring boxes (neigh=1)
 or only reactions within a box (neigh=0).  The former are relatively slow and so
 can be ignored for qualitative simulations by choosing a lower simulation
 accuracy value.  In cases where walls are periodic, it is possible to have
-reactions over the system walls.  The function returns 0 for success or 1 if not
-enough molecules were allocated initially. */
+reactions over the system walls.  With domain decomposition, only the pairs of
+boxes that domainpair accepts for the current reaction phase are considered.
+The function returns 0 for success or 1 if not enough molecules were allocated
+initially. */
 int bireact(simptr sim, int neigh) {
 	int surf_num1, surf_num2, dim, maxspecies, ll1, ll2, i, j, d, *nl, nmol2,
 			b2, m1, m2, bmax, wpcode, nlist, maxlist;
@@ -3297,10 +3472,14 @@ int bireact(simptr sim, int neigh) {
 	rxnptr rxn, *rxnlist;
 	boxptr bptr;
 	moleculeptr **live, *mlist2, mptr1, mptr2;
+	domainptr dom;
 
 	rxnss = sim->rxnss[2];
 	if (!rxnss)
 		return 0;
+	dom = sim->boxs->dom;
+	if (dom && dom->phase < 0)
+		dom = NULL;
 	dim = sim->dim;
 	live = sim->mols->live;
 	maxspecies = rxnss->maxspecies;
@@ -3318,6 +3497,8 @@ int bireact(simptr sim, int neigh) {
 					for (m1 = 0; m1 < nl[ll1]; m1++) {
 						mptr1 = live[ll1][m1];
 						bptr = mptr1->box;
+						if (dom && !domainpair(dom, bptr, bptr))
+							continue;
 						mlist2 = bptr->mol[ll2];
 						nmol2 = bptr->nmol[ll2];
 						for (m2 = 0; m2 < nmol2 && mlist2[m2] != mptr1; m2++) {
@@ -3366,6 +3547,8 @@ int bireact(simptr sim, int neigh) {
 						bptr = mptr1->box;
 						bmax = (ll1 != ll2) ? bptr->nneigh : bptr->midneigh;
 						for (b2 = 0; b2 < bmax; b2++) {
+							if (dom && !domainpair(dom, bptr, bptr->neigh[b2]))
+								continue;
 							mlist2 = bptr->neigh[b2]->mol[ll2];
 							nmol2 = bptr->neigh[b2]->nmol[ll2];
 							if (bptr->wpneigh && bptr->wpneigh[b2]) { // neighbor box with wrapping
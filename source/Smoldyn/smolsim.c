@@ -4,7 +4,9 @@
  Copyright 2003-2011 by Steven Andrews.  This work is distributed under the terms
  of the Gnu General Public License (GPL). */
 
+#include <ctype.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <time.h>
@@ -16,9 +18,57 @@
 #include "smoldyn.h"
 #include "Zn.h"
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+#endif
+
 #define CHECK(A) if(!(A)) goto failure; else (void)0
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
+#define CKPTMAGIC 0x4b434d53
+#define CKPTVERSION 2
+
+typedef struct ckptheadstruct {	// checkpoint file header
+	int magic;									// CKPTMAGIC
+	int version;								// CKPTVERSION
+	int dim;										// system dimensionality
+	int nspecies;								// number of species
+	int nlist;									// number of molecule lists
+	int nbox;										// number of boxes
+	int ncmpt;									// number of compartments
+	int ngausstbl;							// size of Gaussian random number table
+	int eventcount[ETMAX];			// event counters
+	long long serno;						// next molecule serial number
+	long long seed;							// random number seed at checkpoint
+	double time;								// simulation time
+	double dt;									// time step
+	} *ckptheadptr;
+
+typedef struct ckptmolstruct {	// checkpoint molecule record
+	long long serno;						// serial number
+	int ident;									// species
+	int mstate;									// state
+	int box;										// box number, or -1 if none
+	int slot;										// index in box molecule list
+	int srf;										// surface of bound panel, or -1
+	int ps;											// panel shape
+	int pnl;										// panel number
+	int reserved;								// 0, for alignment
+	double pos[DIMMAX];					// position
+	double posx[DIMMAX];				// prior position
+	double via[DIMMAX];					// last surface interaction
+	double posoffset[DIMMAX];		// offset from jumps
+	} *ckptmolptr;
+
 
 /******************************************************************************/
 /***************************** Simulation structure ***************************/
@@ -30,6 +80,12 @@
 /******************************************************************************/
 
 
+/* Names of the event types of enum EventType, for summaries (etname) and for
+column headings (etcol). */
+static char *etname[ETMAX]={"wall interactions","surface interactions","desorptions","zeroth order reactions","unimolecular reactions","intrabox bimolecular reactions","interbox bimolecular reactions","wrap-around bimolecular reactions","imported molecules","exported molecules","dropped port imports"};
+static char *etcol[ETMAX]={"wall","surf","desorb","rxn0","rxn1","rxn2intra","rxn2inter","rxn2wrap","import","export","importdrop"};
+
+
 /* simstring2ss.  Returns the enumerated simulation structure type that
 corresponds to the string input.  Returns SSnone if input is �none� or if it is
 not recognized. */
@@ -94,6 +150,100 @@ void Simsetrandseed(simptr sim,long int randseed) {
 	return; }
 
 
+/* namehashkey.  Returns the FNV-1a hash value of string name. */
+unsigned int namehashkey(char *name) {
+	unsigned int key;
+
+	key=2166136261u;
+	for(;*name;name++) {
+		key^=(unsigned char)*name;
+		key*=16777619u; }
+	return key; }
+
+
+/* namehashfree.  Frees a name hash. */
+void namehashfree(namehashptr nh) {
+	if(!nh) return;
+	free(nh->bucket);
+	free(nh->next);
+	free(nh);
+	return; }
+
+
+/* namehashupdate.  Brings the name hash that is pointed to by nhptr up to date
+with the first n entries of the list names.  The hash is allocated if *nhptr is
+NULL.  A hash is an index into a name list that is owned elsewhere, so it only
+records list indices and it assumes that names are only ever added to the end of
+the list; entries that are already indexed are not checked again.  If the list
+has fewer than the indexed number of names, or it has outgrown the bucket
+array, the hash is rebuilt from scratch.  If a name appears more than once, only
+its first occurrence is indexed, for consistency with stringfind.  Returns 0 for
+success or 1 for inability to allocate memory, in which case *nhptr is freed and
+set to NULL. */
+int namehashupdate(namehashptr *nhptr,char **names,int n) {
+	namehashptr nh;
+	int nbucket,maxn,i,j,b,*newint;
+
+	nh=*nhptr;
+	if(!nh) {
+		CHECK(nh=(namehashptr) malloc(sizeof(struct namehashstruct)));
+		nh->nbucket=0;
+		nh->n=0;
+		nh->maxn=0;
+		nh->bucket=NULL;
+		nh->next=NULL;
+		*nhptr=nh; }
+	if(nh->n==n) return 0;
+
+	if(n>nh->maxn) {
+		maxn=2*n+1;
+		CHECK(newint=(int*) calloc(maxn,sizeof(int)));
+		for(i=0;i<nh->n;i++) newint[i]=nh->next[i];
+		free(nh->next);
+		nh->next=newint;
+		nh->maxn=maxn; }
+
+	if(n<nh->n || n>nh->nbucket) {
+		for(nbucket=16;nbucket<2*n;nbucket*=2);
+		if(nbucket!=nh->nbucket) {
+			CHECK(newint=(int*) calloc(nbucket,sizeof(int)));
+			free(nh->bucket);
+			nh->bucket=newint;
+			nh->nbucket=nbucket; }
+		for(b=0;b<nh->nbucket;b++) nh->bucket[b]=-1;
+		nh->n=0; }
+
+	for(i=nh->n;i<n;i++) {
+		b=namehashkey(names[i])&(nh->nbucket-1);
+		for(j=nh->bucket[b];j>=0 && strcmp(names[j],names[i]);j=nh->next[j]);
+		if(j>=0) nh->next[i]=-2;
+		else {
+			nh->next[i]=nh->bucket[b];
+			nh->bucket[b]=i; }}
+	nh->n=n;
+	return 0;
+
+ failure:
+	namehashfree(nh);
+	*nhptr=NULL;
+	return 1; }
+
+
+/* namehashfind.  Returns the index of name in the first n entries of the list
+names, or -1 if it isn't there, just like stringfind but using the hash pointed
+to by nhptr.  The hash is updated first, so the list can grow between calls.
+If memory for the hash can't be allocated, this falls back to stringfind. */
+int namehashfind(namehashptr *nhptr,char **names,int n,char *name) {
+	namehashptr nh;
+	int i;
+
+	if(namehashupdate(nhptr,names,n)) return stringfind(names,n,name);
+	nh=*nhptr;
+	if(!n) return -1;
+	for(i=nh->bucket[namehashkey(name)&(nh->nbucket-1)];i>=0 && strcmp(names[i],name);i=nh->next[i]);
+	return i; }
+
+
 /******************************************************************************/
 /******************************* memory management ****************************/
 /******************************************************************************/
@@ -130,6 +280,18 @@ simptr simalloc(char *fileroot) {
 	sim->portss=NULL;
 	sim->mzrss=NULL;
 	sim->cmds=NULL;
+	sim->obsplan=NULL;
+	sim->outss=NULL;
+	sim->snapss=NULL;
+	sim->ckptname=NULL;
+	sim->restorename=NULL;
+	sim->cmdreplay=0;
+	sim->restoring=0;
+	sim->updatedepth=0;
+	sim->started=0;
+	sim->nrep=0;
+	sim->maxrep=0;
+	sim->sweep=NULL;
 	sim->graphss=NULL;
 	sim->threads=NULL;
 	simsetpthreads(sim,0);
@@ -137,6 +299,8 @@ simptr simalloc(char *fileroot) {
 	CHECK(sim->filepath=EmptyString());
 	CHECK(sim->filename=EmptyString());
 	CHECK(sim->flags=EmptyString());
+	CHECK(sim->ckptname=EmptyString());
+	CHECK(sim->restorename=EmptyString());
 	CHECK(sim->cmds=scmdssalloc(&docommand,(void*)sim,fileroot));
 	return sim;
 
@@ -154,8 +318,12 @@ void simfree(simptr sim) {
 	dim=sim->dim;
 
 	threadssfree(sim->threads);
+	sweepfree(sim->sweep);
 	graphssfree(sim->graphss);
+	snapssfree(sim->snapss);
+	outssfree(sim->outss);
 	scmdssfree(sim->cmds);
+	obsplanfree(sim->obsplan);
 	mzrssfree(sim->mzrss);
 	portssfree(sim->portss);
 	compartssfree(sim->cmptss);
@@ -166,6 +334,8 @@ void simfree(simptr sim) {
 	for(order=0;order<MAXORDER;order++) rxnssfree(sim->rxnss[order]);
 	free(sim->flags);
 	free(sim->filename);
+	free(sim->restorename);
+	free(sim->ckptname);
 	free(sim->filepath);
 	free(sim);
 	return; }
@@ -191,6 +361,12 @@ void simoutput(simptr sim) {
 
 	if(sim->threads) printf(" Using threading with %d threads\n",sim->threads->nthreads);
 	else printf(" Running in single-threaded mode\n");
+	if(sim->outss && sim->outss->maxqueue==0) printf(" Command output is not buffered\n");
+	else if(sim->outss) printf(" Command output buffer: %i bytes\n",sim->outss->maxqueue);
+	if(sim->snapss) printf(" Snapshot processes: up to %i at once\n",sim->snapss->maxsnap);
+	if(sim->nrep && sim->maxrep) printf(" Ensemble of %i replicates, up to %i at once\n",sim->nrep,sim->maxrep);
+	else if(sim->nrep) printf(" Ensemble of %i replicates, one per processor at once\n",sim->nrep);
+	if(sim->sweep) printf(" Parameter sweep with %i points, from %i listed points and %i statements\n",sweepnumber(sim->sweep),sim->sweep->npoint,sim->sweep->nstmt);
 	
 	printf(" Time from %g to %g step %g\n",sim->tmin,sim->tmax,sim->dt);
 	if(sim->time!=sim->tmin) printf(" Current time: %g\n",sim->time);
@@ -202,6 +378,10 @@ void simoutput(simptr sim) {
 substructures, to the file fptr using a format that can be read by Smoldyn.
 This allows a simulation state to be saved. */
 void writesim(simptr sim,FILE *fptr) {
+	int o,d;
+	obstacleptr obst;
+	char string[STRCHAR];
+
 	fprintf(fptr,"# General simulation parameters\n");
 	fprintf(fptr,"# Configuration file: %s%s\n",sim->filepath,sim->filename);
 	fprintf(fptr,"dim %i\n",sim->dim);
@@ -212,8 +392,21 @@ void writesim(simptr sim,FILE *fptr) {
 	fprintf(fptr,"time_step %g\n",sim->dt);
 	fprintf(fptr,"time_now %g\n",sim->time);
 	fprintf(fptr,"accuracy %g\n",sim->accur);
+	if(sim->outss && sim->outss->maxqueue!=OUTMAXQUEUE) fprintf(fptr,"output_buffer %i\n",sim->outss->maxqueue);
+	if(sim->snapss && sim->snapss->maxsnap!=SNAPMAX) fprintf(fptr,"max_snapshots %i\n",sim->snapss->maxsnap);
 	if(sim->boxs->mpbox) fprintf(fptr,"molperbox %g\n",sim->boxs->mpbox);
 	else if(sim->boxs->boxsize) fprintf(fptr,"boxsize %g\n",sim->boxs->boxsize);
+	if(sim->boxs->dom) fprintf(fptr,"domains %i %i %i\n",sim->boxs->dom->ndomain,sim->boxs->dom->axis,sim->boxs->dom->maxrec);
+	for(o=0;o<sim->boxs->nobst;o++) {
+		obst=sim->boxs->obstlist[o];
+		fprintf(fptr,"obstacle %s %s",obst->include?"include":"exclude",boxos2string(obst->os,string));
+		if(obst->os==OSbox)
+			for(d=0;d<sim->dim;d++) fprintf(fptr," %g %g",obst->poslo[d],obst->poshi[d]);
+		else if(obst->os==OSsphere || obst->os==OScapsule) {
+			for(d=0;d<sim->dim;d++) fprintf(fptr," %g",obst->cent[d]);
+			fprintf(fptr," %g",obst->rad);
+			if(obst->os==OScapsule) fprintf(fptr," %g",obst->length); }
+		fprintf(fptr,"\n"); }
 	fprintf(fptr,"\n");
 	return; }
 
@@ -338,6 +531,18 @@ int simsettime(simptr sim,double time,int code) {
 	return er; }
 
 
+/* simsetreplicates.  Sets the number of replicates that smolsimulateensemble
+runs to nrep, or to 0 for a single normal run, and the maximum number that run
+at once to maxrep, or to 0 for one per processor.  Returns 0 for success, 2 if
+nrep is negative, or 3 if maxrep is negative. */
+int simsetreplicates(simptr sim,int nrep,int maxrep) {
+	if(nrep<0) return 2;
+	if(maxrep<0) return 3;
+	sim->nrep=nrep;
+	sim->maxrep=maxrep;
+	return 0; }
+
+
 /* simreadstring */
 int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 	char nm[STRCHAR],nm1[STRCHAR],shapenm[STRCHAR],ch,rname[STRCHAR],errstring[STRCHAR];
@@ -345,6 +550,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 	double flt1,flt2,v1[DIMMAX*DIMMAX],v2[4],poslo[DIMMAX],poshi[DIMMAX];
 	enum MolecState ms,rctstate[MAXORDER],prdstate[MAXPRODUCT];
 	enum PanelShape ps;
+	enum ObstacleShape os;
 	enum RevParam rpart;
 	enum LightParam ltparam;
 	rxnptr rxn;
@@ -521,7 +727,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		itct=sscanf(line2,"%i %s",&nmol,nm);
 		CHECKS(itct==2,"mol format: number name position_vector");
 		CHECKS(nmol>=0,"number of molecules added needs to be >=0");
-		i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 		CHECKS(i>0,"name not recognized for mol");
 		CHECKS(line2=strnword(line2,2),"insufficient data in mol command");
 		if(sim->wlist)
@@ -565,7 +771,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(itct==3,"surface_mol format: nmol species(state) surface panel_shape panel_name [position]");
 		if(!strcmp(nm,"all")) s=-1;
 		else {
-			s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+			s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 			CHECKS(s>=0,"surface name in surface_mol is not recognized"); }
 		ps=surfstring2ps(shapenm);
 		CHECKS(ps!=PSnone,"in surface_mol, panel shape name not recognized");
@@ -862,6 +1068,58 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(!er,"error setting output_file_number");
 		CHECKS(!strnword(line2,3),"unexpected text following output_file_number"); }
 
+	else if(!strcmp(word,"output_buffer")) {			// output_buffer
+		itct=sscanf(line2,"%i",&i1);
+		CHECKS(itct==1,"output_buffer format: bytes");
+		er=outsetmaxqueue(sim,i1);
+		CHECKS(er!=1,"out of memory in output_buffer");
+		CHECKS(er!=2,"output_buffer needs to be at least 0");
+		CHECKS(!strnword(line2,2),"unexpected text following output_buffer"); }
+
+	else if(!strcmp(word,"max_snapshots")) {			// max_snapshots
+		itct=sscanf(line2,"%i",&i1);
+		CHECKS(itct==1,"max_snapshots format: number");
+		er=snapsetmax(sim,i1);
+		CHECKS(er!=1,"out of memory in max_snapshots");
+		CHECKS(er!=2,"max_snapshots needs to be at least 0");
+		CHECKS(!strnword(line2,2),"unexpected text following max_snapshots"); }
+
+	else if(!strcmp(word,"replicates")) {					// replicates
+		itct=sscanf(line2,"%i %i",&i1,&i);
+		CHECKS(itct>=1,"replicates format: number [max_parallel]");
+		if(itct==1) i=0;
+		er=simsetreplicates(sim,i1,i);
+		CHECKS(er!=2,"number of replicates needs to be at least 0");
+		CHECKS(er!=3,"maximum number of parallel replicates needs to be at least 0");
+		CHECKS(!strnword(line2,itct+1),"unexpected text following replicates"); }
+
+	else if(!strcmp(word,"sweep")) {							// sweep
+		itct=sscanf(line2,"%s",nm);
+		CHECKS(itct==1,"sweep format: label statement");
+		er=sweepaddstatement(sim,nm,strnword(line2,2));
+		CHECKS(er!=1,"out of memory in sweep");
+		CHECKS(er!=2,"sweep format: label statement"); }
+
+	else if(!strcmp(word,"sweep_grid")) {					// sweep_grid
+		er=sweepaddstatement(sim,NULL,line2);
+		CHECKS(er!=1,"out of memory in sweep_grid");
+		CHECKS(er!=2,"sweep_grid format: statement : value1 value2 ..."); }
+
+	else if(!strcmp(word,"sweep_output")) {				// sweep_output
+		itct=sscanf(line2,"%s",nm);
+		CHECKS(itct==1,"sweep_output format: filename");
+		er=sweepsetoutput(sim,nm);
+		CHECKS(er!=1,"out of memory in sweep_output");
+		CHECKS(!strnword(line2,2),"unexpected text following sweep_output"); }
+
+	else if(!strcmp(word,"restore_checkpoint")) {	// restore_checkpoint
+		itct=sscanf(line2,"%s",nm);
+		CHECKS(itct==1,"restore_checkpoint format: filename");
+		CHECKS(strlen(sim->filepath)+strlen(nm)<STRCHAR,"restore_checkpoint file name is too long");
+		strcpy(sim->restorename,sim->filepath);
+		strcat(sim->restorename,nm);
+		CHECKS(!strnword(line2,2),"unexpected text following restore_checkpoint"); }
+
 	else if(!strcmp(word,"cmd")) {								// cmd
 		er=scmdstr2cmd(sim->cmds,line2,sim->tmin,sim->tmax,sim->dt);
 		CHECKS(er!=1,"out of memory in cmd");
@@ -905,7 +1163,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(itct==2,"surface format: surface_name statement_name statement_text");
 		line2=strnword(line2,3);
 		CHECKS(line2,"surface format: surface_name statement_name statement_text");
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		CHECKS(s>=0,"surface is unrecognized");
 		srf=sim->srfss->srflist[s];
 		srf=surfreadstring(sim,srf,nm1,line2,errstring);
@@ -978,7 +1236,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(sim->mols,"need to enter species before reference_difc");
 		itct=sscanf(line2,"%s",nm);
 		CHECKS(itct==1,"reference_difc needs to be a string");
-		i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 		CHECKS(i>0,"species name not recognized");
 		mzrSetValue(sim->mzrss,"refspecies",i);
 		CHECKS(!strnword(line2,2),"unexpected text following reference_difc"); }
@@ -999,6 +1257,14 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		mzrSetValue(sim->mzrss,"expandall",i1);
 		CHECKS(!strnword(line2,2),"unexpected text following expand_network"); }
 	
+	else if(!strcmp(word,"expand_in_background")) {				// expand_in_background
+		CHECKS(sim->mzrss,"need to enter start_rules before expand_in_background");
+		itct=sscanf(line2,"%i",&i1);
+		CHECKS(itct==1,"expand_in_background needs to be an integer");
+		CHECKS(i1==0 || i1==1,"expand_in_background needs to be 0 or 1");
+		mzrSetValue(sim->mzrss,"expandasync",i1);
+		CHECKS(!strnword(line2,2),"unexpected text following expand_in_background"); }
+
 	else if(!strcmp(word,"default_state")) {									// default_state
 		CHECKS(sim->mzrss,"need to enter start_rules before default_state");
 		CHECKS(sim->mols,"need to enter max_species before default_state");
@@ -1079,7 +1345,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 			itct=sscanf(line2,"%s",nm);
 			CHECKS(itct==1,"failed to read reaction surface");
 			CHECKS(sim->srfss,"no surfaces defined");
-			s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+			s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 			CHECKS(s>=0,"surface name not recognized");
 			srf=sim->srfss->srflist[s];
 			line2=strnword(line2,2);
@@ -1088,7 +1354,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(itct==1,"failed to read reaction name");
 		for(order=0;order<MAXORDER;order++)
 			if(sim->rxnss[order]) {
-				CHECKS(stringfind(sim->rxnss[order]->rname,sim->rxnss[order]->totrxn,rname)<0,"reaction name has already been used"); }
+				CHECKS(namehashfind(&sim->rxnss[order]->rnamehash,sim->rxnss[order]->rname,sim->rxnss[order]->totrxn,rname)<0,"reaction name has already been used"); }
 		CHECKS(line2=strnword(line2,2),"missing first reactant");
 		order=0;
 		more=1;
@@ -1242,7 +1508,7 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 			CHECKS(line2,"missing parameters in product_placement");
 			itct=sscanf(line2,"%s",nm1);
 			CHECKS(itct==1,"format for product_param: rname type parameters");
-			CHECKS((i=stringfind(sim->mols->spname,sim->mols->nspecies,nm1))>=0,"unknown molecule in product_placement");
+			CHECKS((i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm1))>=0,"unknown molecule in product_placement");
 			for(prd=0;prd<rxn->nprod && rxn->prdident[prd]!=i;prd++);
 			CHECKS(prd<rxn->nprod,"molecule in product_placement is not a product of this reaction");
 			CHECKS(line2=strnword(line2,2),"position vector missing for product_placement");
@@ -1286,6 +1552,54 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(er!=3,"need to enter dim before boxsize");
 		CHECKS(!strnword(line2,2),"unexpected text following boxsize"); }
 
+	else if(!strcmp(word,"domains")) {						// domains
+		itct=sscanf(line2,"%i",&i1);
+		CHECKS(itct==1,"domains format: number [axis [buffer_size]]");
+		d=0;
+		i=0;
+		line2=strnword(line2,2);
+		if(line2) {
+			itct=sscanf(line2,"%i",&d);
+			CHECKS(itct==1,"domains axis needs to be an integer");
+			line2=strnword(line2,2);
+			if(line2) {
+				itct=sscanf(line2,"%i",&i);
+				CHECKS(itct==1,"domains buffer size needs to be an integer");
+				line2=strnword(line2,2); }}
+		er=boxsetdomains(sim,i1,d,i);
+		CHECKS(er!=1,"out of memory");
+		CHECKS(er!=2,"number of domains needs to be at least 1");
+		CHECKS(er!=3,"need to enter dim before domains");
+		CHECKS(er!=4,"domains axis needs to be between 0 and dim-1");
+		CHECKS(er!=5,"domains buffer size needs to be at least 0");
+		CHECKS(!line2,"unexpected text following domains"); }
+
+	else if(!strcmp(word,"obstacle")) {						// obstacle
+		itct=sscanf(line2,"%s %s",nm,nm1);
+		CHECKS(itct==2,"obstacle format: include|exclude shape parameters");
+		if(!strcmp(nm,"include")) i1=1;
+		else if(!strcmp(nm,"exclude")) i1=0;
+		else i1=-1;
+		CHECKS(i1>=0,"obstacle needs to be include or exclude");
+		os=boxstring2os(nm1);
+		CHECKS(os!=OSnone,"obstacle shape needs to be box, sphere, capsule, or ecoli");
+		if(os==OSbox) i=2*dim;
+		else if(os==OSsphere) i=dim+1;
+		else if(os==OScapsule) i=dim+2;
+		else i=0;
+		line2=strnword(line2,3);
+		if(i) {
+			CHECKS(line2,"missing obstacle parameters");
+			itct=strreadnd(line2,i,v1,NULL);
+			CHECKS(itct==i,"failure reading obstacle parameters");
+			line2=strnword(line2,i+1); }
+		er=boxaddobstacle(sim,i1,os,v1);
+		CHECKS(er!=1,"out of memory");
+		CHECKS(er!=2,"illegal obstacle parameters");
+		CHECKS(er!=3,"need to enter dim before obstacle");
+		CHECKS(er!=4,"ecoli obstacles require a 3 dimensional system");
+		CHECKS(!line2,"unexpected text following obstacle"); }
+
 	else if(!strcmp(word,"gauss_table_size")) {		// gauss_table_size
 		itct=sscanf(line2,"%i",&i1);
 		CHECKS(itct==1,"gauss_table_size needs to be an integer");
@@ -1313,6 +1627,15 @@ int simreadstring(simptr sim,char *word,char *line2,char *erstr) {
 		CHECKS(er!=3,"neighdist value needs to be at least 0");
 		CHECKS(!strnword(line2,2),"unexpected text following neighbor_dist"); }
 
+	else if(!strcmp(word,"emitter_theta")) {			// emitter_theta
+		CHECKS(dim>0,"need to enter dim before emitter_theta");
+		itct=sscanf(line2,"%lg",&flt1);
+		CHECKS(itct==1,"emitter_theta format: value");
+		er=surfsetemittertheta(sim,flt1);
+		CHECKS(er!=2,"out of memory");
+		CHECKS(er!=3,"emitter_theta value needs to be at least 0");
+		CHECKS(!strnword(line2,2),"unexpected text following emitter_theta"); }
+
 	else if(!strcmp(word,"pthreads")) {						// pthreads
 		itct=sscanf(line2,"%i",&i1);
 		CHECKS(itct==1,"pthreads format: number_of_threads");
@@ -1399,15 +1722,14 @@ int loadsim(simptr sim,char *fileroot,char *filename,char *erstr,char *flags) {
 /* simupdate */
 int simupdate(simptr sim,char *erstr) {
 	int er,qflag;
-	static int recurs=0;
 	char errstring[STRCHAR];
 
 	if(sim->condition==SCok) {
 		return 0; }
-	if(recurs>10) {
-		recurs=0;
+	if(sim->updatedepth>10) {
+		sim->updatedepth=0;
 		return 2; }
-	recurs++;
+	sim->updatedepth++;
 
 	qflag=strchr(sim->flags,'q')?1:0;
 
@@ -1442,6 +1764,7 @@ int simupdate(simptr sim,char *erstr) {
 	if(sim->condition==SCinit && !qflag && sim->portss) printf(" setting up ports\n");
 	er=setupports(sim);
 	CHECKS(er!=1,"out of memory setting up ports");
+	CHECKS(er!=3,"unable to open shared memory ring for port");
 
 	if(sim->condition==SCinit && !qflag && sim->mzrss) printf(" setting up moleculizer\n");
 	CHECKS(!mzrsetupmoleculizer(sim,errstring),errstring);
@@ -1457,11 +1780,12 @@ int simupdate(simptr sim,char *erstr) {
 	if(sim->mzrss && sim->mzrss->condition!=SCok) simupdate(sim,erstr);
 
 	simsetcondition(sim,SCok,1);
-	recurs=0;
+	sim->updatedepth=0;
 
 	return 0;
 
  failure:
+	sim->updatedepth=0;
 	return 1; }
 
 
@@ -1510,8 +1834,14 @@ int setupsim(char *fileroot,char *filename,simptr *smptr,char *flags) {
 	wflag=strchr(sim->flags,'w')?1:0;
 	vflag=strchr(sim->flags,'v')?1:0;
 
+	sim->restoring=sim->restorename[0]?1:0;
 	er=simupdate(sim,errstring);
 	CHECKS(!er,errstring);
+	if(sim->restoring) {
+		er=simreadcheckpoint(sim,sim->restorename,errstring);
+		CHECKS(!er,errstring);
+		sim->restoring=0;
+		if(!qflag) printf(" Restored checkpoint %s at time %g\n",sim->restorename,sim->time); }
 
 	if(!qflag) printf("\n");
 	if(!qflag) simoutput(sim);
@@ -1534,10 +1864,520 @@ int setupsim(char *fileroot,char *filename,simptr *smptr,char *flags) {
  failure:
 	fprintf(stderr,"%s",erstr);
 	fprintf(stderr,"\n");
+	if(sim) sim->restoring=0;
 	if(!*smptr) simfree(sim);
 	return 1; }
 
 
+/******************************************************************************/
+/********************************* checkpoints ********************************/
+/******************************************************************************/
+
+
+/* simpanelindex.  Finds panel pnl in the surface superstructure.  Returns the
+panel number and returns the surface number in *sptr and the panel shape in
+*psptr, or returns -1 if the panel isn't found. */
+int simpanelindex(simptr sim,panelptr pnl,int *sptr,int *psptr) {
+	int s,p;
+	enum PanelShape ps;
+	surfaceptr srf;
+
+	for(s=0;s<sim->srfss->nsrf;s++) {
+		srf=sim->srfss->srflist[s];
+		if(srf!=pnl->srf) continue;
+		ps=pnl->ps;
+		for(p=0;p<srf->npanel[ps];p++)
+			if(srf->panels[ps][p]==pnl) {
+				*sptr=s;
+				*psptr=(int)ps;
+				return p; }}
+	return -1; }
+
+
+/* simwritecheckpoint.  Writes the dynamic state of the simulation to the binary
+checkpoint file filename.  The file is written under a temporary name and then
+renamed, so an interrupted run never leaves a partial checkpoint.  The state is
+the molecules of every list, including serial numbers, prior positions, offsets,
+panels, and order within boxes, and also the Gaussian random number table,
+compartment box lists and volume fractions, event counters, and time.  The
+random number generator is reseeded here with a new seed that is saved in the
+file, so that a run restored from the checkpoint continues with the same random
+numbers.  This should be called while molecules are sorted.  Returns 0 for
+success, 1 for out of memory, or 2 if the file could not be written. */
+int simwritecheckpoint(simptr sim,char *filename) {
+	char tempname[STRCHAR+4];
+	FILE *fptr;
+	struct ckptheadstruct head;
+	ckptmolptr rec;
+	molssptr mols;
+	boxptr bptr;
+	compartptr cmpt;
+	moleculeptr mptr;
+	panelptr pnl;
+	int ll,m,c,d,dim,nmol,ok,s,ps,p,b,bc,*bindx;
+
+	mols=sim->mols;
+	dim=sim->dim;
+	head.magic=CKPTMAGIC;
+	head.version=CKPTVERSION;
+	head.dim=dim;
+	head.nspecies=mols->nspecies;
+	head.nlist=mols->nlist;
+	head.nbox=sim->boxs->nbox;
+	head.ncmpt=sim->cmptss?sim->cmptss->ncmpt:0;
+	head.ngausstbl=mols->ngausstbl;
+	for(d=0;d<ETMAX;d++) head.eventcount[d]=sim->eventcount[d];
+	head.serno=mols->serno;
+	head.seed=(long long)(randULI()&0x7fffffff);
+	head.time=sim->time;
+	head.dt=sim->dt;
+	Simsetrandseed(sim,(long int)head.seed);
+
+	snprintf(tempname,STRCHAR+4,"%s.tmp",filename);
+	fptr=fopen(tempname,"wb");
+	if(!fptr) return 2;
+	ok=fwrite(&head,sizeof(struct ckptheadstruct),1,fptr)==1;
+	if(ok && mols->ngausstbl)
+		ok=fwrite(mols->gausstbl,sizeof(double),mols->ngausstbl,fptr)==(size_t)mols->ngausstbl;
+	for(c=0;ok && c<head.ncmpt;c++) {
+		cmpt=sim->cmptss->cmptlist[c];
+		ok=fwrite(&cmpt->nbox,sizeof(int),1,fptr)==1;
+		if(!ok || !cmpt->nbox) continue;
+		bindx=(int*) calloc(cmpt->nbox,sizeof(int));
+		if(!bindx) {
+			fclose(fptr);
+			remove(tempname);
+			return 1; }
+		for(bc=0;bc<cmpt->nbox;bc++) bindx[bc]=indx2addZV(cmpt->boxlist[bc]->indx,sim->boxs->side,dim);
+		ok=fwrite(bindx,sizeof(int),cmpt->nbox,fptr)==(size_t)cmpt->nbox;
+		free(bindx);
+		if(ok) ok=fwrite(cmpt->boxfrac,sizeof(double),cmpt->nbox,fptr)==(size_t)cmpt->nbox; }
+
+	rec=NULL;
+	for(ll=0;ok && ll<mols->nlist;ll++) {
+		nmol=mols->nl[ll];
+		ok=fwrite(&nmol,sizeof(int),1,fptr)==1;
+		if(!ok || !nmol) continue;
+		rec=(ckptmolptr) calloc(nmol,sizeof(struct ckptmolstruct));
+		if(!rec) {
+			fclose(fptr);
+			remove(tempname);
+			return 1; }
+		for(m=0;m<nmol;m++) {
+			mptr=mols->live[ll][m];
+			rec[m].serno=mptr->serno;
+			rec[m].ident=mptr->ident;
+			rec[m].mstate=(int)mptr->mstate;
+			rec[m].box=rec[m].slot=-1;
+			if((bptr=mptr->box)) {
+				rec[m].box=indx2addZV(bptr->indx,sim->boxs->side,dim);
+				for(b=0;b<bptr->nmol[ll] && bptr->mol[ll][b]!=mptr;b++);
+				rec[m].slot=b<bptr->nmol[ll]?b:-1; }
+			rec[m].srf=rec[m].ps=rec[m].pnl=-1;
+			if((pnl=mptr->pnl) && (p=simpanelindex(sim,pnl,&s,&ps))>=0) {
+				rec[m].srf=s;
+				rec[m].ps=ps;
+				rec[m].pnl=p; }
+			for(d=0;d<dim;d++) {
+				rec[m].pos[d]=mptr->pos[d];
+				rec[m].posx[d]=mptr->posx[d];
+				rec[m].via[d]=mptr->via[d];
+				rec[m].posoffset[d]=mptr->posoffset[d]; }}
+		ok=fwrite(rec,sizeof(struct ckptmolstruct),nmol,fptr)==(size_t)nmol;
+		free(rec); }
+
+	if(fclose(fptr)) ok=0;
+	if(!ok || rename(tempname,filename)) {
+		remove(tempname);
+		return 2; }
+	return 0; }
+
+
+/* simreadcheckpoint.  Restores the dynamic state of the simulation from the
+binary checkpoint file filename, which was written by simwritecheckpoint for a
+simulation that was set up from the same configuration file.  This is called
+after the simulation is set up, with sim->restoring set so that setupcomparts
+skips sampling the compartment volumes.  It replaces all molecules, restores
+their order within boxes, the Gaussian random number table, compartment box
+lists and volumes, event counters, time, and time step, reseeds the random
+number generator, and updates the zeroth order reaction rates for the restored
+compartment volumes.  The timing of commands is then brought forward to the
+checkpoint time by replaying the command queue, one time step at a time, without
+running the commands.  The internal state of commands is not in the checkpoint,
+so commands that accumulate over time, such as running averages, histograms, and
+the reference positions of meansqrdisp, start over from the checkpoint time, as
+do observation plans and other cached command data.  Returns 0 for success or 1
+for an error, with the error message in erstr. */
+int simreadcheckpoint(simptr sim,char *filename,char *erstr) {
+	FILE *fptr;
+	struct ckptheadstruct head;
+	ckptmolptr rec;
+	molssptr mols;
+	boxssptr boxs;
+	boxptr bptr;
+	compartptr cmpt;
+	moleculeptr mptr;
+	surfaceptr srf;
+	int ll,m,c,d,dim,nmol,nbox,b,bc,*bindx;
+	double t,*gtable,*bfrac;
+
+	rec=NULL;
+	gtable=NULL;
+	bindx=NULL;
+	bfrac=NULL;
+	fptr=fopen(filename,"rb");
+	CHECKS(fptr,"cannot open checkpoint file");
+	CHECKS(fread(&head,sizeof(struct ckptheadstruct),1,fptr)==1,"checkpoint file is truncated");
+	CHECKS(head.magic==CKPTMAGIC,"file is not a Smoldyn checkpoint or has a different byte order");
+	CHECKS(head.version==CKPTVERSION,"checkpoint file version is not supported");
+	mols=sim->mols;
+	boxs=sim->boxs;
+	dim=sim->dim;
+	CHECKS(mols && boxs,"no molecules or boxes to restore");
+	CHECKS(head.dim==dim,"checkpoint dimensionality differs from configuration");
+	CHECKS(head.nspecies==mols->nspecies,"checkpoint species differ from configuration");
+	CHECKS(head.nlist==mols->nlist,"checkpoint molecule lists differ from configuration");
+	CHECKS(head.nbox==boxs->nbox,"checkpoint boxes differ from configuration");
+	CHECKS(head.ncmpt==(sim->cmptss?sim->cmptss->ncmpt:0),"checkpoint compartments differ from configuration");
+	CHECKS(head.ngausstbl>0,"checkpoint file is damaged");
+
+	if(head.dt!=sim->dt) {												// time step
+		simsettime(sim,head.dt,3);
+		CHECK(!simupdate(sim,erstr)); }
+
+	CHECKS(gtable=(double*) calloc(head.ngausstbl,sizeof(double)),"out of memory");
+	CHECKS(fread(gtable,sizeof(double),head.ngausstbl,fptr)==(size_t)head.ngausstbl,"checkpoint file is truncated");
+	free(mols->gausstbl);
+	mols->gausstbl=gtable;
+	mols->ngausstbl=head.ngausstbl;
+	gtable=NULL;
+
+	for(c=0;c<head.ncmpt;c++) {										// compartments
+		cmpt=sim->cmptss->cmptlist[c];
+		CHECKS(fread(&nbox,sizeof(int),1,fptr)==1,"checkpoint file is truncated");
+		CHECKS(nbox>=0 && nbox<=boxs->nbox,"checkpoint file is damaged");
+		cmpt->nbox=0;
+		cmpt->volume=0;
+		if(!nbox) continue;
+		CHECKS(bindx=(int*) calloc(nbox,sizeof(int)),"out of memory");
+		CHECKS(bfrac=(double*) calloc(nbox,sizeof(double)),"out of memory");
+		CHECKS(fread(bindx,sizeof(int),nbox,fptr)==(size_t)nbox,"checkpoint file is truncated");
+		CHECKS(fread(bfrac,sizeof(double),nbox,fptr)==(size_t)nbox,"checkpoint file is truncated");
+		for(bc=0;bc<nbox;bc++) {
+			CHECKS(bindx[bc]>=0 && bindx[bc]<boxs->nbox && bfrac[bc]>0,"checkpoint file is damaged");
+			CHECKS(compartupdatebox(sim,cmpt,boxs->blist[bindx[bc]],bfrac[bc])!=-1,"out of memory"); }
+		free(bindx);
+		free(bfrac);
+		bindx=NULL;
+		bfrac=NULL; }
+	if(head.ncmpt && sim->rxnss[0]) {							// compartment reaction rates
+		rxnsetcondition(sim,0,SCparams,0);
+		CHECK(!simupdate(sim,erstr)); }
+
+	for(ll=0;ll<mols->nlist;ll++) {								// remove current molecules
+		for(m=0;m<mols->nl[ll];m++) {
+			mptr=mols->live[ll][m];
+			mptr->ident=0;
+			mptr->mstate=MSsoln;
+			mptr->list=-1;
+			mptr->box=NULL;
+			mptr->pnl=NULL;
+			mols->live[ll][m]=NULL;
+			mols->dead[mols->nd++]=mptr; }
+		mols->nl[ll]=mols->topl[ll]=mols->sortl[ll]=0; }
+	mols->topd=mols->nd;
+	for(b=0;b<boxs->nbox;b++)
+		for(ll=0;ll<boxs->nlist;ll++) boxs->blist[b]->nmol[ll]=0;
+
+	for(ll=0;ll<mols->nlist;ll++) {								// add molecules
+		CHECKS(fread(&nmol,sizeof(int),1,fptr)==1,"checkpoint file is truncated");
+		CHECKS(nmol>=0,"checkpoint file is damaged");
+		if(!nmol) continue;
+		CHECKS(rec=(ckptmolptr) calloc(nmol,sizeof(struct ckptmolstruct)),"out of memory");
+		CHECKS(fread(rec,sizeof(struct ckptmolstruct),nmol,fptr)==(size_t)nmol,"checkpoint file is truncated");
+		if(nmol>mols->nd) {
+			CHECKS(!molexpandlist(mols,dim,-1,nmol-mols->nd,nmol-mols->nd),"out of memory"); }
+		if(nmol>mols->maxl[ll]) {
+			CHECKS(!molexpandlist(mols,dim,ll,nmol-mols->maxl[ll],0),"out of memory"); }
+		for(m=0;m<nmol;m++) {
+			CHECKS(rec[m].ident>0 && rec[m].ident<mols->nspecies && rec[m].mstate>=0 && rec[m].mstate<MSMAX,"checkpoint file is damaged");
+			mptr=mols->dead[--mols->nd];
+			mols->dead[mols->nd]=NULL;
+			mols->topd=mols->nd;
+			mptr->serno=rec[m].serno;
+			mptr->ident=rec[m].ident;
+			mptr->mstate=(enum MolecState)rec[m].mstate;
+			mptr->list=ll;
+			mptr->track=-1;
+			for(d=0;d<dim;d++) {
+				mptr->pos[d]=rec[m].pos[d];
+				mptr->posx[d]=rec[m].posx[d];
+				mptr->via[d]=rec[m].via[d];
+				mptr->posoffset[d]=rec[m].posoffset[d]; }
+			mptr->pnl=NULL;
+			if(rec[m].srf>=0) {
+				CHECKS(sim->srfss && rec[m].srf<sim->srfss->nsrf,"checkpoint surfaces differ from configuration");
+				srf=sim->srfss->srflist[rec[m].srf];
+				CHECKS(rec[m].ps>=0 && rec[m].ps<PSMAX && rec[m].pnl>=0 && rec[m].pnl<srf->npanel[rec[m].ps],"checkpoint panels differ from configuration");
+				mptr->pnl=srf->panels[rec[m].ps][rec[m].pnl]; }
+			mptr->box=NULL;
+			if(rec[m].box>=0) {
+				CHECKS(rec[m].box<boxs->nbox && rec[m].slot>=0 && ll<boxs->nlist,"checkpoint file is damaged");
+				bptr=boxs->blist[rec[m].box];
+				if(rec[m].slot>=bptr->maxmol[ll]) {
+					CHECKS(!expandbox(bptr,rec[m].slot+1-bptr->maxmol[ll],ll),"out of memory"); }
+				bptr->mol[ll][rec[m].slot]=mptr;
+				bptr->nmol[ll]++;
+				mptr->box=bptr; }
+			mols->live[ll][mols->nl[ll]++]=mptr; }
+		mols->topl[ll]=mols->sortl[ll]=mols->nl[ll];
+		free(rec);
+		rec=NULL; }
+	fclose(fptr);
+	fptr=NULL;
+
+	for(d=0;d<ETMAX;d++) sim->eventcount[d]=head.eventcount[d];
+	mols->serno=(long int)head.serno;
+	Simsetrandseed(sim,(long int)head.seed);
+
+	sim->cmdreplay=1;															// command timing
+	t=sim->time;
+	scmdexecute(sim->cmds,t,sim->dt,-1,0);
+	while(t<head.time) {
+		t+=sim->dt;
+		scmdexecute(sim->cmds,t,sim->dt,-1,0); }
+	sim->cmdreplay=0;
+	sim->time=head.time;
+	return 0;
+
+ failure:
+	if(fptr) fclose(fptr);
+	free(rec);
+	free(gtable);
+	free(bindx);
+	free(bfrac);
+	return 1; }
+
+
+/******************************************************************************/
+/******************************* parameter sweeps *****************************/
+/******************************************************************************/
+
+
+/* sweepalloc.  Allocates and returns an empty parameter sweep, or returns NULL
+if out of memory. */
+sweepptr sweepalloc(void) {
+	sweepptr sweep;
+
+	sweep=(sweepptr) malloc(sizeof(struct sweepstruct));
+	if(!sweep) return NULL;
+	sweep->maxpoint=0;
+	sweep->npoint=0;
+	sweep->label=NULL;
+	sweep->maxstmt=0;
+	sweep->nstmt=0;
+	sweep->point=NULL;
+	sweep->stmt=NULL;
+	sweep->value=NULL;
+	sweep->nvalue=NULL;
+	sweep->outname=EmptyString();
+	if(!sweep->outname) {
+		free(sweep);
+		return NULL; }
+	return sweep; }
+
+
+/* sweepfree.  Frees a parameter sweep. */
+void sweepfree(sweepptr sweep) {
+	int p,s;
+
+	if(!sweep) return;
+	for(p=0;p<sweep->npoint;p++) free(sweep->label[p]);
+	free(sweep->label);
+	for(s=0;s<sweep->nstmt;s++) {
+		free(sweep->stmt[s]);
+		free(sweep->value[s]); }
+	free(sweep->stmt);
+	free(sweep->value);
+	free(sweep->point);
+	free(sweep->nvalue);
+	free(sweep->outname);
+	free(sweep);
+	return; }
+
+
+/* sweepaddstatement.  Adds a statement to the parameter sweep, allocating the
+sweep if needed.  If label is not NULL, line is a configuration statement for
+the listed point with that label, which is created if it doesn't exist yet.
+If label is NULL, line is a grid axis, in the format "statement : value1 value2
+...", and each sweep point runs the statement with one of the values appended.
+Returns 0 for success, 1 for out of memory, or 2 for a missing statement or
+missing grid values. */
+int sweepaddstatement(simptr sim,char *label,char *line) {
+	sweepptr sweep;
+	int p,s,n,*newpoint,*newnvalue;
+	char **newlabel,**newstmt,**newvalue,*colon;
+
+	if(!line || !strnword(line,1)) return 2;
+	if(!label) {
+		colon=strchr(line,':');
+		if(!colon || colon==line || !strnword(colon+1,1)) return 2; }
+	if(!sim->sweep) {
+		sim->sweep=sweepalloc();
+		if(!sim->sweep) return 1; }
+	sweep=sim->sweep;
+
+	p=-1;
+	if(label) {
+		for(p=0;p<sweep->npoint && strcmp(sweep->label[p],label);p++);
+		if(p==sweep->npoint) {
+			if(sweep->npoint==sweep->maxpoint) {
+				n=2*sweep->maxpoint+1;
+				newlabel=(char**) calloc(n,sizeof(char*));
+				if(!newlabel) return 1;
+				for(p=0;p<sweep->npoint;p++) newlabel[p]=sweep->label[p];
+				free(sweep->label);
+				sweep->label=newlabel;
+				sweep->maxpoint=n; }
+			sweep->label[p]=EmptyString();
+			if(!sweep->label[p]) return 1;
+			strncpy(sweep->label[p],label,STRCHAR-1);
+			sweep->npoint++; }}
+
+	if(sweep->nstmt==sweep->maxstmt) {
+		n=2*sweep->maxstmt+1;
+		newstmt=(char**) calloc(n,sizeof(char*));
+		newvalue=(char**) calloc(n,sizeof(char*));
+		newpoint=(int*) calloc(n,sizeof(int));
+		newnvalue=(int*) calloc(n,sizeof(int));
+		if(!newstmt || !newvalue || !newpoint || !newnvalue) {
+			free(newstmt);
+			free(newvalue);
+			free(newpoint);
+			free(newnvalue);
+			return 1; }
+		for(s=0;s<sweep->nstmt;s++) {
+			newstmt[s]=sweep->stmt[s];
+			newvalue[s]=sweep->value[s];
+			newpoint[s]=sweep->point[s];
+			newnvalue[s]=sweep->nvalue[s]; }
+		free(sweep->stmt);
+		free(sweep->value);
+		free(sweep->point);
+		free(sweep->nvalue);
+		sweep->stmt=newstmt;
+		sweep->value=newvalue;
+		sweep->point=newpoint;
+		sweep->nvalue=newnvalue;
+		sweep->maxstmt=n; }
+
+	s=sweep->nstmt;
+	sweep->stmt[s]=EmptyString();
+	sweep->value[s]=EmptyString();
+	if(!sweep->stmt[s] || !sweep->value[s]) {
+		free(sweep->stmt[s]);
+		free(sweep->value[s]);
+		return 1; }
+	strncpy(sweep->stmt[s],line,STRCHAR-1);
+	sweep->point[s]=p;
+	sweep->nvalue[s]=0;
+	if(!label) {
+		colon=strchr(sweep->stmt[s],':');
+		*colon='\0';
+		strncpy(sweep->value[s],strnword(line+(colon-sweep->stmt[s])+1,1),STRCHAR-1);
+		sweep->nvalue[s]=wordcount(sweep->value[s]); }
+	sweep->nstmt++;
+	return 0; }
+
+
+/* sweepsetoutput.  Sets the name of the file that collects the results of all
+sweep points, allocating the sweep if needed.  The name is relative to the
+output root; "stdout" or an empty name sends the results to stdout.  Returns 0
+for success or 1 for out of memory. */
+int sweepsetoutput(simptr sim,char *filename) {
+	if(!sim->sweep) {
+		sim->sweep=sweepalloc();
+		if(!sim->sweep) return 1; }
+	strncpy(sim->sweep->outname,filename,STRCHAR-1);
+	sim->sweep->outname[STRCHAR-1]='\0';
+	return 0; }
+
+
+/* sweepnumber.  Returns the number of points in the parameter sweep, which is
+the number of listed points, or 1 if there are none, times the number of values
+of each grid axis.  Returns 0 if there is no sweep. */
+int sweepnumber(sweepptr sweep) {
+	int s,n;
+
+	if(!sweep) return 0;
+	n=sweep->npoint>0?sweep->npoint:1;
+	for(s=0;s<sweep->nstmt;s++)
+		if(sweep->point[s]<0) n*=sweep->nvalue[s];
+	return n; }
+
+
+/* sweeppoint.  Finds sweep point pt, which is between 0 and sweepnumber-1.  The
+listed point is returned, or -1 if there are no listed points, and the index of
+the value of each grid axis s is returned in vindex[s], if vindex is not NULL,
+in which case it needs to be allocated with at least nstmt elements.  The point
+label, which combines the listed point label with the grid values, is written to
+label if it is not NULL.  The listed points vary fastest, followed by the grid
+axes in the order that they were entered. */
+int sweeppoint(sweepptr sweep,int pt,int *vindex,char *label) {
+	int s,p,v;
+	char value[STRCHAR];
+
+	p=sweep->npoint>0?pt%sweep->npoint:-1;
+	if(sweep->npoint>0) pt/=sweep->npoint;
+	if(label) {
+		label[0]='\0';
+		if(p>=0) strncpy(label,sweep->label[p],STRCHAR-1); }
+	for(s=0;s<sweep->nstmt;s++)
+		if(sweep->point[s]<0) {
+			v=pt%sweep->nvalue[s];
+			pt/=sweep->nvalue[s];
+			if(vindex) vindex[s]=v;
+			if(label) {
+				sscanf(strnword(sweep->value[s],v+1),"%s",value);
+				if(label[0] && strlen(label)<STRCHAR-1) strcat(label,"_");
+				strncat(label,value,STRCHAR-1-strlen(label)); }}
+	return p; }
+
+
+/* sweepapply.  Applies the statements of sweep point pt to the simulation, by
+running each of them as a configuration statement.  The simulation needs to be
+updated afterwards with simupdate, which only recalculates the parameters that
+depend on the changed values.  Returns 0 for success, 1 for out of memory, or 2
+if a statement has an error, which is then described in erstr. */
+int sweepapply(simptr sim,int pt,char *erstr) {
+	sweepptr sweep;
+	int s,p,*vindex,er,itct;
+	char line[STRCHAR],word[STRCHAR],value[STRCHAR],*line2;
+
+	sweep=sim->sweep;
+	if(!sweep || sweep->nstmt==0) return 0;
+	vindex=(int*) calloc(sweep->nstmt,sizeof(int));
+	if(!vindex) return 1;
+	p=sweeppoint(sweep,pt,vindex,NULL);
+	er=0;
+	for(s=0;s<sweep->nstmt && !er;s++) {
+		if(sweep->point[s]>=0 && sweep->point[s]!=p) continue;
+		strcpy(line,sweep->stmt[s]);
+		if(sweep->point[s]<0) {
+			sscanf(strnword(sweep->value[s],vindex[s]+1),"%s",value);
+			if(strlen(line)+strlen(value)+2<STRCHAR) {
+				strcat(line," ");
+				strcat(line,value); }}
+		itct=sscanf(line,"%s",word);
+		line2=strnword(line,2);
+		if(itct!=1 || !line2) {
+			snprintf(erstr,STRCHAR,"incomplete sweep statement: %s",line);
+			er=2; }
+		else if(simreadstring(sim,word,line2,erstr)) er=2; }
+	free(vindex);
+	return er; }
+
+
 /******************************************************************************/
 /************************** core simulation functions *************************/
 /******************************************************************************/
@@ -1548,14 +2388,24 @@ int simdocommands(simptr sim) {
 	int er;
 	enum CMDcode ccode;
 	char erstr[STRCHAR];
+	long int serno;
 
+	serno=sim->mols?sim->mols->serno:0;
 	ccode=scmdexecute(sim->cmds,sim->time,sim->dt,-1,0);
+	if(mzrMergeExpansion(sim)) {
+		fprintf(stderr,"Unable to add expanded species and reactions to the simulation\n");
+		return 8; }
 	er=simupdate(sim,erstr);
 	if(er) {
 		fprintf(stderr,"%s",erstr);
 		return 8; }
 	er=molsort(sim);														// sort live and dead
 	if(er) return 6;
+	if(sim->boxs && sim->boxs->dom && domainclip(sim,serno)) return 6;
+	if(sim->ckptname[0]) {
+		er=simwritecheckpoint(sim,sim->ckptname);
+		if(er) fprintf(stderr,"Unable to write checkpoint file %s\n",sim->ckptname);
+		sim->ckptname[0]='\0'; }
 	if(ccode==CMDstop || ccode==CMDabort) return 7;
 	return 0; }
 
@@ -1567,12 +2417,20 @@ function returns an error code to indicate that the simulation should stop;
 otherwise it returns 0 to indicate that the simulation should continue.  Error
 codes are 1 for simulation completed normally, 2 for error with assignmolecs, 3
 for error with zeroreact, 4 for error with unireact, 5 for error with bireact, 6
-for error with molsort, or 7 for terminate instruction from docommand (e.g. stop
-command).  Errors 2 and 6 arise from insufficient memory when boxes were being
-exanded and errors 3, 4, and 5 arise from too few molecules being allocated
-initially. */
+for error with molsort, 7 for terminate instruction from docommand (e.g. stop
+command), 10 for error with portexchange, or 11 for error with the exchange of
+molecules between domains.  Errors 2 and 6 arise from insufficient memory when
+boxes were being exanded and errors 3, 4, 5, and 10 arise from too few molecules
+being allocated initially.  With domain decomposition, molecules that left this
+domain move to their new domains after they are assigned to boxes, and
+bimolecular reactions are done by domainbimolreact. */
 int simulatetimestep(simptr sim) {
 	int er,ll; 
+	long int serno;
+	domainptr dom;
+
+	dom=sim->boxs->dom;
+	if(dom && dom->domain<0) dom=NULL;
 	er=(*sim->diffusefn)(sim);											// diffuse
 	if(er) return 9;
 
@@ -1593,17 +2451,27 @@ int simulatetimestep(simptr sim) {
 	er=(*sim->assignmols2boxesfn)(sim,1,0);					// assign to boxes (diffusing molecs., not reborn)
 	if(er) return 2;
 
+	if(dom) {																				// move molecules between domains
+		er=domainmigrate(sim);
+		if(er) return 11; }
+
+	serno=sim->mols->serno;
 	er=(*sim->zeroreactfn)(sim);
 	if(er) return 3;
+	if(dom && domainclip(sim,serno)) return 6;
 
 	er=(*sim->unimolreactfn)(sim);
 	if(er) return 4;
 
-	er=(*sim->bimolreactfn)(sim,0);
-	if(er) return 5;
+	if(dom) {
+		er=domainbimolreact(sim);
+		if(er) return er; }
+	else {
+		er=(*sim->bimolreactfn)(sim,0);
+		if(er) return 5;
 
-	er=(*sim->bimolreactfn)(sim,1);
-	if(er) return 5;
+		er=(*sim->bimolreactfn)(sim,1);
+		if(er) return 5; }
 
 	er=molsort(sim);																// sort live and dead
 	if(er) return 6;
@@ -1619,6 +2487,10 @@ int simulatetimestep(simptr sim) {
 	er=(*sim->assignmols2boxesfn)(sim,0,1);					// assign again (all, reborn)
 	if(er) return 2;
 
+	if(sim->portss) {																// shared memory port rings
+		er=portexchange(sim);
+		if(er) return 10; }
+
 	sim->time+=sim->dt;													// --- end of time step ---
 
 	er=simdocommands(sim);
@@ -1637,13 +2509,15 @@ graphics are used, this routine just returns to where it was called from (which
 is TimerFunction); otherwise, it frees the simulation structure and then returns
 (to smolsimulate and then main). */
 void endsimulate(simptr sim,int er) {
-	int qflag,tflag,*eventcount;
+	int qflag,tflag,et,*eventcount;
 
-	gl2State(2);
+	if(sim->graphss && sim->graphss->graphics>0) gl2State(2);
 	qflag=strchr(sim->flags,'q')?1:0;
 	tflag=strchr(sim->flags,'t')?1:0;
 	scmdpop(sim->cmds,sim->tmax);
 	scmdexecute(sim->cmds,sim->time,sim->dt,-1,1);
+	outflush(sim);
+	snapwait(sim,0);
 	if(!qflag) {
 		printf("\n");
 		if(er==1) printf("Simulation complete\n");
@@ -1655,20 +2529,14 @@ void endsimulate(simptr sim,int er) {
 		else if(er==7) printf("Simulation stopped by a runtime command\n");
 		else if(er==8) printf("Simulation terminated during simulation state updating\n  Out of memory\n");
 		else if(er==9) printf("Simulation terminated during diffusion\n  Out of memory\n");
+		else if(er==10) printf("Simulation terminated during port import\n  Not enough molecules allocated\n");
+		else if(er==11) printf("Simulation terminated during domain exchange\n  Exchange buffer full, not enough molecules allocated, or another domain stopped\n");
 		else printf("Simulation stopped by user\n");
 		printf("Current simulation time: %f\n",sim->time);
 
 		eventcount=sim->eventcount;
-		if(eventcount[ETwall]) printf("%i wall interactions\n",eventcount[ETwall]);
-		if(eventcount[ETsurf]) printf("%i surface interactions\n",eventcount[ETsurf]);
-		if(eventcount[ETdesorb]) printf("%i desorptions\n",eventcount[ETdesorb]);
-		if(eventcount[ETrxn0]) printf("%i zeroth order reactions\n",eventcount[ETrxn0]);
-		if(eventcount[ETrxn1]) printf("%i unimolecular reactions\n",eventcount[ETrxn1]);
-		if(eventcount[ETrxn2intra]) printf("%i intrabox bimolecular reactions\n",eventcount[ETrxn2intra]);
-		if(eventcount[ETrxn2inter]) printf("%i interbox bimolecular reactions\n",eventcount[ETrxn2inter]);
-		if(eventcount[ETrxn2wrap]) printf("%i wrap-around bimolecular reactions\n",eventcount[ETrxn2wrap]);
-		if(eventcount[ETimport]) printf("%i imported molecules\n",eventcount[ETimport]);
-		if(eventcount[ETexport]) printf("%i exported molecules\n",eventcount[ETexport]);
+		for(et=0;et<ETMAX;et++)
+			if(eventcount[et]) printf("%i %s\n",eventcount[et],etname[et]);
 		if(sim->mzrss) printf("%i species generated\n",mzrNumberOfSpecies(sim->mzrss));
 		if(sim->mzrss) printf("%i reactions generated\n",mzrNumberOfReactions(sim->mzrss));
 
@@ -1689,14 +2557,509 @@ int smolsimulate(simptr sim) {
 	qflag=strchr(sim->flags,'q')?1:0;
 	if(!qflag) printf("Starting simulation\n");
 	sim->clockstt=time(NULL);
-	er=simdocommands(sim);
+	if(sim->restorename[0]) er=0;				// commands at restored time ran before checkpoint
+	else er=simdocommands(sim);
+	sim->started=1;
 	if(!er) { 
 		while((er=simulatetimestep(sim))==0);}
 	sim->elapsedtime+=difftime(time(NULL),sim->clockstt);
 	return er; }
 
 
+/* smolsimulateensemble runs the replicates and parameter sweep points of the
+simulation, which needs to be set up but not started and whose output files need
+to be still closed.  Each sweep point is run sim->nrep times, or once if nrep is
+0.  Each run is a child process that is created with fork, so it starts from a
+copy-on-write image of the prepared simulation; surfaces, compartments, boxes,
+reaction tables, and anything else that a run doesn't change stay shared.  A run
+first applies the statements of its sweep point and updates the simulation,
+which only recalculates the parameters that depend on them.  Replicate r uses
+random number seed sim->randseed+r, so every sweep point sees the same seeds,
+and output file names get the prefix "<label>_rep<r>_", without the parts that
+don't apply.  Up to sim->maxrep runs go at once, or one per processor if this is
+0.  Each run records its outcome, event counts, and final molecule counts in
+shared memory.  For a sweep, these are written to the sweep output as each run
+finishes, labelled with the point and replicate.  When all are done, this prints
+the outcome, final time, and run time of each replicate if there is no sweep,
+and the mean and standard deviation of each count for each point over the runs
+that finished.  Species that are generated during the runs are not counted.
+Without fork, this just runs the simulation once.  Returns 0 for success, 1 for
+out of memory, or 2 if any run failed. */
+int smolsimulateensemble(simptr sim) {
+#ifdef _WIN32
+	int er;
 
+	fprintf(stderr,"WARNING: replicates and sweeps are not available on this system, so running the simulation once\n");
+	if(!strchr(sim->flags,'o') && scmdopenfiles(sim->cmds,strchr(sim->flags,'w')?1:0)) return 2;
+	er=smolsimulate(sim);
+	endsimulate(sim,er);
+	return 0;
+#else
+	int nrep,npt,nrun,maxrun,nrow,nspecies,nactive,nfail,nfinish,k,k2,pt,r,n,n2,i,et,er,status,*pid,*run;
+	long int seed;
+	double *result,*row,sum,sum2;
+	char *flags,string[STRCHAR],label[STRCHAR],erstr[STRCHAR];
+	FILE *fptr;
+	pid_t ans;
+
+	nrep=sim->nrep>0?sim->nrep:1;
+	npt=sim->sweep?sweepnumber(sim->sweep):1;
+	if(npt<1) npt=1;
+	nrun=npt*nrep;
+	maxrun=sim->maxrep;
+	if(maxrun==0) maxrun=(int)sysconf(_SC_NPROCESSORS_ONLN);
+	if(maxrun<1) maxrun=1;
+	if(maxrun>nrun) maxrun=nrun;
+	nspecies=sim->mols?sim->mols->nspecies:0;
+	nrow=3+ETMAX+nspecies;												// outcome, time, clock time, events, counts
+	result=(double*) mmap(NULL,nrun*nrow*sizeof(double),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(result==MAP_FAILED) return 1;
+	pid=(int*) calloc(maxrun,sizeof(int));
+	run=(int*) calloc(maxrun,sizeof(int));
+	if(!pid || !run) {
+		free(pid);
+		free(run);
+		munmap(result,nrun*nrow*sizeof(double));
+		return 1; }
+	for(k=0;k<nrun;k++) result[k*nrow]=-1;
+
+	fptr=NULL;
+	if(sim->sweep) {
+		fptr=stdout;
+		if(sim->sweep->outname[0] && strcmp(sim->sweep->outname,"stdout")) {
+			snprintf(string,STRCHAR,"%s%s%s",sim->cmds->root,sim->cmds->froot,sim->sweep->outname);
+			fptr=fopen(string,"w");
+			if(!fptr) {
+				fprintf(stderr,"Unable to open sweep output file %s\n",string);
+				free(pid);
+				free(run);
+				munmap(result,nrun*nrow*sizeof(double));
+				return 2; }}
+		fprintf(fptr,"# point replicate seed code time");
+		for(et=0;et<ETMAX;et++) fprintf(fptr," %s",etcol[et]);
+		for(i=1;i<nspecies;i++) fprintf(fptr," %s",sim->mols->spname[i]);
+		fprintf(fptr,"\n"); }
+
+	if(sim->mzrss) mzrExpandStop(sim->mzrss);			// children can't use these threads
+	outflush(sim);
+	seed=sim->randseed;
+	if(!strchr(sim->flags,'q')) printf("Starting %i runs, up to %i at once\n",nrun,maxrun);
+	fflush(NULL);
+
+	nactive=nfail=0;
+	for(k=0;k<nrun || nactive>0;) {
+		if(k<nrun && nactive<maxrun) {
+			ans=fork();
+			if(ans<0) {
+				fprintf(stderr,"Unable to start run %i\n",k);
+				nfail+=nrun-k;
+				k=nrun;
+				continue; }
+			if(ans==0) {
+				pt=k/nrep;
+				r=k%nrep;
+				row=result+k*nrow;
+				if(fptr && fptr!=stdout) fclose(fptr);
+				if(sim->outss) sim->outss->maxqueue=0;
+				if(sim->snapss) sim->snapss->nsnap=0;
+				flags=(char*) calloc(strlen(sim->flags)+2,sizeof(char));
+				if(flags) {
+					strcpy(flags,sim->flags);
+					strcat(flags,"q");
+					free(sim->flags);
+					sim->flags=flags; }
+				label[0]='\0';
+				if(sim->sweep) {
+					sweeppoint(sim->sweep,pt,NULL,label);
+					er=sweepapply(sim,pt,erstr);
+					if(!er) er=simupdate(sim,erstr);
+					if(er) {
+						fprintf(stderr,"Sweep point %s: %s\n",label,er==1?"out of memory":erstr);
+						fflush(NULL);
+						_exit(1); }}
+				strcpy(string,sim->cmds->froot);
+				if(label[0] && strlen(string)+strlen(label)+1<STRCHAR) {
+					strcat(string,label);
+					strcat(string,"_"); }
+				if(sim->nrep && strlen(string)+16<STRCHAR) sprintf(string+strlen(string),"rep%i_",r);
+				scmdsetfroot(sim->cmds,string);
+				Simsetrandseed(sim,seed+r);
+				er=0;
+				if(!strchr(sim->flags,'o')) er=scmdopenfiles(sim->cmds,strchr(sim->flags,'w')?1:0);
+				if(er) {
+					fprintf(stderr,"Run %i could not open its output files\n",k);
+					fflush(NULL);
+					_exit(1); }
+				er=smolsimulate(sim);
+				endsimulate(sim,er);
+				row[1]=sim->time;
+				row[2]=sim->elapsedtime;
+				for(et=0;et<ETMAX;et++) row[3+et]=sim->eventcount[et];
+				for(i=1;i<nspecies;i++) row[3+ETMAX+i]=molcount(sim,i,MSall,NULL,-1);
+				row[0]=er;
+				fflush(NULL);
+				_exit(er==1 || er==7?0:1); }
+			pid[nactive]=(int)ans;
+			run[nactive++]=k++; }
+		else {
+			ans=waitpid(-1,&status,0);
+			if(ans<0) break;
+			for(n=0;n<nactive && pid[n]!=(int)ans;n++);
+			if(n==nactive) continue;
+			k2=run[n];
+			if(!(WIFEXITED(status) && WEXITSTATUS(status)==0)) {
+				fprintf(stderr,"WARNING: run %i did not succeed\n",k2);
+				nfail++; }
+			row=result+k2*nrow;
+			if(fptr && row[0]>=0) {
+				sweeppoint(sim->sweep,k2/nrep,NULL,label);
+				fprintf(fptr,"%s %i %li %i %g",label[0]?label:"-",k2%nrep,seed+k2%nrep,(int)row[0],row[1]);
+				for(n2=0;n2<ETMAX;n2++) fprintf(fptr," %g",row[3+n2]);
+				for(i=1;i<nspecies;i++) fprintf(fptr," %g",row[3+ETMAX+i]);
+				fprintf(fptr,"\n");
+				fflush(fptr); }
+			nactive--;
+			pid[n]=pid[nactive];
+			run[n]=run[nactive]; }}
+	if(fptr && fptr!=stdout) fclose(fptr);
+
+	printf("\nENSEMBLE SUMMARY\n");
+	printf(" %i runs: %i sweep points with %i replicates each, %i did not succeed\n",nrun,npt,nrep,nfail);
+	for(pt=0;pt<npt;pt++) {
+		label[0]='\0';
+		if(sim->sweep) sweeppoint(sim->sweep,pt,NULL,label);
+		nfinish=0;
+		for(r=0;r<nrep;r++)
+			if(result[(pt*nrep+r)*nrow]>=0) nfinish++;
+		if(label[0]) printf(" point %s: ",label);
+		else printf(" ");
+		printf("%i runs finished\n",nfinish);
+		if(!sim->sweep)																	// no sweep file, so list replicates
+			for(r=0;r<nrep;r++) {
+				row=result+r*nrow;
+				printf("  replicate %i: seed %li, ",r,seed+r);
+				if(row[0]<0) printf("did not finish\n");
+				else printf("ended at time %g with code %i, %g seconds\n",row[1],(int)row[0],row[2]); }
+		if(nfinish==0) continue;
+		for(n=0;n<ETMAX+nspecies;n++) {
+			if(n==ETMAX) continue;											// empty species
+			sum=sum2=0;
+			for(r=0;r<nrep;r++) {
+				row=result+(pt*nrep+r)*nrow;
+				if(row[0]>=0) {
+					sum+=row[3+n];
+					sum2+=row[3+n]*row[3+n]; }}
+			sum/=nfinish;
+			sum2=sum2/nfinish-sum*sum;
+			if(n<ETMAX && sum==0) continue;
+			if(n<ETMAX) printf("  %s: %g %g\n",etname[n],sum,sum2>0?sqrt(sum2):0);
+			else printf("  %s molecules: %g %g\n",sim->mols->spname[n-ETMAX],sum,sum2>0?sqrt(sum2):0); }}
+	printf("\n");
 
+	free(pid);
+	free(run);
+	munmap(result,nrun*nrow*sizeof(double));
+	return nfail?2:0;
+#endif
+	}
+
+
+/* domainmergefiles merges the output files that the domains of
+smolsimulatedomains wrote, with file root prefixes "dom<k>_" for domain k, into
+the output files with file root froot.  merge[fid] tells how file fid can be
+merged, based on the commands that wrote to it (see domaindocommand).  Files
+with DFsum have only molecule counts, which add up over domains.  If their files
+have the same number of lines in all domains, they are merged line by line: a
+line that is all numbers in every domain and has the same first number, such as
+the time of a molcount line, becomes that first number followed by the sums of
+the other columns over the domains, and any other line is copied from domain 0,
+so that headers are kept.  Files with DFcat, such as moments or molecule lists,
+and DFsum files that don't line up are written one domain after the other, each
+after a "# domain k" line, because sums of them would be wrong.  Files with
+DFnone, which are binary, are not merged.  The domain files are kept.  Returns 0
+for success, 1 for out of memory, or 2 if a file could not be opened. */
+int domainmergefiles(simptr sim,char *froot,int ndomain,enum DomainMerge *merge) {
+#ifdef _WIN32
+	return 0;
+#else
+	cmdssptr cmds;
+	FILE **fin,*fout;
+	char string[STRCHAR],**line,*ptr,*end;
+	size_t *size;
+	int fid,k,i,er,same,numeric,col,nval,maxval;
+	long int nline,nline0;
+	double val,*sum,*newsum;
+
+	cmds=sim->cmds;
+	fin=(FILE**) calloc(ndomain,sizeof(FILE*));
+	line=(char**) calloc(ndomain,sizeof(char*));
+	size=(size_t*) calloc(ndomain,sizeof(size_t));
+	sum=NULL;
+	maxval=nval=0;
+	er=(!fin || !line || !size)?1:0;
+	for(fid=0;fid<cmds->nfile && !er;fid++) {
+		if(!strcmp(cmds->fname[fid],"stdout") || !strcmp(cmds->fname[fid],"stderr")) continue;
+		if(merge[fid]==DFnone) {
+			fprintf(stderr,"Binary output file %s was not merged; see the file of each domain\n",cmds->fname[fid]);
+			continue; }
+		for(k=0;k<ndomain;k++) {
+			snprintf(string,STRCHAR,"%sdom%i_",froot,k);
+			scmdsetfroot(cmds,string);
+			scmdcatfname(cmds,fid,string);
+			fin[k]=fopen(string,"r"); }
+		scmdsetfroot(cmds,froot);
+		scmdcatfname(cmds,fid,string);
+		for(k=0;k<ndomain && fin[k];k++);
+		fout=(k==ndomain)?fopen(string,cmds->fappend[fid]?"a":"w"):NULL;
+		if(!fout) er=2;
+
+		if(!er) {
+			same=(merge[fid]==DFsum);
+			nline0=0;
+			for(k=0;k<ndomain;k++) {
+				nline=0;
+				while(getline(&line[0],&size[0],fin[k])>=0) nline++;
+				if(k==0) nline0=nline;
+				else if(nline!=nline0) same=0;
+				rewind(fin[k]); }
+
+			if(same) {																		// merge line by line
+				while(!er && getline(&line[0],&size[0],fin[0])>=0) {
+					for(k=1;k<ndomain;k++)
+						if(getline(&line[k],&size[k],fin[k])<0) same=0;
+					numeric=same;
+					for(k=0;k<ndomain && numeric;k++) {
+						ptr=line[k];
+						for(col=0;numeric;col++) {
+							val=strtod(ptr,&end);
+							if(end==ptr) break;
+							ptr=end;
+							if(k==0) {
+								if(col==maxval) {
+									newsum=(double*) calloc(2*maxval+16,sizeof(double));
+									if(!newsum) {
+										er=1;
+										numeric=0;
+										break; }
+									for(i=0;i<maxval;i++) newsum[i]=sum[i];
+									free(sum);
+									sum=newsum;
+									maxval=2*maxval+16; }
+								sum[col]=val; }
+							else if(col>=nval || (col==0 && val!=sum[0])) numeric=0;
+							else if(col>0) sum[col]+=val; }
+						while(isspace((unsigned char)*ptr)) ptr++;
+						if(*ptr || col<2) numeric=0;
+						if(k==0) nval=col;
+						else if(col!=nval) numeric=0; }
+					if(numeric) {
+						ptr=line[0];
+						while(isspace((unsigned char)*ptr)) ptr++;
+						fprintf(fout,"%.*s",(int)strcspn(ptr," \t\r\n"),ptr);
+						for(col=1;col<nval;col++) fprintf(fout," %.15g",sum[col]);
+						fprintf(fout,"\n"); }
+					else fputs(line[0],fout); }}
+			else																					// concatenate
+				for(k=0;k<ndomain;k++) {
+					fprintf(fout,"# domain %i\n",k);
+					while(getline(&line[0],&size[0],fin[k])>=0) fputs(line[0],fout); }}
+
+		for(k=0;k<ndomain;k++)
+			if(fin[k]) {
+				fclose(fin[k]);
+				fin[k]=NULL; }
+		if(fout) fclose(fout); }
+
+	if(line)
+		for(k=0;k<ndomain;k++) free(line[k]);
+	free(line);
+	free(size);
+	free(fin);
+	free(sum);
+	return er;
+#endif
+	}
+
+
+/* smolsimulatedomains runs the simulation with domain decomposition, as set up
+with the domains statement.  The simulation needs to be set up but not started,
+and its output files need to be still closed.  Each domain is a child process
+that is created with fork, so surfaces, boxes, reaction tables, and everything
+else that doesn't change stay shared, and it replaces the molecule pool with a
+new one that only holds the molecules of its own slab of boxes (see
+domainsplit).  Each time step, the domains exchange the molecules that
+crossed slab boundaries and the ghost molecules for bimolecular reactions
+through shared memory.  Domain k uses random number seed sim->randseed+k and
+writes its output files with the prefix "dom<k>_"; domain 0 prints the usual
+messages and the others are quiet.  Commands run in every domain, on the
+molecules of that domain, and molecules that they add outside of it are
+removed.  Commands that depend on the number of molecules in the whole system,
+which are the conditional commands and the fixmolcount commands, are refused
+(see domaindocommand).  When the domains are done, this merges their output
+files with domainmergefiles, summing only molecule counts, and prints the total
+event and molecule counts.  Domain decomposition can't be combined with
+rule-based species generation or shared memory port rings.  Without fork, this
+just runs the simulation once.  Returns 0 for success, 1 for out of memory, or
+2 if the domains couldn't run, any of them failed, or their output files
+couldn't be merged. */
+int smolsimulatedomains(simptr sim) {
+#ifdef _WIN32
+	int er;
 
+	fprintf(stderr,"WARNING: domain decomposition is not available on this system, so running the simulation in one process\n");
+	if(!strchr(sim->flags,'o') && scmdopenfiles(sim->cmds,strchr(sim->flags,'w')?1:0)) return 2;
+	er=smolsimulate(sim);
+	endsimulate(sim,er);
+	return 0;
+#else
+	domainptr dom;
+	int n,k,i,p,et,er,status,nrow,nspecies,nactive,nfail,nfile,fid;
+	long int seed;
+	size_t bytes,resbytes;
+	enum DomainMerge *merge,*fmerge;
+	void *shm;
+	double *result,*row,sum;
+	char *flags,froot[STRCHAR],string[STRCHAR];
+	pid_t ans;
+
+	dom=sim->boxs->dom;
+	n=dom->ndomain;
+	if(sim->mzrss) {
+		fprintf(stderr,"Domain decomposition can't be used with rule-based species generation\n");
+		return 2; }
+	if(sim->portss)
+		for(p=0;p<sim->portss->nport;p++)
+			if(sim->portss->portlist[p]->ringdir!=PRnone) {
+				fprintf(stderr,"Domain decomposition can't be used with shared memory port rings\n");
+				return 2; }
+	if(sim->boxs->side[dom->axis]<2*n) {
+		fprintf(stderr,"%i domains need at least %i boxes along axis %i\n",n,2*n,dom->axis);
+		return 2; }
+	if(dom->maxrec==0) dom->maxrec=(sim->mols?sim->mols->maxd:0)/n+1;
+
+	nspecies=sim->mols?sim->mols->nspecies:0;
+	nrow=3+ETMAX+nspecies;												// outcome, time, clock time, events, counts
+	nfile=sim->cmds->nfile;
+	fmerge=(enum DomainMerge*) calloc(nfile+1,sizeof(enum DomainMerge));
+	if(!fmerge) return 1;
+	bytes=domainshmsize(sim);
+	shm=mmap(NULL,bytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS|MAP_NORESERVE,-1,0);
+	if(shm==MAP_FAILED) {
+		free(fmerge);
+		return 1; }
+	resbytes=n*nrow*sizeof(double)+n*nfile*sizeof(enum DomainMerge);
+	result=(double*) mmap(NULL,resbytes,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+	if(result==MAP_FAILED) {
+		munmap(shm,bytes);
+		free(fmerge);
+		return 1; }
+	merge=(enum DomainMerge*)(result+n*nrow);				// file merge kinds, DFsum to start
+	for(k=0;k<n;k++) result[k*nrow]=-1;
+	dom->shm=shm;
+	dom->shmbytes=bytes;
+
+	strcpy(froot,sim->cmds->froot);
+	outflush(sim);
+	seed=sim->randseed;
+	if(!strchr(sim->flags,'q')) printf("Starting %i domains along axis %i\n",n,dom->axis);
+	fflush(NULL);
+
+	nactive=nfail=0;
+	for(k=0;k<n;k++) {
+		ans=fork();
+		if(ans<0) {
+			fprintf(stderr,"Unable to start domain %i\n",k);
+			domainabort(dom);
+			nfail+=n-k;
+			break; }
+		if(ans==0) {
+			row=result+k*nrow;
+			dom->merge=merge+k*nfile;
+			dom->fpos=(long int*) calloc(nfile+1,sizeof(long int));
+			if(!dom->fpos) {
+				fprintf(stderr,"Domain %i: out of memory\n",k);
+				domainabort(dom);
+				fflush(NULL);
+				_exit(1); }
+			if(sim->outss) sim->outss->maxqueue=0;
+			if(sim->snapss) sim->snapss->nsnap=0;
+			if(sim->graphss) sim->graphss->graphics=0;
+			if(k>0) {
+				flags=(char*) calloc(strlen(sim->flags)+2,sizeof(char));
+				if(flags) {
+					strcpy(flags,sim->flags);
+					strcat(flags,"q");
+					free(sim->flags);
+					sim->flags=flags; }}
+			er=domainsplit(sim,k,shm);
+			if(er) {
+				fprintf(stderr,"Domain %i: %s\n",k,er==1?"out of memory":"too few boxes");
+				domainabort(dom);
+				fflush(NULL);
+				_exit(1); }
+			snprintf(string,STRCHAR,"%sdom%i_",froot,k);
+			scmdsetfroot(sim->cmds,string);
+			dom->sharedseed=seed;
+			Simsetrandseed(sim,seed+k);
+			er=0;
+			if(!strchr(sim->flags,'o')) er=scmdopenfiles(sim->cmds,strchr(sim->flags,'w')?1:0);
+			if(er) {
+				fprintf(stderr,"Domain %i could not open its output files\n",k);
+				domainabort(dom);
+				fflush(NULL);
+				_exit(1); }
+			er=smolsimulate(sim);
+			if(er!=1) domainabort(dom);									// don't leave others waiting
+			endsimulate(sim,er);
+			row[1]=sim->time;
+			row[2]=sim->elapsedtime;
+			for(et=0;et<ETMAX;et++) row[3+et]=sim->eventcount[et];
+			for(i=1;i<nspecies;i++) row[3+ETMAX+i]=molcount(sim,i,MSall,NULL,-1);
+			row[0]=er;
+			fflush(NULL);
+			_exit((er==1 || er==7) && !dom->refused?0:1); }
+		nactive++; }
+
+	while(nactive>0) {
+		ans=waitpid(-1,&status,0);
+		if(ans<0) break;
+		nactive--;
+		if(!(WIFEXITED(status) && WEXITSTATUS(status)==0)) {
+			domainabort(dom);
+			nfail++; }}
+
+	printf("\nDOMAIN SUMMARY\n");
+	printf(" %i domains along axis %i, %i did not succeed\n",n,dom->axis,nfail);
+	for(et=0;et<ETMAX;et++) {
+		sum=0;
+		for(k=0;k<n;k++)
+			if(result[k*nrow]>=0) sum+=result[k*nrow+3+et];
+		if(sum) printf(" %s: %g\n",etname[et],sum); }
+	for(i=1;i<nspecies;i++) {
+		sum=0;
+		for(k=0;k<n;k++)
+			if(result[k*nrow]>=0) sum+=result[k*nrow+3+ETMAX+i];
+		printf(" %s molecules: %g\n",sim->mols->spname[i],sum); }
+	printf(" Molecules in each domain:");
+	for(k=0;k<n;k++) {
+		sum=0;
+		for(i=1;i<nspecies;i++) sum+=result[k*nrow+3+ETMAX+i];
+		printf(" %g",result[k*nrow]>=0?sum:-1); }
+	printf("\n\n");
 
+	er=0;
+	if(!strchr(sim->flags,'o')) {
+		for(k=0;k<n;k++)
+			for(fid=0;fid<nfile;fid++)
+				if(merge[k*nfile+fid]>fmerge[fid]) fmerge[fid]=merge[k*nfile+fid];
+		er=domainmergefiles(sim,froot,n,fmerge);
+		if(er) fprintf(stderr,"Unable to merge the output files of the domains\n"); }
+
+	dom->shm=NULL;
+	dom->shmbytes=0;
+	munmap(shm,bytes);
+	munmap(result,resbytes);
+	free(fmerge);
+	return nfail || er?2:0;
+#endif
+	}
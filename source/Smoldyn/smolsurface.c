@@ -5,9 +5,11 @@
  of the Gnu General Public License (GPL). */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <string.h>
 #include <float.h>
+#include <ctype.h>
 #include "Geometry.h"
 #include "math2.h"
 #include "random2.h"
@@ -27,6 +29,24 @@
 #define CHECK(A) if(!(A)) goto failure; else (void)0
 #define CHECKS(A,B) if(!(A)) {strncpy(erstr,B,STRCHAR-1);erstr[STRCHAR-1]='\0';goto failure;} else (void)0
 
+#define EMITLEAF 8							// maximum emitters in an emitter tree leaf
+
+#ifdef THREADING
+typedef struct PARAMSET_emitterkappas_threaded {
+	simptr sim;
+	surfaceptr srf;
+	enum PanelFace face;
+	int i;
+	emitnodeptr tree;
+	int *order;
+	panelptr *pnllist;
+	int p1;
+	int p2;
+	double *kappa;
+	int er;
+} PARAMS_emitterkappas_threaded;
+#endif
+
 
 /******************************************************************************/
 /********************************** Surfaces **********************************/
@@ -175,12 +195,12 @@ int readsurfacename(simptr sim,char *str,enum PanelShape *psptr,int *pptr) {
 	if(!strcmp(nm,"all:all") || !strcmp(nm,"all")) {
 		s=-5; }
 	else if(!colon) {
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		if(s==-1) return -3; }
 	else {
 		*colon='\0';
 		if(!strcmp(nm,"all")) return -4;
-		s=stringfind(sim->srfss->snames,sim->srfss->nsrf,nm);
+		s=namehashfind(&sim->srfss->snamehash,sim->srfss->snames,sim->srfss->nsrf,nm);
 		if(s==-1) return -3;
 		if(!strcmp(colon+1,"all"));
 		else {
@@ -467,6 +487,35 @@ panelptr surfrandpos(surfaceptr srf,double *pos,int dim) {
 	return pnl; }
 
 
+/* surfrandposbulk.  Chooses random positions for n points on surface srf, with
+the same distribution as n calls to surfrandpos, but with a single pass through
+the panel area table rather than a table search for each point.  This generates
+the n area values in sorted order, as normalized running sums of exponential
+random numbers, and merges them with the area table.  Points are returned
+grouped by panel, with positions in pos[m*dim+d] and panels in pnls[m].
+Returns 0 for success or 1 if the surface has no panels. */
+int surfrandposbulk(surfaceptr srf,int n,double *pos,panelptr *pnls,int dim) {
+	int m,p,last;
+	double sum,x,scale;
+
+	if(n<=0) return 0;
+	if(!srf->totpanel) return 1;
+	last=srf->totpanel-1;
+	sum=0;
+	for(m=0;m<n;m++) {															// running sums, kept in pos for now
+		sum-=log(1.0-randCOD());
+		pos[m*dim]=sum; }
+	sum-=log(1.0-randCOD());
+	scale=srf->areatable[last]/sum;
+	p=0;
+	for(m=0;m<n;m++) {
+		x=pos[m*dim]*scale;
+		while(p<last && srf->areatable[p]<=x) p++;
+		pnls[m]=srf->paneltable[p];
+		panelrandpos(pnls[m],pos+m*dim,dim); }
+	return 0; }
+
+
 /* issurfprod */
 int issurfprod(simptr sim,int i,enum MolecState ms) {
 	surfacessptr srfss;
@@ -708,6 +757,7 @@ int panelsalloc(surfaceptr srf,int dim,int maxpanel,int maxspecies,enum PanelSha
 		pnl->maxneigh=0;
 		pnl->nneigh=0;
 		pnl->neigh=NULL;
+		pnl->neighedge=NULL;
 		pnl->emitterabsorb[PFfront]=NULL;
 		pnl->emitterabsorb[PFback]=NULL;
 
@@ -746,6 +796,7 @@ void panelfree(panelptr pnl) {
 	if(!pnl) return;
 	free(pnl->emitterabsorb[PFback]);
 	free(pnl->emitterabsorb[PFfront]);
+	free(pnl->neighedge);
 	free(pnl->neigh);
 	if(pnl->npts && pnl->point) {
 		for(pt=0;pt<pnl->npts;pt++)
@@ -841,6 +892,7 @@ surfaceptr surfacealloc(surfaceptr srf,int oldmaxspecies,int maxspecies,int dim)
 		srf->actdetails=NULL;
 		srf->sdifc=NULL; //Christine
 		srf->sdifstep=NULL; //Christine
+		srf->autoneigh=0;
 		srf->fcolor[0]=srf->fcolor[1]=srf->fcolor[2]=0;
 		srf->bcolor[0]=srf->bcolor[1]=srf->bcolor[2]=0;
 		srf->fcolor[3]=srf->bcolor[3]=1;
@@ -1019,11 +1071,14 @@ surfacessptr surfacessalloc(surfacessptr srfss,int maxsurface,int maxspecies,int
 		srfss->nsrf=0;
 		srfss->epsilon=100*DBL_EPSILON;
 		srfss->neighdist=-1;
+		srfss->emittertheta=0;
 		srfss->snames=NULL;
+		srfss->snamehash=NULL;
 		srfss->srflist=NULL;
 		srfss->maxmollist=0;
 		srfss->nmollist=0;
-		srfss->srfmollist=NULL; }
+		srfss->srfmollist=NULL;
+		srfss->molflags=0; }
 	else {																// checks, and update maxspecies if reallocation
 		if(maxsurface<srfss->maxsrf) return NULL;
 		if(maxspecies<srfss->maxspecies) return NULL;
@@ -1077,6 +1132,7 @@ void surfacessfree(surfacessptr srfss) {
 		for(s=0;s<srfss->maxsrf;s++)
 			free(srfss->snames[s]);
 		free(srfss->snames); }
+	namehashfree(srfss->snamehash);
 
 	free(srfss);
 	return; }
@@ -1108,6 +1164,7 @@ void surfaceoutput(simptr sim) {
 		printf(" No internal surfaces\n\n");
 		return; }
 	printf(" Surface epsilon and neighbor distances: %g %g\n",srfss->epsilon,srfss->neighdist);
+	if(srfss->emittertheta>0) printf(" Emitter absorption computed with emitter tree, theta: %g\n",srfss->emittertheta);
 
 	printf(" Molecule lists checked after diffusion:");
 	for(ll=0;ll<srfss->nmollist;ll++)
@@ -1128,6 +1185,7 @@ void surfaceoutput(simptr sim) {
 		printf(" Surface: %s\n",srfss->snames[s]);
 		if(srf->port[PFfront]) printf("  The front of this surface is part of port %s\n",srf->port[PFfront]->portname);
 		if(srf->port[PFback]) printf("  The back of this surface is part of port %s\n",srf->port[PFback]->portname);
+		if(srf->autoneigh) printf("  Panel neighbors are found automatically\n");
 		
 		printf("  actions for molecules:\n");
 		action=srf->action;
@@ -1388,6 +1446,7 @@ void writesurfaces(simptr sim,FILE *fptr) {
 	fprintf(fptr,"max_surface %i\n",srfss->maxsrf);
 	fprintf(fptr,"epsilon %g\n",srfss->epsilon);
 	fprintf(fptr,"neighbor_dist %g\n",srfss->neighdist);
+	if(srfss->emittertheta>0) fprintf(fptr,"emitter_theta %g\n",srfss->emittertheta);
 	fprintf(fptr,"\n");
 	for(s=0;s<srfss->nsrf;s++) {
 		srf=srfss->srflist[s];
@@ -1478,10 +1537,11 @@ void writesurfaces(simptr sim,FILE *fptr) {
 							if(pnl->jumpp[face] && (pnl->jumpf[face]==PFfront || pnl->jumpf[face]==PFback))
 								fprintf(fptr,"jump %s %s -> %s %s\n",pnl->pname,surfface2string(face,string),pnl->jumpp[face]->pname,surfface2string(pnl->jumpf[face],string)); }
 
+		if(srf->autoneigh) fprintf(fptr,"neighbors auto\n");
 		for(ps=0;ps<PSMAX;ps++)
 			for(p=0;p<srf->npanel[ps];p++) {
 				pnl=srf->panels[ps][p];
-				if(pnl->nneigh) {
+				if(pnl->nneigh && !srf->autoneigh) {
 					fprintf(fptr,"neighbors %s",pnl->pname);
 					for(j=0;j<pnl->nneigh;j++) {
 						if(pnl->neigh[j]->srf==srf)
@@ -1727,7 +1787,7 @@ surfaceptr surfaddsurface(simptr sim,char *surfname) {
 		if(er) return NULL; }
 	srfss=sim->srfss;
 
-	s=stringfind(srfss->snames,srfss->nsrf,surfname);
+	s=namehashfind(&srfss->snamehash,srfss->snames,srfss->nsrf,surfname);
 	if(s<0) {
 		if(srfss->nsrf==srfss->maxsrf) {
 			er=surfenablesurfaces(sim,srfss->nsrf*2+1);
@@ -1735,6 +1795,7 @@ surfaceptr surfaddsurface(simptr sim,char *surfname) {
 		s=srfss->nsrf++;
 		strncpy(srfss->snames[s],surfname,STRCHAR-1);
 		srfss->snames[s][STRCHAR-1]='\0';
+		namehashupdate(&srfss->snamehash,srfss->snames,srfss->nsrf);
 		srf=srfss->srflist[s];
 		srf->surface_number=s;//Chr: added surfaces number (position in surface array)
 		sim->nrfs=s+1; //Christine: Keep surface number up to date
@@ -1781,6 +1842,22 @@ int surfsetneighdist(simptr sim,double neighdist) {
 	return 0; }
 
 
+/* surfsetemittertheta.  Sets the opening angle parameter for computing
+emitter absorption with an emitter tree to theta.  0 means that emitter sums are
+computed exactly.  Returns 0 for success, 2 for out of memory, or 3 if theta is
+negative. */
+int surfsetemittertheta(simptr sim,double theta) {
+	int er;
+
+	if(!sim->srfss) {
+		er=surfenablesurfaces(sim,-1);
+		if(er) return 2; }
+	if(theta<0) return 3;
+	sim->srfss->emittertheta=theta;
+	surfsetcondition(sim->srfss,SCparams,0);
+	return 0; }
+
+
 /* surfsetcolor */
 int surfsetcolor(surfaceptr srf,enum PanelFace face,double *rgba) {
 	int col;
@@ -2124,48 +2201,770 @@ int surfaddpanel(surfaceptr srf,int dim,enum PanelShape ps,char *string,double *
 	return 0; }
 
 
-/* surfsetemitterabsorption. */
+/* meshvaluetype.  Returns the PLY value type code for the PLY type name in
+word, or -1 if it is not recognized.  Codes are 0 to 7 for int8, uint8, int16,
+uint16, int32, uint32, float32, and float64, respectively. */
+int meshvaluetype(char *word) {
+	const char *names[16]={"char","uchar","short","ushort","int","uint","float","double","int8","uint8","int16","uint16","int32","uint32","float32","float64"};
+	int i;
+
+	for(i=0;i<16;i++)
+		if(!strcmp(word,names[i])) return i%8;
+	return -1; }
+
+
+/* meshreadvalue.  Reads one value of type code type (see meshvaluetype) from
+file fptr and returns it.  format is 0 for ASCII, 1 for binary little-endian,
+or 2 for binary big-endian.  If the value cannot be read, *erptr is set to 1;
+otherwise *erptr is unchanged. */
+double meshreadvalue(FILE *fptr,int type,int format,int *erptr) {
+	const int size[8]={1,1,2,2,4,4,4,8};
+	unsigned char buf[8],ch;
+	unsigned int one;
+	int i,bigendian;
+	double value;
+	signed char i8;
+	short i16;
+	unsigned short u16;
+	int i32;
+	unsigned int u32;
+	float f32;
+
+	if(format==0) {
+		if(fscanf(fptr,"%lf",&value)!=1) {*erptr=1;return 0;}
+		return value; }
+
+	if((int)fread(buf,1,size[type],fptr)!=size[type]) {*erptr=1;return 0;}
+	one=1;
+	bigendian=(*(unsigned char*)&one==0);
+	if(bigendian!=(format==2))
+		for(i=0;i<size[type]/2;i++) {
+			ch=buf[i];
+			buf[i]=buf[size[type]-1-i];
+			buf[size[type]-1-i]=ch; }
+	if(type==0) {memcpy(&i8,buf,1);value=(double)i8;}
+	else if(type==1) value=(double)buf[0];
+	else if(type==2) {memcpy(&i16,buf,2);value=(double)i16;}
+	else if(type==3) {memcpy(&u16,buf,2);value=(double)u16;}
+	else if(type==4) {memcpy(&i32,buf,4);value=(double)i32;}
+	else if(type==5) {memcpy(&u32,buf,4);value=(double)u32;}
+	else if(type==6) {memcpy(&f32,buf,4);value=(double)f32;}
+	else memcpy(&value,buf,8);
+	return value; }
+
+
+/* meshreadstl.  Reads the triangles in the binary or ASCII STL file fptr.
+Vertices are not shared in STL, so this returns 3 vertices per triangle in
+*vertptr, which is allocated here and has 3 coordinates per vertex, and the
+corresponding vertex indices in *triptr, which is also allocated here.  Returns
+0 for success, -1 for out of memory, or 5 for a file format error. */
+int meshreadstl(FILE *fptr,int *nvertptr,double **vertptr,int *ntriptr,int **triptr) {
+	unsigned char header[84];
+	long int filesize;
+	int ntri,t,k,d,er,ascii;
+	double *vert;
+	int *tri;
+	char word[STRCHAR];
+
+	vert=NULL;
+	tri=NULL;
+	fseek(fptr,0,SEEK_END);
+	filesize=ftell(fptr);
+	rewind(fptr);
+	if(fread(header,1,84,fptr)!=84) return 5;
+	ntri=(int)header[80]|((int)header[81]<<8)|((int)header[82]<<16)|((int)header[83]<<24);
+	ascii=(ntri<0 || filesize!=84+50*(long int)ntri);
+
+	if(ascii) {																	// ASCII, count vertices
+		rewind(fptr);
+		ntri=0;
+		while(fscanf(fptr,"%s",word)==1)
+			if(!strcmp(word,"vertex")) ntri++;
+		if(ntri%3) return 5;
+		ntri/=3;
+		rewind(fptr); }
+
+	CHECK(vert=(double*) calloc(9*ntri+1,sizeof(double)));
+	CHECK(tri=(int*) calloc(3*ntri+1,sizeof(int)));
+	er=0;
+	if(ascii) {																	// ASCII
+		for(k=0;k<3*ntri && !er;) {
+			if(fscanf(fptr,"%s",word)!=1) er=1;
+			else if(!strcmp(word,"vertex")) {
+				for(d=0;d<3;d++) vert[3*k+d]=meshreadvalue(fptr,7,0,&er);
+				k++; }}}
+	else {																			// binary
+		for(t=0;t<ntri && !er;t++) {
+			for(d=0;d<3;d++) meshreadvalue(fptr,6,1,&er);
+			for(k=3*t;k<3*t+3;k++)
+				for(d=0;d<3;d++) vert[3*k+d]=meshreadvalue(fptr,6,1,&er);
+			meshreadvalue(fptr,3,1,&er); }}
+	if(er) {
+		free(tri);
+		free(vert);
+		return 5; }
+	for(k=0;k<3*ntri;k++) tri[k]=k;
+
+	*nvertptr=3*ntri;
+	*vertptr=vert;
+	*ntriptr=ntri;
+	*triptr=tri;
+	return 0;
+
+ failure:
+	free(tri);
+	free(vert);
+	return -1; }
+
+
+/* meshreadply.  Reads the vertices and faces of the ASCII or binary PLY file
+fptr.  Polygonal faces are split into triangle fans.  Other elements and
+properties are skipped.  The file body is read twice, first to count triangles
+and then to store them.  *vertptr and *triptr are allocated here, with 3
+coordinates per vertex and 3 vertex indices per triangle.  Returns 0 for
+success, -1 for out of memory, or 5 for a file format error. */
+int meshreadply(FILE *fptr,int *nvertptr,double **vertptr,int *ntriptr,int **triptr) {
+	const int maxel=16,maxprop=32;
+	char line[STRCHAR],word[STRCHAR],word2[STRCHAR],word3[STRCHAR],word4[STRCHAR],word5[STRCHAR];
+	int format,nel,el,pr,itct,er,e,i,j,n,nvert,ntri,t,pass;
+	int elcount[16],elkind[16],nprop[16],proptype[16][32],listtype[16][32],propuse[16][32];
+	int poly[STRCHAR];
+	long int body;
+	double value,*vert;
+	int *tri;
+
+	vert=NULL;
+	tri=NULL;
+	if(!fgets(line,STRCHAR,fptr) || strncmp(line,"ply",3)) return 5;
+	format=-1;
+	nel=0;
+	while(fgets(line,STRCHAR,fptr) && strncmp(line,"end_header",10)) {	// header
+		itct=sscanf(line,"%s %s %s %s %s",word,word2,word3,word4,word5);
+		if(itct<1) continue;
+		if(!strcmp(word,"format") && itct>=2) {
+			if(!strcmp(word2,"ascii")) format=0;
+			else if(!strcmp(word2,"binary_little_endian")) format=1;
+			else if(!strcmp(word2,"binary_big_endian")) format=2;
+			else return 5; }
+		else if(!strcmp(word,"element") && itct==3) {
+			if(nel==maxel) return 5;
+			el=nel++;
+			elcount[el]=(int)strtol(word3,NULL,10);
+			if(elcount[el]<0) return 5;
+			nprop[el]=0;
+			if(!strcmp(word2,"vertex")) elkind[el]=1;
+			else if(!strcmp(word2,"face")) elkind[el]=2;
+			else elkind[el]=0; }
+		else if(!strcmp(word,"property") && nel>0) {
+			el=nel-1;
+			pr=nprop[el]++;
+			if(pr==maxprop) return 5;
+			if(!strcmp(word2,"list") && itct==5) {
+				listtype[el][pr]=meshvaluetype(word3);
+				proptype[el][pr]=meshvaluetype(word4);
+				if(listtype[el][pr]<0 || proptype[el][pr]<0) return 5;
+				if(elkind[el]==2 && (!strcmp(word5,"vertex_indices") || !strcmp(word5,"vertex_index"))) propuse[el][pr]=3;
+				else propuse[el][pr]=-1; }
+			else if(itct==3) {
+				listtype[el][pr]=-1;
+				proptype[el][pr]=meshvaluetype(word2);
+				if(proptype[el][pr]<0) return 5;
+				if(elkind[el]==1 && !strcmp(word3,"x")) propuse[el][pr]=0;
+				else if(elkind[el]==1 && !strcmp(word3,"y")) propuse[el][pr]=1;
+				else if(elkind[el]==1 && !strcmp(word3,"z")) propuse[el][pr]=2;
+				else propuse[el][pr]=-1; }
+			else return 5; }}
+	if(format<0) return 5;
+	body=ftell(fptr);
+
+	nvert=0;
+	for(el=0;el<nel;el++)
+		if(elkind[el]==1) nvert+=elcount[el];
+	ntri=0;
+	er=0;
+	for(pass=0;pass<2 && !er;pass++) {						// pass 0 counts, pass 1 stores
+		if(pass==1) {
+			CHECK(vert=(double*) calloc(3*nvert+1,sizeof(double)));
+			CHECK(tri=(int*) calloc(3*ntri+1,sizeof(int)));
+			fseek(fptr,body,SEEK_SET); }
+		n=t=0;
+		for(el=0;el<nel && !er;el++)
+			for(e=0;e<elcount[el] && !er;e++) {
+				for(pr=0;pr<nprop[el] && !er;pr++) {
+					if(listtype[el][pr]<0) {
+						value=meshreadvalue(fptr,proptype[el][pr],format,&er);
+						if(pass==1 && propuse[el][pr]>=0) vert[3*n+propuse[el][pr]]=value; }
+					else {
+						i=(int)meshreadvalue(fptr,listtype[el][pr],format,&er);
+						if(i<0 || i>STRCHAR) er=1;
+						for(j=0;j<i && !er;j++) poly[j]=(int)meshreadvalue(fptr,proptype[el][pr],format,&er);
+						if(propuse[el][pr]==3)
+							for(j=1;j<i-1 && !er;j++) {				// triangle fan
+								if(pass==1) {
+									tri[3*t]=poly[0];
+									tri[3*t+1]=poly[j];
+									tri[3*t+2]=poly[j+1]; }
+								t++; }}}
+				if(elkind[el]==1) n++; }
+		ntri=t; }
+	for(i=0;i<3*ntri && !er;i++)
+		if(tri[i]<0 || tri[i]>=nvert) er=1;
+	if(er) {
+		free(tri);
+		free(vert);
+		return 5; }
+
+	*nvertptr=nvert;
+	*vertptr=vert;
+	*ntriptr=ntri;
+	*triptr=tri;
+	return 0;
+
+ failure:
+	free(tri);
+	free(vert);
+	return -1; }
+
+
+/* meshreadobj.  Reads the vertices and faces of the Wavefront OBJ file fptr.
+Only "v" and "f" lines are used; face vertices may be given as v, v/vt, v//vn,
+or v/vt/vn, and may be negative to count back from the most recent vertex.
+Polygonal faces are split into triangle fans.  The file is read twice, first to
+count vertices and triangles and then to store them.  *vertptr and *triptr are
+allocated here.  Returns 0 for success, -1 for out of memory, or 5 for a file
+format error. */
+int meshreadobj(FILE *fptr,int *nvertptr,double **vertptr,int *ntriptr,int **triptr) {
+	char line[4*STRCHAR],*chptr,*endptr;
+	int pass,nvert,ntri,n,t,i,j,er,d;
+	int poly[STRCHAR];
+	double *vert;
+	int *tri;
+
+	vert=NULL;
+	tri=NULL;
+	nvert=ntri=0;
+	er=0;
+	for(pass=0;pass<2 && !er;pass++) {						// pass 0 counts, pass 1 stores
+		if(pass==1) {
+			CHECK(vert=(double*) calloc(3*nvert+1,sizeof(double)));
+			CHECK(tri=(int*) calloc(3*ntri+1,sizeof(int)));
+			rewind(fptr); }
+		n=t=0;
+		while(!er && fgets(line,4*STRCHAR,fptr)) {
+			if(line[0]=='v' && (line[1]==' ' || line[1]=='\t')) {
+				if(pass==1) {
+					chptr=line+2;
+					for(d=0;d<3 && !er;d++) {
+						vert[3*n+d]=strtod(chptr,&endptr);
+						if(endptr==chptr) er=1;
+						chptr=endptr; }}
+				n++; }
+			else if(line[0]=='f' && (line[1]==' ' || line[1]=='\t')) {
+				chptr=line+2;
+				for(i=0;i<STRCHAR;i++) {
+					j=(int)strtol(chptr,&endptr,10);
+					if(endptr==chptr) break;
+					poly[i]=(j<0)?n+j:j-1;
+					for(chptr=endptr;*chptr && !isspace(*chptr);chptr++); }
+				if(i<3) er=1;
+				for(j=1;j<i-1;j++) {										// triangle fan
+					if(pass==1) {
+						tri[3*t]=poly[0];
+						tri[3*t+1]=poly[j];
+						tri[3*t+2]=poly[j+1]; }
+					t++; }}}
+		nvert=n;
+		ntri=t; }
+	for(i=0;i<3*ntri && !er;i++)
+		if(tri[i]<0 || tri[i]>=nvert) er=1;
+	if(er) {
+		free(tri);
+		free(vert);
+		return 5; }
+
+	*nvertptr=nvert;
+	*vertptr=vert;
+	*ntriptr=ntri;
+	*triptr=tri;
+	return 0;
+
+ failure:
+	free(tri);
+	free(vert);
+	return -1; }
+
+
+/* meshweldvertices.  Replaces the vertex indices in tri so that vertices with
+identical coordinates all use the lowest index of the group.  Vertices are
+matched with a hash table, so this takes O(n) time.  Returns 0 for success or
+1 for out of memory. */
+int meshweldvertices(double *vert,int nvert,int *tri,int ntri) {
+	int nbucket,k,j,b,d,*head,*next,*canon;
+	double x[3];
+	unsigned char *byte;
+	unsigned int hash;
+
+	for(nbucket=1;nbucket<2*nvert;nbucket*=2);
+	head=next=canon=NULL;
+	CHECK(head=(int*) calloc(nbucket,sizeof(int)));
+	CHECK(next=(int*) calloc(nvert+1,sizeof(int)));
+	CHECK(canon=(int*) calloc(nvert+1,sizeof(int)));
+	for(b=0;b<nbucket;b++) head[b]=-1;
+
+	for(k=0;k<nvert;k++) {
+		for(d=0;d<3;d++) x[d]=vert[3*k+d]+0.0;			// adding 0 merges -0 with 0
+		byte=(unsigned char*)x;
+		hash=2166136261u;
+		for(j=0;j<(int)sizeof(x);j++) hash=(hash^byte[j])*16777619u;
+		b=hash&(nbucket-1);
+		for(j=head[b];j>=0;j=next[j])
+			if(vert[3*j]==x[0] && vert[3*j+1]==x[1] && vert[3*j+2]==x[2]) break;
+		if(j>=0) canon[k]=canon[j];
+		else {
+			canon[k]=k;
+			next[k]=head[b];
+			head[b]=k; }}
+	for(k=0;k<3*ntri;k++) tri[k]=canon[tri[k]];
+
+	free(canon);
+	free(next);
+	free(head);
+	return 0;
+
+ failure:
+	free(canon);
+	free(next);
+	free(head);
+	return 1; }
+
+
+/* meshorient.  Makes the vertex order, and hence the front side, of the ntri
+triangles in tri consistent across each connected part of a mesh.  This walks
+the triangles that share edges, breadth first, and reverses any triangle that
+traverses a shared edge in the same direction as the triangle it was reached
+from.  Then, if orient is 1, each connected part is reversed if needed so that
+its signed volume is positive, which makes front faces point outward for closed
+meshes with the usual counterclockwise vertex order; orient of -1 makes them
+point inward and orient of 0 keeps the orientation of the first triangle of each
+part.  Returns 0 for success or 1 for out of memory. */
+int meshorient(double *vert,int nvert,int *tri,int ntri,int orient) {
+	int *vstart,*vlist,*flip,*queue,*vnext;
+	int k,j,t,s,qlo,qhi,qfirst,e,u,v,pos,tmp,sign;
+	double vol,*p0,*p1,*p2;
+
+	vstart=vlist=flip=queue=vnext=NULL;
+	CHECK(vstart=(int*) calloc(nvert+1,sizeof(int)));
+	CHECK(vnext=(int*) calloc(nvert+1,sizeof(int)));
+	CHECK(vlist=(int*) calloc(3*ntri+1,sizeof(int)));
+	CHECK(flip=(int*) calloc(ntri+1,sizeof(int)));
+	CHECK(queue=(int*) calloc(ntri+1,sizeof(int)));
+
+	for(k=0;k<=nvert;k++) vstart[k]=0;						// triangles at each vertex
+	for(k=0;k<3*ntri;k++) vstart[tri[k]+1]++;
+	for(k=0;k<nvert;k++) vstart[k+1]+=vstart[k];
+	for(k=0;k<nvert;k++) vnext[k]=vstart[k];
+	for(k=0;k<3*ntri;k++) vlist[vnext[tri[k]]++]=k/3;
+	for(t=0;t<ntri;t++) flip[t]=-1;
+
+	qhi=0;
+	for(t=0;t<ntri;t++)
+		if(flip[t]<0) {
+			flip[t]=0;
+			qfirst=qlo=qhi;
+			queue[qhi++]=t;
+			while(qlo<qhi) {															// walk across shared edges
+				s=queue[qlo++];
+				for(e=0;e<3;e++) {
+					u=tri[3*s+e];
+					v=tri[3*s+(e+1)%3];
+					if(flip[s]) {tmp=u;u=v;v=tmp;}
+					for(j=vstart[u];j<vstart[u+1];j++) {
+						k=vlist[j];
+						if(flip[k]>=0) continue;
+						for(pos=0;pos<3 && tri[3*k+pos]!=u;pos++);
+						if(tri[3*k+(pos+1)%3]==v) flip[k]=1;
+						else if(tri[3*k+(pos+2)%3]==v) flip[k]=0;
+						else continue;
+						queue[qhi++]=k; }}}
+
+			if(orient) {																	// signed volume of this part
+				vol=0;
+				for(j=qfirst;j<qhi;j++) {
+					s=queue[j];
+					p0=vert+3*tri[3*s];
+					p1=vert+3*tri[3*s+(flip[s]?2:1)];
+					p2=vert+3*tri[3*s+(flip[s]?1:2)];
+					vol+=p0[0]*(p1[1]*p2[2]-p1[2]*p2[1])+p0[1]*(p1[2]*p2[0]-p1[0]*p2[2])+p0[2]*(p1[0]*p2[1]-p1[1]*p2[0]); }
+				sign=(vol<0)?-1:1;
+				if(sign!=orient)
+					for(j=qfirst;j<qhi;j++) flip[queue[j]]=!flip[queue[j]]; }}
+
+	for(t=0;t<ntri;t++)
+		if(flip[t]) {
+			tmp=tri[3*t+1];
+			tri[3*t+1]=tri[3*t+2];
+			tri[3*t+2]=tmp; }
+
+	free(queue);
+	free(flip);
+	free(vlist);
+	free(vnext);
+	free(vstart);
+	return 0;
+
+ failure:
+	free(queue);
+	free(flip);
+	free(vlist);
+	free(vnext);
+	free(vstart);
+	return 1; }
+
+
+/* surfaddmesh.  Adds all of the triangles in the mesh file fname to surface srf
+as triangle panels.  The file format is determined from the file name suffix,
+which can be .stl (binary or ASCII), .ply (binary or ASCII), or .obj.
+Identical vertices are merged, degenerate triangles are dropped, triangle front
+sides are oriented according to orient as described for meshorient, and the new
+panels are made neighbors of each other with surfvertexneighbors.  Panel space
+is allocated once, with panelsalloc, and panels get the default names.  This is
+only permitted for 3-D systems.  Returns 0 for success, -1 for out of memory, 1
+for no surface, 2 for the wrong system dimensionality, 3 if the file could not
+be opened, 4 for an unrecognized file suffix, or 5 for a file format error. */
+int surfaddmesh(surfaceptr srf,int dim,char *fname,int orient) {
+	FILE *fptr;
+	char suffix[STRCHAR],*chptr;
+	int er,nvert,ntri,t,k,p0,pt,d,*tri,*vfirst;
+	double *vert;
+	panelptr pnl;
+
+	if(!srf) return 1;
+	if(dim!=3) return 2;
+	chptr=strrchr(fname,'.');
+	if(!chptr) return 4;
+	strncpy(suffix,chptr+1,STRCHAR-1);
+	suffix[STRCHAR-1]='\0';
+	for(chptr=suffix;*chptr;chptr++) *chptr=tolower(*chptr);
+	if(strcmp(suffix,"stl") && strcmp(suffix,"ply") && strcmp(suffix,"obj")) return 4;
+
+	fptr=fopen(fname,"rb");
+	if(!fptr) return 3;
+	vert=NULL;
+	tri=vfirst=NULL;
+	if(!strcmp(suffix,"stl")) er=meshreadstl(fptr,&nvert,&vert,&ntri,&tri);
+	else if(!strcmp(suffix,"ply")) er=meshreadply(fptr,&nvert,&vert,&ntri,&tri);
+	else er=meshreadobj(fptr,&nvert,&vert,&ntri,&tri);
+	fclose(fptr);
+	if(er) return er;
+
+	er=-1;
+	CHECK(meshweldvertices(vert,nvert,tri,ntri)==0);
+	for(t=k=0;t<ntri;t++)												// remove degenerate triangles
+		if(tri[3*t]!=tri[3*t+1] && tri[3*t+1]!=tri[3*t+2] && tri[3*t+2]!=tri[3*t]) {
+			tri[3*k]=tri[3*t];
+			tri[3*k+1]=tri[3*t+1];
+			tri[3*k+2]=tri[3*t+2];
+			k++; }
+	ntri=k;
+	er=5;
+	CHECK(ntri>0);
+	er=-1;
+	CHECK(meshorient(vert,nvert,tri,ntri,orient)==0);
+
+	p0=srf->npanel[PStri];												// create panels
+	if(p0+ntri>srf->maxpanel[PStri]) {
+		CHECK(panelsalloc(srf,dim,p0+ntri,srf->srfss->maxspecies,PStri)); }
+	for(t=0;t<ntri;t++) {
+		pnl=srf->panels[PStri][p0+t];
+		for(pt=0;pt<3;pt++)
+			for(d=0;d<3;d++)
+				pnl->point[pt][d]=vert[3*tri[3*t+pt]+d];
+		Geo_TriNormal(pnl->point[0],pnl->point[1],pnl->point[2],pnl->front); }
+	srf->npanel[PStri]=p0+ntri;
+
+	CHECK(vfirst=(int*) calloc(ntri+1,sizeof(int)));		// panel neighbors
+	for(t=0;t<=ntri;t++) vfirst[t]=3*t;
+	CHECK(surfvertexneighbors(srf->panels[PStri]+p0,ntri,vfirst,tri,nvert,dim)==0);
+
+	free(vfirst);
+	free(tri);
+	free(vert);
+	surfsetcondition(srf->srfss,SClists,0);
+	if(srf->srfss->sim->boxs)
+		boxsetcondition(srf->srfss->sim->boxs,SCparams,0);
+	return 0;
+
+ failure:
+	free(vfirst);
+	free(tri);
+	free(vert);
+	return er; }
+
+
+/* emittertreebuild.  Builds a binary tree of the nemit emitters with amounts
+amount and positions pos, for use by emittertreesum.  order needs to be
+allocated with nemit elements and tree with 2*nemit elements.  On return, order
+lists the emitters so that each tree node covers a contiguous range of it.  Each
+node with more than EMITLEAF emitters is split at the middle of its longest
+bounding box side.  Returns the number of tree nodes. */
+int emittertreebuild(int nemit,double *amount,double **pos,int dim,int *order,emitnodeptr tree) {
+	int n,nnode,e,e1,e2,k,d,dsplit,swap;
+	double lo[DIMMAX],hi[DIMMAX],wt,wtsum,split,dist;
+	emitnodeptr node;
+
+	for(e=0;e<nemit;e++) order[e]=e;
+	tree[0].e1=0;
+	tree[0].e2=nemit;
+	nnode=1;
+	for(n=0;n<nnode;n++) {
+		node=&tree[n];
+		e1=node->e1;
+		e2=node->e2;
+		node->child=-1;
+		node->amount=0;
+		wtsum=0;
+		for(d=0;d<dim;d++) node->center[d]=node->dipole[d]=0;
+		for(e=e1;e<e2;e++) {														// amount and center
+			wt=fabs(amount[order[e]]);
+			node->amount+=amount[order[e]];
+			wtsum+=wt;
+			for(d=0;d<dim;d++) node->center[d]+=wt*pos[order[e]][d]; }
+		for(d=0;d<dim;d++) {
+			if(wtsum>0) node->center[d]/=wtsum;
+			else {
+				node->center[d]=0;
+				for(e=e1;e<e2;e++) node->center[d]+=pos[order[e]][d]/(e2-e1); }}
+		node->radius=0;																	// dipole, radius, bounding box
+		for(d=0;d<dim;d++) {
+			lo[d]=hi[d]=pos[order[e1]][d]; }
+		for(e=e1;e<e2;e++) {
+			for(d=0;d<dim;d++) {
+				node->dipole[d]+=amount[order[e]]*(pos[order[e]][d]-node->center[d]);
+				if(pos[order[e]][d]<lo[d]) lo[d]=pos[order[e]][d];
+				if(pos[order[e]][d]>hi[d]) hi[d]=pos[order[e]][d]; }
+			dist=distanceVVD(pos[order[e]],node->center,dim);
+			if(dist>node->radius) node->radius=dist; }
+
+		if(e2-e1>EMITLEAF) {														// split node
+			dsplit=0;
+			for(d=1;d<dim;d++)
+				if(hi[d]-lo[d]>hi[dsplit]-lo[dsplit]) dsplit=d;
+			if(hi[dsplit]>lo[dsplit]) {
+				split=0.5*(lo[dsplit]+hi[dsplit]);
+				e=e1;
+				for(k=e1;k<e2;k++)
+					if(pos[order[k]][dsplit]<split) {
+						swap=order[e];
+						order[e++]=order[k];
+						order[k]=swap; }
+				node->child=nnode;
+				tree[nnode].e1=e1;
+				tree[nnode++].e2=e;
+				tree[nnode].e1=e;
+				tree[nnode++].e2=e2; }}}
+
+	return nnode; }
+
+
+/* emittertreesum.  Adds the contributions of the emitters in node n of emitter
+tree tree, and its children, to numer and denom for position x, which has unit
+normal vector normal, as described for surfsetemitterabsorption.  Nodes whose
+radius is less than theta times their distance from x are approximated by
+their total amount and dipole moment about their center, and the others are
+opened; theta of 0 gives an exact result.  Returns 1 if x is at an emitter
+position and 0 otherwise. */
+int emittertreesum(emitnodeptr tree,int n,int *order,double *amount,double **pos,int dim,double theta,double *x,double *normal,double *numer,double *denom) {
+	emitnodeptr node;
+	int e,er,d;
+	double dist,vdiff[DIMMAX],dist3,dipdot;
+
+	node=&tree[n];
+	dist=distanceVVD(x,node->center,dim);
+	er=0;
+	if(node->child>=0 && node->radius<theta*dist) {		// far node
+		sumVD(1.0,x,-1.0,node->center,vdiff,dim);
+		dist3=dist*dist*dist;
+		dipdot=dotVVD(node->dipole,vdiff,dim);
+		*denom+=node->amount/dist+dipdot/dist3;
+		*numer+=(node->amount*dotVVD(vdiff,normal,dim)-dotVVD(node->dipole,normal,dim))/dist3+3.0*dipdot*dotVVD(vdiff,normal,dim)/(dist3*dist*dist); }
+	else if(node->child>=0) {													// open node
+		er=emittertreesum(tree,node->child,order,amount,pos,dim,theta,x,normal,numer,denom);
+		er|=emittertreesum(tree,node->child+1,order,amount,pos,dim,theta,x,normal,numer,denom); }
+	else {																						// leaf
+		for(e=node->e1;e<node->e2;e++) {
+			dist=distanceVVD(x,pos[order[e]],dim);
+			if(!(dist>0)) er=1;
+			*denom+=amount[order[e]]/dist;
+			for(d=0;d<dim;d++) vdiff[d]=x[d]-pos[order[e]][d];
+			*numer+=amount[order[e]]*dotVVD(vdiff,normal,dim)/(dist*dist*dist); }}
+	return er; }
+
+
+/* emitterkappas.  Computes the absorption rate constants for panels p1 to p2-1
+of pnllist, for emitters of species i on face face of surface srf, and returns
+them in the same elements of kappa.  If tree is NULL, this sums over all
+emitters directly; otherwise, it uses tree and order from emittertreebuild with
+the emitter theta value of the surface superstructure.  Returns 1 if an emitter
+is at a panel middle and 0 otherwise. */
+int emitterkappas(simptr sim,surfaceptr srf,enum PanelFace face,int i,emitnodeptr tree,int *order,panelptr *pnllist,int p1,int p2,double *kappa) {
+	panelptr pnl;
+	int dim,emit,er,p,nemit;
+	double difc,middle[DIMMAX],normal[DIMMAX],numer,denom,amount,*pos,dist,vdiff[DIMMAX];
+	double *amountlist,**poslist;
+
+	dim=sim->dim;
+	er=0;
+	difc=sim->mols->difc[i][MSsoln];
+	//Christine: no need for use of sdifc here, surface emission probably only to solution...
+	nemit=srf->nemitter[face][i];
+	amountlist=srf->emitteramount[face][i];
+	poslist=srf->emitterpos[face][i];
+	for(p=p1;p<p2;p++) {
+		pnl=pnllist[p];
+		panelmiddle(pnl,middle,dim,1);						// middle position
+		panelnormal(pnl,middle,face==PFfront?PFback:PFfront,dim,normal);	// normal vector
+		numer=0;
+		denom=0;
+		if(tree)
+			er|=emittertreesum(tree,0,order,amountlist,poslist,dim,srf->srfss->emittertheta,middle,normal,&numer,&denom);
+		else
+			for(emit=0;emit<nemit;emit++) {
+				amount=amountlist[emit];
+				pos=poslist[emit];
+				dist=distanceVVD(middle,pos,dim);
+				if(!(dist>0)) er=1;
+				denom+=amount/dist;
+				sumVD(1.0,middle,-1.0,pos,vdiff,dim);
+				numer+=amount*dotVVD(vdiff,normal,dim)/(dist*dist*dist); }
+		kappa[p]=difc*numer/denom; }
+	return er; }
+
+
+#ifdef THREADING
+/* emitterkappas_threaded.  Thread function for surfsetemitterabsorption,
+which calls emitterkappas. */
+void* emitterkappas_threaded(void *data) {
+	PARAMS_emitterkappas_threaded *pParams;
+
+	pParams=(PARAMS_emitterkappas_threaded*) data;
+	pParams->er=emitterkappas(pParams->sim,pParams->srf,pParams->face,pParams->i,pParams->tree,pParams->order,pParams->pnllist,pParams->p1,pParams->p2,pParams->kappa);
+	return NULL; }
+#endif
+
+
+/* surfsetemitterabsorption.  Sets the absorption probabilities of all panels
+for the unbounded emitters of each surface, face, and species.  For each panel,
+these sum the emitter amounts divided by their distances from the panel middle,
+and the amounts times the normal components of the emitter fields.  If the
+surface superstructure emitter theta value is 0, these sums are computed
+directly over all emitters; otherwise, they are computed with an emitter tree
+from emittertreebuild, which reduces the cost from the number of panels times
+the number of emitters to roughly the number of panels times the logarithm of
+the number of emitters, with an accuracy that improves as theta is decreased.
+If the simulation is threaded, panels are divided among the threads.  Returns 0
+for success, 1 if an emitter is at a panel middle, or 2 for out of memory. */
 int surfsetemitterabsorption(simptr sim) {
 	surfacessptr srfss;
 	surfaceptr srf;
-	panelptr pnl;
-	int dim,s,i,nspecies,emit,er,p;
+	int s,i,nspecies,er,p,npnl,maxpnl,nemit,maxemit,*order;
 	enum PanelFace face;
 	enum PanelShape ps;
-	double difc,middle[DIMMAX],normal[DIMMAX],numer,denom,amount,*pos,dist,vdiff[DIMMAX],kappa,prob;
+	double difc,prob,*kappa;
+	panelptr *pnllist;
+	emitnodeptr tree;
+#ifdef THREADING
+	int thread_ndx,nthreads,stride;
+	PARAMS_emitterkappas_threaded theParams;
+	stack *current_thread_input_stack;
+#endif
 
 	srfss=sim->srfss;
-	dim=sim->dim;
 	nspecies=sim->mols->nspecies;
 	er=0;
-	for(s=0;s<srfss->nsrf;s++)
-		for(face=PFfront;face<=PFback;face++) {
-			srf=srfss->srflist[s];
+	maxpnl=maxemit=0;
+	pnllist=NULL;
+	kappa=NULL;
+	order=NULL;
+	tree=NULL;
+	for(s=0;s<srfss->nsrf;s++) {
+		srf=srfss->srflist[s];
+		if(!srf->nemitter[PFfront] && !srf->nemitter[PFback]) continue;
+
+		npnl=0;																					// list of panels
+		for(ps=0;ps<PSMAX;ps++) npnl+=srf->npanel[ps];
+		if(npnl>maxpnl) {
+			free(pnllist);
+			free(kappa);
+			pnllist=NULL;
+			kappa=NULL;
+			maxpnl=npnl;
+			CHECK(pnllist=(panelptr*) calloc(maxpnl,sizeof(panelptr)));
+			CHECK(kappa=(double*) calloc(maxpnl,sizeof(double))); }
+		npnl=0;
+		for(ps=0;ps<PSMAX;ps++)
+			for(p=0;p<srf->npanel[ps];p++)
+				pnllist[npnl++]=srf->panels[ps][p];
+
+		for(face=PFfront;face<=PFback;face++)
 			if(srf->nemitter[face])
 				for(i=1;i<nspecies;i++)
 					if(srf->nemitter[face][i]) {
+						nemit=srf->nemitter[face][i];
+						if(srfss->emittertheta>0) {						// emitter tree
+							if(nemit>maxemit) {
+								free(order);
+								free(tree);
+								order=NULL;
+								tree=NULL;
+								maxemit=nemit;
+								CHECK(order=(int*) calloc(maxemit,sizeof(int)));
+								CHECK(tree=(emitnodeptr) calloc(2*maxemit,sizeof(struct emitnodestruct))); }
+							emittertreebuild(nemit,srf->emitteramount[face][i],srf->emitterpos[face][i],sim->dim,order,tree); }
+
+#ifdef THREADING
+						if(sim->threads && sim->threads->nthreads>1) {
+							nthreads=sim->threads->nthreads;
+							stride=calculatestride(npnl,nthreads);
+							theParams.sim=sim;
+							theParams.srf=srf;
+							theParams.face=face;
+							theParams.i=i;
+							theParams.tree=srfss->emittertheta>0?tree:NULL;
+							theParams.order=order;
+							theParams.pnllist=pnllist;
+							theParams.kappa=kappa;
+							theParams.er=0;
+							for(thread_ndx=0;thread_ndx<nthreads;thread_ndx++) {
+								clearthreaddata(sim->threads->thread[thread_ndx]);
+								current_thread_input_stack=sim->threads->thread[thread_ndx]->input_stack;
+								theParams.p1=thread_ndx*stride<npnl?thread_ndx*stride:npnl;
+								theParams.p2=thread_ndx==nthreads-1 || (thread_ndx+1)*stride>npnl?npnl:(thread_ndx+1)*stride;
+								push_data_onto_stack(current_thread_input_stack,&theParams,sizeof(theParams));
+								pthread_create((pthread_t*) sim->threads->thread[thread_ndx]->thread_id,NULL,emitterkappas_threaded,(void*) current_thread_input_stack->stack_data); }
+							for(thread_ndx=0;thread_ndx<nthreads;thread_ndx++) {
+								pthread_join(*((pthread_t*) sim->threads->thread[thread_ndx]->thread_id),NULL);
+								if(((PARAMS_emitterkappas_threaded*) sim->threads->thread[thread_ndx]->input_stack->stack_data)->er) er=1; }}
+						else
+#endif
+						if(emitterkappas(sim,srf,face,i,srfss->emittertheta>0?tree:NULL,order,pnllist,0,npnl,kappa)) er=1;
+
 						difc=sim->mols->difc[i][MSsoln];
-						//Christine: no need for use of sdifc here, surface emission probably only to solution...
-						for(ps=0;ps<PSMAX;ps++)
-							for(p=0;p<srf->npanel[ps];p++) {
-								pnl=srf->panels[ps][p];
-								panelmiddle(pnl,middle,dim,1);						// middle position
-								panelnormal(pnl,middle,face==PFfront?PFback:PFfront,dim,normal);	// normal vector
-								numer=0;
-								denom=0;
-								for(emit=0;emit<srf->nemitter[face][i];emit++) {
-									amount=srf->emitteramount[face][i][emit];
-									pos=srf->emitterpos[face][i][emit];
-									dist=distanceVVD(middle,pos,dim);
-									if(!(dist>0)) er=1;
-									denom+=amount/dist;
-									sumVD(1.0,middle,-1.0,pos,vdiff,dim);
-									numer+=amount*dotVVD(vdiff,normal,dim)/(dist*dist*dist); }
-								kappa=difc*numer/denom;
-								prob=surfaceprob(kappa,0,sim->dt,difc,NULL,SPAirrAds);
-								pnl->emitterabsorb[face][i]=prob; }}}
+						for(p=0;p<npnl;p++) {
+							prob=surfaceprob(kappa[p],0,sim->dt,difc,NULL,SPAirrAds);
+							pnllist[p]->emitterabsorb[face][i]=prob; }}}
 
-	return er; }
+	free(pnllist);
+	free(kappa);
+	free(order);
+	free(tree);
+	return er;
+
+ failure:
+	free(pnllist);
+	free(kappa);
+	free(order);
+	free(tree);
+	return 2; }
 
 
 /* surfsetjumppanel */
@@ -2318,36 +3117,260 @@ double srfcalcprob(simptr sim,surfaceptr srf,int i,enum MolecState ms1,enum Pane
 	return prob; }
 
 
-/* surfsetneighbors. */
+/* surfsetneighbors.  Adds (add=1) or removes (add=0) the nneigh panels in
+neighlist to or from the neighbor list of panel pnl; if add is 0 and neighlist
+is NULL, all neighbors are removed.  Each neighbor also has a shared edge entry
+in pnl->neighedge, which is left as all zeros here, meaning that the neighbor is
+not known to share an edge with pnl; surfautoneighbors fills these entries in.
+Returns 0 for success or 1 for out of memory. */
 int surfsetneighbors(panelptr pnl,panelptr *neighlist,int nneigh,int add) {
-	int newmaxneigh,p,p2;
+	int newmaxneigh,p,p2,d;
 	panelptr *newneigh;
+	double *newedge;
 
 	if(add) {
 		if(pnl->nneigh+nneigh>pnl->maxneigh) { // allocate more space
 			newmaxneigh=pnl->nneigh+nneigh;
 			newneigh=(panelptr*) calloc(newmaxneigh,sizeof(panelptr));
 			if(!newneigh) return 1;
+			newedge=(double*) calloc(newmaxneigh*(DIMMAX+1),sizeof(double));
+			if(!newedge) {free(newneigh);return 1;}
 			for(p2=0;p2<pnl->nneigh;p2++) newneigh[p2]=pnl->neigh[p2];
 			for(;p2<newmaxneigh;p2++) newneigh[p2]=NULL;
+			for(p2=0;p2<pnl->nneigh*(DIMMAX+1);p2++) newedge[p2]=pnl->neighedge[p2];
+			for(;p2<newmaxneigh*(DIMMAX+1);p2++) newedge[p2]=0;
 			free(pnl->neigh);
+			free(pnl->neighedge);
 			pnl->maxneigh=newmaxneigh;
-			pnl->neigh=newneigh; }
+			pnl->neigh=newneigh;
+			pnl->neighedge=newedge; }
 		for(p=0;p<nneigh;p++) {
 			for(p2=0;p2<pnl->nneigh && pnl->neigh[p2]!=neighlist[p];p2++);
-			if(p2==pnl->nneigh)
-				pnl->neigh[pnl->nneigh++]=neighlist[p]; }}
+			if(p2==pnl->nneigh) {
+				for(d=0;d<DIMMAX+1;d++) pnl->neighedge[p2*(DIMMAX+1)+d]=0;
+				pnl->neigh[pnl->nneigh++]=neighlist[p]; }}}
 	else if(!neighlist) {
 		pnl->nneigh=0; }
 	else {
 		for(p=0;p<nneigh;p++) {
 			for(p2=0;p2<pnl->nneigh && pnl->neigh[p2]!=neighlist[p];p2++);
-			if(p2<pnl->nneigh)
-				pnl->neigh[p2]=pnl->neigh[--pnl->nneigh]; }}
+			if(p2<pnl->nneigh) {
+				pnl->neigh[p2]=pnl->neigh[--pnl->nneigh];
+				for(d=0;d<DIMMAX+1;d++)
+					pnl->neighedge[p2*(DIMMAX+1)+d]=pnl->neighedge[pnl->nneigh*(DIMMAX+1)+d]; }}}
 
 	return 0; }
 
 
+/* paneledgenormal.  Computes the geometry of an edge of panel pnl, which is
+assumed to be a rectangle or triangle, so that it is easy to tell if a point
+that is near the panel has crossed over this edge.  In 3-D, the edge goes from
+pnl->point[pt1] to pnl->point[pt2]; in 2-D, the edge is just the point
+pnl->point[pt1] and pt2 is ignored.  The first dim elements of edge are set to
+the unit vector that is in the plane of the panel, is perpendicular to the edge,
+and points away from the panel interior.  Element DIMMAX of edge is set to the
+dot product of this vector with the edge point, so a point pt is beyond the edge
+if the dot product of edge and pt, minus edge[DIMMAX], is positive.  If the edge
+is degenerate, edge is returned as all zeros. */
+void paneledgenormal(panelptr pnl,int pt1,int pt2,int dim,double *edge) {
+	int d,pt;
+	double **point,u[DIMMAX],w[DIMMAX],len,dot;
+
+	point=pnl->point;
+	for(d=0;d<DIMMAX+1;d++) edge[d]=0;
+	if(dim==2) {
+		pt=(pt1==0)?1:0;
+		for(d=0;d<dim;d++) w[d]=point[pt1][d]-point[pt][d]; }
+	else if(dim==3) {
+		for(pt=0;pt<pnl->npts && (pt==pt1 || pt==pt2);pt++);
+		if(pt==pnl->npts) return;
+		len=0;
+		for(d=0;d<dim;d++) {
+			u[d]=point[pt2][d]-point[pt1][d];
+			len+=u[d]*u[d]; }
+		if(!(len>0)) return;
+		dot=0;
+		for(d=0;d<dim;d++) {
+			w[d]=point[pt1][d]-point[pt][d];
+			dot+=w[d]*u[d]; }
+		for(d=0;d<dim;d++) w[d]-=dot/len*u[d]; }
+	else return;
+
+	len=0;
+	for(d=0;d<dim;d++) len+=w[d]*w[d];
+	if(!(len>0)) return;
+	len=sqrt(len);
+	for(d=0;d<dim;d++) edge[d]=w[d]/len;
+	for(d=0;d<dim;d++) edge[DIMMAX]+=edge[d]*point[pt1][d];
+	return; }
+
+
+/* surfvertexneighbors.  Makes panels that share vertices into neighbors of each
+other.  pnltbl is a list of npnl rectangle or triangle panels.  The vertices of
+panel pnltbl[a] are vid[vfirst[a]] to vid[vfirst[a+1]-1], in the same order as
+the panel points, where vid values are vertex identities that range from 0 to
+nid-1 and equal values mean the same vertex.  Panels that share a vertex become
+neighbors, and panels that share an edge (2 vertices in 3-D or 1 vertex in 2-D)
+also get the shared edge geometry recorded in neighedge, from paneledgenormal.
+Run time is O(n) for n panels, assuming a bounded number of panels at each
+vertex.  Returns 0 for success or 1 for out of memory. */
+int surfvertexneighbors(panelptr *pnltbl,int npnl,int *vfirst,int *vid,int nid,int dim) {
+	panelptr pnl,*nlist;
+	int nvert,a,b,j,k,n,nn,ncand,er;
+	int *vstart,*vnext,*vlist,*mark,*nshare,*share,*cand;
+
+	nvert=vfirst[npnl];
+	nlist=NULL;
+	vstart=vnext=vlist=mark=nshare=share=cand=NULL;
+	er=1;
+	CHECK(nlist=(panelptr*) calloc(npnl,sizeof(panelptr)));
+	CHECK(vstart=(int*) calloc(nid+1,sizeof(int)));
+	CHECK(vnext=(int*) calloc(nid,sizeof(int)));
+	CHECK(vlist=(int*) calloc(nvert,sizeof(int)));
+	CHECK(mark=(int*) calloc(npnl,sizeof(int)));
+	CHECK(nshare=(int*) calloc(npnl,sizeof(int)));
+	CHECK(share=(int*) calloc(2*npnl,sizeof(int)));
+	CHECK(cand=(int*) calloc(npnl,sizeof(int)));
+
+	for(j=0;j<=nid;j++) vstart[j]=0;						// panels at each vertex, compressed
+	for(k=0;k<nvert;k++) vstart[vid[k]+1]++;
+	for(j=0;j<nid;j++) vstart[j+1]+=vstart[j];
+	for(j=0;j<nid;j++) vnext[j]=vstart[j];
+	for(a=0;a<npnl;a++)
+		for(k=vfirst[a];k<vfirst[a+1];k++)
+			vlist[vnext[vid[k]]++]=a;
+
+	for(b=0;b<npnl;b++) mark[b]=-1;							// find neighbors of each panel
+	for(a=0;a<npnl;a++) {
+		pnl=pnltbl[a];
+		ncand=0;
+		for(k=vfirst[a];k<vfirst[a+1];k++)
+			for(j=vstart[vid[k]];j<vstart[vid[k]+1];j++) {
+				b=vlist[j];
+				if(b==a) continue;
+				if(mark[b]!=a) {
+					mark[b]=a;
+					nshare[b]=0;
+					cand[ncand++]=b; }
+				if(nshare[b]<2) share[2*b+nshare[b]]=k-vfirst[a];
+				nshare[b]++; }
+		if(!ncand) continue;
+		for(n=0;n<ncand;n++) nlist[n]=pnltbl[cand[n]];
+		CHECK(surfsetneighbors(pnl,nlist,ncand,1)==0);
+		for(n=0;n<ncand;n++) {
+			b=cand[n];
+			if(nshare[b]>=dim-1) {
+				for(nn=0;pnl->neigh[nn]!=pnltbl[b];nn++);
+				paneledgenormal(pnl,share[2*b],share[2*b+1],dim,pnl->neighedge+nn*(DIMMAX+1)); }}}
+	er=0;
+
+ failure:
+	free(cand);
+	free(share);
+	free(nshare);
+	free(mark);
+	free(vlist);
+	free(vnext);
+	free(vstart);
+	free(nlist);
+	return er; }
+
+
+/* surfautoneighbors.  Finds panel neighbors automatically for all rectangle and
+triangle panels of the surfaces that have autoneigh set.  Panel vertices are
+hashed onto a grid with spacing equal to the surface neighbor distance and any
+vertices that are within this distance of each other are considered to be the
+same vertex; surfvertexneighbors then makes panels that share vertices into
+neighbors.  Neighbors can be on different surfaces.  Returns 0 for success, 1
+for out of memory, or 2 if the neighbor distance has not been set yet. */
+int surfautoneighbors(simptr sim) {
+	surfacessptr srfss;
+	surfaceptr srf;
+	panelptr pnl,*pnltbl;
+	enum PanelShape ps;
+	int dim,s,p,pt,npnl,nvert,nid,nbucket,d,k,j,a,b,er;
+	int *vfirst,*vpnl,*vid,*head,*next;
+	int cell[DIMMAX],cell2[DIMMAX],dcell[DIMMAX];
+	unsigned int hash;
+	double tol,dist;
+
+	srfss=sim->srfss;
+	if(!srfss) return 0;
+	dim=sim->dim;
+	if(dim<2) return 0;
+	tol=srfss->neighdist;
+	if(!(tol>0)) return 2;
+
+	npnl=nvert=0;																// count panels and vertices
+	for(s=0;s<srfss->nsrf;s++) {
+		srf=srfss->srflist[s];
+		if(srf->autoneigh)
+			for(ps=0;ps<=PStri;ps++) {
+				npnl+=srf->npanel[ps];
+				nvert+=srf->npanel[ps]*panelpoints(ps,dim); }}
+	if(npnl==0) return 0;
+
+	pnltbl=NULL;
+	vfirst=vpnl=vid=head=next=NULL;
+	for(nbucket=1;nbucket<2*nvert;nbucket*=2);
+	er=1;
+	CHECK(pnltbl=(panelptr*) calloc(npnl,sizeof(panelptr)));
+	CHECK(vfirst=(int*) calloc(npnl+1,sizeof(int)));
+	CHECK(vpnl=(int*) calloc(nvert,sizeof(int)));
+	CHECK(vid=(int*) calloc(nvert,sizeof(int)));
+	CHECK(head=(int*) calloc(nbucket,sizeof(int)));
+	CHECK(next=(int*) calloc(nvert,sizeof(int)));
+
+	a=k=0;																			// panel and vertex tables
+	for(s=0;s<srfss->nsrf;s++) {
+		srf=srfss->srflist[s];
+		if(srf->autoneigh)
+			for(ps=0;ps<=PStri;ps++)
+				for(p=0;p<srf->npanel[ps];p++) {
+					pnltbl[a]=srf->panels[ps][p];
+					vfirst[a]=k;
+					for(pt=0;pt<pnltbl[a]->npts;pt++) vpnl[k++]=a;
+					a++; }}
+	vfirst[a]=k;
+
+	for(j=0;j<nbucket;j++) head[j]=-1;					// merge vertices with spatial hashing
+	nid=0;
+	for(a=0;a<npnl;a++)
+		for(k=vfirst[a];k<vfirst[a+1];k++) {
+			pnl=pnltbl[a];
+			pt=k-vfirst[a];
+			for(d=0;d<dim;d++) {
+				cell[d]=(int)floor(pnl->point[pt][d]/tol);
+				dcell[d]=-1; }
+			vid[k]=-1;
+			while(vid[k]<0 && dcell[0]<=1) {
+				for(d=0;d<dim;d++) cell2[d]=cell[d]+dcell[d];
+				hash=0;
+				for(d=0;d<dim;d++) hash=hash*73856093u^(unsigned int)cell2[d];
+				for(j=head[hash&(nbucket-1)];j>=0 && vid[k]<0;j=next[j]) {
+					b=vpnl[j];
+					dist=distanceVVD(pnl->point[pt],pnltbl[b]->point[j-vfirst[b]],dim);
+					if(dist<=tol) vid[k]=vid[j]; }
+				for(d=dim-1;d>=0 && ++dcell[d]>1;d--)
+					if(d>0) dcell[d]=-1; }
+			if(vid[k]<0) vid[k]=nid++;
+			hash=0;
+			for(d=0;d<dim;d++) hash=hash*73856093u^(unsigned int)cell[d];
+			next[k]=head[hash&(nbucket-1)];
+			head[hash&(nbucket-1)]=k; }
+
+	er=surfvertexneighbors(pnltbl,npnl,vfirst,vid,nid,dim);
+
+ failure:
+	free(next);
+	free(head);
+	free(vid);
+	free(vpnl);
+	free(vfirst);
+	free(pnltbl);
+	return er; }
+
+
 /* surfaddemitter. */
 int surfaddemitter(surfaceptr srf,enum PanelFace face,int i,double amount,double *pos,int dim) {
 	int er,oldmax,newmax,emit,d;
@@ -2470,7 +3493,7 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 		if(line2) {
 			itct=sscanf(line2,"%s",nm);
 			CHECKS(itct==1,"cannot read new species name");
-			i3=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+			i3=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 			CHECKS(i3!=-1,"new species name not recognized");
 			line2=strnword(line2,2); }
 		if(!strcmp(word,"rate"))
@@ -2592,6 +3615,28 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 
 		CHECKS(!line2,"unexpected text following panel"); }
 
+	else if(!strcmp(word,"mesh")) {								// mesh
+		CHECKS(srf,"need to enter surface name before mesh");
+		CHECKS(dim==3,"mesh is only permitted for 3-D systems");
+		itct=sscanf(line2,"%s %s",nm,nm1);
+		CHECKS(itct>=1,"mesh format: filename [out, in, or asis]");
+		i1=1;
+		if(itct==2) {
+			if(!strcmp(nm1,"out")) i1=1;
+			else if(!strcmp(nm1,"in")) i1=-1;
+			else if(!strcmp(nm1,"asis")) i1=0;
+			else CHECKS(0,"mesh orientation needs to be 'out', 'in', or 'asis'"); }
+		strncpy(nm2,sim->filepath,STRCHAR-1);
+		nm2[STRCHAR-1]='\0';
+		strncat(nm2,nm,STRCHAR-1-strlen(nm2));
+		er=surfaddmesh(srf,dim,nm2,i1);
+		CHECKS(er!=-1,"out of memory adding mesh panels");
+		CHECKS(er!=3,"unable to open mesh file");
+		CHECKS(er!=4,"mesh file name needs to end with .stl, .ply, or .obj");
+		CHECKS(er!=5,"mesh file format error or no triangles in mesh file");
+		CHECKS(!er,"BUG: error in surfaddmesh");
+		CHECKS(!strnword(line2,itct+1),"unexpected text following mesh"); }
+
 	else if(!strcmp(word,"jump")) {								// jump
 		CHECKS(srf,"need to enter surface name before jump");
 		itct=sscanf(line2,"%s %s",nm,facenm);
@@ -2618,6 +3663,12 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 		CHECKS(!er,"BUG: error in surfsetjumppanel");
 		CHECKS(!strnword(line2,3),"unexpected text following jump"); }
 
+	else if(!strcmp(word,"neighbors") && sscanf(line2,"%s",nm)==1 && !strcmp(nm,"auto")) {	// neighbors auto
+		CHECKS(srf,"need to enter surface name before neighbors");
+		srf->autoneigh=1;
+		surfsetcondition(srfss,SCparams,0);
+		CHECKS(!strnword(line2,2),"unexpected text following neighbors auto"); }
+
 	else if(!strcmp(word,"neighbors")) {					// neighbors
 		CHECKS(srf,"need to enter surface name before neighbors");
 		itct=sscanf(line2,"%s",nm);
@@ -2632,7 +3683,7 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 			if(strchr(nm,':')) {
 				chptr=strchr(nm,':')+1;
 				*(chptr-1)='\0';
-				s2=stringfind(srfss->snames,srfss->nsrf,nm);
+				s2=namehashfind(&srfss->snamehash,srfss->snames,srfss->nsrf,nm);
 				CHECKS(s2>=0,"surface name is not recognized");
 				srf2=srfss->srflist[s2]; }
 			else {
@@ -2653,7 +3704,7 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 		CHECKS(sim->mols,"need to enter molecules before surface sdifc");
  		itct=sscanf(line2,"%s %s %i", nm, nm1, &i1);
 		CHECKS(itct==3, "format for surface specific sdifc: species state difc"); 
-		i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 		CHECKS(i!=-1,"in sdifc, molecule name not recognized");	
 		
 		/*Should check that a global difc is set as default value! If there is no global difc
@@ -2677,7 +3728,7 @@ surfaceptr surfreadstring(simptr sim,surfaceptr srf,char *word,char *line2,char
 		CHECKS(itct==3,"format for unbounded_emitter: face species amount position");
 		face=surfstring2face(facenm);
 		CHECKS(face==PFfront || face==PFback,"face must be 'front' or 'back'");
-		i=stringfind(sim->mols->spname,sim->mols->nspecies,nm);
+		i=namehashfind(&sim->mols->sphash,sim->mols->spname,sim->mols->nspecies,nm);
 		CHECKS(i>0,"unrecognized species name");
 		line2=strnword(line2,4);
 		CHECKS(line2,"format for unbounded_emitter: face species amount position");
@@ -2805,6 +3856,9 @@ int surfupdateparams(simptr sim) {
 						if(srfss->srflist[j]->sdifstep[i][ms1]>difstepmax) 	difstepmax=srfss->srflist[j]->sdifstep[i][ms1]; }}}}	
 		surfsetneighdist(sim,3.0*difstepmax);}
 
+	er=surfautoneighbors(sim);											// automatic panel neighbors
+	if(er==1) return 1;
+
 	for(s=0;s<srfss->nsrf;s++) {										// set probabilities
 		srf=srfss->srflist[s];
 		for(i=1;i<nspecies;i++)
@@ -2842,6 +3896,7 @@ int surfupdateparams(simptr sim) {
 							actdetails->srfcumprob[ms2]=sum; }}}}
 	
 	er=surfsetemitterabsorption(sim);
+	if(er==2) return 1;
 	if(er)
 		printf("WARNING: an unbounded emitter is at a surface panel, which will cause inaccurate operation\n");
 	
@@ -2849,12 +3904,52 @@ int surfupdateparams(simptr sim) {
 	return 0; }
 
 
+/* surfupdatemolflags.  Sets the srfmollist flags, which tell which molecule
+lists need to be checked for surface interactions, from the current diffusion
+coefficients and reaction products.  As in surfupdatelists, flags are added but
+never cleared.  This only makes one pass over the species and one over the
+reactions, and doesn't rebuild the panel area tables, so it is used after
+species or reactions are added during a simulation.  Returns 0 for success or 2
+if srfmollist hasn't been set up for the current molecule lists, in which case
+surfupdatelists needs to do a full update. */
+int surfupdatemolflags(simptr sim) {
+	surfacessptr srfss;
+	rxnssptr rxnss;
+	rxnptr rxn;
+	int i,ll,order,r,prd;
+	enum MolecState ms;
+
+	srfss=sim->srfss;
+	if(!srfss || !sim->mols) return 0;
+	if(srfss->nmollist!=sim->mols->nlist) return 2;
+	srfss->molflags=0;
+	if(!srfss->nmollist) return 0;
+
+	for(i=1;i<sim->mols->nspecies;i++)
+		for(ms=0;ms<MSMAX;ms++) {
+			ll=sim->mols->listlookup[i][ms];
+			if(sim->mols->difc[i][ms]>0)
+				srfss->srfmollist[ll]|=SMLdiffuse;
+			if(ms!=MSsoln)
+				srfss->srfmollist[ll]|=SMLsrfbound; }
+
+	for(order=0;order<MAXORDER;order++) {
+		rxnss=sim->rxnss[order];
+		if(rxnss)
+			for(r=0;r<rxnss->totrxn;r++) {
+				rxn=rxnss->rxn[r];
+				for(prd=0;prd<rxn->nprod;prd++) {
+					ms=rxn->prdstate[prd];
+					if(ms<MSMAX && rxnisprodmoving(sim,rxn,prd))
+						srfss->srfmollist[sim->mols->listlookup[rxn->prdident[prd]][ms]]|=SMLreact; }}}
+	return 0; }
+
+
 /* surfupdatelists */
 int surfupdatelists(simptr sim) {
 	surfacessptr srfss;
 	surfaceptr srf;
-	int i,ll,maxmollist,s,totpanel,pindex,p;
-	enum MolecState ms;
+	int ll,maxmollist,s,totpanel,pindex,p;
 	enum SMLflag *newsrfmollist;
 	double totarea,*areatable,area;
 	panelptr *paneltable;
@@ -2877,17 +3972,7 @@ int surfupdatelists(simptr sim) {
 			srfss->srfmollist=newsrfmollist;
 			srfss->maxmollist=maxmollist; }
 		srfss->nmollist=sim->mols->nlist;
-
-		if(srfss->nmollist) {
-			for(i=1;i<sim->mols->nspecies;i++)					// set srfmollist flags
-				for(ms=0;ms<MSMAX;ms++) {
-					ll=sim->mols->listlookup[i][ms];
-					if(sim->mols->difc[i][ms]>0)
-						srfss->srfmollist[ll]|=SMLdiffuse;
-					if(rxnisprod(sim,i,ms,1))
-						srfss->srfmollist[ll]|=SMLreact;
-					if(ms!=MSsoln)
-						srfss->srfmollist[ll]|=SMLsrfbound; }}
+		surfupdatemolflags(sim);											// set srfmollist flags
 
 		for(s=0;s<srfss->nsrf;s++) {									// area lookup tables
 			srf=srfss->srflist[s];
@@ -2914,6 +3999,10 @@ int surfupdatelists(simptr sim) {
 
 		surfsetcondition(srfss,SCparams,1); }
 
+	else if(srfss->molflags && surfupdatemolflags(sim)) {
+		surfsetcondition(srfss,SClists,0);
+		return surfupdatelists(sim); }
+
 	surfupdateparams(sim);
 
 	return 0; }
@@ -3454,8 +4543,8 @@ double closestpanelpt(panelptr pnl,int dim,double *testpt,double *pnlpt) {
 
 /* movemol2closepanel */
 void movemol2closepanel(simptr sim,moleculeptr mptr,int dim,double epsilon,double neighdist) {
-	int nn,p,jump;
-	double dist,pt[DIMMAX],pnledgept[DIMMAX];
+	int nn,p,jump,d;
+	double dist,pt[DIMMAX],pnledgept[DIMMAX],best,*edge;
 	panelptr pnl,newpnl;
 	enum PanelFace face;
 	enum MolecState ms;
@@ -3469,10 +4558,21 @@ void movemol2closepanel(simptr sim,moleculeptr mptr,int dim,double epsilon,doubl
 	if(!ptinpanel(mptr->pos,pnl,dim)) {
 		nn=0;
 		newpnl=NULL;
-		closestpanelpt(pnl,dim,mptr->pos,pnledgept);
-		for(p=0;p<pnl->nneigh;p++) {
-			dist=closestpanelpt(pnl->neigh[p],dim,pnledgept,pt);
-			if(dist<neighdist && coinrandD(1.0/++nn)) newpnl=pnl->neigh[p]; }
+		if(pnl->neighedge) {													// neighbors with shared edges
+			best=0;
+			for(p=0;p<pnl->nneigh;p++) {
+				edge=pnl->neighedge+p*(DIMMAX+1);
+				dist=-edge[DIMMAX];
+				for(d=0;d<dim;d++) dist+=edge[d]*mptr->pos[d];
+				if(dist>best) {
+					best=dist;
+					newpnl=pnl->neigh[p];
+					nn=1; }}}
+		if(!nn) {																			// other neighbors
+			closestpanelpt(pnl,dim,mptr->pos,pnledgept);
+			for(p=0;p<pnl->nneigh;p++) {
+				dist=closestpanelpt(pnl->neigh[p],dim,pnledgept,pt);
+				if(dist<neighdist && coinrandD(1.0/++nn)) newpnl=pnl->neigh[p]; }}
 		if(nn) {
 			mptr->pnl=newpnl;
 			if(face!=PFnone && newpnl->srf->action[mptr->ident][MSsoln][face]==SAjump) {	// jump, if required
@@ -0,0 +1,197 @@
+/* smoltraj.c
+ This is a reader for binary trajectory files that are written by the Smoldyn
+ listmolsbin command; the format is described in smoltraj.h.  It is part of
+ Smoldyn and is distributed under the terms of the Gnu General Public License
+ (GPL). */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "smoltraj.h"
+
+#include "smoldyn_config.h"
+
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
+
+int trajreadhead(FILE *fptr,trajheadptr head);
+int trajindex(FILE *fptr,long long **offsetptr,int *nframeptr);
+int trajreadframe(FILE *fptr,long long offset,trajheadptr head,char **payloadptr);
+void trajprintframe(trajheadptr head,char *payload);
+
+
+/* trajreadhead.  Reads a frame header from the current position of file fptr
+into head.  Returns 0 for success, 1 for end of file, 2 if the data aren't a
+frame header, 3 if the file was written on a machine with a different byte
+order, or 4 for an unknown version. */
+int trajreadhead(FILE *fptr,trajheadptr head) {
+	size_t n;
+
+	n=fread(head,1,sizeof(struct trajheadstruct),fptr);
+	if(n==0) return 1;
+	if(n<sizeof(struct trajheadstruct)) return 2;
+	if(head->magic!=TRAJMAGIC) {
+		if(head->magic==(int)0x534d5446) return 3;
+		return 2; }
+	if(head->version!=TRAJVERSION) return 4;
+	if(head->nmol<0 || head->stored<0 || head->raw<0) return 2;
+	return 0; }
+
+
+/* trajindex.  Reads all of the frame headers of file fptr, skipping over the
+payloads, and returns the file offsets of the frames in *offsetptr and the
+number of frames in *nframeptr.  *offsetptr is allocated here and needs to be
+freed by the caller.  Returns 0 for success, 1 for out of memory, or the
+trajreadhead error code for a bad frame header. */
+int trajindex(FILE *fptr,long long **offsetptr,int *nframeptr) {
+	struct trajheadstruct head;
+	long long *offset,*newoffset,pos;
+	int nframe,maxframe,f,er;
+
+	offset=NULL;
+	nframe=maxframe=0;
+	rewind(fptr);
+	pos=0;
+	while(!(er=trajreadhead(fptr,&head))) {
+		if(nframe==maxframe) {
+			maxframe=2*maxframe+1;
+			newoffset=(long long*) calloc(maxframe,sizeof(long long));
+			if(!newoffset) {free(offset);return 1;}
+			for(f=0;f<nframe;f++) newoffset[f]=offset[f];
+			free(offset);
+			offset=newoffset; }
+		offset[nframe++]=pos;
+		pos+=sizeof(struct trajheadstruct)+head.stored;
+		if(fseek(fptr,(long)pos,SEEK_SET)) break; }
+	if(er>1) {free(offset);return er;}
+	*offsetptr=offset;
+	*nframeptr=nframe;
+	return 0; }
+
+
+/* trajreadframe.  Reads the frame at offset in file fptr.  The header is
+returned in head and the payload, decompressed and with delta encoding undone,
+in *payloadptr, which is allocated here and needs to be freed by the caller.
+Returns 0 for success, 1 for out of memory, 2 for a bad or truncated frame, or
+5 if the frame is compressed and this program was built without zlib. */
+int trajreadframe(FILE *fptr,long long offset,trajheadptr head,char **payloadptr) {
+	char *payload,*stored;
+	long long *serno;
+	int *ident,m,psize;
+#ifdef HAVE_LIBZ
+	uLongf zsize;
+#endif
+
+	if(fseek(fptr,(long)offset,SEEK_SET)) return 2;
+	if(trajreadhead(fptr,head)) return 2;
+	psize=(head->flags&TFdouble)?sizeof(double):sizeof(float);
+	if(head->raw!=(long long)head->nmol*(sizeof(long long)+head->dim*psize+sizeof(int)+sizeof(unsigned char))) return 2;
+
+	stored=(char*) malloc(head->stored+1);
+	if(!stored) return 1;
+	if(fread(stored,1,head->stored,fptr)!=(size_t)head->stored) {free(stored);return 2;}
+	if(head->flags&TFzlib) {
+#ifdef HAVE_LIBZ
+		payload=(char*) malloc(head->raw+1);
+		if(!payload) {free(stored);return 1;}
+		zsize=head->raw;
+		if(uncompress((Bytef*)payload,&zsize,(Bytef*)stored,head->stored)!=Z_OK || (long long)zsize!=head->raw) {
+			free(stored);
+			free(payload);
+			return 2; }
+		free(stored);
+#else
+		free(stored);
+		return 5;
+#endif
+		}
+	else payload=stored;
+
+	if(head->flags&TFdelta) {
+		serno=(long long*)payload;
+		ident=(int*)(payload+head->nmol*(sizeof(long long)+head->dim*psize));
+		for(m=1;m<head->nmol;m++) {
+			serno[m]+=serno[m-1];
+			ident[m]+=ident[m-1]; }}
+	*payloadptr=payload;
+	return 0; }
+
+
+/* trajprintframe.  Prints the molecules of a frame to stdout, one per line,
+with the serial number, species number, state number, and position. */
+void trajprintframe(trajheadptr head,char *payload) {
+	long long *serno;
+	int *ident,m,d,nmol,dim;
+	unsigned char *mstate;
+	float *posf;
+	double *posd;
+
+	nmol=head->nmol;
+	dim=head->dim;
+	serno=(long long*)payload;
+	posf=(float*)(payload+nmol*sizeof(long long));
+	posd=(double*)posf;
+	ident=(int*)(payload+nmol*(sizeof(long long)+dim*((head->flags&TFdouble)?sizeof(double):sizeof(float))));
+	mstate=(unsigned char*)(ident+nmol);
+	printf("# time %.17g molecules %i\n",head->time,nmol);
+	for(m=0;m<nmol;m++) {
+		printf("%lli %i %i",serno[m],ident[m],(int)mstate[m]);
+		for(d=0;d<dim;d++) {
+			if(head->flags&TFdouble) printf(" %.17g",posd[d*nmol+m]);
+			else printf(" %.9g",(double)posf[d*nmol+m]); }
+		printf("\n"); }
+	return; }
+
+
+/* main.  With only a file name, this lists the frames of the file with their
+offsets, times, numbers of molecules, and formats.  With a frame number, or
+"all", it prints the molecules of that frame, or of all frames. */
+int main(int argc,char **argv) {
+	FILE *fptr;
+	long long *offset;
+	int nframe,f,flo,fhi,er;
+	struct trajheadstruct head;
+	char *payload;
+
+	if(argc<2 || argc>3) {
+		fprintf(stderr,"Usage: smoltraj file [frame | all]\n");
+		return 1; }
+	fptr=fopen(argv[1],"rb");
+	if(!fptr) {
+		fprintf(stderr,"Cannot open file %s\n",argv[1]);
+		return 1; }
+	er=trajindex(fptr,&offset,&nframe);
+	if(er==1) fprintf(stderr,"Out of memory\n");
+	else if(er==3) fprintf(stderr,"File %s was written with a different byte order\n",argv[1]);
+	else if(er) fprintf(stderr,"File %s is not a Smoldyn trajectory file\n",argv[1]);
+	if(er) {fclose(fptr);return 1;}
+
+	if(argc==2) {
+		printf("# frame offset time molecules format\n");
+		for(f=0;f<nframe;f++) {
+			fseek(fptr,(long)offset[f],SEEK_SET);
+			trajreadhead(fptr,&head);
+			printf("%i %lli %.17g %i %s%s%s\n",f,offset[f],head.time,head.nmol,(head.flags&TFdouble)?"double":"float",(head.flags&TFdelta)?" delta":"",(head.flags&TFzlib)?" zlib":""); }}
+	else {
+		if(!strcmp(argv[2],"all")) {flo=0;fhi=nframe;}
+		else {
+			flo=atoi(argv[2]);
+			fhi=flo+1;
+			if(flo<0 || flo>=nframe) {
+				fprintf(stderr,"Frame number needs to be between 0 and %i\n",nframe-1);
+				free(offset);
+				fclose(fptr);
+				return 1; }}
+		for(f=flo;f<fhi;f++) {
+			er=trajreadframe(fptr,offset[f],&head,&payload);
+			if(er==1) fprintf(stderr,"Out of memory\n");
+			else if(er==5) fprintf(stderr,"Frame %i is compressed, but smoltraj was built without zlib\n",f);
+			else if(er) fprintf(stderr,"Frame %i is damaged\n",f);
+			if(er) break;
+			trajprintframe(&head,payload);
+			free(payload); }}
+
+	free(offset);
+	fclose(fptr);
+	return er?1:0; }
@@ -0,0 +1,60 @@
+/* smoltraj.h
+ This is the header for the binary trajectory format that is written by the
+ Smoldyn listmolsbin command and by the molcountgrid command, and that is read
+ by the smoltraj program.  It is part of Smoldyn and is distributed under the
+ terms of the Gnu General Public License (GPL). */
+
+#ifndef __smoltraj_h__
+#define __smoltraj_h__
+
+/* A trajectory file is a sequence of frames, each of which is a header followed
+by a payload.  Because each header records the size of its payload, a reader can
+index a file by reading only the headers, and then go to any frame directly.
+Numbers are written in the byte order of the machine that ran the simulation;
+the magic number shows if the order is different.
+
+The payload has columns for nmol molecules, in this order: serial numbers
+(long long), positions (float or double, all x values, then all y values, then
+all z values), species numbers (int), and states (unsigned char).  If the
+TFdelta flag is set, each serial number and species number is stored as the
+difference from the previous one in the frame.  If the TFzlib flag is set, the
+payload is compressed with zlib; stored is then the compressed size and raw is
+the uncompressed size. */
+
+#define TRAJMAGIC 0x46544d53
+#define TRAJVERSION 1
+
+enum TrajFlag {TFdouble=1,TFdelta=2,TFzlib=4};
+
+typedef struct trajheadstruct {	// frame header
+	int magic;									// TRAJMAGIC
+	int version;								// TRAJVERSION
+	int flags;									// combination of TrajFlag values
+	int dim;										// system dimensionality
+	int nmol;										// number of molecules in frame
+	int reserved;								// 0, for alignment
+	long long stored;						// payload bytes in file
+	long long raw;							// payload bytes after decompression
+	double time;								// simulation time of frame
+	} *trajheadptr;
+
+/* Density grids that are written by the molcountgrid command use a similar
+format.  Each frame is a grid header followed by the mean molecule count in each
+bin, as doubles, with the first dimension varying slowest.  Unused dimensions
+have 1 bin. */
+
+#define GRIDMAGIC 0x44474d53
+
+typedef struct gridheadstruct {	// grid frame header
+	int magic;									// GRIDMAGIC
+	int version;								// TRAJVERSION
+	int dim;										// system dimensionality
+	int navg;										// number of invocations averaged
+	int nbin[3];								// number of bins on each axis [d]
+	int reserved;								// 0, for alignment
+	double time;								// simulation time of frame
+	double low[3];							// low edge of grid [d]
+	double high[3];							// high edge of grid [d]
+	} *gridheadptr;
+
+#endif